@@ -26,7 +26,7 @@
 static const gchar base64char[64] =
 	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 
-static const gchar base64val[128] = {
+static const gint base64val[256] = {
 	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
 	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
 	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 62, -1, -1, -1, 63,
@@ -34,24 +34,34 @@ static const gchar base64val[128] = {
 	-1,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
 	15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, -1,
 	-1, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
-	41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, -1, -1, -1, -1, -1
+	41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
 };
 
-#define BASE64VAL(c)	(isascii((guchar)c) ? base64val[(gint)(c)] : -1)
+#define BASE64VAL(c)	(base64val[(guchar)(c)])
 
-void base64_encode(gchar *out, const guchar *in, gint inlen)
+static gchar *base64_encode_real(gchar *out, const guchar *in, gint inlen)
 {
 	const guchar *inp = in;
 	gchar *outp = out;
+	guint32 v;
 
+	/* encode 24 bits at a time */
 	while (inlen >= 3) {
-		*outp++ = base64char[(inp[0] >> 2) & 0x3f];
-		*outp++ = base64char[((inp[0] & 0x03) << 4) |
-				     ((inp[1] >> 4) & 0x0f)];
-		*outp++ = base64char[((inp[1] & 0x0f) << 2) |
-				     ((inp[2] >> 6) & 0x03)];
-		*outp++ = base64char[inp[2] & 0x3f];
+		v = ((guint32)inp[0] << 16) | ((guint32)inp[1] << 8) | inp[2];
+		outp[0] = base64char[v >> 18];
+		outp[1] = base64char[(v >> 12) & 0x3f];
+		outp[2] = base64char[(v >> 6) & 0x3f];
+		outp[3] = base64char[v & 0x3f];
 
+		outp += 4;
 		inp += 3;
 		inlen -= 3;
 	}
@@ -69,7 +79,40 @@ void base64_encode(gchar *out, const guchar *in, gint inlen)
 		*outp++ = '=';
 	}
 
+	return outp;
+}
+
+void base64_encode(gchar *out, const guchar *in, gint inlen)
+{
+	gchar *outp;
+
+	outp = base64_encode_real(out, in, inlen);
+	*outp = '\0';
+}
+
+/* Encodes the whole buffer into lines of line_size input bytes, each
+   terminated by LF.  out must have room for
+   (inlen + line_size - 1) / line_size * ((line_size + 2) / 3 * 4 + 1) + 1
+   bytes.  Returns the length of the output. */
+gint base64_encode_lines(gchar *out, const guchar *in, gint inlen,
+			 gint line_size)
+{
+	gchar *outp = out;
+	gint len;
+
+	g_return_val_if_fail(line_size > 0, 0);
+
+	while (inlen > 0) {
+		len = MIN(inlen, line_size);
+		outp = base64_encode_real(outp, in, len);
+		*outp++ = '\n';
+		in += len;
+		inlen -= len;
+	}
+
 	*outp = '\0';
+
+	return outp - out;
 }
 
 gint base64_decode(guchar *out, const gchar *in, gint inlen)
@@ -129,23 +172,57 @@ void base64_decoder_free(Base64Decoder *decoder)
 gint base64_decoder_decode(Base64Decoder *decoder,
 			   const gchar *in, guchar *out)
 {
+	g_return_val_if_fail(in != NULL, -1);
+
+	return base64_decoder_decode_buf(decoder, in, strlen(in), out);
+}
+
+/* Same as base64_decoder_decode(), but decodes inlen bytes of in, which may
+   span several lines. */
+gint base64_decoder_decode_buf(Base64Decoder *decoder,
+			       const gchar *in, gint inlen, guchar *out)
+{
+	const gchar *inp = in;
+	const gchar *end;
 	gint len, total_len = 0;
 	gint buf_len;
 	gchar buf[4];
+	gint v0, v1, v2, v3;
+	guint32 v;
 
 	g_return_val_if_fail(decoder != NULL, -1);
 	g_return_val_if_fail(in != NULL, -1);
 	g_return_val_if_fail(out != NULL, -1);
 
+	end = in + inlen;
 	buf_len = decoder->buf_len;
 	memcpy(buf, decoder->buf, sizeof(buf));
 
 	for (;;) {
-		while (buf_len < 4) {
-			gchar c = *in;
+		/* fast path: groups of 4 characters without line breaks
+		   and padding */
+		if (buf_len == 0) {
+			while (end - inp >= 4) {
+				v0 = BASE64VAL(inp[0]);
+				v1 = BASE64VAL(inp[1]);
+				v2 = BASE64VAL(inp[2]);
+				v3 = BASE64VAL(inp[3]);
+				if ((v0 | v1 | v2 | v3) < 0)
+					break;
+				v = (v0 << 18) | (v1 << 12) | (v2 << 6) | v3;
+				out[0] = v >> 16;
+				out[1] = (v >> 8) & 0xff;
+				out[2] = v & 0xff;
+				out += 3;
+				total_len += 3;
+				inp += 4;
+			}
+		}
+
+		while (buf_len < 4 && inp < end) {
+			gchar c = *inp;
 
-			in++;
-			if (c == '\0') break;
+			inp++;
 			if (c == '\r' || c == '\n') continue;
 			if (c != '=' && BASE64VAL(c) == -1)
 				return -1;
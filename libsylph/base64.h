@@ -33,6 +33,10 @@ struct _Base64Decoder
 void base64_encode	(gchar		*out,
 			 const guchar	*in,
 			 gint		 inlen);
+gint base64_encode_lines(gchar		*out,
+			 const guchar	*in,
+			 gint		 inlen,
+			 gint		 line_size);
 gint base64_decode	(guchar		*out,
 			 const gchar	*in,
 			 gint		 inlen);
@@ -42,5 +46,9 @@ void	       base64_decoder_free	(Base64Decoder	*decoder);
 gint	       base64_decoder_decode	(Base64Decoder	*decoder,
 					 const gchar	*in,
 					 guchar		*out);
+gint	       base64_decoder_decode_buf(Base64Decoder	*decoder,
+					 const gchar	*in,
+					 gint		 inlen,
+					 guchar		*out);
 
 #endif /* __BASE64_H__ */
@@ -0,0 +1,305 @@
+/*
+ * LibSylph -- E-Mail client library
+ * Copyright (C) 1999-2011 Hiroyuki Yamamoto
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Benchmark of the base64 and quoted-printable codecs: encodes and
+   decodes random data line by line, as attachments are written and
+   parts are decoded, with the current codecs and with the previous
+   per-character ones in test-codec-ref.c.
+
+   usage: bench-codec [-s megabytes] [-r repeat] */
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "base64.h"
+#include "quoted-printable.h"
+#include "test-codec-ref.h"
+
+/* input bytes per base64 line, as compose_write_attach() */
+#define B64_LINE_SIZE	57
+#define QP_LINE_SIZE	76
+
+typedef gint (*BenchFunc)	(const gchar	*in,
+				 gint		 len,
+				 gchar		*out);
+
+/* base64 encoders: in is the binary data */
+
+static gint encode_ref(const gchar *in, gint len, gchar *out)
+{
+	gchar buf[B64_LINE_SIZE / 3 * 4 + 1];
+	gchar *outp = out;
+	gint i, l;
+
+	/* one base64_encode() and one copy per line */
+	for (i = 0; i < len; i += B64_LINE_SIZE) {
+		ref_base64_encode(buf, (const guchar *)in + i,
+				  MIN(B64_LINE_SIZE, len - i));
+		l = strlen(buf);
+		memcpy(outp, buf, l);
+		outp += l;
+		*outp++ = '\n';
+	}
+	*outp = '\0';
+
+	return outp - out;
+}
+
+static gint encode_lines(const gchar *in, gint len, gchar *out)
+{
+	return base64_encode_lines(out, (const guchar *)in, len,
+				   B64_LINE_SIZE);
+}
+
+/* base64 decoders: in is LF-terminated lines, decoded one line at a
+   time as procmime_decode_content() */
+
+static gint decode_ref(const gchar *in, gint len, gchar *out)
+{
+	Base64Decoder *decoder;
+	gchar line[B64_LINE_SIZE / 3 * 4 + 2];
+	const gchar *p, *end = in + len, *next;
+	gint total = 0, ret;
+
+	decoder = base64_decoder_new();
+	for (p = in; p < end; p = next) {
+		next = memchr(p, '\n', end - p);
+		next = next ? next + 1 : end;
+		memcpy(line, p, next - p);
+		line[next - p] = '\0';
+		ret = ref_base64_decoder_decode(decoder, line,
+						(guchar *)out + total);
+		if (ret < 0)
+			break;
+		total += ret;
+	}
+	base64_decoder_free(decoder);
+
+	return total;
+}
+
+static gint decode_buf(const gchar *in, gint len, gchar *out)
+{
+	Base64Decoder *decoder;
+	gchar line[B64_LINE_SIZE / 3 * 4 + 2];
+	const gchar *p, *end = in + len, *next;
+	gint total = 0, ret;
+
+	decoder = base64_decoder_new();
+	for (p = in; p < end; p = next) {
+		next = memchr(p, '\n', end - p);
+		next = next ? next + 1 : end;
+		memcpy(line, p, next - p);
+		line[next - p] = '\0';
+		ret = base64_decoder_decode_buf(decoder, line, next - p,
+						(guchar *)out + total);
+		if (ret < 0)
+			break;
+		total += ret;
+	}
+	base64_decoder_free(decoder);
+
+	return total;
+}
+
+static gint decode_buf_whole(const gchar *in, gint len, gchar *out)
+{
+	Base64Decoder *decoder;
+	gint ret;
+
+	decoder = base64_decoder_new();
+	ret = base64_decoder_decode_buf(decoder, in, len, (guchar *)out);
+	base64_decoder_free(decoder);
+
+	return ret;
+}
+
+/* QP decoders: in is QP encoded lines */
+
+static gint qp_decode(const gchar *in, gint len, gchar *out,
+		      gint (*decode_line)(gchar *str))
+{
+	gchar line[QP_LINE_SIZE * 2];
+	const gchar *p, *end = in + len, *next;
+	gint total = 0, ret;
+
+	for (p = in; p < end; p = next) {
+		next = memchr(p, '\n', end - p);
+		next = next ? next + 1 : end;
+		memcpy(line, p, next - p);
+		line[next - p] = '\0';
+		ret = decode_line(line);
+		memcpy(out + total, line, ret);
+		total += ret;
+	}
+
+	return total;
+}
+
+static gint qp_decode_ref(const gchar *in, gint len, gchar *out)
+{
+	return qp_decode(in, len, out, ref_qp_decode_line);
+}
+
+static gint qp_decode_new(const gchar *in, gint len, gchar *out)
+{
+	return qp_decode(in, len, out, qp_decode_line);
+}
+
+static gdouble bench(const gchar *name, BenchFunc func, const gchar *in,
+		     gint len, gchar *out, gint repeat, gint *ret)
+{
+	GTimer *timer;
+	gdouble elapsed, best = -1;
+	gint i;
+
+	timer = g_timer_new();
+
+	for (i = 0; i < repeat; i++) {
+		g_timer_start(timer);
+		*ret = func(in, len, out);
+		elapsed = g_timer_elapsed(timer, NULL);
+		if (best < 0 || elapsed < best)
+			best = elapsed;
+	}
+	g_print("%-28s %d -> %d bytes: %.3f sec\n", name, len, *ret, best);
+
+	g_timer_destroy(timer);
+
+	return best;
+}
+
+/* QP text where one in every escape_ratio characters is escaped */
+static gchar *create_qp_text(GRand *rand, gint size, gint escape_ratio,
+			     gint *len)
+{
+	static const gchar hex[] = "0123456789ABCDEF";
+	GString *str;
+	gint col = 0;
+	gchar c;
+
+	str = g_string_sized_new(size + QP_LINE_SIZE);
+
+	while (str->len < (gsize)size) {
+		if (col >= QP_LINE_SIZE - 3) {
+			g_string_append(str, "=\n");
+			col = 0;
+		} else if (g_rand_int_range(rand, 0, escape_ratio) == 0) {
+			g_string_append_c(str, '=');
+			c = hex[g_rand_int_range(rand, 8, 16)];
+			g_string_append_c(str, c);
+			c = hex[g_rand_int_range(rand, 0, 16)];
+			g_string_append_c(str, c);
+			col += 3;
+		} else {
+			c = g_rand_int_range(rand, 'a', 'z' + 1);
+			g_string_append_c(str, c);
+			col++;
+		}
+	}
+	g_string_append_c(str, '\n');
+
+	*len = str->len;
+	return g_string_free(str, FALSE);
+}
+
+int main(int argc, char *argv[])
+{
+	static const gint escape_ratios[] = {64, 2};
+	GRand *rand;
+	gchar *data, *enc, *out, *out_ref, *qp;
+	gint size = 16, repeat = 3;
+	gint data_len, enc_len, qp_len, ret, ret_ref;
+	gdouble t_ref, t;
+	gint i;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-s") && i + 1 < argc)
+			size = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-r") && i + 1 < argc)
+			repeat = atoi(argv[++i]);
+		else {
+			g_print("usage: %s [-s megabytes] [-r repeat]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (size <= 0 || repeat <= 0)
+		return 1;
+
+	rand = g_rand_new_with_seed(20110722);
+
+	data_len = size * 1024 * 1024;
+	data = g_malloc(data_len);
+	for (i = 0; i < data_len; i++)
+		data[i] = g_rand_int_range(rand, 0, 256);
+
+	enc = g_malloc((data_len + B64_LINE_SIZE - 1) / B64_LINE_SIZE *
+		       (B64_LINE_SIZE / 3 * 4 + 1) + 1);
+	out = g_malloc(data_len * 2 + 1);
+	out_ref = g_malloc(data_len * 2 + 1);
+
+	t_ref = bench("base64 encode (reference)", encode_ref,
+		      data, data_len, out_ref, repeat, &ret_ref);
+	t = bench("base64_encode_lines", encode_lines,
+		  data, data_len, enc, repeat, &enc_len);
+	if (enc_len != ret_ref || memcmp(enc, out_ref, enc_len) != 0)
+		g_print("base64 encode: output differs from reference\n");
+	g_print("speedup: %.2f\n\n", t > 0 ? t_ref / t : 0);
+
+	t_ref = bench("base64 decode (reference)", decode_ref,
+		      enc, enc_len, out_ref, repeat, &ret_ref);
+	t = bench("base64_decoder_decode_buf", decode_buf,
+		  enc, enc_len, out, repeat, &ret);
+	if (ret != ret_ref || memcmp(out, out_ref, ret) != 0)
+		g_print("base64 decode: output differs from reference\n");
+	g_print("speedup: %.2f\n", t > 0 ? t_ref / t : 0);
+	t = bench("base64_decoder_decode_buf (whole)", decode_buf_whole,
+		  enc, enc_len, out, repeat, &ret);
+	if (ret != ret_ref || memcmp(out, out_ref, ret) != 0)
+		g_print("base64 decode: output differs from reference\n");
+	g_print("speedup: %.2f\n", t > 0 ? t_ref / t : 0);
+
+	/* mostly ASCII text, and text in a national charset */
+	for (i = 0; i < G_N_ELEMENTS(escape_ratios); i++) {
+		qp = create_qp_text(rand, data_len, escape_ratios[i], &qp_len);
+		g_print("\nQP text with 1/%d characters escaped\n",
+			escape_ratios[i]);
+
+		t_ref = bench("qp decode (reference)", qp_decode_ref,
+			      qp, qp_len, out_ref, repeat, &ret_ref);
+		t = bench("qp_decode_line", qp_decode_new,
+			  qp, qp_len, out, repeat, &ret);
+		if (ret != ret_ref || memcmp(out, out_ref, ret) != 0)
+			g_print("qp decode: output differs from reference\n");
+		g_print("speedup: %.2f\n", t > 0 ? t_ref / t : 0);
+
+		g_free(qp);
+	}
+
+	g_free(out_ref);
+	g_free(out);
+	g_free(enc);
+	g_free(data);
+	g_rand_free(rand);
+
+	return 0;
+}
@@ -0,0 +1,222 @@
+/*
+ * LibSylph -- E-Mail client library
+ * Copyright (C) 1999-2011 Hiroyuki Yamamoto
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Benchmark of the filter rules: builds an MH folder, and applies a set
+   of header and regex rules to all of its messages with
+   filter_apply_msginfo() as incorporation does.
+
+   usage: bench-filter [-n messages] [-f rules] [-r repeat] [directory] */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include "defs.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sylmain.h"
+#include "folder.h"
+#include "procmsg.h"
+#include "filter.h"
+#include "utils.h"
+
+#define N_LISTS	40
+
+static gint create_msgs(const gchar *path, gint n)
+{
+	gchar *file;
+	FILE *fp;
+	gint i;
+
+	for (i = 1; i <= n; i++) {
+		file = g_strdup_printf("%s%c%d", path, G_DIR_SEPARATOR, i);
+		if ((fp = g_fopen(file, "wb")) == NULL) {
+			FILE_OP_ERROR(file, "fopen");
+			g_free(file);
+			return -1;
+		}
+		fprintf(fp, "From: Sender %d <sender%d@example.com>\n"
+			"To: rcpt@example.com\n"
+			"Cc: list%d@lists.example.com\n"
+			"Subject: [list%d] message %d\n"
+			"Date: Fri, 22 Jul 2011 12:00:00 +0900\n"
+			"Message-ID: <%d@example.com>\n"
+			"X-Mailing-List: x-list-%d\n"
+			"X-Spam-Status: No, score=-%d.0\n"
+			"\n"
+			"body of message %d\n",
+			i % 100, i % 100, i % N_LISTS, i % N_LISTS, i, i,
+			i % N_LISTS, i % 10, i);
+		fclose(fp);
+		g_free(file);
+	}
+
+	return 0;
+}
+
+/* a mix of substring and regex conditions, as a typical set of mailing
+   list rules */
+static GSList *create_rules(gint n)
+{
+	GSList *rules = NULL;
+	FilterCond *cond;
+	FilterAction *action;
+	gchar *name, *value;
+	gint i;
+
+	for (i = 0; i < n; i++) {
+		switch (i % 4) {
+		case 0:
+			value = g_strdup_printf("[list%d]", i % N_LISTS);
+			cond = filter_cond_new(FLT_COND_HEADER, FLT_CONTAIN, 0,
+					       "Subject", value);
+			break;
+		case 1:
+			value = g_strdup_printf
+				("^Sender %d <sender[0-9]+@example\\.(com|org)>$",
+				 i);
+			cond = filter_cond_new(FLT_COND_HEADER, FLT_REGEX, 0,
+					       "From", value);
+			break;
+		case 2:
+			value = g_strdup_printf("list%d@lists\\.example\\.com",
+						i % N_LISTS);
+			cond = filter_cond_new(FLT_COND_TO_OR_CC, FLT_REGEX, 0,
+					       NULL, value);
+			break;
+		default:
+			value = g_strdup_printf("X-LIST-%d", i % N_LISTS);
+			cond = filter_cond_new(FLT_COND_ANY_HEADER, FLT_CONTAIN,
+					       0, NULL, value);
+			break;
+		}
+		g_free(value);
+
+		name = g_strdup_printf("rule %d", i);
+		action = filter_action_new(FLT_ACTION_MARK, NULL);
+		rules = g_slist_append
+			(rules, filter_rule_new(name, FLT_OR,
+						g_slist_append(NULL, cond),
+						g_slist_append(NULL, action)));
+		g_free(name);
+	}
+
+	return rules;
+}
+
+int main(int argc, char *argv[])
+{
+	const gchar *dir = NULL;
+	gchar *root, *path;
+	gboolean remove_root = FALSE;
+	Folder *folder;
+	FolderItem *item;
+	GSList *mlist, *rules, *cur;
+	GTimer *timer;
+	gdouble elapsed, best = -1;
+	gint n_msgs = 100000, n_rules = 40, repeat = 3;
+	gint i, matched;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-n") && i + 1 < argc)
+			n_msgs = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-f") && i + 1 < argc)
+			n_rules = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-r") && i + 1 < argc)
+			repeat = atoi(argv[++i]);
+		else if (argv[i][0] != '-')
+			dir = argv[i];
+		else {
+			g_print("usage: %s [-n messages] [-f rules] "
+				"[-r repeat] [directory]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (n_msgs <= 0 || n_rules <= 0 || repeat <= 0)
+		return 1;
+
+#if USE_THREADS
+	if (!g_thread_supported())
+		g_thread_init(NULL);
+#endif
+	syl_init();
+
+	if (dir)
+		root = g_strdup(dir);
+	else {
+		root = g_strdup_printf("%s%cbench-filter.%d", g_get_tmp_dir(),
+				       G_DIR_SEPARATOR, getpid());
+		remove_root = TRUE;
+	}
+	path = g_strconcat(root, G_DIR_SEPARATOR_S, "bench", NULL);
+	if (make_dir_hier(path) < 0)
+		return 1;
+
+	folder = folder_new(F_MH, "bench", root);
+	item = folder_item_new("bench", "bench");
+	folder_item_append(FOLDER_ITEM(folder->node->data), item);
+
+	g_print("creating %d messages in %s ...\n", n_msgs, path);
+	if (create_msgs(path, n_msgs) < 0)
+		return 1;
+
+	mlist = folder_item_get_msg_list(item, TRUE);
+	rules = create_rules(n_rules);
+
+	timer = g_timer_new();
+
+	for (i = 0; i < repeat; i++) {
+		matched = 0;
+		g_timer_start(timer);
+		for (cur = mlist; cur != NULL; cur = cur->next) {
+			MsgInfo *msginfo = (MsgInfo *)cur->data;
+			FilterInfo *fltinfo;
+
+			fltinfo = filter_info_new();
+			fltinfo->flags = msginfo->flags;
+			filter_apply_msginfo(rules, msginfo, fltinfo);
+			if (MSG_IS_MARKED(fltinfo->flags))
+				matched++;
+			filter_info_free(fltinfo);
+		}
+		elapsed = g_timer_elapsed(timer, NULL);
+		g_print("%d rules, %d messages (%d matched): %.3f sec\n",
+			n_rules, g_slist_length(mlist), matched, elapsed);
+		if (best < 0 || elapsed < best)
+			best = elapsed;
+	}
+	g_print("best: %.3f sec\n", best);
+
+	g_timer_destroy(timer);
+	filter_rule_list_free(rules);
+	procmsg_msg_list_free(mlist);
+
+	if (remove_root)
+		remove_dir_recursive(root);
+	g_free(path);
+	g_free(root);
+
+	return 0;
+}
@@ -0,0 +1,180 @@
+/*
+ * LibSylph -- E-Mail client library
+ * Copyright (C) 1999-2011 Hiroyuki Yamamoto
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Benchmark of reading an MH folder whose messages were removed by other
+   programs: builds a folder, writes its cache, removes every other
+   message file, and times folder_item_get_msg_list() with the cache.
+
+   usage: bench-mhscan [-n messages] [-r repeat] [directory] */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include "defs.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sylmain.h"
+#include "folder.h"
+#include "procmsg.h"
+#include "utils.h"
+
+static gint create_msgs(const gchar *path, gint n)
+{
+	gchar *file;
+	FILE *fp;
+	gint i;
+
+	for (i = 1; i <= n; i++) {
+		file = g_strdup_printf("%s%c%d", path, G_DIR_SEPARATOR, i);
+		if ((fp = g_fopen(file, "wb")) == NULL) {
+			FILE_OP_ERROR(file, "fopen");
+			g_free(file);
+			return -1;
+		}
+		fprintf(fp, "From: sender%d@example.com\n"
+			"To: rcpt@example.com\n"
+			"Subject: message %d\n"
+			"Date: Fri, 22 Jul 2011 12:00:00 +0900\n"
+			"Message-ID: <%d@example.com>\n"
+			"\n"
+			"body of message %d\n", i % 100, i, i, i);
+		fclose(fp);
+		g_free(file);
+	}
+
+	return 0;
+}
+
+static gint remove_half_msgs(const gchar *path, gint n)
+{
+	gchar *file;
+	gint i;
+
+	for (i = 1; i <= n; i += 2) {
+		file = g_strdup_printf("%s%c%d", path, G_DIR_SEPARATOR, i);
+		if (g_unlink(file) < 0) {
+			FILE_OP_ERROR(file, "unlink");
+			g_free(file);
+			return -1;
+		}
+		g_free(file);
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const gchar *dir = NULL;
+	gchar *root, *path;
+	gboolean remove_root = FALSE;
+	Folder *folder;
+	FolderItem *item;
+	GSList *mlist;
+	GTimer *timer;
+	gdouble elapsed, best = -1;
+	gint n_msgs = 200000, repeat = 5;
+	gint i, len;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-n") && i + 1 < argc)
+			n_msgs = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-r") && i + 1 < argc)
+			repeat = atoi(argv[++i]);
+		else if (argv[i][0] != '-')
+			dir = argv[i];
+		else {
+			g_print("usage: %s [-n messages] [-r repeat] "
+				"[directory]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (n_msgs <= 0 || repeat <= 0)
+		return 1;
+
+#if USE_THREADS
+	if (!g_thread_supported())
+		g_thread_init(NULL);
+#endif
+	syl_init();
+
+	if (dir)
+		root = g_strdup(dir);
+	else {
+		root = g_strdup_printf("%s%cbench-mhscan.%d", g_get_tmp_dir(),
+				       G_DIR_SEPARATOR, getpid());
+		remove_root = TRUE;
+	}
+	path = g_strconcat(root, G_DIR_SEPARATOR_S, "bench", NULL);
+	if (make_dir_hier(path) < 0)
+		return 1;
+
+	folder = folder_new(F_MH, "bench", root);
+	item = folder_item_new("bench", "bench");
+	folder_item_append(FOLDER_ITEM(folder->node->data), item);
+
+	g_print("creating %d messages in %s ...\n", n_msgs, path);
+	if (create_msgs(path, n_msgs) < 0)
+		return 1;
+
+	timer = g_timer_new();
+
+	/* parse all the messages and write the cache */
+	g_timer_start(timer);
+	mlist = folder_item_get_msg_list(item, FALSE);
+	elapsed = g_timer_elapsed(timer, NULL);
+	len = g_slist_length(mlist);
+	procmsg_msg_list_free(mlist);
+	g_print("without cache: %d messages: %.3f sec\n", len, elapsed);
+
+	if (remove_half_msgs(path, n_msgs) < 0)
+		return 1;
+
+	/* the folder mtime is reset so that the cache is always merged
+	   with the directory */
+	for (i = 0; i < repeat; i++) {
+		item->mtime = 0;
+		g_timer_start(timer);
+		mlist = folder_item_get_msg_list(item, TRUE);
+		elapsed = g_timer_elapsed(timer, NULL);
+		len = g_slist_length(mlist);
+		procmsg_msg_list_free(mlist);
+		g_print("with cache, half removed: %d messages: %.3f sec\n",
+			len, elapsed);
+		if (best < 0 || elapsed < best)
+			best = elapsed;
+	}
+	g_print("best: %.3f sec\n", best);
+
+	g_timer_destroy(timer);
+
+	if (remove_root)
+		remove_dir_recursive(root);
+	g_free(path);
+	g_free(root);
+
+	return 0;
+}
@@ -0,0 +1,1329 @@
+/*
+ * LibSylph -- E-Mail client library
+ * Copyright (C) 1999-2011 Hiroyuki Yamamoto
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Body text index of a folder.
+ *
+ * Every trigram of the (case-folded) text parts of a message is hashed
+ * to a 16-bit key. A message can contain a string only if it contains
+ * all the keys of the string, so the index is used to skip messages
+ * before the body is actually searched.
+ *
+ * File format (BODY_INDEX_FILE in the folder cache directory):
+ *
+ *   header:	version, ndocs, postings_size
+ *   docs:	ndocs * (msgnum, size, mtime, flags)
+ *   dir:	BODY_INDEX_NKEYS + 1 offsets of the posting lists
+ *		(only if ndocs > 0)
+ *   postings:	document ids of each key (delta, variable length)
+ *   log:	records appended after the last merge
+ *		'A' msgnum size mtime nkeys keys[nkeys] (guint16)
+ *		'R' msgnum
+ *
+ * The log is merged into the posting lists when it grows.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include "defs.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "bodyindex.h"
+#include "procmime.h"
+#include "prefs_common.h"
+#include "utils.h"
+
+#if USE_THREADS
+#define S_LOCK_DEFINE_STATIC(name)	G_LOCK_DEFINE_STATIC(name)
+#define S_LOCK(name)	G_LOCK(name)
+#define S_UNLOCK(name)	G_UNLOCK(name)
+#else
+#define S_LOCK_DEFINE_STATIC(name)
+#define S_LOCK(name)
+#define S_UNLOCK(name)
+#endif
+
+#define BODY_INDEX_NKEYS	65536
+#define BODY_INDEX_MAX_KEYS	8192
+#define BODY_INDEX_CACHE_SIZE	4
+#define BODY_INDEX_MERGE_MIN	1024
+
+#define BODY_INDEX_REC_ADD	'A'
+#define BODY_INDEX_REC_REMOVE	'R'
+
+#define BODY_INDEX_DOC_NOT_INDEXED	1
+
+#define BODY_INDEX_KEY(a, b, c)						\
+	((((((guint32)(a)) << 16) | (((guint32)(b)) << 8) | (guint32)(c)) * \
+	  2654435761U) >> 16)
+
+typedef struct _BodyIndex	BodyIndex;
+typedef struct _BodyIndexDoc	BodyIndexDoc;
+typedef struct _BodyIndexKeySet	BodyIndexKeySet;
+
+struct _BodyIndexDoc
+{
+	guint msgnum;
+	guint32 size;
+	guint32 mtime;
+	gint id;		/* position in the main segment, or -1 */
+	gint nkeys;		/* -1 if the body is not indexed */
+	guint16 *keys;		/* sorted keys (log entries only) */
+};
+
+struct _BodyIndex
+{
+	FolderItem *item;
+	gchar *path;
+	gchar *file;
+	FILE *fp;
+
+	/* main segment */
+	gint ndocs;
+	BodyIndexDoc *docs;
+	guint32 *dir;
+	glong postings_pos;
+	guint32 postings_size;
+
+	/* log */
+	GPtrArray *log_docs;
+	gint nlog;
+	glong log_end;
+
+	/* msgnum -> current BodyIndexDoc */
+	GHashTable *doc_table;
+
+	/* keys of the last searched string */
+	gchar *query;
+	guint16 *query_keys;
+	gint query_nkeys;
+	guchar *cand;
+};
+
+struct _BodyIndexKeySet
+{
+	guchar bits[BODY_INDEX_NKEYS / 8];
+	gint count;
+};
+
+static GSList *index_cache = NULL;
+S_LOCK_DEFINE_STATIC(body_index);
+
+
+/* prev holds the last two bytes of the preceding chunk of the same line,
+   and nprev the number of valid bytes in it. */
+static void body_index_key_set_add_chunk(BodyIndexKeySet *set,
+					 const gchar *str,
+					 guchar *prev, gint *nprev)
+{
+	const guchar *p;
+	guchar a = prev[0], b = prev[1], c;
+	gint n = *nprev;
+	guint32 key;
+
+	for (p = (const guchar *)str; *p != '\0'; p++) {
+		c = g_ascii_tolower(*p);
+		if (n < 2)
+			n++;
+		else {
+			key = BODY_INDEX_KEY(a, b, c);
+			if (!(set->bits[key >> 3] & (1 << (key & 7)))) {
+				set->bits[key >> 3] |= 1 << (key & 7);
+				set->count++;
+			}
+		}
+		a = b;
+		b = c;
+	}
+
+	prev[0] = a;
+	prev[1] = b;
+	*nprev = n;
+}
+
+static void body_index_key_set_add_str(BodyIndexKeySet *set,
+				       const gchar *str)
+{
+	guchar prev[2] = {0, 0};
+	gint nprev = 0;
+
+	body_index_key_set_add_chunk(set, str, prev, &nprev);
+}
+
+static guint16 *body_index_key_set_to_array(BodyIndexKeySet *set)
+{
+	guint16 *keys;
+	guint32 key;
+	gint n = 0;
+
+	keys = g_new(guint16, set->count + 1);
+	for (key = 0; key < BODY_INDEX_NKEYS; key++) {
+		if (set->bits[key >> 3] == 0) {
+			key |= 7;
+			continue;
+		}
+		if (set->bits[key >> 3] & (1 << (key & 7)))
+			keys[n++] = key;
+	}
+
+	return keys;
+}
+
+/* Collect the keys of the text parts the same way as procmime_find_string()
+   reads them. Returns -1 if the message can't be indexed. */
+static gint body_index_read_keys(FILE *fp, guint16 **keys)
+{
+	MimeInfo *mimeinfo, *partinfo;
+	BodyIndexKeySet *set;
+	gchar buf[BUFFSIZE];
+	gint nkeys = -1;
+
+	*keys = NULL;
+
+	mimeinfo = procmime_scan_mime_header(fp);
+	if (!mimeinfo)
+		return -1;
+
+	/* encrypted messages are searched after decryption */
+	if (mimeinfo->content_type &&
+	    !g_ascii_strcasecmp(mimeinfo->content_type,
+				"multipart/encrypted")) {
+		procmime_mimeinfo_free_all(mimeinfo);
+		return -1;
+	}
+
+	mimeinfo->content_size = get_left_file_size(fp);
+	if (mimeinfo->encoding_type == ENC_BASE64)
+		mimeinfo->content_size = mimeinfo->content_size / 4 * 3;
+	if (mimeinfo->mime_type == MIME_MULTIPART ||
+	    mimeinfo->mime_type == MIME_MESSAGE_RFC822)
+		procmime_scan_multipart_message(mimeinfo, fp);
+
+	set = g_new0(BodyIndexKeySet, 1);
+
+	for (partinfo = mimeinfo; partinfo != NULL;
+	     partinfo = procmime_mimeinfo_next(partinfo)) {
+		BufFile *bf;
+		guchar prev[2] = {0, 0};
+		gint nprev = 0;
+		gboolean eol;
+		gint len;
+
+		if (partinfo->mime_type != MIME_TEXT &&
+		    partinfo->mime_type != MIME_TEXT_HTML)
+			continue;
+
+		bf = procmime_get_text_content_buf(partinfo, fp, NULL);
+		if (!bf)
+			continue;
+		while (set->count <= BODY_INDEX_MAX_KEYS &&
+		       buf_file_gets(buf, sizeof(buf), bf) != NULL) {
+			/* lines longer than buf are read in several chunks.
+			   Keys spanning the chunks are added as well so that
+			   the keys cover the whole line. */
+			len = strlen(buf);
+			eol = (len > 0 && buf[len - 1] == '\n');
+			strretchomp(buf);
+			body_index_key_set_add_chunk(set, buf, prev, &nprev);
+			if (eol)
+				nprev = 0;
+		}
+		buf_file_close(bf);
+	}
+
+	if (set->count <= BODY_INDEX_MAX_KEYS) {
+		nkeys = set->count;
+		*keys = body_index_key_set_to_array(set);
+	}
+
+	g_free(set);
+	procmime_mimeinfo_free_all(mimeinfo);
+
+	return nkeys;
+}
+
+#define WRITE_UINT(n)						\
+{								\
+	guint32 v = (n);					\
+	if (fwrite(&v, sizeof(v), 1, fp) != 1)			\
+		goto error;					\
+}
+
+#define READ_UINT(n)						\
+{								\
+	guint32 v;						\
+	if (fread(&v, sizeof(v), 1, fp) != 1)			\
+		goto error;					\
+	n = v;							\
+}
+
+static void body_index_clear(BodyIndex *index)
+{
+	gint i;
+
+	if (index->fp) {
+		fclose(index->fp);
+		index->fp = NULL;
+	}
+
+	if (index->log_docs) {
+		for (i = 0; i < index->log_docs->len; i++) {
+			BodyIndexDoc *doc = g_ptr_array_index(index->log_docs, i);
+
+			g_free(doc->keys);
+			g_free(doc);
+		}
+		g_ptr_array_free(index->log_docs, TRUE);
+		index->log_docs = NULL;
+	}
+	if (index->doc_table) {
+		g_hash_table_destroy(index->doc_table);
+		index->doc_table = NULL;
+	}
+
+	g_free(index->docs);
+	index->docs = NULL;
+	g_free(index->dir);
+	index->dir = NULL;
+	index->ndocs = 0;
+	index->nlog = 0;
+
+	g_free(index->query);
+	index->query = NULL;
+	g_free(index->query_keys);
+	index->query_keys = NULL;
+	index->query_nkeys = 0;
+	g_free(index->cand);
+	index->cand = NULL;
+}
+
+static gboolean body_index_create_file(const gchar *file)
+{
+	FILE *fp;
+
+	if ((fp = g_fopen(file, "wb")) == NULL) {
+		FILE_OP_ERROR(file, "fopen");
+		return FALSE;
+	}
+
+	WRITE_UINT(BODY_INDEX_VERSION);
+	WRITE_UINT(0);
+	WRITE_UINT(0);
+
+	if (fclose(fp) == EOF) {
+		FILE_OP_ERROR(file, "fclose");
+		g_unlink(file);
+		return FALSE;
+	}
+
+	return TRUE;
+
+error:
+	fclose(fp);
+	g_unlink(file);
+	return FALSE;
+}
+
+static BodyIndexDoc *body_index_log_doc_new(BodyIndex *index, guint msgnum,
+					    guint32 size, guint32 mtime,
+					    gint nkeys, guint16 *keys)
+{
+	BodyIndexDoc *doc;
+
+	doc = g_new(BodyIndexDoc, 1);
+	doc->msgnum = msgnum;
+	doc->size = size;
+	doc->mtime = mtime;
+	doc->id = -1;
+	doc->nkeys = nkeys;
+	doc->keys = keys;
+	g_ptr_array_add(index->log_docs, doc);
+	g_hash_table_insert(index->doc_table, GUINT_TO_POINTER(msgnum), doc);
+	index->nlog++;
+
+	return doc;
+}
+
+static gboolean body_index_read(BodyIndex *index)
+{
+	FILE *fp;
+	guint32 ver, flags;
+	gint i;
+
+	index->log_docs = g_ptr_array_new();
+	index->doc_table = g_hash_table_new(NULL, NULL);
+
+	if ((fp = g_fopen(index->file, "r+b")) == NULL) {
+		FILE_OP_ERROR(index->file, "fopen");
+		return FALSE;
+	}
+	index->fp = fp;
+
+	READ_UINT(ver);
+	if (ver != BODY_INDEX_VERSION) {
+		debug_print("Body index version mismatch: %s\n", index->file);
+		return FALSE;
+	}
+	READ_UINT(index->ndocs);
+	READ_UINT(index->postings_size);
+
+	if (index->ndocs < 0 ||
+	    index->ndocs > get_file_size(index->file) / (sizeof(guint32) * 4))
+		goto error;
+	index->docs = g_new(BodyIndexDoc, index->ndocs + 1);
+	for (i = 0; i < index->ndocs; i++) {
+		BodyIndexDoc *doc = &index->docs[i];
+
+		READ_UINT(doc->msgnum);
+		READ_UINT(doc->size);
+		READ_UINT(doc->mtime);
+		READ_UINT(flags);
+		doc->id = i;
+		doc->nkeys = (flags & BODY_INDEX_DOC_NOT_INDEXED) ? -1 : 0;
+		doc->keys = NULL;
+		g_hash_table_insert(index->doc_table,
+				    GUINT_TO_POINTER(doc->msgnum), doc);
+	}
+
+	if (index->ndocs > 0) {
+		index->dir = g_new(guint32, BODY_INDEX_NKEYS + 1);
+		if (fread(index->dir, sizeof(guint32), BODY_INDEX_NKEYS + 1,
+			  fp) != BODY_INDEX_NKEYS + 1)
+			goto error;
+		/* the posting lists must be in order and inside the
+		   postings area, or their lengths can't be trusted */
+		if (index->dir[0] != 0 ||
+		    index->dir[BODY_INDEX_NKEYS] > index->postings_size)
+			goto error;
+		for (i = 0; i < BODY_INDEX_NKEYS; i++) {
+			if (index->dir[i] > index->dir[i + 1])
+				goto error;
+		}
+	}
+	index->postings_pos = ftell(fp);
+	if (fseek(fp, index->postings_size, SEEK_CUR) < 0)
+		goto error;
+
+	/* replay the log. a broken record at the end is overwritten by
+	   the next record */
+	for (;;) {
+		guint32 type, msgnum, size, mtime, nkeys;
+		guint16 *keys = NULL;
+
+		index->log_end = ftell(fp);
+
+		if (fread(&type, sizeof(type), 1, fp) != 1)
+			break;
+		if (fread(&msgnum, sizeof(msgnum), 1, fp) != 1)
+			break;
+
+		if (type == BODY_INDEX_REC_REMOVE) {
+			g_hash_table_remove(index->doc_table,
+					    GUINT_TO_POINTER(msgnum));
+			index->nlog++;
+			continue;
+		} else if (type != BODY_INDEX_REC_ADD)
+			break;
+
+		if (fread(&size, sizeof(size), 1, fp) != 1 ||
+		    fread(&mtime, sizeof(mtime), 1, fp) != 1 ||
+		    fread(&nkeys, sizeof(nkeys), 1, fp) != 1)
+			break;
+		if ((gint32)nkeys > BODY_INDEX_MAX_KEYS)
+			break;
+		if ((gint32)nkeys > 0) {
+			keys = g_new(guint16, nkeys);
+			if (fread(keys, sizeof(guint16), nkeys, fp) != nkeys) {
+				g_free(keys);
+				break;
+			}
+		}
+
+		body_index_log_doc_new(index, msgnum, size, mtime,
+				       (gint32)nkeys, keys);
+	}
+
+	debug_print("Body index %s: %d docs, %d log records\n",
+		    index->file, index->ndocs, index->nlog);
+
+	return TRUE;
+
+error:
+	g_warning("Body index is corrupted: %s\n", index->file);
+	return FALSE;
+}
+
+static gint body_index_doc_compare(gconstpointer a, gconstpointer b)
+{
+	const BodyIndexDoc *doc_a = *(const BodyIndexDoc **)a;
+	const BodyIndexDoc *doc_b = *(const BodyIndexDoc **)b;
+
+	if (doc_a->msgnum < doc_b->msgnum)
+		return -1;
+	return doc_a->msgnum > doc_b->msgnum ? 1 : 0;
+}
+
+static void body_index_collect_doc_func(gpointer key, gpointer value,
+					gpointer data)
+{
+	g_ptr_array_add((GPtrArray *)data, value);
+}
+
+static guchar *body_index_read_postings(BodyIndex *index, guint key,
+					guint32 *len)
+{
+	guchar *buf;
+
+	*len = index->dir[key + 1] - index->dir[key];
+	if (*len == 0 || index->dir[key + 1] > index->postings_size)
+		return NULL;
+
+	buf = g_malloc(*len);
+	if (fseek(index->fp, index->postings_pos + index->dir[key],
+		  SEEK_SET) < 0 ||
+	    fread(buf, *len, 1, index->fp) != 1) {
+		g_free(buf);
+		return NULL;
+	}
+
+	return buf;
+}
+
+#define NEXT_ID(p, endp, id)						\
+{									\
+	guint32 delta = 0;						\
+	gint shift = 0;							\
+	while (p < endp) {						\
+		delta |= (guint32)(*p & 0x7f) << shift;			\
+		shift += 7;						\
+		if ((*p++ & 0x80) == 0)					\
+			break;						\
+	}								\
+	id += delta;							\
+}
+
+static void body_index_put_id(GByteArray *array, guint32 delta)
+{
+	guchar c;
+
+	while (delta >= 0x80) {
+		c = (delta & 0x7f) | 0x80;
+		g_byte_array_append(array, &c, 1);
+		delta >>= 7;
+	}
+	c = delta;
+	g_byte_array_append(array, &c, 1);
+}
+
+/* Merge the log into the main segment and rewrite the index file. */
+static gboolean body_index_merge(BodyIndex *index)
+{
+	GPtrArray *docs;
+	GArray **log_lists;
+	GByteArray *postings;
+	gint *remap;
+	guint32 *dir;
+	guint32 offset = 0;
+	gchar *tmp;
+	FILE *fp;
+	guint key;
+	gint i, j;
+	gboolean ret = FALSE;
+
+	debug_print("Merging body index %s (%d docs, %d log records)\n",
+		    index->file, index->ndocs, index->nlog);
+
+	docs = g_ptr_array_sized_new(g_hash_table_size(index->doc_table));
+	g_hash_table_foreach(index->doc_table, body_index_collect_doc_func,
+			     docs);
+	g_ptr_array_sort(docs, body_index_doc_compare);
+
+	/* documents get new ids in the order of msgnum */
+	remap = g_new(gint, index->ndocs + 1);
+	for (i = 0; i < index->ndocs; i++)
+		remap[i] = -1;
+	log_lists = g_new0(GArray *, BODY_INDEX_NKEYS);
+	for (i = 0; i < docs->len; i++) {
+		BodyIndexDoc *doc = g_ptr_array_index(docs, i);
+
+		if (doc->id >= 0) {
+			remap[doc->id] = i;
+			continue;
+		}
+		for (j = 0; j < doc->nkeys; j++) {
+			key = doc->keys[j];
+			if (!log_lists[key])
+				log_lists[key] = g_array_new
+					(FALSE, FALSE, sizeof(guint32));
+			g_array_append_val(log_lists[key], i);
+		}
+	}
+
+	dir = g_new(guint32, BODY_INDEX_NKEYS + 1);
+	postings = g_byte_array_new();
+
+	tmp = g_strconcat(index->file, ".tmp", NULL);
+	if ((fp = g_fopen(tmp, "wb")) == NULL) {
+		FILE_OP_ERROR(tmp, "fopen");
+		goto finish;
+	}
+
+	WRITE_UINT(BODY_INDEX_VERSION);
+	WRITE_UINT(docs->len);
+	WRITE_UINT(0);
+
+	for (i = 0; i < docs->len; i++) {
+		BodyIndexDoc *doc = g_ptr_array_index(docs, i);
+
+		WRITE_UINT(doc->msgnum);
+		WRITE_UINT(doc->size);
+		WRITE_UINT(doc->mtime);
+		WRITE_UINT(doc->nkeys < 0 ? BODY_INDEX_DOC_NOT_INDEXED : 0);
+	}
+
+	if (docs->len > 0) {
+		/* placeholder, written after the posting lists */
+		memset(dir, 0, sizeof(guint32) * (BODY_INDEX_NKEYS + 1));
+		if (fwrite(dir, sizeof(guint32), BODY_INDEX_NKEYS + 1, fp) !=
+		    BODY_INDEX_NKEYS + 1)
+			goto error;
+
+		for (key = 0; key < BODY_INDEX_NKEYS; key++) {
+			GArray *log_list = log_lists[key];
+			guchar *buf = NULL, *p = NULL, *endp = NULL;
+			guint32 len, id = 0, next, prev = 0;
+			gint old_id = -1;
+
+			dir[key] = offset;
+			g_byte_array_set_size(postings, 0);
+
+			if (index->ndocs > 0 &&
+			    (buf = body_index_read_postings(index, key, &len))) {
+				p = buf;
+				endp = buf + len;
+			}
+
+			/* merge the old list and the log list, both of
+			   them are sorted by the new ids */
+			j = 0;
+			for (;;) {
+				while (old_id < 0 && p && p < endp) {
+					NEXT_ID(p, endp, id);
+					if (id < index->ndocs)
+						old_id = remap[id];
+				}
+				if (old_id >= 0 &&
+				    (!log_list || j >= log_list->len ||
+				     old_id < g_array_index(log_list,
+							    guint32, j))) {
+					next = old_id;
+					old_id = -1;
+				} else if (log_list && j < log_list->len)
+					next = g_array_index(log_list,
+							     guint32, j++);
+				else
+					break;
+
+				body_index_put_id(postings, next - prev);
+				prev = next;
+			}
+
+			g_free(buf);
+
+			if (postings->len > 0 &&
+			    fwrite(postings->data, postings->len, 1, fp) != 1)
+				goto error;
+			offset += postings->len;
+		}
+		dir[BODY_INDEX_NKEYS] = offset;
+
+		if (fseek(fp, sizeof(guint32) * (3 + 4 * docs->len),
+			  SEEK_SET) < 0 ||
+		    fwrite(dir, sizeof(guint32), BODY_INDEX_NKEYS + 1, fp) !=
+		    BODY_INDEX_NKEYS + 1)
+			goto error;
+		if (fseek(fp, sizeof(guint32) * 2, SEEK_SET) < 0)
+			goto error;
+		WRITE_UINT(offset);
+	}
+
+	if (fclose(fp) == EOF) {
+		FILE_OP_ERROR(tmp, "fclose");
+		fp = NULL;
+		goto error;
+	}
+	fp = NULL;
+
+	if (rename_force(tmp, index->file) < 0) {
+		FILE_OP_ERROR(tmp, "rename");
+		goto error;
+	}
+
+	ret = TRUE;
+	goto finish;
+
+error:
+	g_warning("can't write body index: %s\n", tmp);
+	if (fp)
+		fclose(fp);
+	g_unlink(tmp);
+
+finish:
+	for (key = 0; key < BODY_INDEX_NKEYS; key++) {
+		if (log_lists[key])
+			g_array_free(log_lists[key], TRUE);
+	}
+	g_free(log_lists);
+	g_byte_array_free(postings, TRUE);
+	g_free(dir);
+	g_free(remap);
+	g_ptr_array_free(docs, TRUE);
+	g_free(tmp);
+
+	if (ret) {
+		body_index_clear(index);
+		if (!body_index_read(index)) {
+			body_index_clear(index);
+			ret = FALSE;
+		}
+	}
+
+	return ret;
+}
+
+static void body_index_free(BodyIndex *index)
+{
+	body_index_clear(index);
+	g_free(index->file);
+	g_free(index->path);
+	g_free(index);
+}
+
+static BodyIndex *body_index_open(FolderItem *item, gchar *path, gchar *file)
+{
+	BodyIndex *index;
+
+	index = g_new0(BodyIndex, 1);
+	index->item = item;
+	index->path = path;
+	index->file = file;
+
+	if (!body_index_read(index)) {
+		body_index_clear(index);
+		if (!body_index_create_file(file) || !body_index_read(index)) {
+			body_index_free(index);
+			return NULL;
+		}
+	}
+
+	if (index->nlog >= BODY_INDEX_MERGE_MIN &&
+	    index->nlog * 4 >= index->ndocs)
+		body_index_merge(index);
+	if (!index->fp) {
+		body_index_free(index);
+		return NULL;
+	}
+
+	return index;
+}
+
+/* Return the index of item from the cache, or open it. If create is
+   FALSE, the index is not created if it doesn't exist yet. */
+static BodyIndex *body_index_get(FolderItem *item, gboolean create)
+{
+	BodyIndex *index;
+	GSList *cur;
+	gchar *path, *file;
+
+	path = folder_item_get_path(item);
+	if (!path)
+		return NULL;
+
+	for (cur = index_cache; cur != NULL; cur = cur->next) {
+		index = (BodyIndex *)cur->data;
+		if (index->item == item && !strcmp(index->path, path)) {
+			if (cur != index_cache) {
+				index_cache = g_slist_remove(index_cache,
+							     index);
+				index_cache = g_slist_prepend(index_cache,
+							      index);
+			}
+			g_free(path);
+			return index;
+		}
+	}
+
+	file = g_strconcat(path, G_DIR_SEPARATOR_S, BODY_INDEX_FILE, NULL);
+	if (!is_file_exist(file)) {
+		if (!create || !is_dir_exist(path) ||
+		    !body_index_create_file(file)) {
+			g_free(file);
+			g_free(path);
+			return NULL;
+		}
+	}
+
+	index = body_index_open(item, path, file);
+	if (!index)
+		return NULL;
+
+	index_cache = g_slist_prepend(index_cache, index);
+	if (g_slist_length(index_cache) > BODY_INDEX_CACHE_SIZE) {
+		cur = g_slist_last(index_cache);
+		body_index_free((BodyIndex *)cur->data);
+		index_cache = g_slist_delete_link(index_cache, cur);
+	}
+
+	return index;
+}
+
+static BodyIndexDoc *body_index_lookup(BodyIndex *index, MsgInfo *msginfo)
+{
+	BodyIndexDoc *doc;
+
+	doc = g_hash_table_lookup(index->doc_table,
+				  GUINT_TO_POINTER(msginfo->msgnum));
+	if (doc && doc->size == (guint32)msginfo->size &&
+	    doc->mtime == (guint32)msginfo->mtime)
+		return doc;
+
+	return NULL;
+}
+
+static void body_index_append_add(BodyIndex *index, guint msgnum,
+				  guint32 size, guint32 mtime,
+				  gint nkeys, guint16 *keys)
+{
+	FILE *fp = index->fp;
+
+	if (fseek(fp, index->log_end, SEEK_SET) < 0)
+		goto error;
+
+	WRITE_UINT(BODY_INDEX_REC_ADD);
+	WRITE_UINT(msgnum);
+	WRITE_UINT(size);
+	WRITE_UINT(mtime);
+	WRITE_UINT(nkeys);
+	if (nkeys > 0 && fwrite(keys, sizeof(guint16), nkeys, fp) != nkeys)
+		goto error;
+	if (fflush(fp) == EOF)
+		goto error;
+
+	index->log_end = ftell(fp);
+	body_index_log_doc_new(index, msgnum, size, mtime, nkeys, keys);
+	return;
+
+error:
+	FILE_OP_ERROR(index->file, "fwrite");
+	g_free(keys);
+}
+
+static void body_index_append_remove(BodyIndex *index, guint msgnum)
+{
+	FILE *fp = index->fp;
+
+	if (fseek(fp, index->log_end, SEEK_SET) < 0)
+		goto error;
+
+	WRITE_UINT(BODY_INDEX_REC_REMOVE);
+	WRITE_UINT(msgnum);
+	if (fflush(fp) == EOF)
+		goto error;
+
+	index->log_end = ftell(fp);
+	g_hash_table_remove(index->doc_table, GUINT_TO_POINTER(msgnum));
+	index->nlog++;
+	return;
+
+error:
+	FILE_OP_ERROR(index->file, "fwrite");
+}
+
+static void body_index_merge_if_needed(BodyIndex *index)
+{
+	if (index->nlog >= BODY_INDEX_MERGE_MIN &&
+	    index->nlog * 4 >= index->ndocs &&
+	    !body_index_merge(index) && !index->fp) {
+		index_cache = g_slist_remove(index_cache, index);
+		body_index_free(index);
+	}
+}
+
+static void body_index_set_query(BodyIndex *index, const gchar *str)
+{
+	BodyIndexKeySet *set;
+
+	if (index->query && !strcmp(index->query, str))
+		return;
+
+	g_free(index->query);
+	g_free(index->query_keys);
+	g_free(index->cand);
+	index->cand = NULL;
+
+	set = g_new0(BodyIndexKeySet, 1);
+	body_index_key_set_add_str(set, str);
+	index->query = g_strdup(str);
+	index->query_keys = body_index_key_set_to_array(set);
+	index->query_nkeys = set->count;
+	g_free(set);
+}
+
+static gint body_index_key_compare_by_len(gconstpointer a, gconstpointer b,
+					  gpointer data)
+{
+	const guint32 *dir = (const guint32 *)data;
+	guint key_a = *(const guint16 *)a;
+	guint key_b = *(const guint16 *)b;
+
+	return (gint)(dir[key_a + 1] - dir[key_a]) -
+		(gint)(dir[key_b + 1] - dir[key_b]);
+}
+
+/* Intersect the posting lists of the query keys, shortest first. */
+static void body_index_get_candidates(BodyIndex *index)
+{
+	guint16 *keys;
+	guchar *found;
+	gint i, n;
+
+	index->cand = g_malloc(index->ndocs);
+	memset(index->cand, 1, index->ndocs);
+
+	keys = g_memdup(index->query_keys,
+			sizeof(guint16) * (index->query_nkeys + 1));
+	g_qsort_with_data(keys, index->query_nkeys, sizeof(guint16),
+			  body_index_key_compare_by_len, index->dir);
+
+	found = g_malloc(index->ndocs);
+
+	for (i = 0; i < index->query_nkeys; i++) {
+		guchar *buf, *p, *endp;
+		guint32 len, id = 0;
+
+		memset(found, 0, index->ndocs);
+		buf = body_index_read_postings(index, keys[i], &len);
+		if (!buf) {
+			memset(index->cand, 0, index->ndocs);
+			break;
+		}
+		p = buf;
+		endp = buf + len;
+		while (p < endp) {
+			NEXT_ID(p, endp, id);
+			if (id < index->ndocs)
+				found[id] = 1;
+		}
+		g_free(buf);
+
+		for (n = 0; n < index->ndocs; n++)
+			index->cand[n] &= found[n];
+	}
+
+	g_free(found);
+	g_free(keys);
+}
+
+static gint body_index_key_compare(gconstpointer a, gconstpointer b)
+{
+	return (gint)*(const guint16 *)a - (gint)*(const guint16 *)b;
+}
+
+static gboolean body_index_doc_may_contain(BodyIndex *index,
+					   BodyIndexDoc *doc)
+{
+	gint i;
+
+	if (doc->nkeys < 0 || index->query_nkeys == 0)
+		return TRUE;
+
+	if (doc->id >= 0) {
+		if (!index->cand)
+			body_index_get_candidates(index);
+		return index->cand[doc->id] != 0;
+	}
+
+	for (i = 0; i < index->query_nkeys; i++) {
+		if (!doc->keys ||
+		    !bsearch(&index->query_keys[i], doc->keys, doc->nkeys,
+			     sizeof(guint16), body_index_key_compare))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Returns FALSE if the body of msginfo certainly doesn't contain str
+   (ignoring ASCII case). Messages which are not indexed yet are added
+   to the index. */
+gboolean body_index_may_contain(MsgInfo *msginfo, const gchar *str)
+{
+	BodyIndex *index;
+	BodyIndexDoc *doc;
+	FILE *fp;
+	guint16 *keys;
+	gint nkeys;
+	gboolean ret = TRUE;
+
+	g_return_val_if_fail(msginfo != NULL, TRUE);
+	g_return_val_if_fail(str != NULL, TRUE);
+
+	if (!prefs_common.enable_body_index)
+		return TRUE;
+	if (!msginfo->folder || msginfo->file_path || msginfo->encinfo ||
+	    MSG_IS_QUEUED(msginfo->flags) || MSG_IS_ENCRYPTED(msginfo->flags))
+		return TRUE;
+	if (str[0] == '\0' || str[1] == '\0' || str[2] == '\0')
+		return TRUE;
+
+	S_LOCK(body_index);
+	index = body_index_get(msginfo->folder, TRUE);
+	if (!index) {
+		S_UNLOCK(body_index);
+		return TRUE;
+	}
+	if ((doc = body_index_lookup(index, msginfo)) != NULL) {
+		body_index_set_query(index, str);
+		ret = body_index_doc_may_contain(index, doc);
+		S_UNLOCK(body_index);
+		return ret;
+	}
+	S_UNLOCK(body_index);
+
+	/* the message may be fetched from the server here */
+	if ((fp = procmsg_open_message(msginfo)) == NULL)
+		return TRUE;
+	nkeys = body_index_read_keys(fp, &keys);
+	fclose(fp);
+
+	S_LOCK(body_index);
+	index = body_index_get(msginfo->folder, TRUE);
+	if (index) {
+		body_index_append_add(index, msginfo->msgnum, msginfo->size,
+				      msginfo->mtime, nkeys, keys);
+		if ((doc = body_index_lookup(index, msginfo)) != NULL) {
+			body_index_set_query(index, str);
+			ret = body_index_doc_may_contain(index, doc);
+		}
+		body_index_merge_if_needed(index);
+	} else
+		g_free(keys);
+	S_UNLOCK(body_index);
+
+	return ret;
+}
+
+/* Add a message file which was just added to item. Nothing is done if
+   item has no index. */
+void body_index_add_msg_file(FolderItem *item, guint msgnum,
+			     const gchar *file, MsgFlags flags)
+{
+	struct stat s;
+
+	g_return_if_fail(item != NULL);
+	g_return_if_fail(file != NULL);
+
+	if (!prefs_common.enable_body_index || MSG_IS_QUEUED(flags))
+		return;
+
+	if (g_stat(file, &s) < 0) {
+		FILE_OP_ERROR(file, "stat");
+		return;
+	}
+
+	body_index_add_msg_file_full(item, msgnum, file, s.st_size,
+				     s.st_mtime, flags);
+}
+
+/* Same as body_index_add_msg_file(), but the size and mtime of the
+   message in item are given. They differ from the file for remote
+   folders. */
+void body_index_add_msg_file_full(FolderItem *item, guint msgnum,
+				  const gchar *file, guint32 size,
+				  guint32 mtime, MsgFlags flags)
+{
+	BodyIndex *index;
+	FILE *fp;
+	guint16 *keys;
+	gint nkeys;
+
+	g_return_if_fail(item != NULL);
+	g_return_if_fail(file != NULL);
+
+	if (!prefs_common.enable_body_index || MSG_IS_QUEUED(flags))
+		return;
+
+	S_LOCK(body_index);
+	index = body_index_get(item, FALSE);
+	S_UNLOCK(body_index);
+	if (!index)
+		return;
+
+	if ((fp = g_fopen(file, "rb")) == NULL) {
+		FILE_OP_ERROR(file, "fopen");
+		return;
+	}
+	nkeys = body_index_read_keys(fp, &keys);
+	fclose(fp);
+
+	S_LOCK(body_index);
+	index = body_index_get(item, FALSE);
+	if (index) {
+		body_index_append_add(index, msgnum, size, mtime, nkeys, keys);
+		body_index_merge_if_needed(index);
+	} else
+		g_free(keys);
+	S_UNLOCK(body_index);
+}
+
+typedef struct _BodyIndexCopy
+{
+	guint destnum;
+	gint nkeys;
+	guint16 *keys;
+} BodyIndexCopy;
+
+/* Take the keys of the messages of mlist which are in src from the index
+   of src. The keys of the documents in the main segment are collected in
+   one pass over the posting lists. */
+static void body_index_collect_keys(FolderItem *src, GSList *mlist,
+				    GArray *destnums, GArray *copies)
+{
+	BodyIndex *index;
+	BodyIndexDoc *doc;
+	BodyIndexCopy copy;
+	GArray **lists = NULL;
+	gint *slots = NULL;
+	GSList *cur;
+	gint i, first = copies->len;
+	guint key;
+
+	index = body_index_get(src, FALSE);
+	if (!index)
+		return;
+
+	for (cur = mlist, i = 0; cur != NULL; cur = cur->next, i++) {
+		MsgInfo *msginfo = (MsgInfo *)cur->data;
+
+		if (msginfo->folder != src)
+			continue;
+		if ((doc = body_index_lookup(index, msginfo)) == NULL)
+			continue;
+
+		copy.destnum = g_array_index(destnums, guint, i);
+		copy.nkeys = doc->nkeys;
+		copy.keys = NULL;
+		if (doc->id < 0 && doc->nkeys > 0)
+			copy.keys = g_memdup(doc->keys,
+					     sizeof(guint16) * doc->nkeys);
+		else if (doc->id >= 0 && doc->nkeys == 0) {
+			if (!slots) {
+				slots = g_new(gint, index->ndocs);
+				memset(slots, 0xff, sizeof(gint) * index->ndocs);
+			}
+			slots[doc->id] = copies->len;
+		}
+		g_array_append_val(copies, copy);
+	}
+
+	if (slots) {
+		lists = g_new0(GArray *, copies->len - first);
+		for (key = 0; key < BODY_INDEX_NKEYS; key++) {
+			guchar *buf, *p, *endp;
+			guint32 len, id = 0;
+			guint16 k = key;
+			gint slot;
+
+			buf = body_index_read_postings(index, key, &len);
+			if (!buf)
+				continue;
+			p = buf;
+			endp = buf + len;
+			while (p < endp) {
+				NEXT_ID(p, endp, id);
+				if (id >= index->ndocs || slots[id] < 0)
+					continue;
+				slot = slots[id] - first;
+				if (!lists[slot])
+					lists[slot] = g_array_new
+						(FALSE, FALSE, sizeof(guint16));
+				g_array_append_val(lists[slot], k);
+			}
+			g_free(buf);
+		}
+
+		for (i = 0; i < index->ndocs; i++) {
+			BodyIndexCopy *c;
+			GArray *list;
+
+			if (slots[i] < 0)
+				continue;
+			c = &g_array_index(copies, BodyIndexCopy, slots[i]);
+			list = lists[slots[i] - first];
+			if (list) {
+				c->nkeys = list->len;
+				c->keys = (guint16 *)g_array_free(list, FALSE);
+			}
+		}
+		g_free(lists);
+		g_free(slots);
+	}
+}
+
+/* Add the messages of mlist, which were copied or moved to dest as
+   destnums, to the index of dest. Their keys are taken from the indexes
+   of the source folders, so the message files are not read again. If
+   remove_src is TRUE, the messages are removed from the source indexes.
+   Nothing is added if dest has no index. */
+void body_index_copy_msgs(FolderItem *dest, GSList *mlist, GArray *destnums,
+			  gboolean remove_src)
+{
+	BodyIndex *index;
+	GArray *copies;
+	GSList *srcs = NULL, *cur;
+	gint i;
+
+	g_return_if_fail(dest != NULL);
+	g_return_if_fail(destnums != NULL);
+
+	if (!prefs_common.enable_body_index || !mlist)
+		return;
+
+	for (cur = mlist; cur != NULL; cur = cur->next) {
+		MsgInfo *msginfo = (MsgInfo *)cur->data;
+
+		if (msginfo->folder && !g_slist_find(srcs, msginfo->folder))
+			srcs = g_slist_prepend(srcs, msginfo->folder);
+	}
+
+	copies = g_array_new(FALSE, FALSE, sizeof(BodyIndexCopy));
+
+	S_LOCK(body_index);
+
+	if (body_index_get(dest, FALSE)) {
+		for (cur = srcs; cur != NULL; cur = cur->next)
+			body_index_collect_keys((FolderItem *)cur->data, mlist,
+						destnums, copies);
+	}
+
+	/* the source indexes may have pushed dest out of the cache */
+	index = copies->len > 0 ? body_index_get(dest, FALSE) : NULL;
+	for (i = 0; i < copies->len; i++) {
+		BodyIndexCopy *c = &g_array_index(copies, BodyIndexCopy, i);
+		struct stat s;
+		gchar *file;
+
+		if (!index) {
+			g_free(c->keys);
+			continue;
+		}
+		file = g_strdup_printf("%s%c%u", index->path, G_DIR_SEPARATOR,
+				       c->destnum);
+		if (g_stat(file, &s) == 0)
+			body_index_append_add(index, c->destnum, s.st_size,
+					      s.st_mtime, c->nkeys, c->keys);
+		else {
+			FILE_OP_ERROR(file, "stat");
+			g_free(c->keys);
+		}
+		g_free(file);
+	}
+	if (index)
+		body_index_merge_if_needed(index);
+
+	if (remove_src) {
+		for (cur = mlist; cur != NULL; cur = cur->next) {
+			MsgInfo *msginfo = (MsgInfo *)cur->data;
+
+			if (!msginfo->folder)
+				continue;
+			index = body_index_get(msginfo->folder, FALSE);
+			if (index && g_hash_table_lookup
+				(index->doc_table,
+				 GUINT_TO_POINTER(msginfo->msgnum))) {
+				body_index_append_remove(index,
+							 msginfo->msgnum);
+				body_index_merge_if_needed(index);
+			}
+		}
+	}
+
+	S_UNLOCK(body_index);
+
+	g_array_free(copies, TRUE);
+	g_slist_free(srcs);
+}
+
+void body_index_remove_msg(FolderItem *item, guint msgnum)
+{
+	BodyIndex *index;
+
+	g_return_if_fail(item != NULL);
+
+	S_LOCK(body_index);
+	index = body_index_get(item, FALSE);
+	if (index && g_hash_table_lookup(index->doc_table,
+					 GUINT_TO_POINTER(msgnum))) {
+		body_index_append_remove(index, msgnum);
+		body_index_merge_if_needed(index);
+	}
+	S_UNLOCK(body_index);
+}
+
+/* Remove the index of item. Must be called before the folder directory
+   is removed or its messages are renumbered. */
+void body_index_remove_all(FolderItem *item)
+{
+	GSList *cur, *next;
+	gchar *path, *file;
+
+	g_return_if_fail(item != NULL);
+
+	S_LOCK(body_index);
+
+	for (cur = index_cache; cur != NULL; cur = next) {
+		BodyIndex *index = (BodyIndex *)cur->data;
+
+		next = cur->next;
+		if (index->item == item) {
+			body_index_free(index);
+			index_cache = g_slist_delete_link(index_cache, cur);
+		}
+	}
+
+	path = folder_item_get_path(item);
+	if (path) {
+		file = g_strconcat(path, G_DIR_SEPARATOR_S, BODY_INDEX_FILE,
+				   NULL);
+		if (is_file_exist(file) && g_unlink(file) < 0)
+			FILE_OP_ERROR(file, "unlink");
+		g_free(file);
+		g_free(path);
+	}
+
+	S_UNLOCK(body_index);
+}
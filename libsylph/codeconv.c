@@ -53,6 +53,9 @@ typedef enum
 } JISState;
 
 #define SUBST_CHAR	'_'
+
+#define CONV_ICONV_CACHE_SIZE	4
+#define CONV_MAX_PENDING_LINE	65536
 #define ESC		'\033'
 #define SO		0x0e
 #define SI		0x0f
@@ -183,6 +186,13 @@ static gchar *conv_anytodisp(const gchar *inbuf, gint *error);
 static gchar *conv_ustodisp(const gchar *inbuf, gint *error);
 static gchar *conv_noconv(const gchar *inbuf, gint *error);
 
+static iconv_t conv_iconv_get(const gchar *dest_code, const gchar *src_code);
+static void conv_iconv_put(iconv_t cd, const gchar *dest_code,
+			   const gchar *src_code);
+static gint conv_iconv_convert_buf(iconv_t cd, const gchar *inbuf,
+				   size_t in_size, GString *out,
+				   gboolean partial, size_t *rest);
+
 static gchar *conv_jistoeuc(const gchar *inbuf, gint *error)
 {
 	gchar *outbuf;
@@ -1359,26 +1369,216 @@ CodeConverter *conv_code_converter_new(const gchar *src_encoding,
 		conv_get_code_conv_func(src_encoding, dest_encoding);
 	conv->src_encoding = g_strdup(src_encoding);
 	conv->dest_encoding = g_strdup(dest_encoding);
+	conv->cd = (iconv_t)-1;
+	conv->cd_failed = FALSE;
+	conv->pending = NULL;
 
 	return conv;
 }
 
 void conv_code_converter_destroy(CodeConverter *conv)
 {
+	if (conv->cd != (iconv_t)-1)
+		conv_iconv_put(conv->cd, conv->dest_encoding,
+			       conv->src_encoding);
+	if (conv->pending)
+		g_string_free(conv->pending, TRUE);
 	g_free(conv->src_encoding);
 	g_free(conv->dest_encoding);
 	g_free(conv);
 }
 
+static iconv_t conv_code_converter_get_cd(CodeConverter *conv)
+{
+	if (conv->cd == (iconv_t)-1 && !conv->cd_failed) {
+		conv->cd = conv_iconv_get(conv->dest_encoding,
+					  conv->src_encoding);
+		if (conv->cd == (iconv_t)-1)
+			conv->cd_failed = TRUE;
+	}
+
+	return conv->cd;
+}
+
 gchar *conv_convert(CodeConverter *conv, const gchar *inbuf)
 {
+	iconv_t cd;
+
 	if (!inbuf)
 		return NULL;
 	else if (conv->code_conv_func != conv_noconv)
 		return conv->code_conv_func(inbuf, NULL);
-	else
-		return conv_iconv_strdup
-			(inbuf, conv->src_encoding, conv->dest_encoding, NULL);
+
+	cd = conv_code_converter_get_cd(conv);
+	if (cd == (iconv_t)-1)
+		return NULL;
+
+	return conv_iconv_strdup_with_cd(inbuf, cd, NULL);
+}
+
+/* Converts a part of a stream.  Unlike conv_convert(), the input doesn't
+   have to end at a character boundary: an incomplete multibyte sequence
+   at the end of inbuf is kept in the converter and is converted with the
+   next chunk.  The converters which are not based on iconv work on whole
+   lines, so a partial line is kept as well.  Call conv_convert_finish()
+   after the last chunk.
+   Returns NULL if the conversion is not available. */
+gchar *conv_convert_chunk(CodeConverter *conv, const gchar *inbuf, gint len,
+			  gint *error)
+{
+	GString *out;
+	iconv_t cd;
+	size_t rest = 0;
+	gint error_ = 0;
+
+	g_return_val_if_fail(conv != NULL, NULL);
+	g_return_val_if_fail(inbuf != NULL, NULL);
+
+	if (len < 0)
+		len = strlen(inbuf);
+	if (error)
+		*error = 0;
+
+	if (!conv->pending)
+		conv->pending = g_string_new(NULL);
+
+	if (conv->code_conv_func != conv_noconv) {
+		gchar *str;
+		gchar *ret;
+		gint n;
+
+		g_string_append_len(conv->pending, inbuf, len);
+		for (n = conv->pending->len; n > 0; n--) {
+			if (conv->pending->str[n - 1] == '\n')
+				break;
+		}
+		if (n == 0) {
+			if (conv->pending->len < CONV_MAX_PENDING_LINE)
+				return g_strdup("");
+			n = conv->pending->len;
+		}
+
+		str = g_strndup(conv->pending->str, n);
+		g_string_erase(conv->pending, 0, n);
+		ret = conv->code_conv_func(str, error);
+		g_free(str);
+		return ret;
+	}
+
+	cd = conv_code_converter_get_cd(conv);
+	if (cd == (iconv_t)-1) {
+		if (error)
+			*error = -1;
+		return NULL;
+	}
+
+	out = g_string_sized_new(len * 2 + 16);
+
+	if (conv->pending->len > 0) {
+		g_string_append_len(conv->pending, inbuf, len);
+		error_ = conv_iconv_convert_buf(cd, conv->pending->str,
+						conv->pending->len, out,
+						TRUE, &rest);
+		g_string_erase(conv->pending, 0, conv->pending->len - rest);
+	} else {
+		error_ = conv_iconv_convert_buf(cd, inbuf, len, out,
+						TRUE, &rest);
+		if (rest > 0)
+			g_string_append_len(conv->pending,
+					    inbuf + len - rest, rest);
+	}
+
+	if (error)
+		*error = error_;
+
+	return g_string_free(out, FALSE);
+}
+
+/* Converts the data kept by conv_convert_chunk() and puts the converter
+   back in its initial state. */
+gchar *conv_convert_finish(CodeConverter *conv, gint *error)
+{
+	GString *out;
+	iconv_t cd;
+	gint error_ = 0;
+
+	g_return_val_if_fail(conv != NULL, NULL);
+
+	if (error)
+		*error = 0;
+
+	if (conv->code_conv_func != conv_noconv) {
+		gchar *ret;
+
+		if (!conv->pending || conv->pending->len == 0)
+			return g_strdup("");
+		ret = conv->code_conv_func(conv->pending->str, error);
+		g_string_truncate(conv->pending, 0);
+		return ret;
+	}
+
+	cd = conv_code_converter_get_cd(conv);
+	if (cd == (iconv_t)-1) {
+		if (error)
+			*error = -1;
+		return NULL;
+	}
+
+	out = g_string_new(NULL);
+
+	if (conv->pending && conv->pending->len > 0) {
+		/* incomplete multibyte sequence at the end of the stream */
+		error_ = conv_iconv_convert_buf(cd, conv->pending->str,
+						conv->pending->len, out,
+						FALSE, NULL);
+		g_string_truncate(conv->pending, 0);
+	}
+	if (conv_iconv_convert_buf(cd, NULL, 0, out, FALSE, NULL) < 0)
+		error_ = -1;
+
+	if (error)
+		*error = error_;
+
+	return g_string_free(out, FALSE);
+}
+
+/* Converts the whole contents of infp to outfp in chunks.  If the
+   conversion is not available, the data is copied as is and -1 is
+   returned. */
+gint conv_convert_file(CodeConverter *conv, FILE *infp, FILE *outfp)
+{
+	gchar buf[BUFFSIZE];
+	gchar *str;
+	size_t n_read;
+	gint ret = 0;
+
+	g_return_val_if_fail(conv != NULL, -1);
+	g_return_val_if_fail(infp != NULL, -1);
+	g_return_val_if_fail(outfp != NULL, -1);
+
+	while ((n_read = fread(buf, 1, sizeof(buf), infp)) > 0) {
+		str = conv_convert_chunk(conv, buf, n_read, NULL);
+		if (str) {
+			fputs(str, outfp);
+			g_free(str);
+		} else {
+			ret = -1;
+			fwrite(buf, 1, n_read, outfp);
+		}
+	}
+
+	str = conv_convert_finish(conv, NULL);
+	if (str) {
+		fputs(str, outfp);
+		g_free(str);
+	}
+
+	if (ferror(infp)) {
+		FILE_OP_ERROR("conv_convert_file", "fread");
+		ret = -1;
+	}
+
+	return ret;
 }
 
 gchar *conv_codeset_strdup_full(const gchar *inbuf,
@@ -1501,19 +1701,138 @@ CodeConvFunc conv_get_code_conv_func(const gchar *src_encoding,
 	return code_conv;
 }
 
-gchar *conv_iconv_strdup(const gchar *inbuf,
-			 const gchar *src_code, const gchar *dest_code,
-			 gint *error)
+/* Cache of iconv descriptors keyed by the pair of encodings.  A
+   descriptor holds the shift state of the conversion, so each one is used
+   by a single caller at a time: conv_iconv_get() takes an idle descriptor
+   out of the cache (or opens a new one), and conv_iconv_put() resets it
+   and gives it back. */
+
+typedef struct _ConvIconvEntry
 {
-	iconv_t cd;
-	gchar *outbuf;
+	GSList *cd_list;
+	gboolean unavailable;
+} ConvIconvEntry;
+
+static GHashTable *conv_iconv_table = NULL;
+S_LOCK_DEFINE_STATIC(conv_iconv);
+
+static gchar *conv_iconv_get_key(const gchar *dest_code, const gchar *src_code)
+{
+	gchar *str;
+	gchar *key;
+
+	str = g_strconcat(dest_code, "\n", src_code, NULL);
+	key = g_ascii_strup(str, -1);
+	g_free(str);
+
+	return key;
+}
+
+static iconv_t conv_iconv_get(const gchar *dest_code, const gchar *src_code)
+{
+	ConvIconvEntry *entry;
+	gchar *key;
+	iconv_t cd = (iconv_t)-1;
 
 	if (!src_code)
 		src_code = conv_get_locale_charset_str();
 	if (!dest_code)
 		dest_code = CS_INTERNAL;
 
+	key = conv_iconv_get_key(dest_code, src_code);
+
+	S_LOCK(conv_iconv);
+
+	if (!conv_iconv_table)
+		conv_iconv_table = g_hash_table_new(g_str_hash, g_str_equal);
+
+	entry = g_hash_table_lookup(conv_iconv_table, key);
+	if (entry) {
+		if (entry->unavailable) {
+			S_UNLOCK(conv_iconv);
+			g_free(key);
+			return (iconv_t)-1;
+		}
+		if (entry->cd_list) {
+			cd = (iconv_t)entry->cd_list->data;
+			entry->cd_list = g_slist_delete_link(entry->cd_list,
+							     entry->cd_list);
+			S_UNLOCK(conv_iconv);
+			g_free(key);
+			return cd;
+		}
+	}
+
+	S_UNLOCK(conv_iconv);
+
 	cd = iconv_open(dest_code, src_code);
+
+	if (cd == (iconv_t)-1) {
+		S_LOCK(conv_iconv);
+		entry = g_hash_table_lookup(conv_iconv_table, key);
+		if (!entry) {
+			entry = g_new0(ConvIconvEntry, 1);
+			g_hash_table_insert(conv_iconv_table, key, entry);
+			key = NULL;
+		}
+		entry->unavailable = TRUE;
+		S_UNLOCK(conv_iconv);
+		debug_print("conv_iconv_get: cannot convert from %s to %s\n",
+			    src_code, dest_code);
+	}
+
+	g_free(key);
+
+	return cd;
+}
+
+static void conv_iconv_put(iconv_t cd, const gchar *dest_code,
+			   const gchar *src_code)
+{
+	ConvIconvEntry *entry;
+	gchar *key;
+
+	if (cd == (iconv_t)-1)
+		return;
+
+	if (!src_code)
+		src_code = conv_get_locale_charset_str();
+	if (!dest_code)
+		dest_code = CS_INTERNAL;
+
+	/* return to the initial shift state */
+	iconv(cd, NULL, NULL, NULL, NULL);
+
+	key = conv_iconv_get_key(dest_code, src_code);
+
+	S_LOCK(conv_iconv);
+
+	entry = g_hash_table_lookup(conv_iconv_table, key);
+	if (!entry) {
+		entry = g_new0(ConvIconvEntry, 1);
+		g_hash_table_insert(conv_iconv_table, key, entry);
+		key = NULL;
+	}
+	if (g_slist_length(entry->cd_list) < CONV_ICONV_CACHE_SIZE) {
+		entry->cd_list = g_slist_prepend(entry->cd_list, (gpointer)cd);
+		cd = (iconv_t)-1;
+	}
+
+	S_UNLOCK(conv_iconv);
+
+	if (cd != (iconv_t)-1)
+		iconv_close(cd);
+	g_free(key);
+}
+
+gchar *conv_iconv_strdup(const gchar *inbuf,
+			 const gchar *src_code, const gchar *dest_code,
+			 gint *error)
+{
+	iconv_t cd;
+	gchar *outbuf;
+
+	cd = conv_iconv_get(dest_code, src_code);
 	if (cd == (iconv_t)-1) {
 		if (error)
 			*error = -1;
@@ -1522,46 +1841,87 @@ gchar *conv_iconv_strdup(const gchar *inbuf,
 
 	outbuf = conv_iconv_strdup_with_cd(inbuf, cd, error);
 
-	iconv_close(cd);
+	conv_iconv_put(cd, dest_code, src_code);
 
 	return outbuf;
 }
 
 gchar *conv_iconv_strdup_with_cd(const gchar *inbuf, iconv_t cd, gint *error)
+{
+	GString *out;
+	size_t in_size;
+	gint error_;
+
+	if (!inbuf) {
+		if (error)
+			*error = 0;
+		return NULL;
+	}
+
+	in_size = strlen(inbuf);
+	out = g_string_sized_new((in_size + 1) * 2);
+
+	error_ = conv_iconv_convert_buf(cd, inbuf, in_size, out, FALSE, NULL);
+	if (conv_iconv_convert_buf(cd, NULL, 0, out, FALSE, NULL) < 0)
+		error_ = -1;
+
+	if (error)
+		*error = error_;
+
+	return g_string_free(out, FALSE);
+}
+
+/* Appends the conversion of in_size bytes of inbuf to out.  If inbuf is
+   NULL, the sequence to return to the initial shift state is appended.
+   If partial is TRUE, an incomplete multibyte sequence at the end of
+   inbuf is not an error: it is left unconverted and its length is
+   returned in *rest. */
+static gint conv_iconv_convert_buf(iconv_t cd, const gchar *inbuf,
+				   size_t in_size, GString *out,
+				   gboolean partial, size_t *rest)
 {
 	const gchar *inbuf_p;
-	gchar *outbuf;
 	gchar *outbuf_p;
-	size_t in_size;
 	size_t in_left;
-	size_t out_size;
 	size_t out_left;
-	size_t n_conv;
 	size_t len;
+	size_t n_conv;
 	gint error_ = 0;
 
+	if (rest)
+		*rest = 0;
+
+	len = out->len;
+	g_string_set_size(out, len + (in_size + 1) * 2);
+	outbuf_p = out->str + len;
+	out_left = out->len - len;
+
+#define EXPAND_BUF()					\
+{							\
+	len = outbuf_p - out->str;			\
+	g_string_set_size(out, out->len * 2);		\
+	outbuf_p = out->str + len;			\
+	out_left = out->len - len;			\
+}
+
 	if (!inbuf) {
-		if (error)
-			*error = 0;
-		return NULL;
+		while ((n_conv = iconv(cd, NULL, NULL, &outbuf_p, &out_left))
+		       == (size_t)-1) {
+			if (E2BIG == errno) {
+				EXPAND_BUF();
+			} else {
+				g_warning("conv_iconv_convert_buf(): %s\n",
+					  g_strerror(errno));
+				error_ = -1;
+				break;
+			}
+		}
+		g_string_truncate(out, outbuf_p - out->str);
+		return error_;
 	}
 
 	inbuf_p = inbuf;
-	in_size = strlen(inbuf);
 	in_left = in_size;
-	out_size = (in_size + 1) * 2;
-	outbuf = g_malloc(out_size);
-	outbuf_p = outbuf;
-	out_left = out_size;
-
-#define EXPAND_BUF()				\
-{						\
-	len = outbuf_p - outbuf;		\
-	out_size *= 2;				\
-	outbuf = g_realloc(outbuf, out_size);	\
-	outbuf_p = outbuf + len;		\
-	out_left = out_size - len;		\
-}
 
 	while ((n_conv = iconv(cd, (ICONV_CONST gchar **)&inbuf_p, &in_left,
 			       &outbuf_p, &out_left)) == (size_t)-1) {
@@ -1576,24 +1936,15 @@ gchar *conv_iconv_strdup_with_cd(const gchar *inbuf, iconv_t cd, gint *error)
 			*outbuf_p++ = SUBST_CHAR;
 			out_left--;
 		} else if (EINVAL == errno) {
-			error_ = -1;
+			if (partial && rest)
+				*rest = in_left;
+			else
+				error_ = -1;
 			break;
 		} else if (E2BIG == errno) {
 			EXPAND_BUF();
 		} else {
-			g_warning("conv_iconv_strdup(): %s\n",
-				  g_strerror(errno));
-			error_ = -1;
-			break;
-		}
-	}
-
-	while ((n_conv = iconv(cd, NULL, NULL, &outbuf_p, &out_left)) ==
-	       (size_t)-1) {
-		if (E2BIG == errno) {
-			EXPAND_BUF();
-		} else {
-			g_warning("conv_iconv_strdup(): %s\n",
+			g_warning("conv_iconv_convert_buf(): %s\n",
 				  g_strerror(errno));
 			error_ = -1;
 			break;
@@ -1602,14 +1953,9 @@ gchar *conv_iconv_strdup_with_cd(const gchar *inbuf, iconv_t cd, gint *error)
 
 #undef EXPAND_BUF
 
-	len = outbuf_p - outbuf;
-	outbuf = g_realloc(outbuf, len + 1);
-	outbuf[len] = '\0';
-
-	if (error)
-		*error = error_;
+	g_string_truncate(out, outbuf_p - out->str);
 
-	return outbuf;
+	return error_;
 }
 
 static const struct {
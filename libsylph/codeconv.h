@@ -25,6 +25,7 @@
 #endif
 
 #include <glib.h>
+#include <stdio.h>
 #include <iconv.h>
 
 typedef struct _CodeConverter	CodeConverter;
@@ -109,6 +110,10 @@ struct _CodeConverter
 	CodeConvFunc code_conv_func;
 	gchar *src_encoding;
 	gchar *dest_encoding;
+
+	iconv_t cd;
+	gboolean cd_failed;
+	GString *pending;
 };
 
 #define CS_AUTO			"AUTO"
@@ -198,6 +203,15 @@ CodeConverter *conv_code_converter_new	(const gchar	*src_encoding,
 void conv_code_converter_destroy	(CodeConverter	*conv);
 gchar *conv_convert			(CodeConverter	*conv,
 					 const gchar	*inbuf);
+gchar *conv_convert_chunk		(CodeConverter	*conv,
+					 const gchar	*inbuf,
+					 gint		 len,
+					 gint		*error);
+gchar *conv_convert_finish		(CodeConverter	*conv,
+					 gint		*error);
+gint conv_convert_file			(CodeConverter	*conv,
+					 FILE		*infp,
+					 FILE		*outfp);
 
 #define conv_codeset_strdup(inbuf, src_code, dest_code) \
 	(conv_codeset_strdup_full(inbuf, src_code, dest_code, NULL))
@@ -80,9 +80,16 @@
 #define CACHE_FILE		".sylpheed_cache"
 #define MARK_FILE		".sylpheed_mark"
 #define SEARCH_CACHE		"search_cache"
+#define SEARCH_RESULT		"search_result"
+#define BODY_INDEX_FILE		".sylpheed_body_index"
+#define THREAD_INDEX_FILE	".sylpheed_thread"
 #define CACHE_VERSION		0x21
+#define CACHE_COLUMN_VERSION	0x23
 #define MARK_VERSION		2
 #define SEARCH_CACHE_VERSION	1
+#define SEARCH_RESULT_VERSION	2
+#define BODY_INDEX_VERSION	2
+#define THREAD_INDEX_VERSION	1
 
 #ifdef G_OS_WIN32
 #  define REMOTE_CMD_PORT	50215
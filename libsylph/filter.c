@@ -29,6 +29,14 @@
 #include <strings.h>
 #include <stdlib.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#ifndef G_OS_WIN32
+#  include <sys/wait.h>
+#  include <sys/time.h>
+#  include <unistd.h>
+#  include <signal.h>
+#  include <errno.h>
+#endif
 #if USE_ONIGURUMA
 #  include <onigposix.h>
 #elif HAVE_REGEX_H
@@ -37,10 +45,13 @@
 #include <time.h>
 
 #include "filter.h"
+#include "bodyindex.h"
 #include "procmsg.h"
 #include "procheader.h"
+#include "procmime.h"
 #include "folder.h"
 #include "utils.h"
+#include "socket.h"
 #include "xml.h"
 #include "prefs.h"
 #include "prefs_common.h"
@@ -54,19 +65,122 @@ typedef enum
 	FLT_O_REGEX	= 1 << 2
 } FilterOldFlag;
 
+#if USE_THREADS
+#define S_LOCK_DEFINE_STATIC(name)	G_LOCK_DEFINE_STATIC(name)
+#define S_LOCK(name)	G_LOCK(name)
+#define S_UNLOCK(name)	G_UNLOCK(name)
+#else
+#define S_LOCK_DEFINE_STATIC(name)
+#define S_LOCK(name)
+#define S_UNLOCK(name)
+#endif
+
+/* Aho-Corasick automaton over case-folded needles */
+typedef struct _FilterACMachine
+{
+	gint n_needles;
+	gint n_nodes;
+	gint n_classes;
+	guchar byte_class[256];
+	gint *delta;
+	gint *out;
+	gint *dict;
+} FilterACMachine;
+
+/* evaluates the header conditions of a whole rule list in one pass over
+   the header list */
+typedef struct _FilterEngine
+{
+	GSList *fltlist;
+	guint serial;
+	GPtrArray *rules;
+
+	GPtrArray *conds;		/* header conditions (index = slot) */
+	GHashTable *slot_table;		/* FilterCond -> slot + 1 */
+	GHashTable *name_table;		/* lowercased header name -> slots */
+	GSList *any_slots;		/* slots matching any header */
+	gint *needle;			/* slot -> needle index or -1 */
+
+	FilterACMachine *ac;
+
+	/* per-message state */
+	gboolean *hit;
+	guint *found;
+	guint stamp;
+} FilterEngine;
+
+#define FILTER_ENGINE_CACHE_SIZE	4
+
+static GSList *engine_cache = NULL;
+S_LOCK_DEFINE_STATIC(engine_cache);
+
+static gint filter_serial = 0;
+
 static FilterInAddressBookFunc default_addrbook_func = NULL;
 
+/* The data of a message which are parsed or decoded on demand while the
+   filter rules are evaluated against it. */
+struct _FilterMsgContext
+{
+	MsgInfo *msginfo;
+
+	GSList *hlist;
+	MimeInfo *mimeinfo;
+
+	/* lines of each decoded text part (gchar **) */
+	GPtrArray *text_parts;
+};
+
+static FilterMsgContext *filter_msg_context_get	(FilterInfo	*fltinfo,
+						 MsgInfo	*msginfo);
+static void filter_msg_context_free		(FilterMsgContext *ctx);
+static GSList *filter_msg_context_get_header_list
+						(FilterMsgContext *ctx);
+static GPtrArray *filter_msg_context_get_text_parts
+						(FilterMsgContext *ctx);
+
+#ifndef G_OS_WIN32
+/* long-lived junk classifier (prefs_common.junk_classify_batch_cmd) */
+typedef struct _FilterJunkClassifier
+{
+	GPid pid;
+	gint in_fd;
+	gint out_fd;
+	GString *buf;
+} FilterJunkClassifier;
+
+static FilterJunkClassifier *junk_classifier = NULL;
+static gboolean junk_classifier_disabled = FALSE;
+
+static gint filter_junk_classifier_classify	(const gchar	*file);
+#endif
+
+static FilterEngine *filter_engine_get	(GSList		*fltlist);
+static void filter_engine_release	(FilterEngine	*engine);
+static void filter_engine_match_headers	(FilterEngine	*engine,
+					 GSList		*hlist);
+
+static gboolean filter_match_rule_real	(FilterRule	*rule,
+					 MsgInfo	*msginfo,
+					 GSList		*hlist,
+					 FilterInfo	*fltinfo,
+					 FilterEngine	*engine);
 static gboolean filter_match_cond	(FilterCond	*cond,
 					 MsgInfo	*msginfo,
 					 GSList		*hlist,
-					 FilterInfo	*fltinfo);
+					 FilterInfo	*fltinfo,
+					 FilterEngine	*engine);
 static gboolean filter_match_header_cond(FilterCond	*cond,
-					 GSList		*hlist);
+					 GSList		*hlist,
+					 FilterEngine	*engine);
+static gboolean filter_match_cond_str	(FilterCond	*cond,
+					 const gchar	*str);
 static gboolean filter_match_in_addressbook
 					(FilterCond	*cond,
 					 GSList		*hlist,
 					 FilterInfo	*fltinfo);
 
+static void filter_cond_compile		(FilterCond	*cond);
 static void filter_cond_free		(FilterCond	*cond);
 static void filter_action_free		(FilterAction	*action);
 
@@ -74,6 +188,9 @@ static void filter_action_free		(FilterAction	*action);
 gint filter_apply(GSList *fltlist, const gchar *file, FilterInfo *fltinfo)
 {
 	MsgInfo *msginfo;
+	FilterMsgContext *ctx;
+	struct stat s;
+	FILE *fp;
 	gint ret = 0;
 
 	g_return_val_if_fail(file != NULL, -1);
@@ -81,10 +198,32 @@ gint filter_apply(GSList *fltlist, const gchar *file, FilterInfo *fltinfo)
 
 	if (!fltlist) return 0;
 
-	msginfo = procheader_parse_file(file, fltinfo->flags, FALSE);
-	if (!msginfo) return 0;
+	/* parse the header once for both MsgInfo and the header list */
+	if (g_stat(file, &s) < 0) {
+		FILE_OP_ERROR(file, "stat");
+		return 0;
+	}
+	if (!S_ISREG(s.st_mode))
+		return 0;
+	if ((fp = g_fopen(file, "rb")) == NULL) {
+		FILE_OP_ERROR(file, "fopen");
+		return 0;
+	}
+
+	msginfo = procheader_parse_stream(fp, fltinfo->flags, FALSE);
+	if (!msginfo) {
+		fclose(fp);
+		return 0;
+	}
+	msginfo->size = s.st_size;
+	msginfo->mtime = s.st_mtime;
 	msginfo->file_path = g_strdup(file);
 
+	ctx = filter_msg_context_get(fltinfo, msginfo);
+	rewind(fp);
+	ctx->hlist = procheader_get_header_list(fp);
+	fclose(fp);
+
 	/* inherit MIME flag */
 	fltinfo->flags.tmp_flags =
 		(fltinfo->flags.tmp_flags & ~MSG_CACHED_FLAG_MASK) |
@@ -92,6 +231,9 @@ gint filter_apply(GSList *fltlist, const gchar *file, FilterInfo *fltinfo)
 
 	ret = filter_apply_msginfo(fltlist, msginfo, fltinfo);
 
+	/* msginfo is freed here */
+	filter_msg_context_free(fltinfo->msg_ctx);
+	fltinfo->msg_ctx = NULL;
 	procmsg_msginfo_free(msginfo);
 
 	return ret;
@@ -103,6 +245,7 @@ gint filter_apply_msginfo(GSList *fltlist, MsgInfo *msginfo,
 	gchar *file;
 	GSList *hlist, *cur;
 	FilterRule *rule;
+	FilterEngine *engine;
 	gint ret = 0;
 
 	g_return_val_if_fail(msginfo != NULL, -1);
@@ -115,7 +258,8 @@ gint filter_apply_msginfo(GSList *fltlist, MsgInfo *msginfo,
 	file = procmsg_get_message_file(msginfo);
 	if (!file)
 		return -1;
-	hlist = procheader_get_header_list_from_file(file);
+	hlist = filter_msg_context_get_header_list
+		(filter_msg_context_get(fltinfo, msginfo));
 	if (!hlist) {
 		g_free(file);
 		return 0;
@@ -123,12 +267,16 @@ gint filter_apply_msginfo(GSList *fltlist, MsgInfo *msginfo,
 
 	procmsg_set_auto_decrypt_message(FALSE);
 
+	engine = filter_engine_get(fltlist);
+	filter_engine_match_headers(engine, hlist);
+
 	for (cur = fltlist; cur != NULL; cur = cur->next) {
 		gboolean matched;
 
 		rule = (FilterRule *)cur->data;
 		if (!rule->enabled) continue;
-		matched = filter_match_rule(rule, msginfo, hlist, fltinfo);
+		matched = filter_match_rule_real(rule, msginfo, hlist, fltinfo,
+						 engine);
 		if (fltinfo->error != FLT_ERROR_OK) {
 			g_warning("filter_match_rule() returned error (code: %d)\n", fltinfo->error);
 		}
@@ -146,9 +294,10 @@ gint filter_apply_msginfo(GSList *fltlist, MsgInfo *msginfo,
 		}
 	}
 
+	filter_engine_release(engine);
+
 	procmsg_set_auto_decrypt_message(TRUE);
 
-	procheader_header_list_destroy(hlist);
 	g_free(file);
 
 	return ret;
@@ -356,8 +505,435 @@ static gboolean strmatch_regex(const gchar *haystack, const gchar *needle)
 		return FALSE;
 }
 
+static gboolean str_case_find_folded(const gchar *haystack,
+				     const gchar *needle, gint needle_len)
+{
+	const gchar *p;
+	gchar lc, uc;
+
+	lc = needle[0];
+	uc = g_ascii_toupper(lc);
+
+	for (p = haystack; *p != '\0'; p++) {
+		if ((*p == lc || *p == uc) &&
+		    !g_ascii_strncasecmp(p + 1, needle + 1, needle_len - 1))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+static gboolean filter_match_cond_str(FilterCond *cond, const gchar *str)
+{
+	if (cond->match_type == FLT_REGEX) {
+#if defined(USE_ONIGURUMA) || defined(HAVE_REGCOMP)
+		if (cond->preg &&
+		    regexec((regex_t *)cond->preg, str, 0, NULL, 0) == 0)
+			return TRUE;
+#endif
+		return FALSE;
+	}
+
+	if (cond->str_key)
+		return str_case_find_folded(str, cond->str_key,
+					    cond->str_key_len);
+
+	return cond->match_func(str, cond->str_value);
+}
+
+static gboolean filter_match_cond_str_func(const gchar *str, gpointer data)
+{
+	return filter_match_cond_str((FilterCond *)data, str);
+}
+
+static gboolean filter_match_header_name(FilterCond *cond, const gchar *name)
+{
+	if (!cond->header_key)
+		return TRUE;
+
+	return (!g_ascii_strncasecmp(name, cond->header_key,
+				     cond->header_key_len) &&
+		name[cond->header_key_len] == '\0');
+}
+
+static FilterACMachine *filter_ac_new(GPtrArray *needles)
+{
+	FilterACMachine *ac;
+	gint max_nodes = 1;
+	gint nc;
+	gint *fail;
+	gint *queue;
+	gint qhead = 0, qtail = 0;
+	gint i, c;
+
+	ac = g_new0(FilterACMachine, 1);
+	ac->n_needles = needles->len;
+
+	/* map every byte that appears in a needle to its own class, and
+	   the upper case letters to the class of their lower case ones */
+	nc = 1;
+	for (i = 0; i < needles->len; i++) {
+		const guchar *p = g_ptr_array_index(needles, i);
+
+		for (; *p != '\0'; p++, max_nodes++) {
+			if (ac->byte_class[*p] == 0)
+				ac->byte_class[*p] = nc++;
+		}
+	}
+	for (c = 'a'; c <= 'z'; c++)
+		ac->byte_class[(guchar)g_ascii_toupper(c)] = ac->byte_class[c];
+	ac->n_classes = nc;
+
+	ac->delta = g_new(gint, max_nodes * nc);
+	for (i = 0; i < max_nodes * nc; i++)
+		ac->delta[i] = -1;
+	ac->out = g_new(gint, max_nodes);
+	ac->dict = g_new(gint, max_nodes);
+	for (i = 0; i < max_nodes; i++) {
+		ac->out[i] = -1;
+		ac->dict[i] = -1;
+	}
+	ac->n_nodes = 1;
+
+	/* build the trie */
+	for (i = 0; i < needles->len; i++) {
+		const guchar *p = g_ptr_array_index(needles, i);
+		gint node = 0;
+
+		for (; *p != '\0'; p++) {
+			gint *next = &ac->delta[node * nc + ac->byte_class[*p]];
+
+			if (*next < 0)
+				*next = ac->n_nodes++;
+			node = *next;
+		}
+		ac->out[node] = i;
+	}
+
+	/* compute failure links breadth-first and turn the trie into a DFA */
+	fail = g_new0(gint, ac->n_nodes);
+	queue = g_new(gint, ac->n_nodes);
+	queue[qtail++] = 0;
+
+	while (qhead < qtail) {
+		gint u = queue[qhead++];
+
+		for (c = 0; c < nc; c++) {
+			gint v = ac->delta[u * nc + c];
+
+			if (v < 0) {
+				ac->delta[u * nc + c] =
+					u == 0 ? 0 : ac->delta[fail[u] * nc + c];
+				continue;
+			}
+
+			fail[v] = u == 0 ? 0 : ac->delta[fail[u] * nc + c];
+			ac->dict[v] = ac->out[fail[v]] >= 0 ? fail[v]
+				: ac->dict[fail[v]];
+			queue[qtail++] = v;
+		}
+	}
+
+	g_free(queue);
+	g_free(fail);
+
+	return ac;
+}
+
+static void filter_ac_free(FilterACMachine *ac)
+{
+	if (!ac)
+		return;
+
+	g_free(ac->dict);
+	g_free(ac->out);
+	g_free(ac->delta);
+	g_free(ac);
+}
+
+/* mark found[n] with stamp for every needle n that occurs in str */
+static void filter_ac_scan(FilterACMachine *ac, const gchar *str,
+			   guint *found, guint stamp)
+{
+	const guchar *p;
+	gint state = 0;
+	gint n;
+
+	for (p = (const guchar *)str; *p != '\0'; p++) {
+		state = ac->delta[state * ac->n_classes + ac->byte_class[*p]];
+		for (n = ac->out[state] >= 0 ? state : ac->dict[state]; n >= 0;
+		     n = ac->dict[n])
+			found[ac->out[n]] = stamp;
+	}
+}
+
+static void filter_engine_add_slot(FilterEngine *engine, const gchar *name,
+				   gint slot)
+{
+	GSList *slots;
+
+	if (!name) {
+		engine->any_slots = g_slist_prepend(engine->any_slots,
+						    GINT_TO_POINTER(slot));
+		return;
+	}
+
+	slots = g_hash_table_lookup(engine->name_table, name);
+	if (slots)
+		g_slist_append(slots, GINT_TO_POINTER(slot));
+	else
+		g_hash_table_insert(engine->name_table, g_strdup(name),
+				    g_slist_append(NULL, GINT_TO_POINTER(slot)));
+}
+
+static FilterEngine *filter_engine_new(GSList *fltlist)
+{
+	FilterEngine *engine;
+	GHashTable *needle_table;
+	GPtrArray *needles;
+	GSList *cur, *cur_cond;
+	gint slot;
+
+	engine = g_new0(FilterEngine, 1);
+	engine->fltlist = fltlist;
+	engine->serial = g_atomic_int_get(&filter_serial);
+	engine->rules = g_ptr_array_new();
+	engine->conds = g_ptr_array_new();
+	engine->slot_table = g_hash_table_new(NULL, NULL);
+	engine->name_table = g_hash_table_new(g_str_hash, g_str_equal);
+
+	needle_table = g_hash_table_new(g_str_hash, g_str_equal);
+	needles = g_ptr_array_new();
+
+	for (cur = fltlist; cur != NULL; cur = cur->next) {
+		FilterRule *rule = (FilterRule *)cur->data;
+
+		g_ptr_array_add(engine->rules, rule);
+
+		for (cur_cond = rule->cond_list; cur_cond != NULL;
+		     cur_cond = cur_cond->next) {
+			FilterCond *cond = (FilterCond *)cur_cond->data;
+
+			if (cond->type != FLT_COND_HEADER &&
+			    cond->type != FLT_COND_ANY_HEADER &&
+			    cond->type != FLT_COND_TO_OR_CC)
+				continue;
+			if (cond->match_type == FLT_IN_ADDRESSBOOK)
+				continue;
+			if (g_hash_table_lookup(engine->slot_table, cond))
+				continue;
+
+			slot = engine->conds->len;
+			g_ptr_array_add(engine->conds, cond);
+			g_hash_table_insert(engine->slot_table, cond,
+					    GINT_TO_POINTER(slot + 1));
+
+			if (cond->type == FLT_COND_HEADER)
+				filter_engine_add_slot(engine, cond->header_key,
+						       slot);
+			else if (cond->type == FLT_COND_TO_OR_CC) {
+				filter_engine_add_slot(engine, "to", slot);
+				filter_engine_add_slot(engine, "cc", slot);
+			} else
+				filter_engine_add_slot(engine, NULL, slot);
+		}
+	}
+
+	engine->needle = g_new(gint, engine->conds->len + 1);
+	engine->hit = g_new0(gboolean, engine->conds->len + 1);
+
+	/* case-insensitive substring needles are searched at once */
+	for (slot = 0; slot < engine->conds->len; slot++) {
+		FilterCond *cond = g_ptr_array_index(engine->conds, slot);
+		gpointer n;
+
+		engine->needle[slot] = -1;
+		if (!cond->str_key)
+			continue;
+
+		n = g_hash_table_lookup(needle_table, cond->str_key);
+		if (!n) {
+			g_ptr_array_add(needles, cond->str_key);
+			n = GINT_TO_POINTER(needles->len);
+			g_hash_table_insert(needle_table, cond->str_key, n);
+		}
+		engine->needle[slot] = GPOINTER_TO_INT(n) - 1;
+	}
+
+	if (needles->len > 0)
+		engine->ac = filter_ac_new(needles);
+	engine->found = g_new0(guint, needles->len + 1);
+
+	g_ptr_array_free(needles, TRUE);
+	g_hash_table_destroy(needle_table);
+
+	return engine;
+}
+
+static void filter_engine_name_table_free_func(gpointer key, gpointer val,
+					       gpointer data)
+{
+	g_free(key);
+	g_slist_free((GSList *)val);
+}
+
+static void filter_engine_free(FilterEngine *engine)
+{
+	g_hash_table_foreach(engine->name_table,
+			     filter_engine_name_table_free_func, NULL);
+	g_hash_table_destroy(engine->name_table);
+	g_hash_table_destroy(engine->slot_table);
+	g_slist_free(engine->any_slots);
+	g_ptr_array_free(engine->conds, TRUE);
+	g_ptr_array_free(engine->rules, TRUE);
+	filter_ac_free(engine->ac);
+	g_free(engine->found);
+	g_free(engine->hit);
+	g_free(engine->needle);
+	g_free(engine);
+}
+
+static gboolean filter_engine_is_valid(FilterEngine *engine, GSList *fltlist)
+{
+	GSList *cur;
+	gint i = 0;
+
+	if (engine->serial != g_atomic_int_get(&filter_serial))
+		return FALSE;
+
+	for (cur = fltlist; cur != NULL; cur = cur->next, i++) {
+		if (i >= engine->rules->len ||
+		    g_ptr_array_index(engine->rules, i) != cur->data)
+			return FALSE;
+	}
+
+	return i == engine->rules->len;
+}
+
+static FilterEngine *filter_engine_get(GSList *fltlist)
+{
+	FilterEngine *engine = NULL;
+	GSList *cur;
+
+	S_LOCK(engine_cache);
+	for (cur = engine_cache; cur != NULL; cur = cur->next) {
+		engine = (FilterEngine *)cur->data;
+		if (engine->fltlist == fltlist) {
+			engine_cache = g_slist_delete_link(engine_cache, cur);
+			break;
+		}
+		engine = NULL;
+	}
+	S_UNLOCK(engine_cache);
+
+	if (engine && !filter_engine_is_valid(engine, fltlist)) {
+		filter_engine_free(engine);
+		engine = NULL;
+	}
+	if (!engine)
+		engine = filter_engine_new(fltlist);
+
+	return engine;
+}
+
+static void filter_engine_release(FilterEngine *engine)
+{
+	GSList *last;
+
+	S_LOCK(engine_cache);
+	engine_cache = g_slist_prepend(engine_cache, engine);
+	if (g_slist_length(engine_cache) > FILTER_ENGINE_CACHE_SIZE) {
+		last = g_slist_last(engine_cache);
+		filter_engine_free((FilterEngine *)last->data);
+		engine_cache = g_slist_delete_link(engine_cache, last);
+	}
+	S_UNLOCK(engine_cache);
+}
+
+static void filter_engine_match_slots(FilterEngine *engine, GSList *slots,
+				      const gchar *body, gboolean *scanned)
+{
+	GSList *cur;
+
+	for (cur = slots; cur != NULL; cur = cur->next) {
+		gint slot = GPOINTER_TO_INT(cur->data);
+		FilterCond *cond;
+
+		if (engine->hit[slot])
+			continue;
+
+		cond = g_ptr_array_index(engine->conds, slot);
+		if (!cond->str_value)
+			engine->hit[slot] = TRUE;
+		else if (engine->needle[slot] >= 0) {
+			if (!*scanned) {
+				filter_ac_scan(engine->ac, body, engine->found,
+					       ++engine->stamp);
+				*scanned = TRUE;
+			}
+			engine->hit[slot] = (engine->found[engine->needle[slot]]
+					     == engine->stamp);
+		} else
+			engine->hit[slot] = filter_match_cond_str(cond, body);
+	}
+}
+
+/* evaluate the header conditions of all rules in one pass over hlist */
+static void filter_engine_match_headers(FilterEngine *engine, GSList *hlist)
+{
+	GSList *cur;
+	gchar buf[64];
+
+	memset(engine->hit, 0, engine->conds->len * sizeof(gboolean));
+	if (engine->conds->len == 0)
+		return;
+
+	for (cur = hlist; cur != NULL; cur = cur->next) {
+		Header *header = (Header *)cur->data;
+		gboolean scanned = FALSE;
+		GSList *slots;
+		gchar *name;
+		gint i;
+
+		for (i = 0; header->name[i] != '\0' && i < sizeof(buf) - 1; i++)
+			buf[i] = g_ascii_tolower(header->name[i]);
+		buf[i] = '\0';
+		if (header->name[i] != '\0')
+			name = g_ascii_strdown(header->name, -1);
+		else
+			name = buf;
+
+		slots = g_hash_table_lookup(engine->name_table, name);
+		if (name != buf)
+			g_free(name);
+
+		filter_engine_match_slots(engine, slots, header->body,
+					  &scanned);
+		filter_engine_match_slots(engine, engine->any_slots,
+					  header->body, &scanned);
+	}
+}
+
 gboolean filter_match_rule(FilterRule *rule, MsgInfo *msginfo, GSList *hlist,
 			   FilterInfo *fltinfo)
+{
+	gboolean matched;
+
+	if (fltinfo->msg_ctx)
+		return filter_match_rule_real(rule, msginfo, hlist, fltinfo,
+					      NULL);
+
+	/* the caller may not free fltinfo with filter_info_free() */
+	matched = filter_match_rule_real(rule, msginfo, hlist, fltinfo, NULL);
+	filter_msg_context_free(fltinfo->msg_ctx);
+	fltinfo->msg_ctx = NULL;
+
+	return matched;
+}
+
+static gboolean filter_match_rule_real(FilterRule *rule, MsgInfo *msginfo,
+				       GSList *hlist, FilterInfo *fltinfo,
+				       FilterEngine *engine)
 {
 	FilterCond *cond;
 	GSList *cur;
@@ -385,7 +961,7 @@ gboolean filter_match_rule(FilterRule *rule, MsgInfo *msginfo, GSList *hlist,
 			cond = (FilterCond *)cur->data;
 			if (cond->type >= FLT_COND_SIZE_GREATER) {
 				matched = filter_match_cond
-					(cond, msginfo, hlist, fltinfo);
+					(cond, msginfo, hlist, fltinfo, engine);
 				if (matched == FALSE)
 					return FALSE;
 			}
@@ -395,7 +971,7 @@ gboolean filter_match_rule(FilterRule *rule, MsgInfo *msginfo, GSList *hlist,
 			cond = (FilterCond *)cur->data;
 			if (cond->type <= FLT_COND_TO_OR_CC) {
 				matched = filter_match_cond
-					(cond, msginfo, hlist, fltinfo);
+					(cond, msginfo, hlist, fltinfo, engine);
 				if (matched == FALSE)
 					return FALSE;
 			}
@@ -406,7 +982,7 @@ gboolean filter_match_rule(FilterRule *rule, MsgInfo *msginfo, GSList *hlist,
 			if (cond->type == FLT_COND_BODY ||
 			    cond->type == FLT_COND_CMD_TEST) {
 				matched = filter_match_cond
-					(cond, msginfo, hlist, fltinfo);
+					(cond, msginfo, hlist, fltinfo, engine);
 				if (matched == FALSE)
 					return FALSE;
 			}
@@ -418,7 +994,7 @@ gboolean filter_match_rule(FilterRule *rule, MsgInfo *msginfo, GSList *hlist,
 			cond = (FilterCond *)cur->data;
 			if (cond->type >= FLT_COND_SIZE_GREATER) {
 				matched = filter_match_cond
-					(cond, msginfo, hlist, fltinfo);
+					(cond, msginfo, hlist, fltinfo, engine);
 				if (matched == TRUE)
 					return TRUE;
 			}
@@ -428,7 +1004,7 @@ gboolean filter_match_rule(FilterRule *rule, MsgInfo *msginfo, GSList *hlist,
 			cond = (FilterCond *)cur->data;
 			if (cond->type <= FLT_COND_TO_OR_CC) {
 				matched = filter_match_cond
-					(cond, msginfo, hlist, fltinfo);
+					(cond, msginfo, hlist, fltinfo, engine);
 				if (matched == TRUE)
 					return TRUE;
 			}
@@ -439,7 +1015,7 @@ gboolean filter_match_rule(FilterRule *rule, MsgInfo *msginfo, GSList *hlist,
 			if (cond->type == FLT_COND_BODY ||
 			    cond->type == FLT_COND_CMD_TEST) {
 				matched = filter_match_cond
-					(cond, msginfo, hlist, fltinfo);
+					(cond, msginfo, hlist, fltinfo, engine);
 				if (matched == TRUE)
 					return TRUE;
 			}
@@ -452,7 +1028,8 @@ gboolean filter_match_rule(FilterRule *rule, MsgInfo *msginfo, GSList *hlist,
 }
 
 static gboolean filter_match_cond(FilterCond *cond, MsgInfo *msginfo,
-				  GSList *hlist, FilterInfo *fltinfo)
+				  GSList *hlist, FilterInfo *fltinfo,
+				  FilterEngine *engine)
 {
 	gint ret;
 	gboolean matched = FALSE;
@@ -466,29 +1043,54 @@ static gboolean filter_match_cond(FilterCond *cond, MsgInfo *msginfo,
 		if (cond->match_type == FLT_IN_ADDRESSBOOK)
 			return filter_match_in_addressbook(cond, hlist, fltinfo);
 		else
-			return filter_match_header_cond(cond, hlist);
+			return filter_match_header_cond(cond, hlist, engine);
 	case FLT_COND_ANY_HEADER:
-		return filter_match_header_cond(cond, hlist);
+		return filter_match_header_cond(cond, hlist, engine);
 	case FLT_COND_TO_OR_CC:
 		if (cond->match_type == FLT_IN_ADDRESSBOOK)
 			return filter_match_in_addressbook(cond, hlist, fltinfo);
 		else
-			return filter_match_header_cond(cond, hlist);
+			return filter_match_header_cond(cond, hlist, engine);
 	case FLT_COND_BODY:
-		matched = procmime_find_string(msginfo, cond->str_value,
-					       cond->match_func);
+		/* skip the messages which the body index excludes */
+		if (cond->str_value &&
+		    (cond->match_type == FLT_REGEX ||
+		     body_index_may_contain(msginfo, cond->str_value))) {
+			GPtrArray *parts;
+			gchar **lines;
+			gint i;
+
+			parts = filter_msg_context_get_text_parts
+				(filter_msg_context_get(fltinfo, msginfo));
+			for (i = 0; !matched && i < parts->len; i++) {
+				lines = g_ptr_array_index(parts, i);
+				for (; !matched && *lines != NULL; lines++)
+					matched = filter_match_cond_str
+						(cond, *lines);
+			}
+		}
 		break;
 	case FLT_COND_CMD_TEST:
 		file = procmsg_get_message_file(msginfo);
 		if (!file)
 			return FALSE;
-		cmdline = g_strconcat(cond->str_value, " \"", file, "\"", NULL);
-		ret = execute_command_line_async_wait(cmdline);
+		ret = -1;
+#ifndef G_OS_WIN32
+		/* classify through the long-lived helper if it is set up */
+		if (prefs_common.junk_classify_cmd &&
+		    !strcmp(cond->str_value, prefs_common.junk_classify_cmd))
+			ret = filter_junk_classifier_classify(file);
+#endif
+		if (ret == -1) {
+			cmdline = g_strconcat(cond->str_value, " \"", file,
+					      "\"", NULL);
+			ret = execute_command_line_async_wait(cmdline);
+			g_free(cmdline);
+		}
 		fltinfo->last_exec_exit_status = ret;
 		matched = (ret == 0);
 		if (ret == -1)
 			fltinfo->error = FLT_ERROR_EXEC_FAILED;
-		g_free(cmdline);
 		g_free(file);
 		break;
 	case FLT_COND_SIZE_GREATER:
@@ -566,37 +1168,43 @@ static gboolean filter_match_cond(FilterCond *cond, MsgInfo *msginfo,
 	return matched;
 }
 
-static gboolean filter_match_header_cond(FilterCond *cond, GSList *hlist)
+static gboolean filter_match_header_cond(FilterCond *cond, GSList *hlist,
+					 FilterEngine *engine)
 {
 	gboolean matched = FALSE;
 	gboolean not_match = FALSE;
 	GSList *cur;
 	Header *header;
+	gint slot;
+
+	if (engine &&
+	    (slot = GPOINTER_TO_INT(g_hash_table_lookup(engine->slot_table,
+							 cond))) > 0) {
+		matched = engine->hit[slot - 1];
+		hlist = NULL;
+	}
 
 	for (cur = hlist; cur != NULL; cur = cur->next) {
 		header = (Header *)cur->data;
 
 		switch (cond->type) {
 		case FLT_COND_HEADER:
-			if (!g_ascii_strcasecmp
-				(header->name, cond->header_name)) {
+			if (filter_match_header_name(cond, header->name)) {
 				if (!cond->str_value ||
-				    cond->match_func(header->body,
-						     cond->str_value))
+				    filter_match_cond_str(cond, header->body))
 					matched = TRUE;
 			}
 			break;
 		case FLT_COND_ANY_HEADER:
 			if (!cond->str_value ||
-			    cond->match_func(header->body, cond->str_value))
+			    filter_match_cond_str(cond, header->body))
 				matched = TRUE;
 			break;
 		case FLT_COND_TO_OR_CC:
 			if (!g_ascii_strcasecmp(header->name, "To") ||
 			    !g_ascii_strcasecmp(header->name, "Cc")) {
 				if (!cond->str_value ||
-				    cond->match_func(header->body,
-						     cond->str_value))
+				    filter_match_cond_str(cond, header->body))
 					matched = TRUE;
 			}
 			break;
@@ -652,8 +1260,7 @@ static gboolean filter_match_in_addressbook(FilterCond *cond, GSList *hlist,
 		header = (Header *)cur->data;
 
 		if (cond->type == FLT_COND_HEADER) {
-			if (!g_ascii_strcasecmp
-				(header->name, cond->header_name)) {
+			if (filter_match_header_name(cond, header->name)) {
 				if (default_addrbook_func(header->body))
 					matched = TRUE;
 			}
@@ -1431,6 +2038,8 @@ FilterRule *filter_rule_new(const gchar *name, FilterBoolOp bool_op,
 {
 	FilterRule *rule;
 
+	g_atomic_int_inc(&filter_serial);
+
 	rule = g_new0(FilterRule, 1);
 	rule->name = g_strdup(name);
 	rule->bool_op = bool_op;
@@ -1483,9 +2092,47 @@ FilterCond *filter_cond_new(FilterCondType type,
 			cond->match_func = str_case_find;
 	}
 
+	filter_cond_compile(cond);
+
 	return cond;
 }
 
+/* Prepare the condition so that it can be evaluated against many messages
+   without being parsed again: header names are lowercased, needles of
+   case-insensitive substring matches are case-folded, and regular
+   expressions are compiled. */
+static void filter_cond_compile(FilterCond *cond)
+{
+	if (cond->header_name) {
+		cond->header_key = g_ascii_strdown(cond->header_name, -1);
+		cond->header_key_len = strlen(cond->header_key);
+	}
+
+	if (!cond->str_value)
+		return;
+
+	if (cond->match_type == FLT_REGEX) {
+#if defined(USE_ONIGURUMA) || defined(HAVE_REGCOMP)
+		regex_t *preg;
+
+		preg = g_new(regex_t, 1);
+#if USE_ONIGURUMA
+		reg_set_encoding(REG_POSIX_ENCODING_UTF8);
+#endif
+		if (regcomp(preg, cond->str_value,
+			    REG_ICASE|REG_EXTENDED|REG_NOSUB) != 0) {
+			debug_print("filter_cond_compile: invalid regex: %s\n",
+				    cond->str_value);
+			g_free(preg);
+		} else
+			cond->preg = preg;
+#endif
+	} else if (cond->match_func == str_case_find) {
+		cond->str_key = g_ascii_strdown(cond->str_value, -1);
+		cond->str_key_len = strlen(cond->str_key);
+	}
+}
+
 FilterAction *filter_action_new(FilterActionType type, const gchar *str)
 {
 	FilterAction *action;
@@ -1502,6 +2149,116 @@ FilterAction *filter_action_new(FilterActionType type, const gchar *str)
 	return action;
 }
 
+static FilterMsgContext *filter_msg_context_get(FilterInfo *fltinfo,
+						MsgInfo *msginfo)
+{
+	FilterMsgContext *ctx = fltinfo->msg_ctx;
+
+	if (ctx && ctx->msginfo == msginfo)
+		return ctx;
+
+	filter_msg_context_free(ctx);
+	ctx = g_new0(FilterMsgContext, 1);
+	ctx->msginfo = msginfo;
+	fltinfo->msg_ctx = ctx;
+
+	return ctx;
+}
+
+static void filter_msg_context_free(FilterMsgContext *ctx)
+{
+	gint i;
+
+	if (!ctx)
+		return;
+
+	if (ctx->hlist)
+		procheader_header_list_destroy(ctx->hlist);
+	if (ctx->mimeinfo)
+		procmime_mimeinfo_free_all(ctx->mimeinfo);
+	if (ctx->text_parts) {
+		for (i = 0; i < ctx->text_parts->len; i++)
+			g_strfreev(g_ptr_array_index(ctx->text_parts, i));
+		g_ptr_array_free(ctx->text_parts, TRUE);
+	}
+	g_free(ctx);
+}
+
+static GSList *filter_msg_context_get_header_list(FilterMsgContext *ctx)
+{
+	gchar *file;
+
+	if (ctx->hlist)
+		return ctx->hlist;
+
+	file = procmsg_get_message_file(ctx->msginfo);
+	if (!file)
+		return NULL;
+	ctx->hlist = procheader_get_header_list_from_file(file);
+	g_free(file);
+
+	return ctx->hlist;
+}
+
+/* Decode all text parts of the message once, and keep them as arrays of
+   lines for the body conditions. */
+static GPtrArray *filter_msg_context_get_text_parts(FilterMsgContext *ctx)
+{
+	MimeInfo *partinfo;
+	gchar *file;
+	FILE *fp;
+	BufFile *bf;
+	GString *str;
+	gchar buf[BUFFSIZE];
+	gchar **lines;
+	gsize len;
+	gint i;
+
+	if (ctx->text_parts)
+		return ctx->text_parts;
+
+	ctx->text_parts = g_ptr_array_new();
+
+	file = procmsg_get_message_file(ctx->msginfo);
+	if (!file)
+		return ctx->text_parts;
+	if (!ctx->mimeinfo)
+		ctx->mimeinfo = procmime_scan_message(ctx->msginfo);
+	if (!ctx->mimeinfo || (fp = g_fopen(file, "rb")) == NULL) {
+		g_free(file);
+		return ctx->text_parts;
+	}
+
+	str = g_string_new(NULL);
+
+	for (partinfo = ctx->mimeinfo; partinfo != NULL;
+	     partinfo = procmime_mimeinfo_next(partinfo)) {
+		if (partinfo->mime_type != MIME_TEXT &&
+		    partinfo->mime_type != MIME_TEXT_HTML)
+			continue;
+
+		bf = procmime_get_text_content_buf(partinfo, fp, NULL);
+		if (!bf)
+			continue;
+
+		g_string_truncate(str, 0);
+		while ((len = buf_file_read(buf, sizeof(buf), bf)) > 0)
+			g_string_append_len(str, buf, len);
+		buf_file_close(bf);
+
+		lines = g_strsplit(str->str, "\n", -1);
+		for (i = 0; lines[i] != NULL; i++)
+			strretchomp(lines[i]);
+		g_ptr_array_add(ctx->text_parts, lines);
+	}
+
+	g_string_free(str, TRUE);
+	fclose(fp);
+	g_free(file);
+
+	return ctx->text_parts;
+}
+
 FilterInfo *filter_info_new(void)
 {
 	FilterInfo *fltinfo;
@@ -1516,6 +2273,197 @@ FilterInfo *filter_info_new(void)
 	return fltinfo;
 }
 
+#ifndef G_OS_WIN32
+static gboolean filter_junk_classifier_start(void)
+{
+	gchar **argv;
+	GPid pid;
+	gint in_fd, out_fd;
+	GError *error = NULL;
+
+	argv = strsplit_with_quote(prefs_common.junk_classify_batch_cmd,
+				   " ", 0);
+	if (!argv || !argv[0]) {
+		g_strfreev(argv);
+		return FALSE;
+	}
+
+	debug_print("filter_junk_classifier_start: executing: %s\n",
+		    prefs_common.junk_classify_batch_cmd);
+
+	if (!g_spawn_async_with_pipes(NULL, argv, NULL,
+				      G_SPAWN_SEARCH_PATH |
+				      G_SPAWN_DO_NOT_REAP_CHILD,
+				      NULL, NULL, &pid, &in_fd, &out_fd, NULL,
+				      &error)) {
+		g_warning("filter_junk_classifier_start: %s\n",
+			  error ? error->message : "");
+		if (error)
+			g_error_free(error);
+		g_strfreev(argv);
+		return FALSE;
+	}
+	g_strfreev(argv);
+
+	junk_classifier = g_new0(FilterJunkClassifier, 1);
+	junk_classifier->pid = pid;
+	junk_classifier->in_fd = in_fd;
+	junk_classifier->out_fd = out_fd;
+	junk_classifier->buf = g_string_new(NULL);
+
+	return TRUE;
+}
+
+static void filter_junk_classifier_kill(gboolean force)
+{
+	gint i;
+
+	if (!junk_classifier)
+		return;
+
+	/* the helper should exit on EOF of its input */
+	close(junk_classifier->in_fd);
+	close(junk_classifier->out_fd);
+
+	for (i = 0; !force && i < 100; i++) {
+		if (waitpid(junk_classifier->pid, NULL, WNOHANG) != 0)
+			break;
+		g_usleep(10000);
+	}
+	if (force || i == 100) {
+		kill(junk_classifier->pid, SIGTERM);
+		waitpid(junk_classifier->pid, NULL, 0);
+	}
+	g_spawn_close_pid(junk_classifier->pid);
+
+	g_string_free(junk_classifier->buf, TRUE);
+	g_free(junk_classifier);
+	junk_classifier = NULL;
+}
+
+static gint filter_junk_classifier_read_line(gchar **line)
+{
+	GString *buf = junk_classifier->buf;
+	gchar tmp[BUFFSIZE];
+	gchar *p;
+	gint timeout = prefs_common.io_timeout_secs > 0
+		? prefs_common.io_timeout_secs : 60;
+	ssize_t len;
+
+	while ((p = memchr(buf->str, '\n', buf->len)) == NULL) {
+		struct timeval tv;
+		fd_set fds;
+		gint ret;
+
+		FD_ZERO(&fds);
+		FD_SET(junk_classifier->out_fd, &fds);
+		tv.tv_sec = timeout;
+		tv.tv_usec = 0;
+
+		ret = select(junk_classifier->out_fd + 1, &fds, NULL, NULL,
+			     &tv);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0) {
+			g_warning("filter_junk_classifier: %s\n",
+				  ret == 0 ? "timeout" : g_strerror(errno));
+			return -1;
+		}
+
+		len = read(junk_classifier->out_fd, tmp, sizeof(tmp));
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len <= 0)
+			return -1;
+		g_string_append_len(buf, tmp, len);
+	}
+
+	*line = g_strndup(buf->str, p - buf->str);
+	g_string_erase(buf, 0, p - buf->str + 1);
+	strretchomp(*line);
+
+	return 0;
+}
+
+/* Classify a message with the long-lived junk classifier.
+ *
+ * The helper reads the path of a message per line from its standard
+ * input, and answers with a line for each one. The answer may be
+ * prefixed with the path, and is either the exit status of the one-shot
+ * classify command (0: junk, 1: clean, 2: unsure, 3 or more: error) or
+ * a status letter as printed by "bogofilter -b" (S, H or U).
+ *
+ * Returns the status, or -1 if the helper is not available, in which
+ * case the one-shot command should be executed instead. */
+static gint filter_junk_classifier_classify(const gchar *file)
+{
+	gchar *req;
+	gchar *line = NULL;
+	const gchar *p;
+	gint ret = -1;
+
+	if (junk_classifier_disabled ||
+	    !prefs_common.junk_classify_batch_cmd ||
+	    !*prefs_common.junk_classify_batch_cmd)
+		return -1;
+	if (strchr(file, '\n') != NULL)
+		return -1;
+
+	if (!junk_classifier && !filter_junk_classifier_start()) {
+		junk_classifier_disabled = TRUE;
+		return -1;
+	}
+
+	req = g_strconcat(file, "\n", NULL);
+	if (fd_write_all(junk_classifier->in_fd, req, strlen(req)) < 0 ||
+	    filter_junk_classifier_read_line(&line) < 0)
+		goto error;
+
+	p = line;
+	if (!strncmp(p, file, strlen(file)) && p[strlen(file)] == ' ')
+		p += strlen(file);
+	while (*p == ' ' || *p == '\t')
+		p++;
+
+	if (g_ascii_isdigit(*p))
+		ret = atoi(p);
+	else if (*p == 'S' || *p == 's')
+		ret = 0;
+	else if (*p == 'H' || *p == 'h')
+		ret = 1;
+	else if (*p == 'U' || *p == 'u')
+		ret = 2;
+	else {
+		g_warning("filter_junk_classifier: invalid response: %s\n",
+			  line);
+		goto error;
+	}
+
+	debug_print("filter_junk_classifier: %s: %d\n", file, ret);
+
+	g_free(line);
+	g_free(req);
+	return ret;
+
+error:
+	g_warning("filter_junk_classifier: falling back to one-shot command\n");
+	g_free(line);
+	g_free(req);
+	filter_junk_classifier_kill(TRUE);
+	junk_classifier_disabled = TRUE;
+	return -1;
+}
+#endif /* G_OS_WIN32 */
+
+/* Terminate the long-lived junk classifier at the end of a batch. */
+void filter_junk_classifier_stop(void)
+{
+#ifndef G_OS_WIN32
+	filter_junk_classifier_kill(FALSE);
+	junk_classifier_disabled = FALSE;
+#endif
+}
+
 FilterRule *filter_junk_rule_create(PrefsAccount *account,
 				    FolderItem *default_junk,
 				    gboolean is_manual)
@@ -1869,6 +2817,8 @@ void filter_rule_free(FilterRule *rule)
 {
 	if (!rule) return;
 
+	g_atomic_int_inc(&filter_serial);
+
 	g_free(rule->name);
 	g_free(rule->target_folder);
 
@@ -1898,6 +2848,14 @@ void filter_action_list_free(GSList *action_list)
 
 static void filter_cond_free(FilterCond *cond)
 {
+#if defined(USE_ONIGURUMA) || defined(HAVE_REGCOMP)
+	if (cond->preg) {
+		regfree((regex_t *)cond->preg);
+		g_free(cond->preg);
+	}
+#endif
+	g_free(cond->str_key);
+	g_free(cond->header_key);
 	g_free(cond->header_name);
 	g_free(cond->str_value);
 	g_free(cond);
@@ -1912,5 +2870,6 @@ static void filter_action_free(FilterAction *action)
 void filter_info_free(FilterInfo *fltinfo)
 {
 	g_slist_free(fltinfo->dest_list);
+	filter_msg_context_free(fltinfo->msg_ctx);
 	g_free(fltinfo);
 }
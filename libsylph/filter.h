@@ -30,6 +30,7 @@ typedef struct _FilterCond	FilterCond;
 typedef struct _FilterAction	FilterAction;
 typedef struct _FilterRule	FilterRule;
 typedef struct _FilterInfo	FilterInfo;
+typedef struct _FilterMsgContext	FilterMsgContext;
 
 typedef enum
 {
@@ -126,6 +127,13 @@ struct _FilterCond
 	FilterMatchFlag match_flag;
 
 	StrFindFunc match_func;
+
+	/* compiled form (prepared by filter_cond_new()) */
+	gchar *header_key;
+	gint header_key_len;
+	gchar *str_key;
+	gint str_key_len;
+	gpointer preg;
 };
 
 struct _FilterAction
@@ -164,6 +172,9 @@ struct _FilterInfo
 
 	FilterErrorValue error;
 	gint last_exec_exit_status;
+
+	/* parsed data of the message shared by all conditions */
+	FilterMsgContext *msg_ctx;
 };
 
 gint filter_apply			(GSList			*fltlist,
@@ -217,6 +228,7 @@ FilterInfo *filter_info_new		(void);
 FilterRule *filter_junk_rule_create	(PrefsAccount		*account,
 					 FolderItem		*default_junk,
 					 gboolean		 is_manual);
+void filter_junk_classifier_stop	(void);
 
 void filter_rule_rename_dest_path	(FilterRule		*rule,
 					 const gchar		*old_path,
@@ -172,11 +172,14 @@ gint folder_remote_folder_destroy_all_sessions(void)
 		folder = FOLDER(list->data);
 		if (FOLDER_IS_REMOTE(folder)) {
 			rfolder = REMOTE_FOLDER(folder);
-			if (rfolder->session &&
-			    !folder_remote_folder_is_session_active(rfolder)) {
+			if (folder_remote_folder_is_session_active(rfolder))
+				continue;
+			if (rfolder->session) {
 				session_destroy(rfolder->session);
 				rfolder->session = NULL;
 			}
+			if (FOLDER_TYPE(folder) == F_IMAP)
+				imap_session_pool_destroy(IMAP_FOLDER(folder));
 		}
 	}
 
@@ -264,6 +267,7 @@ FolderItem *folder_item_new(const gchar *name, const gchar *path)
 	item->last_selected = 0;
 	item->qsearch_cond_type = 0;
 	item->data = NULL;
+	item->modseq = 0;
 
 	return item;
 }
@@ -317,6 +321,7 @@ FolderItem *folder_item_copy(FolderItem *item)
 	new_item->last_selected = item->last_selected;
 	new_item->qsearch_cond_type = item->qsearch_cond_type;
 	new_item->data = item->data;
+	new_item->modseq = item->modseq;
 
 	return new_item;
 }
@@ -1222,6 +1227,10 @@ gint folder_item_fetch_all_msg(FolderItem *item)
 
 	mlist = folder_item_get_msg_list(item, TRUE);
 
+	/* fetch the uncached messages with pipelined commands first */
+	if (FOLDER_TYPE(folder) == F_IMAP)
+		imap_fetch_msgs(item, mlist);
+
 	for (cur = mlist; cur != NULL; cur = cur->next) {
 		MsgInfo *msginfo = (MsgInfo *)cur->data;
 		gchar *msg;
@@ -1526,6 +1535,7 @@ static gboolean folder_build_tree(GNode *node, gpointer data)
 	gboolean qsearch_cond_type = 0;
 	gint new = 0, unread = 0, total = 0;
 	time_t mtime = 0;
+	guint64 modseq = 0;
 	gboolean use_auto_to_on_reply = FALSE;
 	gchar *auto_to = NULL, *auto_cc = NULL, *auto_bcc = NULL,
 	      *auto_replyto = NULL;
@@ -1571,6 +1581,8 @@ static gboolean folder_build_tree(GNode *node, gpointer data)
 			path = attr->value;
 		} else if (!strcmp(attr->name, "mtime"))
 			mtime = strtoul(attr->value, NULL, 10);
+		else if (!strcmp(attr->name, "modseq"))
+			modseq = g_ascii_strtoull(attr->value, NULL, 10);
 		else if (!strcmp(attr->name, "new"))
 			new = atoi(attr->value);
 		else if (!strcmp(attr->name, "unread"))
@@ -1665,6 +1677,7 @@ static gboolean folder_build_tree(GNode *node, gpointer data)
 	item = folder_item_new(name, path);
 	item->stype = stype;
 	item->mtime = mtime;
+	item->modseq = modseq;
 	item->new = new;
 	item->unread = unread;
 	item->total = total;
@@ -1881,6 +1894,9 @@ static void folder_write_list_recursive(GNode *node, gpointer data)
 		fprintf(fp,
 			" mtime=\"%lu\" new=\"%d\" unread=\"%d\" total=\"%d\"",
 			item->mtime, item->new, item->unread, item->total);
+		if (item->modseq > 0)
+			fprintf(fp, " modseq=\"%" G_GUINT64_FORMAT "\"",
+				item->modseq);
 
 		if (item->account)
 			fprintf(fp, " account_id=\"%d\"",
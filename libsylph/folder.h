@@ -317,6 +317,8 @@ struct _FolderItem
 	gint qsearch_cond_type;
 
 	gpointer data;
+
+	guint64 modseq; /* IMAP HIGHESTMODSEQ of the cached state */
 };
 
 Folder     *folder_new			(FolderType	 type,
@@ -183,15 +183,13 @@ static void html_get_parenthesis	(HTMLParser	*parser,
 					 gint		 len);
 
 
-HTMLParser *html_parser_new(FILE *fp, CodeConverter *conv)
+static HTMLParser *html_parser_alloc(CodeConverter *conv)
 {
 	HTMLParser *parser;
 
-	g_return_val_if_fail(fp != NULL, NULL);
-	g_return_val_if_fail(conv != NULL, NULL);
-
 	parser = g_new0(HTMLParser, 1);
-	parser->fp = fp;
+	parser->fp = NULL;
+	parser->bf = NULL;
 	parser->conv = conv;
 	parser->str = g_string_new(NULL);
 	parser->buf = g_string_new(NULL);
@@ -226,6 +224,32 @@ HTMLParser *html_parser_new(FILE *fp, CodeConverter *conv)
 	return parser;
 }
 
+HTMLParser *html_parser_new(FILE *fp, CodeConverter *conv)
+{
+	HTMLParser *parser;
+
+	g_return_val_if_fail(fp != NULL, NULL);
+	g_return_val_if_fail(conv != NULL, NULL);
+
+	parser = html_parser_alloc(conv);
+	parser->fp = fp;
+
+	return parser;
+}
+
+HTMLParser *html_parser_new_from_buf_file(BufFile *bf, CodeConverter *conv)
+{
+	HTMLParser *parser;
+
+	g_return_val_if_fail(bf != NULL, NULL);
+	g_return_val_if_fail(conv != NULL, NULL);
+
+	parser = html_parser_alloc(conv);
+	parser->bf = bf;
+
+	return parser;
+}
+
 void html_parser_destroy(HTMLParser *parser)
 {
 	g_string_free(parser->str, TRUE);
@@ -283,10 +307,15 @@ const gchar *html_parse(HTMLParser *parser)
 static HTMLState html_read_line(HTMLParser *parser)
 {
 	gchar buf[HTMLBUFSIZE];
+	gchar *p;
 	gchar *conv_str;
 	gint index;
 
-	if (fgets(buf, sizeof(buf), parser->fp) == NULL) {
+	if (parser->bf)
+		p = buf_file_gets(buf, sizeof(buf), parser->bf);
+	else
+		p = fgets(buf, sizeof(buf), parser->fp);
+	if (p == NULL) {
 		parser->state = HTML_EOF;
 		return HTML_EOF;
 	}
@@ -24,6 +24,7 @@
 #include <stdio.h>
 
 #include "codeconv.h"
+#include "utils.h"
 
 typedef enum
 {
@@ -48,6 +49,7 @@ typedef struct _HTMLTag		HTMLTag;
 struct _HTMLParser
 {
 	FILE *fp;
+	BufFile *bf;
 	CodeConverter *conv;
 
 	GHashTable *symbol_table;
@@ -81,6 +83,9 @@ struct _HTMLTag
 
 HTMLParser *html_parser_new	(FILE		*fp,
 				 CodeConverter	*conv);
+HTMLParser *html_parser_new_from_buf_file
+				(BufFile	*bf,
+				 CodeConverter	*conv);
 void html_parser_destroy	(HTMLParser	*parser);
 const gchar *html_parse		(HTMLParser	*parser);
 
@@ -43,6 +43,7 @@
 #include "recv.h"
 #include "procmsg.h"
 #include "procheader.h"
+#include "bodyindex.h"
 #include "folder.h"
 #include "prefs_account.h"
 #include "codeconv.h"
@@ -60,6 +61,17 @@
 #define IMAP_COPY_LIMIT	200
 #define IMAP_CMD_LIMIT	1000
 
+#define IMAP_PIPELINE_WINDOW	MAX(prefs_common.imap_pipeline_window, 1)
+
+#if USE_THREADS
+#define IMAP_MAX_SESSIONS	MAX(prefs_common.imap_max_connections, 1)
+#else
+#define IMAP_MAX_SESSIONS	1
+#endif
+
+/* minimum number of message headers to split among the sessions */
+#define IMAP_POOL_FETCH_MIN	500
+
 #define QUOTE_IF_REQUIRED(out, str)					\
 {									\
 	if (*str != '"' && strpbrk(str, " \t(){}[]%&*") != NULL) {	\
@@ -85,6 +97,10 @@ typedef gint (*IMAPProgressFunc)	(IMAPSession	*session,
 typedef struct _IMAPRealSession
 {
 	IMAPSession imap_session;
+	GQueue *cmd_queue;
+	gboolean qresync;
+	gboolean login_capability;	/* sent with the login response */
+	guint64 highest_modseq;	/* of the selected mailbox */
 #if USE_THREADS
 	GThreadPool *pool;
 	IMAPThreadFunc thread_func;
@@ -97,6 +113,29 @@ typedef struct _IMAPRealSession
 #endif
 } IMAPRealSession;
 
+/* pipelined command waiting for the tagged response */
+typedef struct _IMAPQueuedCmd
+{
+	guint tag;
+	gchar *cmd;
+
+	/* UID FETCH <uid> BODY.PEEK[] */
+	guint32 uid;
+	gchar *filename;
+	gboolean fetched;
+} IMAPQueuedCmd;
+
+/* job run on one of the sessions of the pool. send_func is called in
+   the main thread, and recv_func in the thread of the session. */
+typedef struct _IMAPPoolJob
+{
+	IMAPThreadFunc send_func;
+	IMAPThreadFunc recv_func;
+	gpointer data;
+	gint weight;
+	gint retval;
+} IMAPPoolJob;
+
 static GList *session_list = NULL;
 
 static void imap_folder_init		(Folder		*folder,
@@ -119,6 +158,12 @@ static gint imap_search_flags		(IMAPSession	*session,
 static gint imap_fetch_flags		(IMAPSession	*session,
 					 GArray	       **uids,
 					 GHashTable    **flags_table);
+static gint imap_fetch_changed_flags	(IMAPSession	*session,
+					 FolderItem	*item,
+					 GSList		*mlist,
+					 gint		 exists,
+					 GArray	       **uids,
+					 GHashTable    **flags_table);
 
 static GSList *imap_get_msg_list	(Folder		*folder,
 					 FolderItem	*item,
@@ -201,6 +246,16 @@ static gint imap_remove_folder		(Folder		*folder,
 
 static IMAPSession *imap_session_get	(Folder		*folder);
 
+static gint imap_session_pool_get	(Folder		*folder,
+					 IMAPSession   **sessions,
+					 gint		 max);
+static gint imap_session_pool_run	(IMAPSession   **sessions,
+					 gint		 n_sessions,
+					 IMAPPoolJob	*jobs,
+					 gint		 n_jobs,
+					 IMAPProgressFunc progress_func,
+					 gpointer	 data);
+
 static gint imap_greeting		(IMAPSession	*session);
 static gint imap_auth			(IMAPSession	*session,
 					 const gchar	*user,
@@ -234,6 +289,10 @@ static gint imap_remove_msgs_by_seq_set	(Folder		*folder,
 					 FolderItem	*item,
 					 GSList		*seq_list);
 
+static GSList *imap_get_uncached_messages_pool	(IMAPSession	*session,
+						 FolderItem	*item,
+						 GArray		*uids,
+						 guint		 begin);
 static GSList *imap_get_uncached_messages	(IMAPSession	*session,
 						 FolderItem	*item,
 						 guint32	 first_uid,
@@ -282,6 +341,15 @@ static gint imap_status				(IMAPSession	*session,
 						 guint32	*uid_next,
 						 guint32	*uid_validity,
 						 gint		*unseen);
+static gint imap_cmd_status			(IMAPSession	*session,
+						 IMAPFolder	*folder,
+						 const gchar	*path);
+static gint imap_parse_status			(GPtrArray	*argbuf,
+						 gint		*messages,
+						 gint		*recent,
+						 guint32	*uid_next,
+						 guint32	*uid_validity,
+						 gint		*unseen);
 
 static void imap_parse_namespace		(IMAPSession	*session,
 						 IMAPFolder	*folder);
@@ -311,6 +379,11 @@ static void imap_capability_free	(IMAPSession	*session);
 
 /* low-level IMAP4rev1 commands */
 static gint imap_cmd_capability	(IMAPSession	*session);
+static gboolean imap_parse_capability	(IMAPSession	*session,
+					 GPtrArray	*argbuf);
+static gint imap_cmd_auth_ok	(IMAPSession	*session);
+static gint imap_cmd_enable	(IMAPSession	*session,
+				 const gchar	*capability);
 static gint imap_cmd_authenticate
 				(IMAPSession	*session,
 				 const gchar	*user,
@@ -368,7 +441,8 @@ static gint imap_cmd_append	(IMAPSession	*session,
 				 const gchar	*destfolder,
 				 const gchar	*file,
 				 IMAPFlags	 flags,
-				 guint32	*new_uid);
+				 guint32	*new_uid,
+				 gint		*new_size);
 static gint imap_cmd_copy	(IMAPSession	*session,
 				 const gchar	*seq_set,
 				 const gchar	*destfolder);
@@ -387,6 +461,14 @@ static gint imap_cmd_gen_send	(IMAPSession	*session,
 static gint imap_cmd_gen_recv	(IMAPSession	*session,
 				 gchar	       **ret);
 
+static gint imap_cmd_queue_send	(IMAPSession	*session,
+				 guint32	 uid,
+				 const gchar	*filename,
+				 const gchar	*format, ...);
+static gint imap_cmd_queue_wait	(IMAPSession	*session,
+				 guint		 max_pending);
+static void imap_cmd_queue_clear(IMAPSession	*session);
+
 static gint imap_cmd_gen_recv_silent	(IMAPSession	*session,
 					 gchar	       **ret);
 
@@ -420,6 +502,10 @@ static gboolean imap_rename_folder_func		(GNode		*node,
 						 gpointer	 data);
 
 #if USE_THREADS
+static gint imap_thread_start		(IMAPSession		*session,
+					 IMAPThreadFunc		 func,
+					 gpointer		 data);
+static gint imap_thread_finish		(IMAPSession		*session);
 static gint imap_thread_run		(IMAPSession		*session,
 					 IMAPThreadFunc		 func,
 					 gpointer		 data);
@@ -499,6 +585,7 @@ static void imap_folder_destroy(Folder *folder)
 		g_free(dir);
 	}
 
+	imap_session_pool_destroy(IMAP_FOLDER(folder));
 	folder_remote_folder_destroy(REMOTE_FOLDER(folder));
 }
 
@@ -528,7 +615,8 @@ static IMAPSession *imap_session_get(Folder *folder)
 		return IMAP_SESSION(rfolder->session);
 	}
 
-	if (time(NULL) - rfolder->session->last_access_time <
+	if (rfolder->session->state != SESSION_ERROR &&
+	    time(NULL) - rfolder->session->last_access_time <
 		SESSION_TIMEOUT_INTERVAL) {
 		return IMAP_SESSION(rfolder->session);
 	}
@@ -550,6 +638,69 @@ static IMAPSession *imap_session_get(Folder *folder)
 	return IMAP_SESSION(rfolder->session);
 }
 
+/* Get the sessions to run parallel jobs with. The first one is the
+   main session of the folder, and the others are connected on demand.
+   Returns the number of the sessions stored in sessions. */
+static gint imap_session_pool_get(Folder *folder, IMAPSession **sessions,
+				  gint max)
+{
+	IMAPFolder *ifolder = IMAP_FOLDER(folder);
+	IMAPSession *session;
+	GSList *cur, *next;
+	gint n = 0;
+
+	session = imap_session_get(folder);
+	if (!session)
+		return 0;
+	sessions[n++] = session;
+
+	for (cur = ifolder->pool_sessions; cur != NULL && n < max;
+	     cur = next) {
+		next = cur->next;
+		session = IMAP_SESSION(cur->data);
+
+		if (SESSION(session)->state == SESSION_ERROR ||
+		    (time(NULL) - SESSION(session)->last_access_time >=
+		     SESSION_TIMEOUT_INTERVAL &&
+		     imap_cmd_noop(session) != IMAP_SUCCESS)) {
+			debug_print("imap_session_pool_get: "
+				    "removing disconnected session\n");
+			ifolder->pool_sessions =
+				g_slist_remove(ifolder->pool_sessions, session);
+			session_destroy(SESSION(session));
+			continue;
+		}
+
+		sessions[n++] = session;
+	}
+
+	while (n < max) {
+		/* the server may limit the number of connections */
+		session = IMAP_SESSION(imap_session_new(folder->account));
+		if (!session)
+			break;
+		ifolder->pool_sessions =
+			g_slist_append(ifolder->pool_sessions, session);
+		sessions[n++] = session;
+	}
+
+	debug_print("imap_session_pool_get: %d sessions\n", n);
+
+	return n;
+}
+
+void imap_session_pool_destroy(IMAPFolder *folder)
+{
+	GSList *cur;
+
+	g_return_if_fail(folder != NULL);
+
+	for (cur = folder->pool_sessions; cur != NULL; cur = cur->next)
+		session_destroy(SESSION(cur->data));
+	g_slist_free(folder->pool_sessions);
+	folder->pool_sessions = NULL;
+}
+
 static gint imap_greeting(IMAPSession *session)
 {
 	gchar *greeting;
@@ -632,6 +783,7 @@ static Session *imap_session_new(PrefsAccount *account)
 #endif
 
 	session = IMAP_SESSION(g_new0(IMAPRealSession, 1));
+	((IMAPRealSession *)session)->cmd_queue = g_queue_new();
 
 	session_init(SESSION(session));
 
@@ -740,6 +892,7 @@ static gint imap_session_connect(IMAPSession *session)
 	}
 #endif
 
+	((IMAPRealSession *)session)->login_capability = FALSE;
 	if (!session->authenticated &&
 	    imap_auth(session, account->userid, pass, account->imap_auth_type)
 	    != IMAP_SUCCESS) {
@@ -751,6 +904,16 @@ static gint imap_session_connect(IMAPSession *session)
 		return IMAP_AUTHFAIL;
 	}
 
+	/* QRESYNC may be announced only after login. The capabilities are
+	   asked again only if they didn't come with the login response. */
+	if (!imap_has_capability(session, "QRESYNC") &&
+	    !((IMAPRealSession *)session)->login_capability &&
+	    imap_cmd_capability(session) != IMAP_SUCCESS)
+		return IMAP_ERROR;
+	if (imap_has_capability(session, "QRESYNC") &&
+	    imap_cmd_enable(session, "QRESYNC") == IMAP_SUCCESS)
+		((IMAPRealSession *)session)->qresync = TRUE;
+
 	return IMAP_SUCCESS;
 }
 
@@ -762,6 +925,8 @@ static gint imap_session_reconnect(IMAPSession *session)
 
 	imap_capability_free(session);
 	session->uidplus = FALSE;
+	((IMAPRealSession *)session)->qresync = FALSE;
+	((IMAPRealSession *)session)->login_capability = FALSE;
 	g_free(session->mbox);
 	session->mbox = NULL;
 	session->authenticated = FALSE;
@@ -779,6 +944,8 @@ static void imap_session_destroy(Session *session)
 		g_thread_pool_free(real->pool, TRUE, TRUE);
 #endif
 	imap_capability_free(IMAP_SESSION(session));
+	imap_cmd_queue_clear(IMAP_SESSION(session));
+	g_queue_free(((IMAPRealSession *)session)->cmd_queue);
 	g_free(IMAP_SESSION(session)->mbox);
 	session_list = g_list_remove(session_list, session);
 }
@@ -859,8 +1026,46 @@ static gint imap_search_flags(IMAPSession *session, GArray **uids,
 	return IMAP_SUCCESS;
 }
 
-static gint imap_fetch_flags(IMAPSession *session, GArray **uids,
-			     GHashTable **flags_table)
+/* Parse the uid-set of VANISHED and append the ranges to vanished as
+   (first, last) pairs. */
+static void imap_parse_vanished(const gchar *str, GArray *vanished)
+{
+	const gchar *p = str;
+	gchar *ep;
+	guint32 first, last;
+
+	if (!strncmp(p, "(EARLIER) ", 10))
+		p += 10;
+
+	while (*p != '\0') {
+		first = strtoul(p, &ep, 10);
+		if (p == ep)
+			break;
+		p = ep;
+		last = first;
+		if (*p == ':') {
+			p++;
+			last = strtoul(p, &ep, 10);
+			if (p == ep)
+				break;
+			p = ep;
+			if (last < first) {
+				guint32 tmp = first;
+				first = last;
+				last = tmp;
+			}
+		}
+		g_array_append_val(vanished, first);
+		g_array_append_val(vanished, last);
+		if (*p != ',')
+			break;
+		p++;
+	}
+}
+
+static gint imap_fetch_flags_real(IMAPSession *session, const gchar *cmd,
+				  GArray **uids, GHashTable **flags_table,
+				  GArray *vanished)
 {
 	gint ok;
 	gchar *tmp;
@@ -869,7 +1074,7 @@ static gint imap_fetch_flags(IMAPSession *session, GArray **uids,
 	guint32 uid;
 	IMAPFlags flags;
 
-	if (imap_cmd_gen_send(session, "UID FETCH 1:* (UID FLAGS)") != IMAP_SUCCESS)
+	if (imap_cmd_gen_send(session, "%s", cmd) != IMAP_SUCCESS)
 		return IMAP_ERROR;
 
 	*uids = g_array_new(FALSE, FALSE, sizeof(guint32));
@@ -885,6 +1090,13 @@ static gint imap_fetch_flags(IMAPSession *session, GArray **uids,
 		}
 		cur_pos = tmp + 2;
 
+		if (!strncmp(cur_pos, "VANISHED ", 9)) {
+			if (vanished)
+				imap_parse_vanished(cur_pos + 9, vanished);
+			g_free(tmp);
+			continue;
+		}
+
 #define PARSE_ONE_ELEMENT(ch)					\
 {								\
 	cur_pos = strchr_cpy(cur_pos, ch, buf, sizeof(buf));	\
@@ -927,6 +1139,9 @@ static gint imap_fetch_flags(IMAPSession *session, GArray **uids,
 				PARSE_ONE_ELEMENT(')');
 				flags = imap_parse_imap_flags(buf);
 				flags |= IMAP_FLAG_DRAFT;
+			} else if (!strncmp(cur_pos, "MODSEQ (", 8)) {
+				cur_pos += 8;
+				PARSE_ONE_ELEMENT(')');
 			} else {
 				g_warning("invalid FETCH response: %s\n", cur_pos);
 				break;
@@ -952,12 +1167,157 @@ static gint imap_fetch_flags(IMAPSession *session, GArray **uids,
 	return ok;
 }
 
+static gint imap_fetch_flags(IMAPSession *session, GArray **uids,
+			     GHashTable **flags_table)
+{
+	return imap_fetch_flags_real(session, "UID FETCH 1:* (UID FLAGS)",
+				     uids, flags_table, NULL);
+}
+
+static gint imap_uid_cmp(gconstpointer a, gconstpointer b)
+{
+	guint32 uid_a = *(const guint32 *)a;
+	guint32 uid_b = *(const guint32 *)b;
+
+	return uid_a < uid_b ? -1 : uid_a > uid_b ? 1 : 0;
+}
+
+static void imap_flags_table_to_uids_func(gpointer key, gpointer value,
+					  gpointer data)
+{
+	guint32 uid = GPOINTER_TO_UINT(key);
+
+	g_array_append_val((GArray *)data, uid);
+}
+
+/* Same as imap_fetch_flags(), but only the changes since item->modseq
+   (CONDSTORE) are fetched, and the flags of the other messages are
+   taken from the cache (mlist). With QRESYNC, the expunged messages are
+   also reported by the server. Otherwise UID SEARCH is used only if the
+   number of messages doesn't match. */
+static gint imap_fetch_changed_flags(IMAPSession *session, FolderItem *item,
+				     GSList *mlist, gint exists,
+				     GArray **uids, GHashTable **flags_table)
+{
+	IMAPRealSession *real = (IMAPRealSession *)session;
+	GArray *changed_uids = NULL;
+	GHashTable *changed_table = NULL;
+	GArray *vanished;
+	GHashTable *table;
+	GSList *cur;
+	guint32 uid, first, last, cache_last = 0;
+	gint ok = IMAP_SUCCESS;
+	guint i;
+
+	vanished = g_array_new(FALSE, FALSE, sizeof(guint32));
+
+	if (real->highest_modseq != item->modseq) {
+		gchar *cmd;
+
+		cmd = g_strdup_printf("UID FETCH 1:* (UID FLAGS) "
+				      "(CHANGEDSINCE %" G_GUINT64_FORMAT "%s)",
+				      item->modseq,
+				      real->qresync ? " VANISHED" : "");
+		ok = imap_fetch_flags_real(session, cmd, &changed_uids,
+					   &changed_table, vanished);
+		g_free(cmd);
+		if (ok != IMAP_SUCCESS) {
+			g_array_free(vanished, TRUE);
+			return ok;
+		}
+	}
+
+	table = g_hash_table_new(NULL, g_direct_equal);
+
+	for (cur = mlist; cur != NULL; cur = cur->next) {
+		MsgInfo *msginfo = (MsgInfo *)cur->data;
+		IMAPFlags iflags = IMAP_FLAG_DRAFT;
+
+		if (!MSG_IS_UNREAD(msginfo->flags))
+			iflags |= IMAP_FLAG_SEEN;
+		if (MSG_IS_MARKED(msginfo->flags))
+			iflags |= IMAP_FLAG_FLAGGED;
+		if (MSG_IS_REPLIED(msginfo->flags))
+			iflags |= IMAP_FLAG_ANSWERED;
+		IMAP_SET_COLORLABEL_VALUE
+			(iflags, MSG_GET_COLORLABEL_VALUE(msginfo->flags));
+
+		g_hash_table_insert(table, GUINT_TO_POINTER(msginfo->msgnum),
+				    GINT_TO_POINTER(iflags));
+		if (cache_last < msginfo->msgnum)
+			cache_last = msginfo->msgnum;
+	}
+
+	for (i = 0; i + 1 < vanished->len; i += 2) {
+		first = g_array_index(vanished, guint32, i);
+		last = MIN(g_array_index(vanished, guint32, i + 1), cache_last);
+		for (uid = first; uid <= last; uid++) {
+			g_hash_table_remove(table, GUINT_TO_POINTER(uid));
+			if (uid == last)
+				break;
+		}
+	}
+	g_array_free(vanished, TRUE);
+
+	if (changed_uids) {
+		for (i = 0; i < changed_uids->len; i++) {
+			uid = g_array_index(changed_uids, guint32, i);
+			g_hash_table_insert
+				(table, GUINT_TO_POINTER(uid),
+				 g_hash_table_lookup(changed_table,
+						     GUINT_TO_POINTER(uid)));
+		}
+		g_array_free(changed_uids, TRUE);
+		g_hash_table_destroy(changed_table);
+	}
+
+	if (g_hash_table_size(table) != exists) {
+		GArray *all_uids;
+		GHashTable *all_table;
+
+		debug_print("imap_fetch_changed_flags: "
+			    "checking expunged messages\n");
+		ok = imap_cmd_search(session, "ALL", &all_uids);
+		if (ok != IMAP_SUCCESS) {
+			g_hash_table_destroy(table);
+			return ok;
+		}
+
+		all_table = g_hash_table_new(NULL, g_direct_equal);
+		for (i = 0; i < all_uids->len; i++) {
+			uid = g_array_index(all_uids, guint32, i);
+			if (g_hash_table_lookup(table, GUINT_TO_POINTER(uid)))
+				g_hash_table_insert
+					(all_table, GUINT_TO_POINTER(uid),
+					 g_hash_table_lookup
+						(table, GUINT_TO_POINTER(uid)));
+		}
+		g_array_free(all_uids, TRUE);
+		g_hash_table_destroy(table);
+		table = all_table;
+
+		/* the cache is out of sync */
+		if (g_hash_table_size(table) != exists) {
+			g_hash_table_destroy(table);
+			return IMAP_ERROR;
+		}
+	}
+
+	*uids = g_array_new(FALSE, FALSE, sizeof(guint32));
+	g_hash_table_foreach(table, imap_flags_table_to_uids_func, *uids);
+	g_array_sort(*uids, imap_uid_cmp);
+	*flags_table = table;
+
+	return IMAP_SUCCESS;
+}
+
 static GSList *imap_get_msg_list_full(Folder *folder, FolderItem *item,
 				      gboolean use_cache,
 				      gboolean uncached_only)
 {
 	GSList *mlist = NULL;
 	IMAPSession *session;
+	IMAPRealSession *real;
 	gint ok, exists = 0, recent = 0, unseen = 0;
 	guint32 uid_validity = 0;
 	guint32 first_uid = 0, last_uid = 0;
@@ -981,6 +1341,8 @@ static GSList *imap_get_msg_list_full(Folder *folder, FolderItem *item,
 		return mlist;
 	}
 
+	real = (IMAPRealSession *)session;
+
 	ok = imap_select(session, IMAP_FOLDER(folder), item->path,
 			 &exists, &recent, &unseen, &uid_validity);
 	if (ok != IMAP_SUCCESS) THROW;
@@ -995,6 +1357,7 @@ static GSList *imap_get_msg_list_full(Folder *folder, FolderItem *item,
 		debug_print("imap_get_msg_list: "
 			    "UIDVALIDITY has been changed.\n");
 		use_cache = FALSE;
+		body_index_remove_all(item);
 	}
 
 	if (use_cache) {
@@ -1003,6 +1366,7 @@ static GSList *imap_get_msg_list_full(Folder *folder, FolderItem *item,
 		GHashTable *flags_table;
 		guint32 cache_last;
 		guint32 begin = 0;
+		guint begin_index = 0;
 		GSList *cur, *next = NULL;
 		MsgInfo *msginfo;
 		IMAPFlags imap_flags;
@@ -1022,7 +1386,14 @@ static GSList *imap_get_msg_list_full(Folder *folder, FolderItem *item,
 			if (ok != IMAP_SUCCESS) THROW;
 		}
 #else
-		ok = imap_fetch_flags(session, &uids, &flags_table);
+		ok = IMAP_ERROR;
+		if (item->modseq > 0 && real->highest_modseq > 0 && mlist)
+			ok = imap_fetch_changed_flags(session, item, mlist,
+						      exists, &uids,
+						      &flags_table);
+		if (ok == IMAP_SOCKET || ok == IMAP_IOERR) THROW;
+		if (ok != IMAP_SUCCESS)
+			ok = imap_fetch_flags(session, &uids, &flags_table);
 		if (ok != IMAP_SUCCESS) THROW;
 #endif
 
@@ -1122,12 +1493,11 @@ static GSList *imap_get_msg_list_full(Folder *folder, FolderItem *item,
 		if (msg_table == NULL)
 			begin = first_uid;
 		else {
-			gint i;
-
-			for (i = 0; i < uids->len; i++) {
+			for (begin_index = 0; begin_index < uids->len;
+			     begin_index++) {
 				guint32 uid;
 
-				uid = g_array_index(uids, guint32, i);
+				uid = g_array_index(uids, guint32, begin_index);
 				if (g_hash_table_lookup
 					(msg_table, GUINT_TO_POINTER(uid))
 					== NULL) {
@@ -1140,7 +1510,6 @@ static GSList *imap_get_msg_list_full(Folder *folder, FolderItem *item,
 			g_hash_table_destroy(msg_table);
 		}
 
-		g_array_free(uids, TRUE);
 		g_hash_table_destroy(flags_table);
 
 		/* remove ununsed caches */
@@ -1153,19 +1522,33 @@ static GSList *imap_get_msg_list_full(Folder *folder, FolderItem *item,
 		}
 
 		if (begin > 0 && begin <= last_uid) {
-			newlist = imap_get_uncached_messages
-				(session, item, begin, last_uid,
-				 exists - item->total, TRUE);
+			newlist = imap_get_uncached_messages_pool
+				(session, item, uids, begin_index);
 			if (newlist) {
 				item->cache_dirty = TRUE;
 				item->mark_dirty = TRUE;
 			}
 			mlist = g_slist_concat(mlist, newlist);
 		}
+
+		g_array_free(uids, TRUE);
 	} else {
+		GArray *uids = NULL;
+
 		imap_delete_all_cached_messages(item);
-		mlist = imap_get_uncached_messages(session, item, 0, 0, exists,
-						   TRUE);
+
+		/* get the UID list first to split the fetch */
+		if (exists >= IMAP_POOL_FETCH_MIN && IMAP_MAX_SESSIONS > 1 &&
+		    imap_cmd_search(session, "ALL", &uids) == IMAP_SUCCESS &&
+		    uids->len > 0) {
+			g_array_sort(uids, imap_uid_cmp);
+			mlist = imap_get_uncached_messages_pool
+				(session, item, uids, 0);
+		} else
+			mlist = imap_get_uncached_messages(session, item, 0, 0,
+							   exists, TRUE);
+		if (uids)
+			g_array_free(uids, TRUE);
 		last_uid = procmsg_get_last_num_in_msg_list(mlist);
 		item->cache_dirty = TRUE;
 		item->mark_dirty = TRUE;
@@ -1186,6 +1569,7 @@ static GSList *imap_get_msg_list_full(Folder *folder, FolderItem *item,
 
 	if (!item->opened) {
 		item->mtime = uid_validity;
+		item->modseq = real->highest_modseq;
 		if (item->cache_dirty)
 			procmsg_write_cache_list(item, mlist);
 		if (item->mark_dirty)
@@ -1279,6 +1663,81 @@ static gchar *imap_fetch_msg(Folder *folder, FolderItem *item, gint uid)
 	return filename;
 }
 
+/* Fetch the messages in msglist which are not cached yet. The commands
+   are pipelined. */
+gint imap_fetch_msgs(FolderItem *item, GSList *msglist)
+{
+	Folder *folder;
+	IMAPSession *session;
+	GSList *cur;
+	gchar *path, *filename;
+	gchar nstr[16];
+	gint count = 0, total;
+	gint ok;
+
+	g_return_val_if_fail(item != NULL, -1);
+	g_return_val_if_fail(item->folder != NULL, -1);
+
+	folder = item->folder;
+	g_return_val_if_fail(FOLDER_TYPE(folder) == F_IMAP, -1);
+
+	if (!msglist)
+		return 0;
+
+	session = imap_session_get(folder);
+	if (!session)
+		return -1;
+
+	ok = imap_select(session, IMAP_FOLDER(folder), item->path,
+			 NULL, NULL, NULL, NULL);
+	if (ok != IMAP_SUCCESS) {
+		g_warning("can't select mailbox %s\n", item->path);
+		return -1;
+	}
+
+	path = folder_item_get_path(item);
+	if (!is_dir_exist(path))
+		make_dir_hier(path);
+
+	total = g_slist_length(msglist);
+
+	for (cur = msglist; cur != NULL; cur = cur->next) {
+		MsgInfo *msginfo = (MsgInfo *)cur->data;
+		guint32 uid32 = (guint32)msginfo->msgnum;
+
+		count++;
+
+		g_snprintf(nstr, sizeof(nstr), "%u", uid32);
+		filename = g_strconcat(path, G_DIR_SEPARATOR_S, nstr, NULL);
+		if (is_file_exist(filename)) {
+			g_free(filename);
+			continue;
+		}
+
+		status_print(_("Getting message %u"), uid32);
+		debug_print("getting message %u...\n", uid32);
+		progress_show(count, total);
+		ui_update();
+
+		ok = imap_cmd_queue_send(session, uid32, filename,
+					 "UID FETCH %u BODY.PEEK[]", uid32);
+		g_free(filename);
+		if (ok == IMAP_SUCCESS)
+			ok = imap_cmd_queue_wait(session,
+						 IMAP_PIPELINE_WINDOW - 1);
+		if (ok != IMAP_SUCCESS)
+			break;
+	}
+
+	if (imap_cmd_queue_wait(session, 0) != IMAP_SUCCESS)
+		ok = IMAP_ERROR;
+
+	progress_show(0, 0);
+	g_free(path);
+
+	return ok == IMAP_SUCCESS ? 0 : -1;
+}
+
 static MsgInfo *imap_get_msginfo(Folder *folder, FolderItem *item, gint uid)
 {
 	IMAPSession *session;
@@ -1367,6 +1826,7 @@ static gint imap_add_msgs(Folder *folder, FolderItem *dest, GSList *file_list,
 	for (cur = file_list; cur != NULL; cur = cur->next) {
 		IMAPFlags iflags = 0;
 		guint32 new_uid = 0;
+		gint new_size = 0;
 
 		fileinfo = (MsgFileInfo *)cur->data;
 
@@ -1397,7 +1857,7 @@ static gint imap_add_msgs(Folder *folder, FolderItem *dest, GSList *file_list,
 		++count;
 
 		ok = imap_cmd_append(session, destdir, fileinfo->file, iflags,
-				     &new_uid);
+				     &new_uid, &new_size);
 
 		if (ok != IMAP_SUCCESS) {
 			g_warning("can't append message %s\n", fileinfo->file);
@@ -1411,6 +1871,18 @@ static gint imap_add_msgs(Folder *folder, FolderItem *dest, GSList *file_list,
 		else if (last_uid < new_uid)
 			last_uid = new_uid;
 
+		/* the server reports the size of the canonicalized message
+		   as RFC822.SIZE, and the cached messages have no mtime */
+		if (new_uid > 0) {
+			MsgFlags flags = {0, 0};
+
+			if (fileinfo->flags)
+				flags = *fileinfo->flags;
+			body_index_add_msg_file_full(dest, new_uid,
+						     fileinfo->file, new_size,
+						     0, flags);
+		}
+
 		dest->last_num = last_uid;
 		dest->total++;
 		dest->updated = TRUE;
@@ -1525,15 +1997,21 @@ static gint imap_do_copy_msgs(Folder *folder, FolderItem *dest, GSList *msglist,
 		ui_update();
 
 		ok = imap_cmd_copy(session, seq_set, destdir);
-		if (ok != IMAP_SUCCESS) {
-			imap_seq_set_free(seq_list);
-			progress_show(0, 0);
-			return -1;
-		}
+		if (ok != IMAP_SUCCESS)
+			break;
 	}
 
+	if (imap_cmd_queue_wait(session, 0) != IMAP_SUCCESS)
+		ok = IMAP_ERROR;
+
 	progress_show(0, 0);
 
+	if (ok != IMAP_SUCCESS) {
+		imap_seq_set_free(seq_list);
+		g_free(destdir);
+		return -1;
+	}
+
 	dest->updated = TRUE;
 
 	imap_seq_set_free(seq_list);
@@ -1662,10 +2140,17 @@ static gint imap_remove_msgs_by_seq_set(Folder *folder, FolderItem *item,
 		if (ok != IMAP_SUCCESS) {
 			log_warning(_("can't set deleted flags: %s\n"),
 				    seq_set);
+			imap_cmd_queue_wait(session, 0);
 			return ok;
 		}
 	}
 
+	ok = imap_cmd_queue_wait(session, 0);
+	if (ok != IMAP_SUCCESS) {
+		log_warning(_("can't set deleted flags\n"));
+		return ok;
+	}
+
 	ok = imap_cmd_expunge(session);
 	if (ok != IMAP_SUCCESS)
 		log_warning(_("can't expunge\n"));
@@ -1722,6 +2207,7 @@ static gint imap_remove_msgs(Folder *folder, FolderItem *item, GSList *msglist)
 
 		if (dir_exist)
 			remove_numbered_files(dir, uid, uid);
+		body_index_remove_msg(item, uid);
 		item->total--;
 		if (MSG_IS_NEW(msginfo->flags))
 			item->new--;
@@ -1774,6 +2260,8 @@ static gint imap_remove_all_msg(Folder *folder, FolderItem *item)
 	item->new = item->unread = item->total = 0;
 	item->updated = TRUE;
 
+	body_index_remove_all(item);
+
 	dir = folder_item_get_path(item);
 	if (is_dir_exist(dir))
 		remove_all_numbered_files(dir);
@@ -1846,40 +2334,154 @@ static gint imap_scan_folder(Folder *folder, FolderItem *item)
 	return 0;
 }
 
-static gint imap_scan_tree(Folder *folder)
+typedef struct _IMAPStatusData
 {
-	FolderItem *item = NULL;
-	IMAPSession *session;
-	gchar *root_folder = NULL;
-	GSList *item_list, *cur;
+	IMAPFolder *folder;
+	FolderItem *item;
+	GPtrArray *argbuf;
+} IMAPStatusData;
 
-	g_return_val_if_fail(folder != NULL, -1);
-	g_return_val_if_fail(folder->account != NULL, -1);
+static gint imap_status_send_func(IMAPSession *session, gpointer data)
+{
+	IMAPStatusData *status_data = (IMAPStatusData *)data;
 
-	session = imap_session_get(folder);
-	if (!session) {
-		if (!folder->node) {
-			folder_tree_destroy(folder);
-			item = folder_item_new(folder->name, NULL);
-			item->folder = folder;
-			folder->node = item->node = g_node_new(item);
-		}
-		return -1;
-	}
+	return imap_cmd_status(session, status_data->folder,
+			       status_data->item->path);
+}
 
-	if (folder->account->imap_dir && *folder->account->imap_dir) {
-		gchar *real_path;
-		GPtrArray *argbuf;
-		gint ok;
+static gint imap_status_recv_func(IMAPSession *session, gpointer data)
+{
+	IMAPStatusData *status_data = (IMAPStatusData *)data;
 
-		Xstrdup_a(root_folder, folder->account->imap_dir, return -1);
-		extract_quote(root_folder, '"');
-		subst_char(root_folder,
-			   imap_get_path_separator(IMAP_FOLDER(folder),
-						   root_folder),
-			   '/');
-		strtailchomp(root_folder, '/');
-		real_path = imap_get_real_path
+	return imap_cmd_ok_real(session, status_data->argbuf);
+}
+
+static gint imap_scan_folder_list_progress_func(IMAPSession *session,
+						gint count, gint total,
+						gpointer data)
+{
+	status_print(_("Scanning folders (%d / %d)"), count, total);
+	progress_show(count, total);
+#ifndef USE_THREADS
+	ui_update();
+#endif
+	return 0;
+}
+
+/* Same as imap_scan_folder() for each item of item_list, but STATUS
+   commands are issued in parallel on the sessions of the pool. The
+   results are stored to the items in the main thread. */
+gint imap_scan_folder_list(Folder *folder, GSList *item_list)
+{
+	IMAPSession **sessions;
+	IMAPPoolJob *jobs;
+	IMAPStatusData *status_data;
+	GSList *cur;
+	gint n_sessions, n_jobs, i;
+	gint messages, recent, unseen;
+	guint32 uid_next, uid_validity;
+	gint ret = 0;
+
+	g_return_val_if_fail(folder != NULL, -1);
+	g_return_val_if_fail(FOLDER_TYPE(folder) == F_IMAP, -1);
+
+	n_jobs = g_slist_length(item_list);
+	if (n_jobs == 0)
+		return 0;
+
+	sessions = g_new0(IMAPSession *, IMAP_MAX_SESSIONS);
+	n_sessions = imap_session_pool_get
+		(folder, sessions, MIN(IMAP_MAX_SESSIONS, n_jobs));
+	if (n_sessions == 0) {
+		g_free(sessions);
+		return -1;
+	}
+
+	jobs = g_new0(IMAPPoolJob, n_jobs);
+	status_data = g_new0(IMAPStatusData, n_jobs);
+
+	for (cur = item_list, i = 0; cur != NULL; cur = cur->next, i++) {
+		status_data[i].folder = IMAP_FOLDER(folder);
+		status_data[i].item = FOLDER_ITEM(cur->data);
+		status_data[i].argbuf = g_ptr_array_new();
+		jobs[i].send_func = imap_status_send_func;
+		jobs[i].recv_func = imap_status_recv_func;
+		jobs[i].data = &status_data[i];
+		jobs[i].weight = 1;
+	}
+
+	imap_session_pool_run(sessions, n_sessions, jobs, n_jobs,
+			      imap_scan_folder_list_progress_func, NULL);
+	progress_show(0, 0);
+
+	for (i = 0; i < n_jobs; i++) {
+		FolderItem *item = status_data[i].item;
+		gint ok = jobs[i].retval;
+
+		if (ok == IMAP_SUCCESS)
+			ok = imap_parse_status(status_data[i].argbuf,
+					       &messages, &recent, &uid_next,
+					       &uid_validity, &unseen);
+		else {
+			log_warning(_("error on imap command: STATUS\n"));
+			if (ok == IMAP_SOCKET || ok == IMAP_IOERR)
+				ret = -1;
+		}
+
+		if (ok == IMAP_SUCCESS) {
+			item->new = unseen > 0 ? recent : 0;
+			item->unread = unseen;
+			item->total = messages;
+			item->last_num = (messages > 0 && uid_next > 0)
+				? uid_next - 1 : 0;
+			item->updated = TRUE;
+		}
+
+		ptr_array_free_strings(status_data[i].argbuf);
+		g_ptr_array_free(status_data[i].argbuf, TRUE);
+	}
+
+	g_free(status_data);
+	g_free(jobs);
+	g_free(sessions);
+
+	return ret;
+}
+
+static gint imap_scan_tree(Folder *folder)
+{
+	FolderItem *item = NULL;
+	IMAPSession *session;
+	gchar *root_folder = NULL;
+	GSList *item_list, *cur;
+
+	g_return_val_if_fail(folder != NULL, -1);
+	g_return_val_if_fail(folder->account != NULL, -1);
+
+	session = imap_session_get(folder);
+	if (!session) {
+		if (!folder->node) {
+			folder_tree_destroy(folder);
+			item = folder_item_new(folder->name, NULL);
+			item->folder = folder;
+			folder->node = item->node = g_node_new(item);
+		}
+		return -1;
+	}
+
+	if (folder->account->imap_dir && *folder->account->imap_dir) {
+		gchar *real_path;
+		GPtrArray *argbuf;
+		gint ok;
+
+		Xstrdup_a(root_folder, folder->account->imap_dir, return -1);
+		extract_quote(root_folder, '"');
+		subst_char(root_folder,
+			   imap_get_path_separator(IMAP_FOLDER(folder),
+						   root_folder),
+			   '/');
+		strtailchomp(root_folder, '/');
+		real_path = imap_get_real_path
 			(IMAP_FOLDER(folder), root_folder);
 		debug_print("IMAP root directory: %s\n", real_path);
 
@@ -2632,6 +3234,7 @@ static gint imap_remove_folder(Folder *folder, FolderItem *item)
 	}
 
 	g_free(path);
+	body_index_remove_all(item);
 	cache_dir = folder_item_get_path(item);
 	if (is_dir_exist(cache_dir) && remove_dir_recursive(cache_dir) < 0)
 		g_warning("can't remove directory '%s'\n", cache_dir);
@@ -2647,6 +3250,8 @@ typedef struct _IMAPGetData
 	gint exists;
 	gboolean update_count;
 	GSList *newlist;
+	guint32 first_uid;
+	guint32 last_uid;
 } IMAPGetData;
 
 static gint imap_get_uncached_messages_progress_func(IMAPSession *session,
@@ -2799,6 +3404,111 @@ static GSList *imap_get_uncached_messages(IMAPSession *session,
 	return get_data.newlist;
 }
 
+static gint imap_get_uncached_messages_send_func(IMAPSession *session,
+						 gpointer data)
+{
+	IMAPGetData *get_data = (IMAPGetData *)data;
+	gchar seq_set[22];
+
+	g_snprintf(seq_set, sizeof(seq_set), "%u:%u",
+		   get_data->first_uid, get_data->last_uid);
+	return imap_cmd_envelope(session, seq_set);
+}
+
+/* Get the headers of the messages uids[begin] ... uids[uids->len - 1].
+   If there are many, they are split into ranges which are fetched in
+   parallel on the sessions of the pool. */
+static GSList *imap_get_uncached_messages_pool(IMAPSession *session,
+					       FolderItem *item,
+					       GArray *uids, guint begin)
+{
+	IMAPSession **sessions;
+	IMAPPoolJob *jobs;
+	IMAPGetData *get_data;
+	GSList *newlist = NULL;
+	GSList *cur;
+	guint count;
+	guint first, last;
+	gint n_sessions, i;
+
+	g_return_val_if_fail(uids != NULL, NULL);
+	g_return_val_if_fail(begin < uids->len, NULL);
+
+	count = uids->len - begin;
+
+	if (count < IMAP_POOL_FETCH_MIN || IMAP_MAX_SESSIONS < 2)
+		return imap_get_uncached_messages
+			(session, item, g_array_index(uids, guint32, begin),
+			 g_array_index(uids, guint32, uids->len - 1),
+			 count, TRUE);
+
+	sessions = g_new0(IMAPSession *, IMAP_MAX_SESSIONS);
+	n_sessions = imap_session_pool_get(item->folder, sessions,
+					   IMAP_MAX_SESSIONS);
+
+	/* the other sessions must have the folder selected */
+	for (i = 1; i < n_sessions; i++) {
+		if (imap_select(sessions[i], IMAP_FOLDER(item->folder),
+				item->path, NULL, NULL, NULL, NULL)
+		    != IMAP_SUCCESS) {
+			sessions[i--] = sessions[--n_sessions];
+		}
+	}
+
+	if (n_sessions < 2) {
+		g_free(sessions);
+		return imap_get_uncached_messages
+			(session, item, g_array_index(uids, guint32, begin),
+			 g_array_index(uids, guint32, uids->len - 1),
+			 count, TRUE);
+	}
+
+	jobs = g_new0(IMAPPoolJob, n_sessions);
+	get_data = g_new0(IMAPGetData, n_sessions);
+
+	for (i = 0; i < n_sessions; i++) {
+		first = begin + (guint64)count * i / n_sessions;
+		last = begin + (guint64)count * (i + 1) / n_sessions - 1;
+
+		get_data[i].item = item;
+		get_data[i].exists = last - first + 1;
+		get_data[i].update_count = FALSE;
+		get_data[i].first_uid = g_array_index(uids, guint32, first);
+		get_data[i].last_uid = g_array_index(uids, guint32, last);
+		jobs[i].send_func = imap_get_uncached_messages_send_func;
+		jobs[i].recv_func = imap_get_uncached_messages_func;
+		jobs[i].data = &get_data[i];
+		jobs[i].weight = get_data[i].exists;
+	}
+
+	imap_session_pool_run(sessions, n_sessions, jobs, n_sessions,
+			      imap_get_uncached_messages_progress_func, NULL);
+	progress_show(0, 0);
+
+	/* the counts of the item are updated in the main thread */
+	for (i = 0; i < n_sessions; i++) {
+		if (jobs[i].retval != IMAP_SUCCESS)
+			log_warning(_("can't get envelope\n"));
+
+		for (cur = get_data[i].newlist; cur != NULL; cur = cur->next) {
+			MsgInfo *msginfo = (MsgInfo *)cur->data;
+
+			if (MSG_IS_NEW(msginfo->flags))
+				item->new++;
+			if (MSG_IS_UNREAD(msginfo->flags))
+				item->unread++;
+			item->total++;
+		}
+		newlist = g_slist_concat(newlist, get_data[i].newlist);
+	}
+
+	g_free(get_data);
+	g_free(jobs);
+	g_free(sessions);
+
+	return newlist;
+}
+
 static void imap_delete_cached_message(FolderItem *item, guint32 uid)
 {
 	gchar *dir;
@@ -3380,6 +4090,9 @@ static MsgInfo *imap_parse_envelope(IMAPSession *session, FolderItem *item,
 		} else if (!strncmp(cur_pos, "RFC822.SIZE ", 12)) {
 			cur_pos += 12;
 			size = strtol(cur_pos, &cur_pos, 10);
+		} else if (!strncmp(cur_pos, "MODSEQ (", 8)) {
+			cur_pos += 8;
+			PARSE_ONE_ELEMENT(')');
 		} else if (!strncmp(cur_pos, "RFC822.HEADER", 13)) {
 			gchar *headers;
 
@@ -3463,6 +4176,9 @@ static gint imap_msg_list_change_perm_flags(GSList *msglist, MsgPermFlags flags,
 		}
 	}
 
+	if (imap_cmd_queue_wait(session, 0) != IMAP_SUCCESS)
+		ok = IMAP_ERROR;
+
 	imap_seq_set_free(seq_list);
 
 	return ok;
@@ -3537,14 +4253,22 @@ gint imap_msg_list_set_colorlabel_flags(GSList *msglist, guint color)
 		ok = imap_cmd_store(session, seq_set,
 				    "-FLAGS.SILENT ($label1 $label2 $label3 $label4 $label5 $label6 $label7)");
 		if (ok != IMAP_SUCCESS) break;
+	}
 
-		if (iflags) {
-			ok = imap_set_message_flags(session, seq_set, iflags,
-						    TRUE);
-			if (ok != IMAP_SUCCESS) break;
-		}
+	/* the labels must be removed before setting the new one */
+	if (imap_cmd_queue_wait(session, 0) != IMAP_SUCCESS)
+		ok = IMAP_ERROR;
+
+	for (cur = seq_list; cur != NULL && iflags && ok == IMAP_SUCCESS;
+	     cur = cur->next) {
+		gchar *seq_set = (gchar *)cur->data;
+
+		ok = imap_set_message_flags(session, seq_set, iflags, TRUE);
 	}
 
+	if (imap_cmd_queue_wait(session, 0) != IMAP_SUCCESS)
+		ok = IMAP_ERROR;
+
 	imap_seq_set_free(seq_list);
 
 	return ok;
@@ -3633,42 +4357,39 @@ static gint imap_select(IMAPSession *session, IMAPFolder *folder,
 
 #define THROW(err) { ok = err; goto catch; }
 
-static gint imap_status(IMAPSession *session, IMAPFolder *folder,
-			const gchar *path,
-			gint *messages, gint *recent,
-			guint32 *uid_next, guint32 *uid_validity,
-			gint *unseen)
+static gint imap_cmd_status(IMAPSession *session, IMAPFolder *folder,
+			    const gchar *path)
 {
 	gchar *real_path;
 	gchar *real_path_;
 	gint ok;
-	GPtrArray *argbuf = NULL;
-	gchar *str;
-
-	if (messages && recent && uid_next && uid_validity && unseen) {
-		*messages = *recent = *uid_next = *uid_validity = *unseen = 0;
-		argbuf = g_ptr_array_new();
-	}
 
 	real_path = imap_get_real_path(folder, path);
 	QUOTE_IF_REQUIRED(real_path_, real_path);
 	ok = imap_cmd_gen_send(session, "STATUS %s "
 			       "(MESSAGES RECENT UIDNEXT UIDVALIDITY UNSEEN)",
 			       real_path_);
-	if (ok != IMAP_SUCCESS) {
-		log_warning("error on sending imap command: STATUS\n");
-		THROW(ok);
-	}
-	ok = imap_cmd_ok(session, argbuf);
 	if (ok != IMAP_SUCCESS)
-		log_warning(_("error on imap command: STATUS\n"));
-	if (ok != IMAP_SUCCESS || !argbuf) THROW(ok);
+		log_warning("error on sending imap command: STATUS\n");
+	g_free(real_path);
+
+	return ok;
+}
+
+static gint imap_parse_status(GPtrArray *argbuf,
+			      gint *messages, gint *recent,
+			      guint32 *uid_next, guint32 *uid_validity,
+			      gint *unseen)
+{
+	gchar *str;
+
+	*messages = *recent = *uid_next = *uid_validity = *unseen = 0;
 
 	str = search_array_str(argbuf, "STATUS");
-	if (!str) THROW(IMAP_ERROR);
+	if (!str) return IMAP_ERROR;
 
 	str = strchr(str, '(');
-	if (!str) THROW(IMAP_ERROR);
+	if (!str) return IMAP_ERROR;
 	str++;
 	while (*str != '\0' && *str != ')') {
 		while (*str == ' ') str++;
@@ -3694,8 +4415,34 @@ static gint imap_status(IMAPSession *session, IMAPFolder *folder,
 		}
 	}
 
+	return IMAP_SUCCESS;
+}
+
+static gint imap_status(IMAPSession *session, IMAPFolder *folder,
+			const gchar *path,
+			gint *messages, gint *recent,
+			guint32 *uid_next, guint32 *uid_validity,
+			gint *unseen)
+{
+	gint ok;
+	GPtrArray *argbuf = NULL;
+
+	if (messages && recent && uid_next && uid_validity && unseen) {
+		*messages = *recent = *uid_next = *uid_validity = *unseen = 0;
+		argbuf = g_ptr_array_new();
+	}
+
+	ok = imap_cmd_status(session, folder, path);
+	if (ok != IMAP_SUCCESS) THROW(ok);
+	ok = imap_cmd_ok(session, argbuf);
+	if (ok != IMAP_SUCCESS)
+		log_warning(_("error on imap command: STATUS\n"));
+	if (ok != IMAP_SUCCESS || !argbuf) THROW(ok);
+
+	ok = imap_parse_status(argbuf, messages, recent, uid_next,
+			       uid_validity, unseen);
+
 catch:
-	g_free(real_path);
 	if (argbuf) {
 		ptr_array_free_strings(argbuf);
 		g_ptr_array_free(argbuf, TRUE);
@@ -3736,7 +4483,6 @@ static gint imap_cmd_capability(IMAPSession *session)
 {
 	gint ok;
 	GPtrArray *argbuf;
-	gchar *capability;
 
 	argbuf = g_ptr_array_new();
 
@@ -3744,22 +4490,78 @@ static gint imap_cmd_capability(IMAPSession *session)
 		THROW(ok);
 	if ((ok = imap_cmd_ok(session, argbuf)) != IMAP_SUCCESS) THROW(ok);
 
-	capability = search_array_str(argbuf, "CAPABILITY ");
-	if (!capability) THROW(IMAP_ERROR);
+	if (!imap_parse_capability(session, argbuf)) THROW(IMAP_ERROR);
 
-	capability += strlen("CAPABILITY ");
+catch:
+	ptr_array_free_strings(argbuf);
+	g_ptr_array_free(argbuf, TRUE);
+
+	return ok;
+}
+
+#undef THROW
+
+/* Take the capabilities from an untagged CAPABILITY response or from a
+   [CAPABILITY ...] response code. Returns FALSE if there is neither. */
+static gboolean imap_parse_capability(IMAPSession *session,
+				      GPtrArray *argbuf)
+{
+	gchar *capability;
+	gchar *p = NULL;
+	gint i;
+
+	capability = search_array_str(argbuf, "CAPABILITY ");
+	if (capability) {
+		capability = g_strdup(capability + strlen("CAPABILITY "));
+	} else {
+		for (i = 0; i < argbuf->len; i++) {
+			p = strstr(g_ptr_array_index(argbuf, i),
+				   "OK [CAPABILITY ");
+			if (p)
+				break;
+		}
+		if (!p || !strchr(p, ']'))
+			return FALSE;
+		p += strlen("OK [CAPABILITY ");
+		capability = g_strndup(p, strchr(p, ']') - p);
+	}
 
 	imap_capability_free(session);
 	session->capability = g_strsplit(capability, " ", -1);
+	g_free(capability);
+
+	return TRUE;
+}
+
+/* Wait for the response of LOGIN or AUTHENTICATE, and remember whether
+   the server sent its new capabilities with it. */
+static gint imap_cmd_auth_ok(IMAPSession *session)
+{
+	GPtrArray *argbuf;
+	gint ok;
+
+	argbuf = g_ptr_array_new();
+
+	ok = imap_cmd_ok(session, argbuf);
+	if (ok == IMAP_SUCCESS && imap_parse_capability(session, argbuf))
+		((IMAPRealSession *)session)->login_capability = TRUE;
 
-catch:
 	ptr_array_free_strings(argbuf);
 	g_ptr_array_free(argbuf, TRUE);
 
 	return ok;
 }
 
-#undef THROW
+static gint imap_cmd_enable(IMAPSession *session, const gchar *capability)
+{
+	gint ok;
+
+	ok = imap_cmd_gen_send(session, "ENABLE %s", capability);
+	if (ok == IMAP_SUCCESS)
+		ok = imap_cmd_ok(session, NULL);
+
+	return ok;
+}
 
 static gint imap_cmd_auth_plain(IMAPSession *session, const gchar *user,
 				const gchar *pass)
@@ -3783,7 +4585,7 @@ static gint imap_cmd_auth_plain(IMAPSession *session, const gchar *user,
 
 	log_print("IMAP4> ****************\n");
 	sock_puts(SESSION(session)->sock, response64);
-	ok = imap_cmd_ok(session, NULL);
+	ok = imap_cmd_auth_ok(session);
 	if (ok != IMAP_SUCCESS)
 		log_warning(_("IMAP4 authentication failed.\n"));
 	g_free(response64);
@@ -3818,7 +4620,7 @@ static gint imap_cmd_auth_cram_md5(IMAPSession *session, const gchar *user,
 
 	log_print("IMAP> %s\n", response64);
 	sock_puts(SESSION(session)->sock, response64);
-	ok = imap_cmd_ok(session, NULL);
+	ok = imap_cmd_auth_ok(session);
 	if (ok != IMAP_SUCCESS)
 		log_warning(_("IMAP4 authentication failed.\n"));
 
@@ -3871,7 +4673,7 @@ static gint imap_cmd_login(IMAPSession *session,
 	QUOTE_IF_REQUIRED(pass_, pass);
 	ok = imap_cmd_gen_send(session, "LOGIN %s %s", user_, pass_);
 	if (ok == IMAP_SUCCESS)
-		ok = imap_cmd_ok(session, NULL);
+		ok = imap_cmd_auth_ok(session);
 	if (ok != IMAP_SUCCESS)
 		log_warning(_("IMAP4 login failed.\n"));
 
@@ -3960,6 +4762,7 @@ static gint imap_cmd_do_select(IMAPSession *session, const gchar *folder,
 	guint uid_validity_;
 
 	*exists = *recent = *unseen = *uid_validity = 0;
+	((IMAPRealSession *)session)->highest_modseq = 0;
 	argbuf = g_ptr_array_new();
 
 	if (examine)
@@ -4007,6 +4810,13 @@ static gint imap_cmd_do_select(IMAPSession *session, const gchar *folder,
 		}
 	}
 
+	resp_str = search_array_contain_str(argbuf, "[HIGHESTMODSEQ ");
+	if (resp_str) {
+		resp_str = strstr(resp_str, "[HIGHESTMODSEQ ");
+		((IMAPRealSession *)session)->highest_modseq =
+			g_ascii_strtoull(resp_str + 15, NULL, 10);
+	}
+
 catch:
 	ptr_array_free_strings(argbuf);
 	g_ptr_array_free(argbuf, TRUE);
@@ -4231,7 +5041,7 @@ static void imap_get_date_time(gchar *buf, size_t len, time_t timer)
 
 static gint imap_cmd_append(IMAPSession *session, const gchar *destfolder,
 			    const gchar *file, IMAPFlags flags,
-			    guint32 *new_uid)
+			    guint32 *new_uid, gint *new_size)
 {
 	gint ok;
 	MsgInfo *msginfo;
@@ -4266,6 +5076,8 @@ static gint imap_cmd_append(IMAPSession *session, const gchar *destfolder,
 	fclose(fp);
 	if (!tmp)
 		return -1;
+	if (new_size != NULL)
+		*new_size = size;
 
 	QUOTE_IF_REQUIRED(destfolder_, destfolder);
 	flag_str = imap_get_flag_str(flags);
@@ -4339,6 +5151,8 @@ static gint imap_cmd_append(IMAPSession *session, const gchar *destfolder,
 	return ok;
 }
 
+/* pipelined: imap_cmd_queue_wait(session, 0) must be called after the
+   last one */
 static gint imap_cmd_copy(IMAPSession *session, const gchar *seq_set,
 			  const gchar *destfolder)
 {
@@ -4348,13 +5162,10 @@ static gint imap_cmd_copy(IMAPSession *session, const gchar *seq_set,
 	g_return_val_if_fail(destfolder != NULL, IMAP_ERROR);
 
 	QUOTE_IF_REQUIRED(destfolder_, destfolder);
-	ok = imap_cmd_gen_send(session, "UID COPY %s %s", seq_set, destfolder_);
+	ok = imap_cmd_queue_send(session, 0, NULL, "UID COPY %s %s",
+				 seq_set, destfolder_);
 	if (ok == IMAP_SUCCESS)
-		ok = imap_cmd_ok(session, NULL);
-	if (ok != IMAP_SUCCESS) {
-		log_warning(_("can't copy %s to %s\n"), seq_set, destfolder_);
-		return -1;
-	}
+		ok = imap_cmd_queue_wait(session, IMAP_PIPELINE_WINDOW - 1);
 
 	return ok;
 }
@@ -4366,21 +5177,19 @@ gint imap_cmd_envelope(IMAPSession *session, const gchar *seq_set)
 		 seq_set);
 }
 
+/* pipelined: imap_cmd_queue_wait(session, 0) must be called after the
+   last one */
 static gint imap_cmd_store(IMAPSession *session, const gchar *seq_set,
 			   const gchar *sub_cmd)
 {
 	gint ok;
 
-	ok = imap_cmd_gen_send(session, "UID STORE %s %s", seq_set, sub_cmd);
+	ok = imap_cmd_queue_send(session, 0, NULL, "UID STORE %s %s",
+				 seq_set, sub_cmd);
 	if (ok == IMAP_SUCCESS)
-		ok = imap_cmd_ok(session, NULL);
-	if (ok != IMAP_SUCCESS) {
-		log_warning(_("error while imap command: STORE %s %s\n"),
-			    seq_set, sub_cmd);
-		return ok;
-	}
+		ok = imap_cmd_queue_wait(session, IMAP_PIPELINE_WINDOW - 1);
 
-	return IMAP_SUCCESS;
+	return ok;
 }
 
 static gint imap_cmd_expunge(IMAPSession *session)
@@ -4503,6 +5312,222 @@ static gint imap_cmd_ok(IMAPSession *session, GPtrArray *argbuf)
 #endif
 }
 
+/* Send a command without waiting for the response. uid and filename
+   are given for UID FETCH <uid> BODY.PEEK[], to which the literal of
+   the message is written. */
+static gint imap_cmd_queue_send(IMAPSession *session, guint32 uid,
+				const gchar *filename, const gchar *format, ...)
+{
+	IMAPRealSession *real = (IMAPRealSession *)session;
+	IMAPQueuedCmd *qcmd;
+	gchar *cmd;
+	va_list args;
+	gint ok;
+
+	va_start(args, format);
+	cmd = g_strdup_vprintf(format, args);
+	va_end(args);
+
+	ok = imap_cmd_gen_send(session, "%s", cmd);
+	if (ok != IMAP_SUCCESS) {
+		g_free(cmd);
+		return ok;
+	}
+
+	qcmd = g_new0(IMAPQueuedCmd, 1);
+	qcmd->tag = session->cmd_count;
+	qcmd->cmd = cmd;
+	qcmd->uid = uid;
+	qcmd->filename = g_strdup(filename);
+	g_queue_push_tail(real->cmd_queue, qcmd);
+
+	return IMAP_SUCCESS;
+}
+
+static void imap_queued_cmd_free(IMAPQueuedCmd *qcmd)
+{
+	g_free(qcmd->filename);
+	g_free(qcmd->cmd);
+	g_free(qcmd);
+}
+
+static void imap_cmd_queue_clear(IMAPSession *session)
+{
+	IMAPRealSession *real = (IMAPRealSession *)session;
+	IMAPQueuedCmd *qcmd;
+
+	while ((qcmd = g_queue_pop_head(real->cmd_queue)) != NULL)
+		imap_queued_cmd_free(qcmd);
+}
+
+static IMAPQueuedCmd *imap_cmd_queue_find(IMAPSession *session, gint tag)
+{
+	IMAPRealSession *real = (IMAPRealSession *)session;
+	GList *cur;
+
+	for (cur = real->cmd_queue->head; cur != NULL; cur = cur->next) {
+		IMAPQueuedCmd *qcmd = (IMAPQueuedCmd *)cur->data;
+
+		if (qcmd->tag == tag)
+			return qcmd;
+	}
+
+	return NULL;
+}
+
+/* if uid is 0 (UID was not sent before the literal), the oldest fetch
+   is assumed */
+static IMAPQueuedCmd *imap_cmd_queue_find_fetch(IMAPSession *session,
+						guint32 uid)
+{
+	IMAPRealSession *real = (IMAPRealSession *)session;
+	GList *cur;
+
+	for (cur = real->cmd_queue->head; cur != NULL; cur = cur->next) {
+		IMAPQueuedCmd *qcmd = (IMAPQueuedCmd *)cur->data;
+
+		if (qcmd->filename && !qcmd->fetched &&
+		    (uid == 0 || qcmd->uid == uid))
+			return qcmd;
+	}
+
+	return NULL;
+}
+
+/* Receive the responses until one of the queued commands completes.
+   The tagged responses may arrive in any order. */
+static gint imap_cmd_queue_recv_real(IMAPSession *session,
+				     IMAPQueuedCmd **ret)
+{
+	IMAPRealSession *real = (IMAPRealSession *)session;
+	IMAPQueuedCmd *qcmd;
+	gchar *buf;
+	gchar *p;
+	gchar obuf[32];
+	gchar cmd_status[IMAPBUFSIZE + 1];
+	gint cmd_num;
+	glong len;
+	guint32 uid;
+	gboolean in_untagged = FALSE;
+	gint ok;
+
+	*ret = NULL;
+
+	while ((ok = imap_cmd_gen_recv(session, &buf)) == IMAP_SUCCESS) {
+		if (in_untagged || (buf[0] == '*' && buf[1] == ' ')) {
+			in_untagged = FALSE;
+			if (!(p = strrchr_with_skip_quote(buf, '"', '{'))) {
+				g_free(buf);
+				continue;
+			}
+
+			/* literal */
+			p = strchr_cpy(p + 1, '}', obuf, sizeof(obuf));
+			len = atol(obuf);
+			if (len < 0 || p == NULL || *p != '\0') {
+				g_free(buf);
+				return IMAP_ERROR;
+			}
+
+			qcmd = NULL;
+			if (strstr(buf, "FETCH") && strstr(buf, "BODY[]")) {
+				uid = 0;
+				if ((p = strstr(buf, "UID ")) != NULL)
+					uid = strtoul(p + 4, NULL, 10);
+				qcmd = imap_cmd_queue_find_fetch(session, uid);
+			}
+			g_free(buf);
+
+			if (qcmd) {
+				gint r;
+
+				r = recv_bytes_write_to_file
+					(SESSION(session)->sock, len,
+					 qcmd->filename);
+				if (r == -2)
+					return IMAP_SOCKET;
+				qcmd->fetched = (r == 0);
+			} else {
+				gchar *literal;
+
+				literal = recv_bytes(SESSION(session)->sock,
+						     len);
+				if (!literal)
+					return IMAP_SOCKET;
+				g_free(literal);
+			}
+
+			/* the rest of the response follows */
+			in_untagged = TRUE;
+			continue;
+		}
+
+		if (sscanf(buf, "%d %" Xstr(IMAPBUFSIZE) "s",
+			   &cmd_num, cmd_status) < 2 ||
+		    (qcmd = imap_cmd_queue_find(session, cmd_num)) == NULL) {
+			g_free(buf);
+			return IMAP_ERROR;
+		}
+		g_free(buf);
+
+		g_queue_remove(real->cmd_queue, qcmd);
+		*ret = qcmd;
+
+		if (strcmp(cmd_status, "OK") != 0 ||
+		    (qcmd->filename && !qcmd->fetched))
+			return IMAP_ERROR;
+		return IMAP_SUCCESS;
+	}
+
+	return ok;
+}
+
+#if USE_THREADS
+static gint imap_cmd_queue_recv_func(IMAPSession *session, gpointer data)
+{
+	return imap_cmd_queue_recv_real(session, (IMAPQueuedCmd **)data);
+}
+#endif
+
+static gint imap_cmd_queue_recv(IMAPSession *session, IMAPQueuedCmd **qcmd)
+{
+#if USE_THREADS
+	return imap_thread_run(session, imap_cmd_queue_recv_func, qcmd);
+#else
+	return imap_cmd_queue_recv_real(session, qcmd);
+#endif
+}
+
+/* Wait for the queued commands until at most max_pending of them
+   remain. Returns the first error. */
+static gint imap_cmd_queue_wait(IMAPSession *session, guint max_pending)
+{
+	IMAPRealSession *real = (IMAPRealSession *)session;
+	IMAPQueuedCmd *qcmd;
+	gint ok = IMAP_SUCCESS;
+	gint ret;
+
+	while (g_queue_get_length(real->cmd_queue) > max_pending) {
+		ret = imap_cmd_queue_recv(session, &qcmd);
+		if (!qcmd) {
+			/* the responses can't be matched any more */
+			imap_cmd_queue_clear(session);
+			return ret;
+		}
+		if (ret != IMAP_SUCCESS) {
+			log_warning(_("error while imap command: %s\n"),
+				    qcmd->cmd);
+			if (qcmd->filename && qcmd->fetched)
+				g_unlink(qcmd->filename);
+			if (ok == IMAP_SUCCESS)
+				ok = ret;
+		}
+		imap_queued_cmd_free(qcmd);
+	}
+
+	return ok;
+}
+
 static gint imap_cmd_gen_send(IMAPSession *session, const gchar *format, ...)
 {
 	IMAPRealSession *real = (IMAPRealSession *)session;
@@ -5020,11 +6045,10 @@ static void imap_thread_run_proxy(gpointer push_data, gpointer data)
 	debug_print("imap_thread_run_proxy (%p): thread_func done\n", g_thread_self());
 }
 
-static gint imap_thread_run(IMAPSession	*session, IMAPThreadFunc func,
-			    gpointer data)
+static gint imap_thread_start(IMAPSession *session, IMAPThreadFunc func,
+			      gpointer data)
 {
 	IMAPRealSession *real = (IMAPRealSession *)session;
-	gint ret;
 
 	if (real->is_running) {
 		g_warning("imap_thread_run: thread is already running");
@@ -5043,11 +6067,18 @@ static gint imap_thread_run(IMAPSession	*session, IMAPThreadFunc func,
 	real->thread_data = data;
 	real->flag = 0;
 	real->retval = 0;
+	real->prog_count = 0;
+	real->prog_total = 0;
 
 	g_thread_pool_push(real->pool, real, NULL);
 
-	while (g_atomic_int_get(&real->flag) == 0)
-		event_loop_iterate();
+	return IMAP_SUCCESS;
+}
+
+static gint imap_thread_finish(IMAPSession *session)
+{
+	IMAPRealSession *real = (IMAPRealSession *)session;
+	gint ret;
 
 	real->is_running = FALSE;
 	real->thread_func = NULL;
@@ -5055,6 +6086,25 @@ static gint imap_thread_run(IMAPSession	*session, IMAPThreadFunc func,
 	real->flag = 0;
 	ret = real->retval;
 	real->retval = 0;
+	real->prog_count = 0;
+	real->prog_total = 0;
+
+	return ret;
+}
+
+static gint imap_thread_run(IMAPSession	*session, IMAPThreadFunc func,
+			    gpointer data)
+{
+	IMAPRealSession *real = (IMAPRealSession *)session;
+	gint ret;
+
+	if (imap_thread_start(session, func, data) != IMAP_SUCCESS)
+		return IMAP_ERROR;
+
+	while (g_atomic_int_get(&real->flag) == 0)
+		event_loop_iterate();
+
+	ret = imap_thread_finish(session);
 	log_flush();
 
 	return ret;
@@ -5068,27 +6118,8 @@ static gint imap_thread_run_progress(IMAPSession *session, IMAPThreadFunc func,
 	gint prev_count = 0;
 	gint ret;
 
-	if (real->is_running) {
-		g_warning("imap_thread_run: thread is already running");
+	if (imap_thread_start(session, func, data) != IMAP_SUCCESS)
 		return IMAP_ERROR;
-	}
-
-	if (!real->pool) {
-		real->pool = g_thread_pool_new(imap_thread_run_proxy, real,
-					       -1, FALSE, NULL);
-		if (!real->pool)
-			return IMAP_ERROR;
-	}
-
-	real->is_running = TRUE;
-	real->thread_func = func;
-	real->thread_data = data;
-	real->flag = 0;
-	real->retval = 0;
-	real->prog_count = 0;
-	real->prog_total = 0;
-
-	g_thread_pool_push(real->pool, real, NULL);
 
 	while (g_atomic_int_get(&real->flag) == 0) {
 		event_loop_iterate();
@@ -5099,27 +6130,149 @@ static gint imap_thread_run_progress(IMAPSession *session, IMAPThreadFunc func,
 		}
 	}
 
-	real->is_running = FALSE;
-	real->thread_func = NULL;
-	real->thread_data = NULL;
-	real->flag = 0;
-	ret = real->retval;
-	real->retval = 0;
-	real->prog_count = 0;
-	real->prog_total = 0;
+	ret = imap_thread_finish(session);
 	log_flush();
 
 	return ret;
 }
 #endif /* USE_THREADS */
 
+/* Run the jobs on n_sessions sessions in parallel. A session that got
+   a connection error is not used for the rest of the jobs, and
+   marked as SESSION_ERROR so that imap_session_pool_get() drops it.
+   The result of each job is stored to its retval. */
+static gint imap_session_pool_run(IMAPSession **sessions, gint n_sessions,
+				  IMAPPoolJob *jobs, gint n_jobs,
+				  IMAPProgressFunc progress_func,
+				  gpointer data)
+{
+	gint total = 0, done = 0, prev_count = 0, count;
+	gint next = 0;
+	gint ok, i;
+#if USE_THREADS
+	IMAPPoolJob **running;
+	gint n_running = 0;
+#endif
+
+	g_return_val_if_fail(n_sessions > 0, IMAP_ERROR);
+
+	debug_print("imap_session_pool_run: %d jobs on %d sessions\n",
+		    n_jobs, n_sessions);
+
+	for (i = 0; i < n_jobs; i++)
+		total += jobs[i].weight;
+
+#define SET_SESSION_ERROR(session, ok)				\
+{								\
+	if (ok == IMAP_SOCKET || ok == IMAP_IOERR)		\
+		SESSION(session)->state = SESSION_ERROR;	\
+}
+
+#if USE_THREADS
+	running = g_new0(IMAPPoolJob *, n_sessions);
+
+	for (;;) {
+		for (i = 0; i < n_sessions; i++) {
+			while (running[i] == NULL && next < n_jobs &&
+			       SESSION(sessions[i])->state != SESSION_ERROR) {
+				IMAPPoolJob *job = &jobs[next++];
+
+				ok = job->send_func(sessions[i], job->data);
+				if (ok == IMAP_SUCCESS)
+					ok = imap_thread_start(sessions[i],
+							       job->recv_func,
+							       job->data);
+				if (ok == IMAP_SUCCESS) {
+					running[i] = job;
+					n_running++;
+				} else {
+					job->retval = ok;
+					done += job->weight;
+					SET_SESSION_ERROR(sessions[i], ok);
+				}
+			}
+		}
+
+		if (n_running == 0)
+			break;
+
+		event_loop_iterate();
+
+		count = done;
+		for (i = 0; i < n_sessions; i++) {
+			IMAPRealSession *real = (IMAPRealSession *)sessions[i];
+
+			if (running[i] == NULL)
+				continue;
+			if (g_atomic_int_get(&real->flag) == 0) {
+				count += real->prog_count;
+				continue;
+			}
+
+			ok = imap_thread_finish(sessions[i]);
+			running[i]->retval = ok;
+			done += running[i]->weight;
+			count += running[i]->weight;
+			running[i] = NULL;
+			n_running--;
+			SET_SESSION_ERROR(sessions[i], ok);
+		}
+
+		if (progress_func && count != prev_count && total > 0) {
+			progress_func(sessions[0], count, total, data);
+			prev_count = count;
+		}
+	}
+
+	g_free(running);
+	log_flush();
+
+	/* no usable session is left */
+	for (; next < n_jobs; next++)
+		jobs[next].retval = IMAP_SOCKET;
+#else
+	for (next = 0; next < n_jobs; next++) {
+		IMAPPoolJob *job = &jobs[next];
+
+		ok = job->send_func(sessions[0], job->data);
+		if (ok == IMAP_SUCCESS)
+			ok = job->recv_func(sessions[0], job->data);
+		job->retval = ok;
+		SET_SESSION_ERROR(sessions[0], ok);
+
+		done += job->weight;
+		count = done;
+		if (progress_func && count != prev_count && total > 0) {
+			progress_func(sessions[0], count, total, data);
+			prev_count = count;
+		}
+	}
+#endif
+
+#undef SET_SESSION_ERROR
+
+	for (i = 0; i < n_jobs; i++) {
+		if (jobs[i].retval != IMAP_SUCCESS)
+			return jobs[i].retval;
+	}
+
+	return IMAP_SUCCESS;
+}
+
 gboolean imap_is_session_active(IMAPFolder *folder)
 {
 #if USE_THREADS
 	IMAPRealSession *real;
+	GSList *cur;
 
 	g_return_val_if_fail(folder != NULL, FALSE);
 
+	for (cur = folder->pool_sessions; cur != NULL; cur = cur->next) {
+		real = (IMAPRealSession *)cur->data;
+		if (real->is_running)
+			return TRUE;
+	}
+
 	real = (IMAPRealSession *)(REMOTE_FOLDER(folder)->session);
 	if (!real)
 		return FALSE;
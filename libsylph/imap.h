@@ -55,6 +55,9 @@ struct _IMAPFolder
 	GList *ns_personal;
 	GList *ns_others;
 	GList *ns_shared;
+
+	/* additional sessions for parallel jobs */
+	GSList *pool_sessions;
 };
 
 struct _IMAPSession
@@ -125,6 +128,14 @@ gint imap_msg_list_unset_perm_flags	(GSList		*msglist,
 gint imap_msg_list_set_colorlabel_flags	(GSList		*msglist,
 					 guint		 color);
 
+gint imap_fetch_msgs			(FolderItem	*item,
+					 GSList		*msglist);
+
+gint imap_scan_folder_list		(Folder		*folder,
+					 GSList		*item_list);
+
+void imap_session_pool_destroy		(IMAPFolder	*folder);
+
 gboolean imap_is_session_active		(IMAPFolder	*folder);
 
 #endif /* __IMAP_H__ */
@@ -138,6 +138,7 @@ gint proc_mbox_full(FolderItem *dest, const gchar *mbox,
 			FILE_OP_ERROR(tmp_file, "fopen");
 			g_warning(_("can't open temporary file\n"));
 			filter_rule_free(junk_rule);
+			filter_junk_classifier_stop();
 			g_free(tmp_file);
 			fclose(mbox_fp);
 			return -1;
@@ -225,6 +226,7 @@ gint proc_mbox_full(FolderItem *dest, const gchar *mbox,
 			FILE_OP_ERROR(tmp_file, "fclose");
 			g_warning(_("can't write to temporary file\n"));
 			filter_rule_free(junk_rule);
+			filter_junk_classifier_stop();
 			g_unlink(tmp_file);
 			g_free(tmp_file);
 			fclose(mbox_fp);
@@ -241,6 +243,7 @@ gint proc_mbox_full(FolderItem *dest, const gchar *mbox,
 			g_warning("proc_mbox_full: procheader_parse_file failed");
 			filter_info_free(fltinfo);
 			filter_rule_free(junk_rule);
+			filter_junk_classifier_stop();
 			g_unlink(tmp_file);
 			g_free(tmp_file);
 			fclose(mbox_fp);
@@ -275,6 +278,7 @@ gint proc_mbox_full(FolderItem *dest, const gchar *mbox,
 				procmsg_msginfo_free(msginfo);
 				filter_info_free(fltinfo);
 				filter_rule_free(junk_rule);
+				filter_junk_classifier_stop();
 				g_unlink(tmp_file);
 				g_free(tmp_file);
 				fclose(mbox_fp);
@@ -314,6 +318,7 @@ gint proc_mbox_full(FolderItem *dest, const gchar *mbox,
 
 	if (junk_rule)
 		filter_rule_free(junk_rule);
+	filter_junk_classifier_stop();
 
 	g_free(tmp_file);
 	fclose(mbox_fp);
@@ -31,6 +31,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
 
 #ifdef G_OS_WIN32
 #  include <windows.h>
@@ -43,16 +44,63 @@
 #include "mh.h"
 #include "procmsg.h"
 #include "procheader.h"
+#include "bodyindex.h"
 #include "utils.h"
 #include "prefs_common.h"
 
+/* The global lock serializes the changes of the folder tree. Messages
+   are accessed only with the lock of their FolderItem, and all the file
+   operations use absolute paths so that different folders can be read
+   and written concurrently. */
 #if USE_THREADS
 G_LOCK_DEFINE_STATIC(mh);
 #define S_LOCK(name)	G_LOCK(name)
 #define S_UNLOCK(name)	G_UNLOCK(name)
+#define S_ITEM_LOCK(item)	g_mutex_lock(mh_item_get_mutex(item))
+#define S_ITEM_UNLOCK(item)	g_mutex_unlock(mh_item_get_mutex(item))
+G_LOCK_DEFINE_STATIC(mh_item_mutex);
+static GHashTable *mh_item_mutex_table = NULL;
 #else
 #define S_LOCK(name)
 #define S_UNLOCK(name)
+#define S_ITEM_LOCK(item)
+#define S_ITEM_UNLOCK(item)
+#endif
+
+typedef enum
+{
+	MH_STORE_LINK,	/* hard link, or copy if it is not possible */
+	MH_STORE_COPY,
+	MH_STORE_MOVE
+} MHStoreMode;
+
+/* new messages are parsed in parallel if there are at least
+   MH_PARSE_THREAD_MIN of them */
+#define MH_PARSE_THREAD_MIN	256
+#define MH_PARSE_CHUNK_SIZE	64
+
+#if USE_THREADS
+typedef struct _MHParseInfo	MHParseInfo;
+typedef struct _MHParseJob	MHParseJob;
+
+struct _MHParseInfo
+{
+	FolderItem *item;
+	const gchar *path;
+	const gint *nums;
+	MsgInfo **msgs;
+	gint done;
+	gint pending;
+	GMutex *mutex;
+	GCond *cond;
+};
+
+struct _MHParseJob
+{
+	MHParseInfo *info;
+	gint start;
+	gint end;
+};
 #endif
 
 static void	mh_folder_init		(Folder		*folder,
@@ -136,17 +184,29 @@ static gint    mh_move_folder		(Folder		*folder,
 static gint    mh_remove_folder		(Folder		*folder,
 					 FolderItem	*item);
 
-static gchar   *mh_get_new_msg_filename		(FolderItem	*dest);
+static gchar   *mh_get_dest_path		(FolderItem	*dest);
+static gint	mh_get_max_msg_num		(const gchar	*path);
+static gint	mh_store_msg_file		(FolderItem	*dest,
+						 const gchar	*destpath,
+						 const gchar	*src,
+						 MHStoreMode	 mode,
+						 gchar	       **destfile);
 
 static gint	mh_do_move_msgs			(Folder		*folder,
 						 FolderItem	*dest,
 						 GSList		*msglist);
 
 static time_t  mh_get_mtime			(FolderItem	*item);
-static GSList  *mh_get_uncached_msgs		(GHashTable	*msg_table,
-						 FolderItem	*item);
+static GSList  *mh_get_uncached_msgs		(FolderItem	*item);
+static GSList  *mh_merge_cached_msgs		(FolderItem	*item,
+						 GSList		*mlist,
+						 GSList	       **newlist);
 static MsgInfo *mh_parse_msg			(const gchar	*file,
-						 FolderItem	*item);
+						 FolderItem	*item,
+						 gint		 num);
+static MsgInfo *mh_parse_msg_in_dir		(const gchar	*path,
+						 FolderItem	*item,
+						 gint		 num);
 static void	mh_remove_missing_folder_items	(Folder		*folder);
 static void	mh_scan_tree_recursive		(FolderItem	*item);
 
@@ -194,6 +254,76 @@ FolderClass *mh_get_class(void)
 	return &mh_class;
 }
 
+#if USE_THREADS
+/* The mutexes are never freed, since another thread may be waiting for
+   one when its FolderItem is removed. */
+static GMutex *mh_item_get_mutex(FolderItem *item)
+{
+	GMutex *mutex;
+
+	G_LOCK(mh_item_mutex);
+	if (!mh_item_mutex_table)
+		mh_item_mutex_table = g_hash_table_new(NULL, NULL);
+	mutex = g_hash_table_lookup(mh_item_mutex_table, item);
+	if (!mutex) {
+		mutex = g_mutex_new();
+		g_hash_table_insert(mh_item_mutex_table, item, mutex);
+	}
+	G_UNLOCK(mh_item_mutex);
+
+	return mutex;
+}
+#endif
+
+static gint mh_item_cmp(gconstpointer a, gconstpointer b)
+{
+	return a < b ? -1 : a > b ? 1 : 0;
+}
+
+/* Lock all the items in the list. The locks are always taken in the
+   order of the addresses to avoid deadlocks. Returns the sorted list
+   without duplicates that must be passed to mh_unlock_items(). */
+static GSList *mh_lock_items(GSList *items)
+{
+	GSList *cur;
+
+	items = g_slist_sort(items, mh_item_cmp);
+	for (cur = items; cur != NULL; cur = cur->next) {
+		while (cur->next && cur->next->data == cur->data)
+			items = g_slist_delete_link(items, cur->next);
+		S_ITEM_LOCK((FolderItem *)cur->data);
+	}
+
+	return items;
+}
+
+static void mh_unlock_items(GSList *items)
+{
+	GSList *cur;
+
+	for (cur = items; cur != NULL; cur = cur->next)
+		S_ITEM_UNLOCK((FolderItem *)cur->data);
+	g_slist_free(items);
+}
+
+static gboolean mh_get_subtree_items_func(GNode *node, gpointer data)
+{
+	GSList **items = (GSList **)data;
+
+	*items = g_slist_prepend(*items, node->data);
+	return FALSE;
+}
+
+/* lock item and all its descendants */
+static GSList *mh_lock_subtree(FolderItem *item)
+{
+	GSList *items = NULL;
+
+	g_node_traverse(item->node, G_PRE_ORDER, G_TRAVERSE_ALL, -1,
+			mh_get_subtree_items_func, &items);
+	return mh_lock_items(items);
+}
+
 static Folder *mh_folder_new(const gchar *name, const gchar *path)
 {
 	Folder *folder;
@@ -219,7 +349,6 @@ static GSList *mh_get_msg_list_full(Folder *folder, FolderItem *item,
 				    gboolean use_cache, gboolean uncached_only)
 {
 	GSList *mlist;
-	GHashTable *msg_table;
 	time_t cur_mtime;
 	GSList *newlist = NULL;
 #ifdef MEASURE_TIME
@@ -228,7 +357,7 @@ static GSList *mh_get_msg_list_full(Folder *folder, FolderItem *item,
 
 	g_return_val_if_fail(item != NULL, NULL);
 
-	S_LOCK(mh);
+	S_ITEM_LOCK(item);
 
 #ifdef MEASURE_TIME
 	timer = g_timer_new();
@@ -240,43 +369,24 @@ static GSList *mh_get_msg_list_full(Folder *folder, FolderItem *item,
 		debug_print("Folder is not modified.\n");
 		mlist = procmsg_read_cache(item, FALSE);
 		if (!mlist) {
-			mlist = mh_get_uncached_msgs(NULL, item);
+			mlist = mh_get_uncached_msgs(item);
 			if (mlist)
 				item->cache_dirty = TRUE;
 		}
 	} else if (use_cache) {
-		GSList *cur, *next;
 		gboolean strict_cache_check = prefs_common.strict_cache_check;
 
 		if (item->stype == F_QUEUE || item->stype == F_DRAFT)
 			strict_cache_check = TRUE;
 
 		mlist = procmsg_read_cache(item, strict_cache_check);
-		msg_table = procmsg_msg_hash_table_create(mlist);
-		newlist = mh_get_uncached_msgs(msg_table, item);
+		mlist = mh_merge_cached_msgs(item, mlist, &newlist);
 		if (newlist)
 			item->cache_dirty = TRUE;
-		if (msg_table)
-			g_hash_table_destroy(msg_table);
-
-		if (!strict_cache_check) {
-			/* remove nonexistent messages */
-			for (cur = mlist; cur != NULL; cur = next) {
-				MsgInfo *msginfo = (MsgInfo *)cur->data;
-				next = cur->next;
-				if (!MSG_IS_CACHED(msginfo->flags)) {
-					debug_print("removing nonexistent message %d from cache\n", msginfo->msgnum);
-					mlist = g_slist_remove(mlist, msginfo);
-					procmsg_msginfo_free(msginfo);
-					item->cache_dirty = TRUE;
-					item->mark_dirty = TRUE;
-				}
-			}
-		}
 
 		mlist = g_slist_concat(mlist, newlist);
 	} else {
-		mlist = mh_get_uncached_msgs(NULL, item);
+		mlist = mh_get_uncached_msgs(item);
 		item->cache_dirty = TRUE;
 		newlist = mlist;
 	}
@@ -312,27 +422,27 @@ static GSList *mh_get_msg_list_full(Folder *folder, FolderItem *item,
 
 		if (newlist == NULL) {
 			procmsg_msg_list_free(mlist);
-			S_UNLOCK(mh);
+			S_ITEM_UNLOCK(item);
 			return NULL;
 		}
 		if (mlist == newlist) {
-			S_UNLOCK(mh);
+			S_ITEM_UNLOCK(item);
 			return newlist;
 		}
 		for (cur = mlist; cur != NULL; cur = cur->next) {
 			if (cur->next == newlist) {
 				cur->next = NULL;
 				procmsg_msg_list_free(mlist);
-				S_UNLOCK(mh);
+				S_ITEM_UNLOCK(item);
 				return newlist;
 			}
 		}
 		procmsg_msg_list_free(mlist);
-		S_UNLOCK(mh);
+		S_ITEM_UNLOCK(item);
 		return NULL;
 	}
 
-	S_UNLOCK(mh);
+	S_ITEM_UNLOCK(item);
 	return mlist;
 }
 
@@ -386,18 +496,14 @@ static MsgInfo *mh_get_msginfo(Folder *folder, FolderItem *item, gint num)
 	file = mh_fetch_msg(folder, item, num);
 	if (!file) return NULL;
 
-	msginfo = mh_parse_msg(file, item);
-	if (msginfo)
-		msginfo->msgnum = num;
-
+	msginfo = mh_parse_msg(file, item, num);
 	g_free(file);
 
 	return msginfo;
 }
 
-static gchar *mh_get_new_msg_filename(FolderItem *dest)
+static gchar *mh_get_dest_path(FolderItem *dest)
 {
-	gchar *destfile;
 	gchar *destpath;
 
 	destpath = folder_item_get_path(dest);
@@ -406,19 +512,114 @@ static gchar *mh_get_new_msg_filename(FolderItem *dest)
 	if (!is_dir_exist(destpath))
 		make_dir_hier(destpath);
 
+	return destpath;
+}
+
+static gint mh_get_max_msg_num(const gchar *path)
+{
+	GDir *dp;
+	const gchar *dir_name;
+	gint num, max = 0;
+
+	if ((dp = g_dir_open(path, 0, NULL)) == NULL) {
+		FILE_OP_ERROR(path, "opendir");
+		return -1;
+	}
+	while ((dir_name = g_dir_read_name(dp)) != NULL) {
+		if ((num = to_number(dir_name)) > max)
+			max = num;
+	}
+	g_dir_close(dp);
+
+	return max;
+}
+
+/* Store src as the message dest->last_num + 1 of dest.
+   The number is taken with link() or an O_EXCL create, which fail
+   instead of replacing an existing file, so no existence check is needed
+   before each message. If the number is already used, last_num is
+   refreshed from the directory once, and then just incremented.
+   A move on the same filesystem is only a rename over the reserved
+   entry. */
+static gint mh_store_msg_file(FolderItem *dest, const gchar *destpath,
+			      const gchar *src, MHStoreMode mode,
+			      gchar **destfile)
+{
+	gchar *file;
+	gboolean use_link = (mode == MH_STORE_LINK);
+	gboolean rescanned = FALSE;
+	gint fd;
+
+	*destfile = NULL;
+
 	for (;;) {
-		destfile = g_strdup_printf("%s%c%d", destpath, G_DIR_SEPARATOR,
-					   dest->last_num + 1);
-		if (is_file_entry_exist(destfile)) {
-			dest->last_num++;
-			g_free(destfile);
-		} else
-			break;
+		file = g_strdup_printf("%s%c%d", destpath, G_DIR_SEPARATOR,
+				       dest->last_num + 1);
+
+		if (use_link) {
+			if (syl_link(src, file) == 0) {
+				*destfile = file;
+				return 0;
+			}
+			if (errno != EEXIST)
+				use_link = FALSE;
+		}
+		if (!use_link) {
+			fd = g_open(file, O_WRONLY | O_CREAT | O_EXCL, 0600);
+			if (fd >= 0) {
+				close(fd);
+				break;
+			}
+			if (errno != EEXIST) {
+				FILE_OP_ERROR(file, "open");
+				g_free(file);
+				return -1;
+			}
+		}
+
+		/* the number is already used */
+		g_free(file);
+		if (!rescanned) {
+			gint max;
+
+			rescanned = TRUE;
+			max = mh_get_max_msg_num(destpath);
+			if (max > dest->last_num) {
+				debug_print("mh_store_msg_file: last number of %s is %d, not %d\n",
+					    dest->path, max, dest->last_num);
+				dest->last_num = max;
+				continue;
+			}
+		}
+		dest->last_num++;
 	}
 
-	g_free(destpath);
+	if (mode == MH_STORE_MOVE) {
+		if (rename_force(src, file) == 0) {
+			*destfile = file;
+			return 0;
+		}
+		if (errno != EXDEV) {
+			FILE_OP_ERROR(src, "rename");
+			g_unlink(file);
+			g_free(file);
+			return -1;
+		}
+	}
 
-	return destfile;
+	if (copy_file(src, file, FALSE) < 0) {
+		g_warning(_("can't copy message %s to %s\n"), src, file);
+		g_unlink(file);
+		g_free(file);
+		return -1;
+	}
+	if (mode == MH_STORE_MOVE) {
+		if (g_unlink(src) < 0)
+			FILE_OP_ERROR(src, "unlink");
+	}
+
+	*destfile = file;
+	return 0;
 }
 
 #define SET_DEST_MSG_FLAGS(fp, dest, n, fl)				\
@@ -461,6 +662,7 @@ static gint mh_add_msg(Folder *folder, FolderItem *dest, const gchar *file,
 static gint mh_add_msgs(Folder *folder, FolderItem *dest, GSList *file_list,
 			gboolean remove_source, gint *first)
 {
+	gchar *destpath;
 	gchar *destfile;
 	GSList *cur;
 	MsgFileInfo *fileinfo;
@@ -476,7 +678,13 @@ static gint mh_add_msgs(Folder *folder, FolderItem *dest, GSList *file_list,
 		if (dest->last_num < 0) return -1;
 	}
 
-	S_LOCK(mh);
+	S_ITEM_LOCK(dest);
+
+	destpath = mh_get_dest_path(dest);
+	if (!destpath) {
+		S_ITEM_UNLOCK(dest);
+		return -1;
+	}
 
 	if (!dest->opened) {
 		if ((fp = procmsg_open_mark_file(dest, DATA_APPEND)) == NULL)
@@ -492,32 +700,28 @@ static gint mh_add_msgs(Folder *folder, FolderItem *dest, GSList *file_list,
 		msginfo = procheader_parse_file(fileinfo->file, flags, 0);
 		if (!msginfo) {
 			if (fp) fclose(fp);
-			S_UNLOCK(mh);
+			g_free(destpath);
+			S_ITEM_UNLOCK(dest);
 			return -1;
 		}
 
-		destfile = mh_get_new_msg_filename(dest);
-		if (destfile == NULL) {
-			S_UNLOCK(mh);
+		if (mh_store_msg_file(dest, destpath, fileinfo->file,
+				      MH_STORE_LINK, &destfile) < 0) {
+			procmsg_msginfo_free(msginfo);
+			if (fp) fclose(fp);
+			g_free(destpath);
+			S_ITEM_UNLOCK(dest);
 			return -1;
 		}
 		if (first_ == 0 || first_ > dest->last_num + 1)
 			first_ = dest->last_num + 1;
 
-		if (syl_link(fileinfo->file, destfile) < 0) {
-			if (copy_file(fileinfo->file, destfile, TRUE) < 0) {
-				g_warning(_("can't copy message %s to %s\n"),
-					  fileinfo->file, destfile);
-				g_free(destfile);
-				if (fp) fclose(fp);
-				S_UNLOCK(mh);
-				return -1;
-			}
-		}
-
 		if (syl_app_get())
 			g_signal_emit_by_name(syl_app_get(), "add-msg", dest, destfile, dest->last_num + 1);
 
+		body_index_add_msg_file(dest, dest->last_num + 1, destfile,
+					flags);
+
 		g_free(destfile);
 		dest->last_num++;
 		dest->total++;
@@ -555,7 +759,8 @@ static gint mh_add_msgs(Folder *folder, FolderItem *dest, GSList *file_list,
 		}
 	}
 
-	S_UNLOCK(mh);
+	g_free(destpath);
+	S_ITEM_UNLOCK(dest);
 	return dest->last_num;
 }
 
@@ -580,6 +785,7 @@ static gint mh_add_msgs_msginfo(Folder *folder, FolderItem *dest,
 	GSList *cur;
 	MsgInfo *msginfo;
 	gchar *srcfile;
+	gchar *destpath;
 	gchar *destfile;
 	gint first_ = 0;
 	FILE *fp = NULL;
@@ -592,7 +798,13 @@ static gint mh_add_msgs_msginfo(Folder *folder, FolderItem *dest,
 		if (dest->last_num < 0) return -1;
 	}
 
-	S_LOCK(mh);
+	S_ITEM_LOCK(dest);
+
+	destpath = mh_get_dest_path(dest);
+	if (!destpath) {
+		S_ITEM_UNLOCK(dest);
+		return -1;
+	}
 
 	if (!dest->opened) {
 		if ((fp = procmsg_open_mark_file(dest, DATA_APPEND)) == NULL)
@@ -602,36 +814,31 @@ static gint mh_add_msgs_msginfo(Folder *folder, FolderItem *dest,
 	for (cur = msglist; cur != NULL; cur = cur->next) {
 		msginfo = (MsgInfo *)cur->data;
 
-		destfile = mh_get_new_msg_filename(dest);
-		if (!destfile) {
-			if (fp) fclose(fp);
-			S_UNLOCK(mh);
-			return -1;
-		}
-		if (first_ == 0 || first_ > dest->last_num + 1)
-			first_ = dest->last_num + 1;
-
 		srcfile = procmsg_get_message_file(msginfo);
 		if (!srcfile) {
 			if (fp) fclose(fp);
-			g_free(destfile);
-			S_UNLOCK(mh);
+			g_free(destpath);
+			S_ITEM_UNLOCK(dest);
 			return -1;
 		}
-		if (syl_link(srcfile, destfile) < 0) {
-			if (copy_file(srcfile, destfile, TRUE) < 0) {
-				g_warning("mh_add_msgs_msginfo: can't copy message %s to %s", srcfile, destfile);
-				g_free(srcfile);
-				g_free(destfile);
-				if (fp) fclose(fp);
-				S_UNLOCK(mh);
-				return -1;
-			}
+		if (mh_store_msg_file(dest, destpath, srcfile, MH_STORE_LINK,
+				      &destfile) < 0) {
+			g_warning("mh_add_msgs_msginfo: can't copy message %s to %s", srcfile, destpath);
+			g_free(srcfile);
+			if (fp) fclose(fp);
+			g_free(destpath);
+			S_ITEM_UNLOCK(dest);
+			return -1;
 		}
+		if (first_ == 0 || first_ > dest->last_num + 1)
+			first_ = dest->last_num + 1;
 
 		if (syl_app_get())
 			g_signal_emit_by_name(syl_app_get(), "add-msg", dest, destfile, dest->last_num + 1);
 
+		body_index_add_msg_file(dest, dest->last_num + 1, destfile,
+					msginfo->flags);
+
 		g_free(srcfile);
 		g_free(destfile);
 		dest->last_num++;
@@ -674,7 +881,8 @@ static gint mh_add_msgs_msginfo(Folder *folder, FolderItem *dest,
 		}
 	}
 
-	S_UNLOCK(mh);
+	g_free(destpath);
+	S_ITEM_UNLOCK(dest);
 	return dest->last_num;
 }
 
@@ -683,8 +891,13 @@ static gint mh_do_move_msgs(Folder *folder, FolderItem *dest, GSList *msglist)
 {
 	FolderItem *src;
 	gchar *srcfile;
+	gchar *destpath;
 	gchar *destfile;
 	GSList *cur;
+	GSList *locked;
+	GSList *moved = NULL;
+	GArray *destnums;
+	guint destnum;
 	MsgInfo *msginfo;
 
 	g_return_val_if_fail(dest != NULL, -1);
@@ -695,7 +908,25 @@ static gint mh_do_move_msgs(Folder *folder, FolderItem *dest, GSList *msglist)
 		if (dest->last_num < 0) return -1;
 	}
 
-	S_LOCK(mh);
+	/* the source folders are modified as well. They are scanned before
+	   locking since mh_fetch_msg() may scan them. */
+	locked = g_slist_prepend(NULL, dest);
+	for (cur = msglist; cur != NULL; cur = cur->next) {
+		msginfo = (MsgInfo *)cur->data;
+		src = msginfo->folder;
+		if (src->last_num < 0 || msginfo->msgnum > src->last_num)
+			mh_scan_folder(folder, src);
+		locked = g_slist_prepend(locked, src);
+	}
+	locked = mh_lock_items(locked);
+
+	destpath = mh_get_dest_path(dest);
+	if (!destpath) {
+		mh_unlock_items(locked);
+		return -1;
+	}
+
+	destnums = g_array_new(FALSE, FALSE, sizeof(guint));
 
 	for (cur = msglist; cur != NULL; cur = cur->next) {
 		msginfo = (MsgInfo *)cur->data;
@@ -708,15 +939,14 @@ static gint mh_do_move_msgs(Folder *folder, FolderItem *dest, GSList *msglist)
 		debug_print("Moving message %s/%d to %s ...\n",
 			    src->path, msginfo->msgnum, dest->path);
 
-		destfile = mh_get_new_msg_filename(dest);
-		if (!destfile) break;
 		srcfile = procmsg_get_message_file(msginfo);
+		if (!srcfile) break;
 
 		/* g_signal_emit_by_name(syl_app_get(), "remove-msg", src, srcfile, msginfo->msgnum); */
 
-		if (move_file(srcfile, destfile, FALSE) < 0) {
+		if (mh_store_msg_file(dest, destpath, srcfile, MH_STORE_MOVE,
+				      &destfile) < 0) {
 			g_free(srcfile);
-			g_free(destfile);
 			break;
 		}
 
@@ -725,6 +955,10 @@ static gint mh_do_move_msgs(Folder *folder, FolderItem *dest, GSList *msglist)
 			g_signal_emit_by_name(syl_app_get(), "remove-msg", src, srcfile, msginfo->msgnum);
 		}
 
+		moved = g_slist_prepend(moved, msginfo);
+		destnum = dest->last_num + 1;
+		g_array_append_val(destnums, destnum);
+
 		g_free(srcfile);
 		g_free(destfile);
 		src->total--;
@@ -750,12 +984,20 @@ static gint mh_do_move_msgs(Folder *folder, FolderItem *dest, GSList *msglist)
 		MSG_SET_TMP_FLAGS(msginfo->flags, MSG_INVALID);
 	}
 
+	/* the moved files are the same, so their keys are taken from the
+	   source indexes */
+	moved = g_slist_reverse(moved);
+	body_index_copy_msgs(dest, moved, destnums, TRUE);
+	g_slist_free(moved);
+	g_array_free(destnums, TRUE);
+
 	if (!dest->opened) {
 		procmsg_flush_mark_queue(dest, NULL);
 		procmsg_flush_cache_queue(dest, NULL);
 	}
 
-	S_UNLOCK(mh);
+	g_free(destpath);
+	mh_unlock_items(locked);
 	return dest->last_num;
 }
 
@@ -804,8 +1046,12 @@ static gint mh_copy_msg(Folder *folder, FolderItem *dest, MsgInfo *msginfo)
 static gint mh_copy_msgs(Folder *folder, FolderItem *dest, GSList *msglist)
 {
 	gchar *srcfile;
+	gchar *destpath;
 	gchar *destfile;
 	GSList *cur;
+	GSList *copied = NULL;
+	GArray *destnums;
+	guint destnum;
 	MsgInfo *msginfo;
 
 	g_return_val_if_fail(dest != NULL, -1);
@@ -816,7 +1062,15 @@ static gint mh_copy_msgs(Folder *folder, FolderItem *dest, GSList *msglist)
 		if (dest->last_num < 0) return -1;
 	}
 
-	S_LOCK(mh);
+	S_ITEM_LOCK(dest);
+
+	destpath = mh_get_dest_path(dest);
+	if (!destpath) {
+		S_ITEM_UNLOCK(dest);
+		return -1;
+	}
+
+	destnums = g_array_new(FALSE, FALSE, sizeof(guint));
 
 	for (cur = msglist; cur != NULL; cur = cur->next) {
 		msginfo = (MsgInfo *)cur->data;
@@ -828,20 +1082,23 @@ static gint mh_copy_msgs(Folder *folder, FolderItem *dest, GSList *msglist)
 		debug_print(_("Copying message %s/%d to %s ...\n"),
 			    msginfo->folder->path, msginfo->msgnum, dest->path);
 
-		destfile = mh_get_new_msg_filename(dest);
-		if (!destfile) break;
 		srcfile = procmsg_get_message_file(msginfo);
+		if (!srcfile) break;
 
-		if (copy_file(srcfile, destfile, TRUE) < 0) {
+		if (mh_store_msg_file(dest, destpath, srcfile, MH_STORE_COPY,
+				      &destfile) < 0) {
 			FILE_OP_ERROR(srcfile, "copy");
 			g_free(srcfile);
-			g_free(destfile);
 			break;
 		}
 
 		if (syl_app_get())
 			g_signal_emit_by_name(syl_app_get(), "add-msg", dest, destfile, dest->last_num + 1);
 
+		copied = g_slist_prepend(copied, msginfo);
+		destnum = dest->last_num + 1;
+		g_array_append_val(destnums, destnum);
+
 		g_free(srcfile);
 		g_free(destfile);
 		dest->last_num++;
@@ -858,12 +1115,18 @@ static gint mh_copy_msgs(Folder *folder, FolderItem *dest, GSList *msglist)
 			dest->unread++;
 	}
 
+	copied = g_slist_reverse(copied);
+	body_index_copy_msgs(dest, copied, destnums, FALSE);
+	g_slist_free(copied);
+	g_array_free(destnums, TRUE);
+
 	if (!dest->opened) {
 		procmsg_flush_mark_queue(dest, NULL);
 		procmsg_flush_cache_queue(dest, NULL);
 	}
 
-	S_UNLOCK(mh);
+	g_free(destpath);
+	S_ITEM_UNLOCK(dest);
 	return dest->last_num;
 }
 
@@ -879,16 +1142,18 @@ static gint mh_remove_msg(Folder *folder, FolderItem *item, MsgInfo *msginfo)
 	if (syl_app_get())
 		g_signal_emit_by_name(syl_app_get(), "remove-msg", item, file, msginfo->msgnum);
 
-	S_LOCK(mh);
+	S_ITEM_LOCK(item);
 
 	if (g_unlink(file) < 0) {
 		FILE_OP_ERROR(file, "unlink");
 		g_free(file);
-		S_UNLOCK(mh);
+		S_ITEM_UNLOCK(item);
 		return -1;
 	}
 	g_free(file);
 
+	body_index_remove_msg(item, msginfo->msgnum);
+
 	item->total--;
 	item->updated = TRUE;
 	item->mtime = 0;
@@ -898,7 +1163,7 @@ static gint mh_remove_msg(Folder *folder, FolderItem *item, MsgInfo *msginfo)
 		item->unread--;
 	MSG_SET_TMP_FLAGS(msginfo->flags, MSG_INVALID);
 
-	S_UNLOCK(mh);
+	S_ITEM_UNLOCK(item);
 
 	if (msginfo->msgnum == item->last_num)
 		mh_scan_folder_full(folder, item, FALSE);
@@ -918,7 +1183,9 @@ static gint mh_remove_all_msg(Folder *folder, FolderItem *item)
 	if (syl_app_get())
 		g_signal_emit_by_name(syl_app_get(), "remove-all-msg", item);
 
-	S_LOCK(mh);
+	body_index_remove_all(item);
+
+	S_ITEM_LOCK(item);
 
 	val = remove_all_numbered_files(path);
 	g_free(path);
@@ -929,7 +1196,7 @@ static gint mh_remove_all_msg(Folder *folder, FolderItem *item)
 		item->mtime = 0;
 	}
 
-	S_UNLOCK(mh);
+	S_ITEM_UNLOCK(item);
 
 	return val;
 }
@@ -938,9 +1205,20 @@ static gboolean mh_is_msg_changed(Folder *folder, FolderItem *item,
 				  MsgInfo *msginfo)
 {
 	struct stat s;
+	gchar *path;
+	gchar *file;
 	gchar buf[16];
+	gint ret;
 
-	if (g_stat(utos_buf(buf, msginfo->msgnum), &s) < 0 ||
+	path = folder_item_get_path(item);
+	g_return_val_if_fail(path != NULL, TRUE);
+	file = g_strconcat(path, G_DIR_SEPARATOR_S,
+			   utos_buf(buf, msginfo->msgnum), NULL);
+	ret = g_stat(file, &s);
+	g_free(file);
+	g_free(path);
+
+	if (ret < 0 ||
 	    msginfo->size  != s.st_size ||
 	    msginfo->mtime != s.st_mtime)
 		return TRUE;
@@ -1057,30 +1335,26 @@ static gint mh_scan_folder_full(Folder *folder, FolderItem *item,
 
 	debug_print("mh_scan_folder(): Scanning %s ...\n", item->path);
 
-	S_LOCK(mh);
+	S_ITEM_LOCK(item);
 
 	path = folder_item_get_path(item);
 	if (!path) {
-		S_UNLOCK(mh);
+		S_ITEM_UNLOCK(item);
 		return -1;
 	}
-	if (change_dir(path) < 0) {
-		g_free(path);
-		S_UNLOCK(mh);
-		return -1;
-	}
-	g_free(path);
 
 #ifdef G_OS_WIN32
-	if ((hfind = find_first_file(NULL, &wfd)) == INVALID_HANDLE_VALUE) {
-		g_warning("failed to open directory\n");
+	if ((hfind = find_first_file(path, &wfd)) == INVALID_HANDLE_VALUE) {
+		g_warning("failed to open directory: %s\n", path);
 #else
-	if ((dp = opendir(".")) == NULL) {
-		FILE_OP_ERROR(item->path, "opendir");
+	if ((dp = opendir(path)) == NULL) {
+		FILE_OP_ERROR(path, "opendir");
 #endif
-		S_UNLOCK(mh);
+		g_free(path);
+		S_ITEM_UNLOCK(item);
 		return -1;
 	}
+	g_free(path);
 
 	if (folder->ui_func)
 		folder->ui_func(folder, item, folder->ui_func_data);
@@ -1147,7 +1421,7 @@ static gint mh_scan_folder_full(Folder *folder, FolderItem *item,
 	debug_print("Last number in dir %s = %d\n", item->path, max);
 	item->last_num = max;
 
-	S_UNLOCK(mh);
+	S_ITEM_UNLOCK(item);
 	return 0;
 }
 
@@ -1173,7 +1447,7 @@ static gint mh_scan_tree(Folder *folder)
 		item = FOLDER_ITEM(folder->node->data);
 
 	rootpath = folder_item_get_path(item);
-	if (change_dir(rootpath) < 0) {
+	if (!is_dir_exist(rootpath)) {
 		g_free(rootpath);
 		S_UNLOCK(mh);
 		return -1;
@@ -1188,55 +1462,48 @@ static gint mh_scan_tree(Folder *folder)
 	return 0;
 }
 
-#define MAKE_DIR_IF_NOT_EXIST(dir) \
-{ \
-	if (!is_dir_exist(dir)) { \
-		if (is_file_exist(dir)) { \
-			g_warning(_("File `%s' already exists.\n" \
-				    "Can't create folder."), dir); \
-			return -1; \
-		} \
-		if (make_dir(dir) < 0) \
-			return -1; \
-	} \
-}
+static gint mh_make_dir_if_not_exist(const gchar *dir, gboolean hier)
+{
+	if (!is_dir_exist(dir)) {
+		if (is_file_exist(dir)) {
+			g_warning(_("File `%s' already exists.\n"
+				    "Can't create folder."), dir);
+			return -1;
+		}
+		if ((hier ? make_dir_hier(dir) : make_dir(dir)) < 0)
+			return -1;
+	}
 
-#define MAKE_DIR_HIER_IF_NOT_EXIST(dir) \
-{ \
-	if (!is_dir_exist(dir)) { \
-		if (is_file_exist(dir)) { \
-			g_warning(_("File `%s' already exists.\n" \
-				    "Can't create folder."), dir); \
-			return -1; \
-		} \
-		if (make_dir_hier(dir) < 0) \
-			return -1; \
-	} \
+	return 0;
 }
 
 static gint mh_create_tree(Folder *folder)
 {
+	static const gchar *special_dirs[] = {
+		INBOX_DIR, OUTBOX_DIR, QUEUE_DIR, DRAFT_DIR, TRASH_DIR, JUNK_DIR
+	};
 	gchar *rootpath;
+	gchar *dir;
+	gint i;
+	gint ret;
 
 	g_return_val_if_fail(folder != NULL, -1);
 
-	CHDIR_RETURN_VAL_IF_FAIL(get_mail_base_dir(), -1);
-	rootpath = LOCAL_FOLDER(folder)->rootpath;
-	MAKE_DIR_HIER_IF_NOT_EXIST(rootpath);
-	CHDIR_RETURN_VAL_IF_FAIL(rootpath, -1);
-	MAKE_DIR_IF_NOT_EXIST(INBOX_DIR);
-	MAKE_DIR_IF_NOT_EXIST(OUTBOX_DIR);
-	MAKE_DIR_IF_NOT_EXIST(QUEUE_DIR);
-	MAKE_DIR_IF_NOT_EXIST(DRAFT_DIR);
-	MAKE_DIR_IF_NOT_EXIST(TRASH_DIR);
-	MAKE_DIR_IF_NOT_EXIST(JUNK_DIR);
+	rootpath = folder_get_path(folder);
+	g_return_val_if_fail(rootpath != NULL, -1);
+
+	ret = mh_make_dir_if_not_exist(rootpath, TRUE);
+	for (i = 0; ret == 0 && i < G_N_ELEMENTS(special_dirs); i++) {
+		dir = g_strconcat(rootpath, G_DIR_SEPARATOR_S, special_dirs[i],
+				  NULL);
+		ret = mh_make_dir_if_not_exist(dir, FALSE);
+		g_free(dir);
+	}
 
-	return 0;
+	g_free(rootpath);
+	return ret;
 }
 
-#undef MAKE_DIR_IF_NOT_EXIST
-#undef MAKE_DIR_HIER_IF_NOT_EXIST
-
 static FolderItem *mh_create_folder(Folder *folder, FolderItem *parent,
 				    const gchar *name)
 {
@@ -1282,7 +1549,6 @@ static FolderItem *mh_create_folder(Folder *folder, FolderItem *parent,
 static gint mh_move_folder_real(Folder *folder, FolderItem *item,
 				FolderItem *new_parent, const gchar *name)
 {
-	gchar *rootpath;
 	gchar *oldpath;
 	gchar *newpath;
 	gchar *dirname;
@@ -1291,6 +1557,7 @@ static gint mh_move_folder_real(Folder *folder, FolderItem *item,
 	gchar *utf8_name;
 	gchar *paths[2];
 	gchar *old_id, *new_id;
+	GSList *locked;
 
 	g_return_val_if_fail(folder != NULL, -1);
 	g_return_val_if_fail(item != NULL, -1);
@@ -1346,21 +1613,13 @@ static gint mh_move_folder_real(Folder *folder, FolderItem *item,
 		return -1;
 	}
 
-	rootpath = folder_get_path(folder);
-	if (change_dir(rootpath) < 0) {
-		g_free(rootpath);
-		g_free(oldpath);
-		g_free(newpath);
-		g_free(utf8_name);
-		S_UNLOCK(mh);
-		return -1;
-	}
-	g_free(rootpath);
-
 	debug_print("mh_move_folder: rename(%s, %s)\n", oldpath, newpath);
 
+	/* the paths of all the subfolders are changed */
+	locked = mh_lock_subtree(item);
 	if (g_rename(oldpath, newpath) < 0) {
 		FILE_OP_ERROR(oldpath, "rename");
+		mh_unlock_items(locked);
 		g_free(oldpath);
 		g_free(newpath);
 		g_free(utf8_name);
@@ -1405,6 +1664,7 @@ static gint mh_move_folder_real(Folder *folder, FolderItem *item,
 
 	g_free(paths[0]);
 	g_free(paths[1]);
+	mh_unlock_items(locked);
 
 	new_id = folder_item_get_identifier(item);
 	if (syl_app_get())
@@ -1432,22 +1692,28 @@ static gint mh_rename_folder(Folder *folder, FolderItem *item,
 static gint mh_remove_folder(Folder *folder, FolderItem *item)
 {
 	gchar *path;
+	GSList *locked;
 
 	g_return_val_if_fail(folder != NULL, -1);
 	g_return_val_if_fail(item != NULL, -1);
 	g_return_val_if_fail(item->path != NULL, -1);
 
+	body_index_remove_all(item);
+
 	S_LOCK(mh);
+	locked = mh_lock_subtree(item);
 
 	path = folder_item_get_path(item);
 	if (remove_dir_recursive(path) < 0) {
 		g_warning("can't remove directory `%s'\n", path);
 		g_free(path);
+		mh_unlock_items(locked);
 		S_UNLOCK(mh);
 		return -1;
 	}
 
 	g_free(path);
+	mh_unlock_items(locked);
 	if (syl_app_get())
 		g_signal_emit_by_name(syl_app_get(), "remove-folder", item);
 	folder_item_remove(item);
@@ -1473,107 +1739,309 @@ static time_t mh_get_mtime(FolderItem *item)
 	}
 }
 
-static GSList *mh_get_uncached_msgs(GHashTable *msg_table, FolderItem *item)
+static MsgInfo *mh_parse_msg_in_dir(const gchar *path, FolderItem *item,
+				    gint num)
+{
+	MsgInfo *msginfo;
+	gchar *file;
+	gchar buf[16];
+
+	file = g_strconcat(path, G_DIR_SEPARATOR_S, utos_buf(buf, num), NULL);
+	msginfo = mh_parse_msg(file, item, num);
+	g_free(file);
+
+	return msginfo;
+}
+
+#if USE_THREADS
+static void mh_parse_job_func(gpointer data, gpointer user_data)
+{
+	MHParseJob *job = (MHParseJob *)data;
+	MHParseInfo *info = job->info;
+	gint i;
+
+	for (i = job->start; i < job->end; i++) {
+		info->msgs[i] = mh_parse_msg_in_dir(info->path, info->item,
+						    info->nums[i]);
+		g_atomic_int_inc(&info->done);
+	}
+
+	g_mutex_lock(info->mutex);
+	info->pending--;
+	g_cond_signal(info->cond);
+	g_mutex_unlock(info->mutex);
+
+	g_free(job);
+}
+
+/* Parse the message files on a pool of threads. The calling thread only
+   waits and reports the progress with folder->ui_func. */
+static void mh_parse_msgs_parallel(FolderItem *item, const gchar *path,
+				   const gint *nums, gint n, MsgInfo **msgs,
+				   gint n_threads)
+{
+	Folder *folder = item->folder;
+	MHParseInfo info;
+	GThreadPool *pool;
+	GTimeVal tv;
+	gint start;
+
+	info.item = item;
+	info.path = path;
+	info.nums = nums;
+	info.msgs = msgs;
+	info.done = 0;
+	info.pending = 0;
+	info.mutex = g_mutex_new();
+	info.cond = g_cond_new();
+
+	pool = g_thread_pool_new(mh_parse_job_func, NULL, n_threads, FALSE,
+				 NULL);
+
+	g_mutex_lock(info.mutex);
+
+	for (start = 0; start < n; start += MH_PARSE_CHUNK_SIZE) {
+		MHParseJob *job;
+
+		job = g_new(MHParseJob, 1);
+		job->info = &info;
+		job->start = start;
+		job->end = MIN(start + MH_PARSE_CHUNK_SIZE, n);
+		info.pending++;
+		g_thread_pool_push(pool, job, NULL);
+	}
+
+	while (info.pending > 0) {
+		g_get_current_time(&tv);
+		g_time_val_add(&tv, 100 * 1000);
+		g_cond_timed_wait(info.cond, info.mutex, &tv);
+
+		if (folder->ui_func) {
+			g_mutex_unlock(info.mutex);
+			folder->ui_func(folder, item, folder->ui_func_data ?
+					folder->ui_func_data :
+					GINT_TO_POINTER(g_atomic_int_get
+							(&info.done)));
+			g_mutex_lock(info.mutex);
+		}
+	}
+
+	g_mutex_unlock(info.mutex);
+
+	g_thread_pool_free(pool, FALSE, TRUE);
+	g_cond_free(info.cond);
+	g_mutex_free(info.mutex);
+}
+#endif
+
+static gint mh_cmp_num(gconstpointer a, gconstpointer b)
+{
+	return *(const gint *)a - *(const gint *)b;
+}
+
+/* Return the message numbers in the folder directory in ascending order. */
+static GArray *mh_get_msg_nums(const gchar *path)
 {
-	gchar *path;
 	GDir *dp;
 	const gchar *dir_name;
+	GArray *nums;
+	gint num;
+
+	if ((dp = g_dir_open(path, 0, NULL)) == NULL) {
+		FILE_OP_ERROR(path, "opendir");
+		return NULL;
+	}
+
+	nums = g_array_new(FALSE, FALSE, sizeof(gint));
+
+	while ((dir_name = g_dir_read_name(dp)) != NULL) {
+		if ((num = to_number(dir_name)) > 0)
+			g_array_append_val(nums, num);
+	}
+
+	g_dir_close(dp);
+
+	g_array_sort(nums, mh_cmp_num);
+
+	return nums;
+}
+
+/* Parse the messages of nums (sorted) and return them in the same order. */
+static GSList *mh_parse_msgs(FolderItem *item, const gchar *path,
+			     const gint *nums, gint n)
+{
+	Folder *folder = item->folder;
+	MsgInfo **msgs;
 	GSList *newlist = NULL;
-	GSList *last = NULL;
-	MsgInfo *msginfo;
 	gint n_newmsg = 0;
-	gint num;
-	Folder *folder;
+	gint i;
+#if USE_THREADS
+	gint n_threads;
+#endif
+
+	if (n == 0)
+		return NULL;
+
+	msgs = g_new0(MsgInfo *, n + 1);
+
+#if USE_THREADS
+	n_threads = get_processor_count();
+	if (n_threads > 1 && n >= MH_PARSE_THREAD_MIN) {
+		debug_print("parsing %d messages with %d threads\n",
+			    n, n_threads);
+		mh_parse_msgs_parallel(item, path, nums, n, msgs, n_threads);
+	} else
+#endif
+	{
+		for (i = 0; i < n; i++) {
+			msgs[i] = mh_parse_msg_in_dir(path, item, nums[i]);
+			if (folder->ui_func)
+				folder->ui_func(folder, item, folder->ui_func_data ? folder->ui_func_data : GINT_TO_POINTER(i + 1));
+		}
+	}
+
+	for (i = n - 1; i >= 0; i--) {
+		if (msgs[i]) {
+			newlist = g_slist_prepend(newlist, msgs[i]);
+			n_newmsg++;
+		}
+	}
+
+	g_free(msgs);
+
+	if (n_newmsg)
+		debug_print("%d uncached message(s) found.\n", n_newmsg);
+
+	return newlist;
+}
+
+static GSList *mh_get_uncached_msgs(FolderItem *item)
+{
+	gchar *path;
+	GArray *nums;
+	GSList *newlist;
 
 	g_return_val_if_fail(item != NULL, NULL);
 	g_return_val_if_fail(item->folder != NULL, NULL);
 
-	folder = item->folder;
-
 	path = folder_item_get_path(item);
 	g_return_val_if_fail(path != NULL, NULL);
-	if (change_dir(path) < 0) {
+
+	debug_print("Searching uncached messages...\n");
+
+	if ((nums = mh_get_msg_nums(path)) == NULL) {
 		g_free(path);
 		return NULL;
 	}
+
+	newlist = mh_parse_msgs(item, path, (gint *)nums->data, nums->len);
+
+	g_array_free(nums, TRUE);
 	g_free(path);
 
-	if ((dp = g_dir_open(".", 0, NULL)) == NULL) {
-		FILE_OP_ERROR(item->path, "opendir");
-		return NULL;
-	}
+	return newlist;
+}
+
+/* Reconcile the cached message list with the folder directory in one
+   merge pass over both sequences sorted by number. Cache entries whose
+   file no longer exists are freed, and the files without a cache entry
+   are parsed and returned in *newlist. Returns the remaining cached
+   list in ascending order. */
+static GSList *mh_merge_cached_msgs(FolderItem *item, GSList *mlist,
+				    GSList **newlist)
+{
+	gchar *path;
+	GArray *nums;
+	GArray *uncached;
+	GSList *cur, *next, *last = NULL;
+	GSList *result = NULL;
+	gint prev = 0;
+	gint n_removed = 0;
+	guint i = 0;
+
+	g_return_val_if_fail(item != NULL, mlist);
+
+	*newlist = NULL;
+
+	path = folder_item_get_path(item);
+	g_return_val_if_fail(path != NULL, mlist);
 
 	debug_print("Searching uncached messages...\n");
 
-	if (msg_table) {
-		gint count = 0;
+	if ((nums = mh_get_msg_nums(path)) == NULL) {
+		g_free(path);
+		return mlist;
+	}
+
+	/* the cache is normally written in number order */
+	for (cur = mlist; cur != NULL; cur = cur->next) {
+		gint num = ((MsgInfo *)cur->data)->msgnum;
 
-		while ((dir_name = g_dir_read_name(dp)) != NULL) {
-			if ((num = to_number(dir_name)) <= 0) continue;
+		if (num < prev) {
+			debug_print("cache is not sorted, sorting...\n");
+			mlist = g_slist_sort(mlist,
+					     procmsg_cmp_msgnum_for_sort);
+			break;
+		}
+		prev = num;
+	}
 
-			msginfo = g_hash_table_lookup
-				(msg_table, GUINT_TO_POINTER(num));
+	uncached = g_array_new(FALSE, FALSE, sizeof(gint));
+	prev = 0;
 
-			if (msginfo) {
-				MSG_SET_TMP_FLAGS(msginfo->flags, MSG_CACHED);
-			} else {
-				/* not found in the cache (uncached message) */
-				msginfo = mh_parse_msg(dir_name, item);
-				if (!msginfo) continue;
+	for (cur = mlist; cur != NULL; cur = next) {
+		MsgInfo *msginfo = (MsgInfo *)cur->data;
 
-				if (!newlist)
-					last = newlist =
-						g_slist_append(NULL, msginfo);
-				else {
-					last = g_slist_append(last, msginfo);
-					last = last->next;
-				}
-				n_newmsg++;
-			}
+		next = cur->next;
 
-			count++;
-			if (folder->ui_func)
-				folder->ui_func(folder, item, folder->ui_func_data ? folder->ui_func_data : GINT_TO_POINTER(count));
+		while (i < nums->len &&
+		       g_array_index(nums, gint, i) < msginfo->msgnum) {
+			g_array_append_val(uncached,
+					   g_array_index(nums, gint, i));
+			i++;
 		}
-	} else {
-		/* discard all previous cache */
-		while ((dir_name = g_dir_read_name(dp)) != NULL) {
-			if (to_number(dir_name) <= 0) continue;
-
-			msginfo = mh_parse_msg(dir_name, item);
-			if (!msginfo) continue;
-
-			if (!newlist)
-				last = newlist = g_slist_append(NULL, msginfo);
-			else {
-				last = g_slist_append(last, msginfo);
-				last = last->next;
-			}
-			n_newmsg++;
-			if (folder->ui_func)
-				folder->ui_func(folder, item, folder->ui_func_data ? folder->ui_func_data : GINT_TO_POINTER(n_newmsg));
+
+		if (i < nums->len &&
+		    g_array_index(nums, gint, i) == msginfo->msgnum &&
+		    msginfo->msgnum != prev) {
+			prev = msginfo->msgnum;
+			i++;
+			cur->next = NULL;
+			if (last)
+				last->next = cur;
+			else
+				result = cur;
+			last = cur;
+		} else {
+			/* the file was removed, or a duplicated entry */
+			debug_print("removing nonexistent message %d from cache\n", msginfo->msgnum);
+			procmsg_msginfo_free(msginfo);
+			g_slist_free_1(cur);
+			n_removed++;
 		}
 	}
 
-	g_dir_close(dp);
-
-	if (n_newmsg)
-		debug_print("%d uncached message(s) found.\n", n_newmsg);
-	else
-		debug_print("done.\n");
+	for (; i < nums->len; i++)
+		g_array_append_val(uncached, g_array_index(nums, gint, i));
 
-	/* sort new messages in numerical order */
-	if (newlist && item->sort_key == SORT_BY_NONE) {
-		debug_print("Sorting uncached messages in numerical order...\n");
-		newlist = g_slist_sort
-			(newlist, (GCompareFunc)procmsg_cmp_msgnum_for_sort);
-		debug_print("done.\n");
+	if (n_removed > 0) {
+		debug_print("%d nonexistent message(s) removed from cache\n",
+			    n_removed);
+		item->cache_dirty = TRUE;
+		item->mark_dirty = TRUE;
 	}
 
-	return newlist;
+	*newlist = mh_parse_msgs(item, path, (gint *)uncached->data,
+				 uncached->len);
+
+	g_array_free(uncached, TRUE);
+	g_array_free(nums, TRUE);
+	g_free(path);
+
+	return result;
 }
 
-static MsgInfo *mh_parse_msg(const gchar *file, FolderItem *item)
+static MsgInfo *mh_parse_msg(const gchar *file, FolderItem *item, gint num)
 {
 	MsgInfo *msginfo;
 	MsgFlags flags;
@@ -1593,7 +2061,7 @@ static MsgInfo *mh_parse_msg(const gchar *file, FolderItem *item)
 	msginfo = procheader_parse_file(file, flags, FALSE);
 	if (!msginfo) return NULL;
 
-	msginfo->msgnum = atoi(file);
+	msginfo->msgnum = num;
 	msginfo->folder = item;
 
 	return msginfo;
@@ -1691,11 +2159,8 @@ static void mh_scan_tree_recursive(FolderItem *item)
 
 	folder = item->folder;
 
-	fs_path = item->path ?
-		g_filename_from_utf8(item->path, -1, NULL, NULL, NULL)
-		: g_strdup(".");
-	if (!fs_path)
-		fs_path = g_strdup(item->path);
+	fs_path = folder_item_get_path(item);
+	g_return_if_fail(fs_path != NULL);
 #ifdef G_OS_WIN32
 	hfind = find_first_file(fs_path, &wfd);
 	if (hfind == INVALID_HANDLE_VALUE) {
@@ -1711,7 +2176,6 @@ static void mh_scan_tree_recursive(FolderItem *item)
 		return;
 	}
 #endif
-	g_free(fs_path);
 
 	debug_print("scanning %s ...\n",
 		    item->path ? item->path
@@ -1744,12 +2208,7 @@ static void mh_scan_tree_recursive(FolderItem *item)
 						NULL);
 		} else
 			utf8entry = g_strdup(utf8name);
-		entry = g_filename_from_utf8(utf8entry, -1, NULL, NULL, NULL);
-		if (!entry)
-			entry = g_strdup(utf8entry);
-#ifdef G_OS_WIN32
-		subst_char(entry, '/', G_DIR_SEPARATOR);
-#endif
+		entry = g_strconcat(fs_path, G_DIR_SEPARATOR_S, dir_name, NULL);
 
 		if (
 #ifdef G_OS_WIN32
@@ -1845,6 +2304,7 @@ static void mh_scan_tree_recursive(FolderItem *item)
 #else
 	closedir(dp);
 #endif
+	g_free(fs_path);
 
 	if (item->path) {
 		gint new, unread, total, min, max;
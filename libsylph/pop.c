@@ -67,6 +67,8 @@ gint pop3_retr_send		(Pop3Session *session);
 gint pop3_retr_recv		(Pop3Session *session,
 				 FILE	     *fp,
 				 guint        len);
+gint pop3_retr_recv_file	(Pop3Session *session,
+				 const gchar *file);
 gint pop3_delete_send		(Pop3Session *session);
 gint pop3_delete_recv		(Pop3Session *session);
 gint pop3_logout_send		(Pop3Session *session);
@@ -90,10 +92,15 @@ static gint pop3_session_recv_msg		(Session	*session,
 static gint pop3_session_recv_data_finished	(Session	*session,
 						 guchar		*data,
 						 guint		 len);
+static gint pop3_session_retr_finished		(Pop3Session	*pop3_session);
 static gint pop3_session_recv_data_as_file_finished
 						(Session	*session,
 						 FILE		*fp,
 						 guint		 len);
+static gint pop3_session_recv_data_to_file_finished
+						(Session	*session,
+						 const gchar	*file,
+						 guint		 len);
 
 
 gint pop3_greeting_recv(Pop3Session *session, const gchar *msg)
@@ -341,7 +348,7 @@ gint pop3_retr_send(Pop3Session *session)
 gint pop3_retr_recv(Pop3Session *session, FILE *fp, guint len)
 {
 	gchar *file;
-	gint drop_ok;
+	gint ret;
 
 	file = get_tmp_file();
 	if (pop3_write_msg_to_file(file, fp, len) < 0) {
@@ -350,9 +357,20 @@ gint pop3_retr_recv(Pop3Session *session, FILE *fp, guint len)
 		return -1;
 	}
 
+	ret = pop3_retr_recv_file(session, file);
+	g_free(file);
+
+	return ret;
+}
+
+/* file is the received message already converted into the local format.
+   It is removed after being passed to drop_message(). */
+gint pop3_retr_recv_file(Pop3Session *session, const gchar *file)
+{
+	gint drop_ok;
+
 	drop_ok = session->drop_message(session, file);
 	g_unlink(file);
-	g_free(file);
 	if (drop_ok < 0) {
 		session->error_val = PS_IOERR;
 		return -1;
@@ -426,6 +444,8 @@ Session *pop3_session_new(PrefsAccount *account)
 	SESSION(session)->recv_data_finished = pop3_session_recv_data_finished;
 	SESSION(session)->recv_data_as_file_finished =
 		pop3_session_recv_data_as_file_finished;
+	SESSION(session)->recv_data_to_file_finished =
+		pop3_session_recv_data_to_file_finished;
 
 	SESSION(session)->destroy = pop3_session_destroy;
 
@@ -732,6 +752,7 @@ static gint pop3_session_recv_msg(Session *session, const gchar *msg)
 	Pop3Session *pop3_session = POP3_SESSION(session);
 	gint val = PS_SUCCESS;
 	const gchar *body;
+	gchar *file;
 
 	body = msg;
 	if (pop3_session->state != POP3_GETRANGE_UIDL_RECV &&
@@ -820,7 +841,9 @@ static gint pop3_session_recv_msg(Session *session, const gchar *msg)
 		break;
 	case POP3_RETR:
 		pop3_session->state = POP3_RETR_RECV;
-		val = session_recv_data_as_file(session, 0, ".\r\n");
+		file = get_tmp_file();
+		val = session_recv_data_to_file(session, file);
+		g_free(file);
 		break;
 	case POP3_DELETE:
 		val = pop3_delete_recv(pop3_session);
@@ -880,18 +903,10 @@ static gint pop3_session_recv_data_finished(Session *session, guchar *data,
 	return 0;
 }
 
-static gint pop3_session_recv_data_as_file_finished(Session *session, FILE *fp,
-						    guint len)
+static gint pop3_session_retr_finished(Pop3Session *pop3_session)
 {
-	Pop3Session *pop3_session = POP3_SESSION(session);
-
-	g_return_val_if_fail(pop3_session->state == POP3_RETR_RECV, -1);
-
-	if (pop3_retr_recv(pop3_session, fp, len) < 0)
-		return -1;
-
 	/* disconnected? */
-	if (!session->sock)
+	if (!SESSION(pop3_session)->sock)
 		return -1;
 
 	if (pop3_session->msg[pop3_session->cur_msg].recv_time
@@ -911,3 +926,30 @@ static gint pop3_session_recv_data_as_file_finished(Session *session, FILE *fp,
 
 	return 0;
 }
+
+static gint pop3_session_recv_data_as_file_finished(Session *session, FILE *fp,
+						    guint len)
+{
+	Pop3Session *pop3_session = POP3_SESSION(session);
+
+	g_return_val_if_fail(pop3_session->state == POP3_RETR_RECV, -1);
+
+	if (pop3_retr_recv(pop3_session, fp, len) < 0)
+		return -1;
+
+	return pop3_session_retr_finished(pop3_session);
+}
+
+static gint pop3_session_recv_data_to_file_finished(Session *session,
+						    const gchar *file,
+						    guint len)
+{
+	Pop3Session *pop3_session = POP3_SESSION(session);
+
+	g_return_val_if_fail(pop3_session->state == POP3_RETR_RECV, -1);
+
+	if (pop3_retr_recv_file(pop3_session, file) < 0)
+		return -1;
+
+	return pop3_session_retr_finished(pop3_session);
+}
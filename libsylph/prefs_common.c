@@ -375,6 +375,8 @@ static PrefParam param[] = {
 	{"junk_classify_command", "bogofilter -I",
 	 &prefs_common.junk_classify_cmd, P_STRING},
 #endif
+	{"junk_classify_batch_command", NULL,
+	 &prefs_common.junk_classify_batch_cmd, P_STRING},
 	{"junk_folder", NULL, &prefs_common.junk_folder, P_STRING},
 	{"filter_junk_on_receive", "FALSE", &prefs_common.filter_junk_on_recv,
 	 P_BOOL},
@@ -496,6 +498,13 @@ static PrefParam param[] = {
 	{"strict_cache_check", "FALSE", &prefs_common.strict_cache_check,
 	 P_BOOL},
 	{"io_timeout_secs", "60", &prefs_common.io_timeout_secs, P_INT},
+	{"search_threads", "0", &prefs_common.search_threads, P_INT},
+	{"enable_body_index", "TRUE", &prefs_common.enable_body_index,
+	 P_BOOL},
+	{"imap_pipeline_window", "16", &prefs_common.imap_pipeline_window,
+	 P_INT},
+	{"imap_max_connections", "4", &prefs_common.imap_max_connections,
+	 P_INT},
 
 	{NULL, NULL, NULL, P_OTHER}
 };
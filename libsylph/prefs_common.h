@@ -234,6 +234,7 @@ struct _PrefsCommon
 	gchar *junk_learncmd;
 	gchar *nojunk_learncmd;
 	gchar *junk_classify_cmd;
+	gchar *junk_classify_batch_cmd;
 	gchar *junk_folder;
 	gboolean filter_junk_on_recv;
 	gboolean filter_junk_before;
@@ -330,6 +331,11 @@ struct _PrefsCommon
 	gint addressbook_col_name;
 	gint addressbook_col_addr;
 	gint addressbook_col_rem;
+
+	gint search_threads;                 /* Advanced */
+	gboolean enable_body_index;          /* Advanced */
+	gint imap_pipeline_window;           /* Advanced */
+	gint imap_max_connections;           /* Advanced */
 };
 
 extern PrefsCommon prefs_common;
@@ -42,6 +42,9 @@
 
 #define MAX_MIME_LEVEL	64
 
+/* decoded parts larger than this are written to a temporary file */
+#define PROCMIME_MEM_MAX	(1024 * 1024)
+
 static GHashTable *procmime_get_mime_type_table	(void);
 static GList *procmime_get_mime_type_list	(const gchar *file);
 
@@ -859,58 +862,192 @@ MimeInfo *procmime_scan_mime_header(FILE *fp)
 	return mimeinfo;
 }
 
-static gint procmime_normalize_lbreak(FILE *infp, FILE *outfp)
+/* The decoding pipeline: procmime_decode_content_real() decodes the
+   transfer encoding and passes the data to decode_output_write(), which
+   normalizes the line breaks, converts the charset, and stores the result
+   into a FILE or a BufFile. */
+
+typedef struct _DecodeOutput
 {
-	gchar buf[BUFFSIZE];
-	gint len;
+	FILE *fp;
+	BufFile *bf;
 
-	g_return_val_if_fail(infp != NULL, -1);
-	g_return_val_if_fail(outfp != NULL, -1);
+	gboolean normalize_lbreak;
+	gint n_cr;
+	gboolean bol;
 
-	while (fgets(buf, sizeof(buf), infp) != NULL) {
-		len = strlen(buf);
-		if (len == sizeof(buf) - 1 && buf[len - 1] != '\n') {
-			if (buf[len - 1] == '\r') {
-				ungetc('\r', infp);
-				buf[len - 1] = '\0';
-			}
-			fputs(buf, outfp);
+	CodeConverter *conv;
+	gboolean conv_fail;
+
+	gboolean error;
+} DecodeOutput;
+
+static void decode_output_init(DecodeOutput *out, FILE *fp, BufFile *bf)
+{
+	out->fp = fp;
+	out->bf = bf;
+	out->normalize_lbreak = FALSE;
+	out->n_cr = 0;
+	out->bol = TRUE;
+	out->conv = NULL;
+	out->conv_fail = FALSE;
+	out->error = FALSE;
+}
+
+static void decode_output_store(DecodeOutput *out, const gchar *buf, gsize len)
+{
+	if (len == 0 || out->error)
+		return;
+
+	if (out->fp) {
+		if (fwrite(buf, len, 1, out->fp) != 1)
+			out->error = TRUE;
+	} else {
+		if (buf_file_write(out->bf, buf, len) < 0)
+			out->error = TRUE;
+	}
+}
+
+static void decode_output_convert(DecodeOutput *out, const gchar *buf,
+				  gsize len)
+{
+	gchar *str;
+
+	if (!out->conv) {
+		decode_output_store(out, buf, len);
+		return;
+	}
+
+	str = conv_convert_chunk(out->conv, buf, len, NULL);
+	if (str) {
+		decode_output_store(out, str, strlen(str));
+		g_free(str);
+	} else {
+		out->conv_fail = TRUE;
+		decode_output_store(out, buf, len);
+	}
+}
+
+#ifdef G_OS_WIN32
+#define LBREAK		"\r\n"
+#define LBREAK_LEN	2
+#else
+#define LBREAK		"\n"
+#define LBREAK_LEN	1
+#endif
+
+/* Same as the line break conversion with strcrchomp() (strretchomp() and
+   appending CR+LF on Win32) for each line.  The CRs at the end of a chunk
+   are held until the next character is known. */
+static void decode_output_normalize(DecodeOutput *out, const gchar *buf,
+				    gsize len)
+{
+	GString *str;
+	const gchar *p = buf;
+	const gchar *end = buf + len;
+	const gchar *q;
+
+	str = g_string_sized_new(len + LBREAK_LEN);
+
+	while (p < end) {
+		for (q = p; q < end && *q != '\r' && *q != '\n'; q++)
+			;
+		if (q > p) {
+			for (; out->n_cr > 0; out->n_cr--)
+				g_string_append_c(str, '\r');
+			g_string_append_len(str, p, q - p);
+			out->bol = FALSE;
+			p = q;
 			continue;
 		}
+
+		if (*p == '\r') {
+			out->n_cr++;
+		} else {
 #ifdef G_OS_WIN32
-		strretchomp(buf);
-		fputs(buf, outfp);
-		fputs("\r\n", outfp);
+			out->n_cr = 0;
 #else
-		strcrchomp(buf);
-		fputs(buf, outfp);
+			if (out->n_cr > 0)
+				out->n_cr--;
+			for (; out->n_cr > 0; out->n_cr--)
+				g_string_append_c(str, '\r');
 #endif
+			g_string_append_len(str, LBREAK, LBREAK_LEN);
+			out->bol = TRUE;
+		}
+		p++;
 	}
 
-	return 0;
+	decode_output_convert(out, str->str, str->len);
+	g_string_free(str, TRUE);
 }
 
-FILE *procmime_decode_content(FILE *outfp, FILE *infp, MimeInfo *mimeinfo)
+static void decode_output_write(DecodeOutput *out, const gchar *buf,
+				gsize len)
 {
-	gchar buf[BUFFSIZE];
-	gchar *boundary = NULL;
-	gint boundary_len = 0;
-	gboolean tmp_file = FALSE;
-	gboolean normalize_lbreak = FALSE;
-	ContentType content_type;
+	if (out->normalize_lbreak)
+		decode_output_normalize(out, buf, len);
+	else
+		decode_output_convert(out, buf, len);
+}
 
-	g_return_val_if_fail(infp != NULL, NULL);
-	g_return_val_if_fail(mimeinfo != NULL, NULL);
+static void decode_output_puts(DecodeOutput *out, const gchar *str)
+{
+	decode_output_write(out, str, strlen(str));
+}
 
-	if (!outfp) {
-		outfp = my_tmpfile();
-		if (!outfp) {
-			perror("tmpfile");
-			return NULL;
+static gint decode_output_finish(DecodeOutput *out)
+{
+	gchar *str;
+
+	if (out->normalize_lbreak) {
+		GString *rest;
+
+		rest = g_string_new(NULL);
+#ifdef G_OS_WIN32
+		if (!out->bol || out->n_cr > 0)
+			g_string_append(rest, LBREAK);
+#else
+		for (; out->n_cr > 0; out->n_cr--)
+			g_string_append_c(rest, '\r');
+#endif
+		out->n_cr = 0;
+		out->bol = TRUE;
+		decode_output_convert(out, rest->str, rest->len);
+		g_string_free(rest, TRUE);
+	}
+
+	if (out->conv) {
+		str = conv_convert_finish(out->conv, NULL);
+		if (str) {
+			decode_output_store(out, str, strlen(str));
+			g_free(str);
 		}
-		tmp_file = TRUE;
 	}
 
+	if (out->fp) {
+		if (fflush(out->fp) == EOF) {
+			perror("fflush");
+			out->error = TRUE;
+		}
+		if (ferror(out->fp) != 0)
+			out->error = TRUE;
+	}
+
+	return out->error ? -1 : 0;
+}
+
+#undef LBREAK_LEN
+#undef LBREAK
+
+static void procmime_decode_content_real(DecodeOutput *out, FILE *infp,
+					 MimeInfo *mimeinfo)
+{
+	gchar buf[BUFFSIZE];
+	gchar *boundary = NULL;
+	gint boundary_len = 0;
+	ContentType content_type;
+
 	if (mimeinfo->parent && mimeinfo->parent->boundary) {
 		boundary = mimeinfo->parent->boundary;
 		boundary_len = strlen(boundary);
@@ -919,68 +1056,55 @@ FILE *procmime_decode_content(FILE *outfp, FILE *infp, MimeInfo *mimeinfo)
 	content_type = procmime_scan_mime_type(mimeinfo->content_type);
 	if (content_type == MIME_TEXT ||
 	    content_type == MIME_TEXT_HTML) {
-		normalize_lbreak = TRUE;
+		out->normalize_lbreak = TRUE;
 	}
 
 	if (mimeinfo->encoding_type == ENC_QUOTED_PRINTABLE) {
-		FILE *tmpfp = outfp;
 		gchar prev_empty_line[3] = "";
+		gchar tail[2];
+		gint carry = 0;
+		gint len;
 
-		if (normalize_lbreak) {
-			tmpfp = my_tmpfile();
-			if (!tmpfp) {
-				perror("tmpfile");
-				if (tmp_file) fclose(outfp);
-				return NULL;
-			}
-		}
-
-		while (fgets(buf, sizeof(buf), infp) != NULL &&
+		while (fgets(buf + carry, sizeof(buf) - carry, infp) != NULL &&
 		       (!boundary ||
 			!IS_BOUNDARY(buf, boundary, boundary_len))) {
-			gint len;
-
 			if (prev_empty_line[0]) {
-				fputs(prev_empty_line, tmpfp);
+				decode_output_puts(out, prev_empty_line);
 				prev_empty_line[0] = '\0';
 			}
 
+			carry = 0;
 			if (buf[0] == '\n' ||
 			    (buf[0] == '\r' && buf[1] == '\n'))
 				strcpy(prev_empty_line, buf);
 			else {
+				/* an escape split by the end of buf is decoded
+				   with the rest of the line */
+				len = strlen(buf);
+				if (buf[len - 1] != '\n') {
+					if (buf[len - 1] == '=')
+						carry = 1;
+					else if (len > 1 && buf[len - 2] == '=')
+						carry = 2;
+					memcpy(tail, buf + len - carry, carry);
+					buf[len - carry] = '\0';
+				}
 				len = qp_decode_line(buf);
-				fwrite(buf, len, 1, tmpfp);
+				decode_output_write(out, buf, len);
+				memcpy(buf, tail, carry);
 			}
 		}
-		if (!boundary && prev_empty_line[0])
-			fputs(prev_empty_line, tmpfp);
-
-		if (normalize_lbreak) {
-			if (fflush(tmpfp) == EOF) {
-				perror("fflush");
-				fclose(tmpfp);
-				if (tmp_file) fclose(outfp);
-				return NULL;
-			}
-			rewind(tmpfp);
-			procmime_normalize_lbreak(tmpfp, outfp);
-			fclose(tmpfp);
+		if (carry > 0) {
+			buf[carry] = '\0';
+			len = qp_decode_line(buf);
+			decode_output_write(out, buf, len);
 		}
+		if (!boundary && prev_empty_line[0])
+			decode_output_puts(out, prev_empty_line);
 	} else if (mimeinfo->encoding_type == ENC_BASE64) {
 		gchar outbuf[BUFFSIZE];
 		gint len;
 		Base64Decoder *decoder;
-		FILE *tmpfp = outfp;
-
-		if (normalize_lbreak) {
-			tmpfp = my_tmpfile();
-			if (!tmpfp) {
-				perror("tmpfile");
-				if (tmp_file) fclose(outfp);
-				return NULL;
-			}
-		}
 
 		decoder = base64_decoder_new();
 		while (fgets(buf, sizeof(buf), infp) != NULL &&
@@ -992,26 +1116,16 @@ FILE *procmime_decode_content(FILE *outfp, FILE *infp, MimeInfo *mimeinfo)
 				g_warning("Bad BASE64 content\n");
 				break;
 			}
-			fwrite(outbuf, sizeof(gchar), len, tmpfp);
+			decode_output_write(out, outbuf, len);
 		}
 		base64_decoder_free(decoder);
-
-		if (normalize_lbreak) {
-			if (fflush(tmpfp) == EOF) {
-				perror("fflush");
-				fclose(tmpfp);
-				if (tmp_file) fclose(outfp);
-				return NULL;
-			}
-			rewind(tmpfp);
-			procmime_normalize_lbreak(tmpfp, outfp);
-			fclose(tmpfp);
-		}
 	} else if (mimeinfo->encoding_type == ENC_X_UUENCODE) {
 		gchar outbuf[BUFFSIZE];
 		gint len;
 		gboolean flag = FALSE;
 
+		out->normalize_lbreak = FALSE;
+
 		while (fgets(buf, sizeof(buf), infp) != NULL &&
 		       (!boundary ||
 			!IS_BOUNDARY(buf, boundary, boundary_len))) {
@@ -1024,7 +1138,7 @@ FILE *procmime_decode_content(FILE *outfp, FILE *infp, MimeInfo *mimeinfo)
 						g_warning("Bad UUENCODE content(%d)\n", len);
 					break;
 				}
-				fwrite(outbuf, sizeof(gchar), len, outfp);
+				decode_output_write(out, outbuf, len);
 			} else
 				flag = TRUE;
 		}
@@ -1037,7 +1151,7 @@ FILE *procmime_decode_content(FILE *outfp, FILE *infp, MimeInfo *mimeinfo)
 		       (!boundary ||
 			!IS_BOUNDARY(buf, boundary, boundary_len))) {
 			if (prev_empty_line[0]) {
-				fputs(prev_empty_line, outfp);
+				decode_output_puts(out, prev_empty_line);
 				prev_empty_line[0] = '\0';
 			}
 
@@ -1047,46 +1161,47 @@ FILE *procmime_decode_content(FILE *outfp, FILE *infp, MimeInfo *mimeinfo)
 				if (buf[len - 1] == '\r') {
 					ungetc('\r', infp);
 					buf[len - 1] = '\0';
+					len--;
 				}
-				fputs(buf, outfp);
+				decode_output_write(out, buf, len);
 				cont_line = TRUE;
 				continue;
 			}
 
-			if (normalize_lbreak) {
-#ifdef G_OS_WIN32
-				strretchomp(buf);
-				if (!cont_line && buf[0] == '\0')
-					strcpy(prev_empty_line, "\r\n");
-				else {
-					fputs(buf, outfp);
-					fputs("\r\n", outfp);
-				}
-#else
-				strcrchomp(buf);
-				if (!cont_line && buf[0] == '\n')
-					strcpy(prev_empty_line, "\n");
-				else
-					fputs(buf, outfp);
-#endif
-			} else {
-				if (!cont_line &&
-				    (buf[0] == '\n' ||
-				     (buf[0] == '\r' && buf[1] == '\n')))
-					strcpy(prev_empty_line, buf);
-				else
-					fputs(buf, outfp);
-			}
+			if (!cont_line &&
+			    (buf[0] == '\n' ||
+			     (buf[0] == '\r' && buf[1] == '\n')))
+				strcpy(prev_empty_line, buf);
+			else
+				decode_output_write(out, buf, len);
 
 			cont_line = FALSE;
 		}
 		if (!boundary && prev_empty_line[0])
-			fputs(prev_empty_line, outfp);
+			decode_output_puts(out, prev_empty_line);
+	}
+}
+
+FILE *procmime_decode_content(FILE *outfp, FILE *infp, MimeInfo *mimeinfo)
+{
+	DecodeOutput out;
+	gboolean tmp_file = FALSE;
+
+	g_return_val_if_fail(infp != NULL, NULL);
+	g_return_val_if_fail(mimeinfo != NULL, NULL);
+
+	if (!outfp) {
+		outfp = my_tmpfile();
+		if (!outfp) {
+			perror("tmpfile");
+			return NULL;
+		}
+		tmp_file = TRUE;
 	}
 
-	if (fflush(outfp) == EOF)
-		perror("fflush");
-	if (ferror(outfp) != 0) {
+	decode_output_init(&out, outfp, NULL);
+	procmime_decode_content_real(&out, infp, mimeinfo);
+	if (decode_output_finish(&out) < 0) {
 		g_warning("procmime_decode_content(): Can't write to temporary file\n");
 		if (tmp_file) fclose(outfp);
 		return NULL;
@@ -1096,6 +1211,28 @@ FILE *procmime_decode_content(FILE *outfp, FILE *infp, MimeInfo *mimeinfo)
 	return outfp;
 }
 
+/* Same as procmime_decode_content(NULL, infp, mimeinfo), but the result is
+   kept in memory unless it is very large. */
+BufFile *procmime_decode_content_buf(FILE *infp, MimeInfo *mimeinfo)
+{
+	DecodeOutput out;
+	BufFile *bf;
+
+	g_return_val_if_fail(infp != NULL, NULL);
+	g_return_val_if_fail(mimeinfo != NULL, NULL);
+
+	bf = buf_file_new(PROCMIME_MEM_MAX);
+	decode_output_init(&out, NULL, bf);
+	procmime_decode_content_real(&out, infp, mimeinfo);
+	if (decode_output_finish(&out) < 0 || buf_file_rewind(bf) < 0) {
+		g_warning("procmime_decode_content_buf(): Can't write to temporary file\n");
+		buf_file_close(bf);
+		return NULL;
+	}
+
+	return bf;
+}
+
 gint procmime_get_part(const gchar *outfile, const gchar *infile,
 		       MimeInfo *mimeinfo)
 {
@@ -1227,74 +1364,80 @@ gint procmime_get_all_parts(const gchar *dir, const gchar *infile,
 	return 0;
 }
 
-FILE *procmime_get_text_content(MimeInfo *mimeinfo, FILE *infp,
-				const gchar *encoding)
+static gint procmime_get_text_content_real(DecodeOutput *out,
+					   MimeInfo *mimeinfo, FILE *infp,
+					   const gchar *encoding)
 {
-	FILE *tmpfp, *outfp;
 	const gchar *src_encoding;
-	gboolean conv_fail = FALSE;
+	CodeConverter *conv;
 	gchar buf[BUFFSIZE];
-
-	g_return_val_if_fail(mimeinfo != NULL, NULL);
-	g_return_val_if_fail(infp != NULL, NULL);
-	g_return_val_if_fail(mimeinfo->mime_type == MIME_TEXT ||
-			     mimeinfo->mime_type == MIME_TEXT_HTML, NULL);
+	gint ret = 0;
 
 	if (fseek(infp, mimeinfo->fpos, SEEK_SET) < 0) {
 		perror("fseek");
-		return NULL;
+		return -1;
 	}
 
 	while (fgets(buf, sizeof(buf), infp) != NULL)
 		if (buf[0] == '\r' || buf[0] == '\n') break;
 
-	tmpfp = procmime_decode_content(NULL, infp, mimeinfo);
-	if (!tmpfp)
-		return NULL;
-
-	if ((outfp = my_tmpfile()) == NULL) {
-		perror("tmpfile");
-		fclose(tmpfp);
-		return NULL;
-	}
-
 	src_encoding = prefs_common.force_charset ? prefs_common.force_charset
 		: mimeinfo->charset ? mimeinfo->charset
 		: prefs_common.default_encoding;
 
-	if (mimeinfo->mime_type == MIME_TEXT) {
-		while (fgets(buf, sizeof(buf), tmpfp) != NULL) {
-			gchar *str;
+	conv = conv_code_converter_new(src_encoding, encoding);
 
-			str = conv_codeset_strdup(buf, src_encoding, encoding);
-			if (str) {
-				fputs(str, outfp);
-				g_free(str);
-			} else {
-				conv_fail = TRUE;
-				fputs(buf, outfp);
-			}
-		}
+	if (mimeinfo->mime_type == MIME_TEXT) {
+		/* decode and convert in one pass */
+		out->conv = conv;
+		procmime_decode_content_real(out, infp, mimeinfo);
+		ret = decode_output_finish(out);
 	} else if (mimeinfo->mime_type == MIME_TEXT_HTML) {
 		HTMLParser *parser;
-		CodeConverter *conv;
+		BufFile *bf;
 		const gchar *str;
 
-		conv = conv_code_converter_new(src_encoding, encoding);
-		parser = html_parser_new(tmpfp, conv);
+		if ((bf = procmime_decode_content_buf(infp, mimeinfo)) == NULL) {
+			conv_code_converter_destroy(conv);
+			return -1;
+		}
+
+		parser = html_parser_new_from_buf_file(bf, conv);
 		while ((str = html_parse(parser)) != NULL) {
-			fputs(str, outfp);
+			decode_output_store(out, str, strlen(str));
 		}
 		html_parser_destroy(parser);
-		conv_code_converter_destroy(conv);
+		buf_file_close(bf);
+		ret = decode_output_finish(out);
 	}
 
-	if (conv_fail)
+	conv_code_converter_destroy(conv);
+
+	if (out->conv_fail)
 		g_warning(_("procmime_get_text_content(): Code conversion failed.\n"));
 
-	fclose(tmpfp);
-	if (fflush(outfp) == EOF) {
-		perror("fflush");
+	return ret;
+}
+
+FILE *procmime_get_text_content(MimeInfo *mimeinfo, FILE *infp,
+				const gchar *encoding)
+{
+	DecodeOutput out;
+	FILE *outfp;
+
+	g_return_val_if_fail(mimeinfo != NULL, NULL);
+	g_return_val_if_fail(infp != NULL, NULL);
+	g_return_val_if_fail(mimeinfo->mime_type == MIME_TEXT ||
+			     mimeinfo->mime_type == MIME_TEXT_HTML, NULL);
+
+	if ((outfp = my_tmpfile()) == NULL) {
+		perror("tmpfile");
+		return NULL;
+	}
+
+	decode_output_init(&out, outfp, NULL);
+	if (procmime_get_text_content_real(&out, mimeinfo, infp,
+					   encoding) < 0) {
 		fclose(outfp);
 		return NULL;
 	}
@@ -1303,6 +1446,31 @@ FILE *procmime_get_text_content(MimeInfo *mimeinfo, FILE *infp,
 	return outfp;
 }
 
+/* Same as procmime_get_text_content(), but the result is kept in memory
+   unless it is very large. */
+BufFile *procmime_get_text_content_buf(MimeInfo *mimeinfo, FILE *infp,
+				       const gchar *encoding)
+{
+	DecodeOutput out;
+	BufFile *bf;
+
+	g_return_val_if_fail(mimeinfo != NULL, NULL);
+	g_return_val_if_fail(infp != NULL, NULL);
+	g_return_val_if_fail(mimeinfo->mime_type == MIME_TEXT ||
+			     mimeinfo->mime_type == MIME_TEXT_HTML, NULL);
+
+	bf = buf_file_new(PROCMIME_MEM_MAX);
+	decode_output_init(&out, NULL, bf);
+	if (procmime_get_text_content_real(&out, mimeinfo, infp,
+					   encoding) < 0 ||
+	    buf_file_rewind(bf) < 0) {
+		buf_file_close(bf);
+		return NULL;
+	}
+
+	return bf;
+}
+
 /* search the first text part of (multipart) MIME message,
    decode, convert it and output to outfp. */
 FILE *procmime_get_first_text_content(MsgInfo *msginfo, const gchar *encoding)
@@ -1338,45 +1506,88 @@ FILE *procmime_get_first_text_content(MsgInfo *msginfo, const gchar *encoding)
 	return outfp;
 }
 
-gboolean procmime_find_string_part(MimeInfo *mimeinfo, const gchar *filename,
-				   const gchar *str, StrFindFunc find_func)
+typedef struct _StrFindData
 {
+	const gchar *str;
+	StrFindFunc find_func;
+} StrFindData;
 
-	FILE *infp, *outfp;
-	gchar buf[BUFFSIZE];
+static gboolean procmime_str_find_func(const gchar *haystack, gpointer data)
+{
+	StrFindData *fdata = (StrFindData *)data;
 
-	g_return_val_if_fail(mimeinfo != NULL, FALSE);
-	g_return_val_if_fail(mimeinfo->mime_type == MIME_TEXT ||
-			     mimeinfo->mime_type == MIME_TEXT_HTML, FALSE);
-	g_return_val_if_fail(str != NULL, FALSE);
-	g_return_val_if_fail(find_func != NULL, FALSE);
+	return fdata->find_func(haystack, fdata->str);
+}
+
+static gboolean procmime_find_string_part_real(MimeInfo *mimeinfo,
+					       const gchar *filename,
+					       StrMatchFunc match_func,
+					       gpointer data)
+{
+	FILE *infp;
+	BufFile *bf;
+	gchar buf[BUFFSIZE];
 
 	if ((infp = g_fopen(filename, "rb")) == NULL) {
 		FILE_OP_ERROR(filename, "fopen");
 		return FALSE;
 	}
 
-	outfp = procmime_get_text_content(mimeinfo, infp, NULL);
+	bf = procmime_get_text_content_buf(mimeinfo, infp, NULL);
 	fclose(infp);
 
-	if (!outfp)
+	if (!bf)
 		return FALSE;
 
-	while (fgets(buf, sizeof(buf), outfp) != NULL) {
+	while (buf_file_gets(buf, sizeof(buf), bf) != NULL) {
 		strretchomp(buf);
-		if (find_func(buf, str)) {
-			fclose(outfp);
+		if (match_func(buf, data)) {
+			buf_file_close(bf);
 			return TRUE;
 		}
 	}
 
-	fclose(outfp);
+	buf_file_close(bf);
 
 	return FALSE;
 }
 
+gboolean procmime_find_string_part(MimeInfo *mimeinfo, const gchar *filename,
+				   const gchar *str, StrFindFunc find_func)
+{
+	StrFindData fdata;
+
+	g_return_val_if_fail(mimeinfo != NULL, FALSE);
+	g_return_val_if_fail(mimeinfo->mime_type == MIME_TEXT ||
+			     mimeinfo->mime_type == MIME_TEXT_HTML, FALSE);
+	g_return_val_if_fail(str != NULL, FALSE);
+	g_return_val_if_fail(find_func != NULL, FALSE);
+
+	fdata.str = str;
+	fdata.find_func = find_func;
+
+	return procmime_find_string_part_real(mimeinfo, filename,
+					      procmime_str_find_func, &fdata);
+}
+
 gboolean procmime_find_string(MsgInfo *msginfo, const gchar *str,
 			      StrFindFunc find_func)
+{
+	StrFindData fdata;
+
+	g_return_val_if_fail(msginfo != NULL, FALSE);
+	g_return_val_if_fail(str != NULL, FALSE);
+	g_return_val_if_fail(find_func != NULL, FALSE);
+
+	fdata.str = str;
+	fdata.find_func = find_func;
+
+	return procmime_find_string_func(msginfo, procmime_str_find_func,
+					 &fdata);
+}
+
+gboolean procmime_find_string_func(MsgInfo *msginfo, StrMatchFunc match_func,
+				   gpointer data)
 {
 	MimeInfo *mimeinfo;
 	MimeInfo *partinfo;
@@ -1384,8 +1595,7 @@ gboolean procmime_find_string(MsgInfo *msginfo, const gchar *str,
 	gboolean found = FALSE;
 
 	g_return_val_if_fail(msginfo != NULL, FALSE);
-	g_return_val_if_fail(str != NULL, FALSE);
-	g_return_val_if_fail(find_func != NULL, FALSE);
+	g_return_val_if_fail(match_func != NULL, FALSE);
 
 	filename = procmsg_get_message_file(msginfo);
 	if (!filename) return FALSE;
@@ -1395,8 +1605,8 @@ gboolean procmime_find_string(MsgInfo *msginfo, const gchar *str,
 	     partinfo = procmime_mimeinfo_next(partinfo)) {
 		if (partinfo->mime_type == MIME_TEXT ||
 		    partinfo->mime_type == MIME_TEXT_HTML) {
-			if (procmime_find_string_part
-				(partinfo, filename, str, find_func) == TRUE) {
+			if (procmime_find_string_part_real
+				(partinfo, filename, match_func, data) == TRUE) {
 				found = TRUE;
 				break;
 			}
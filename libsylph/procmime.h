@@ -167,6 +167,8 @@ MimeInfo *procmime_scan_mime_header	(FILE		*fp);
 FILE *procmime_decode_content		(FILE		*outfp,
 					 FILE		*infp,
 					 MimeInfo	*mimeinfo);
+BufFile *procmime_decode_content_buf	(FILE		*infp,
+					 MimeInfo	*mimeinfo);
 gint procmime_get_part			(const gchar	*outfile,
 					 const gchar	*infile,
 					 MimeInfo	*mimeinfo);
@@ -182,6 +184,9 @@ gint procmime_get_all_parts		(const gchar	*dir,
 FILE *procmime_get_text_content		(MimeInfo	*mimeinfo,
 					 FILE		*infp,
 					 const gchar	*encoding);
+BufFile *procmime_get_text_content_buf	(MimeInfo	*mimeinfo,
+					 FILE		*infp,
+					 const gchar	*encoding);
 FILE *procmime_get_first_text_content	(MsgInfo	*msginfo,
 					 const gchar	*encoding);
 
@@ -192,6 +197,9 @@ gboolean procmime_find_string_part	(MimeInfo	*mimeinfo,
 gboolean procmime_find_string		(MsgInfo	*msginfo,
 					 const gchar	*str,
 					 StrFindFunc	 find_func);
+gboolean procmime_find_string_func	(MsgInfo	*msginfo,
+					 StrMatchFunc	 match_func,
+					 gpointer	 data);
 
 gchar *procmime_get_part_file_name	(MimeInfo	*mimeinfo);
 gchar *procmime_get_tmp_file_name	(MimeInfo	*mimeinfo);
@@ -23,6 +23,7 @@
 #include <glib/gi18n.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 
 #include "utils.h"
@@ -33,12 +34,47 @@
 #include "prefs_common.h"
 #include "folder.h"
 #include "codeconv.h"
+#include "threadindex.h"
 
 typedef struct _MsgFlagInfo {
 	guint msgnum;
 	MsgFlags flags;
 } MsgFlagInfo;
 
+#define MSGINFO_ARENA_CHUNK_SIZE	(64 * 1024)
+
+/* MsgInfos read from the summary cache are allocated in large chunks.
+   A chunk is freed when all the MsgInfos in it have been freed.
+   The string members of the column cache point into the mapped cache
+   file, which is kept until the arena is freed. */
+struct _MsgInfoArena
+{
+	gint ref_count;
+	GSList *chunks;
+	gchar *pos;
+	gsize left;
+
+	GMappedFile *map;
+	const gchar *map_start;
+	const gchar *map_end;
+};
+
+/* MsgInfo followed by its references list and strings */
+typedef struct _MsgInfoArenaRec
+{
+	MsgInfo msginfo;
+	gsize len;
+} MsgInfoArenaRec;
+
+#define MSGINFO_ARENA_ALIGN(size)	\
+	(((size) + sizeof(gpointer) * 2 - 1) & ~(sizeof(gpointer) * 2 - 1))
+
+/* lowercased keys so that the sort comparators only need strcmp() */
+struct _MsgSortKeys
+{
+	gchar *key[MSG_SORT_KEY_NUM];
+};
+
 static GSList *procmsg_read_cache_queue		(FolderItem	*item,
 						 gboolean	 scan_file);
 
@@ -47,11 +83,13 @@ static void mark_sum_func			(gpointer	 key,
 						 gpointer	 data);
 
 static GHashTable *procmsg_read_mark_file	(FolderItem	*item);
+static void procmsg_msginfo_free_sort_keys	(MsgInfo	*msginfo);
 static void procmsg_write_mark_file		(FolderItem	*item,
 						 GHashTable	*mark_table);
 
 static GMappedFile *procmsg_open_cache_file_mmap(FolderItem	*item,
-						 DataOpenMode	 mode);
+						 DataOpenMode	 mode,
+						 guint32	*version);
 
 static gint procmsg_cmp_by_mark			(gconstpointer	 a,
 						 gconstpointer	 b);
@@ -157,7 +195,177 @@ gint procmsg_read_cache_data_str(FILE *fp, gchar **str)
 	return 0;
 }
 
-static gint procmsg_read_cache_data_str_mem(const gchar **p, const gchar *endp, gchar **str)
+static MsgInfoArena *procmsg_arena_new(void)
+{
+	MsgInfoArena *arena;
+
+	arena = g_new0(MsgInfoArena, 1);
+	arena->ref_count = 1;
+
+	return arena;
+}
+
+static void procmsg_arena_unref(MsgInfoArena *arena)
+{
+	GSList *cur;
+
+	if (!g_atomic_int_dec_and_test(&arena->ref_count))
+		return;
+
+	for (cur = arena->chunks; cur != NULL; cur = cur->next)
+		g_free(cur->data);
+	g_slist_free(arena->chunks);
+	if (arena->map)
+		g_mapped_file_free(arena->map);
+	g_free(arena);
+}
+
+static MsgInfo *procmsg_arena_msginfo_new(MsgInfoArena *arena, gsize len)
+{
+	MsgInfoArenaRec *rec;
+
+	len = MSGINFO_ARENA_ALIGN(len);
+	if (len > arena->left) {
+		gsize size = MAX(len, MSGINFO_ARENA_CHUNK_SIZE);
+
+		arena->pos = g_malloc(size);
+		arena->left = size;
+		arena->chunks = g_slist_prepend(arena->chunks, arena->pos);
+	}
+
+	rec = (MsgInfoArenaRec *)arena->pos;
+	arena->pos += len;
+	arena->left -= len;
+
+	memset(rec, 0, sizeof(MsgInfoArenaRec));
+	rec->len = len;
+	rec->msginfo.arena = arena;
+	g_atomic_int_inc(&arena->ref_count);
+
+	return &rec->msginfo;
+}
+
+static void procmsg_arena_msginfo_free(MsgInfo *msginfo)
+{
+	MsgInfoArenaRec *rec = (MsgInfoArenaRec *)msginfo;
+	const gchar *start = (const gchar *)rec;
+	const gchar *end = start + rec->len;
+	const gchar *map_start = msginfo->arena->map_start;
+	const gchar *map_end = msginfo->arena->map_end;
+	GSList *cur, *next;
+
+	/* free only the members which were replaced after loading */
+#define IN_REC(ptr)	(((const gchar *)(ptr) >= start && \
+			  (const gchar *)(ptr) < end) || \
+			 ((const gchar *)(ptr) >= map_start && \
+			  (const gchar *)(ptr) < map_end))
+#define MEMBFREE(mmb)	if (!IN_REC(msginfo->mmb)) g_free(msginfo->mmb)
+
+	MEMBFREE(fromname);
+	MEMBFREE(date);
+	MEMBFREE(from);
+	MEMBFREE(to);
+	MEMBFREE(cc);
+	MEMBFREE(newsgroups);
+	MEMBFREE(subject);
+	MEMBFREE(msgid);
+	MEMBFREE(inreplyto);
+	MEMBFREE(xface);
+	MEMBFREE(file_path);
+
+	for (cur = msginfo->references; cur != NULL; cur = next) {
+		next = cur->next;
+		if (!IN_REC(cur->data))
+			g_free(cur->data);
+		if (!IN_REC(cur))
+			g_slist_free_1(cur);
+	}
+
+#undef MEMBFREE
+#undef IN_REC
+
+	if (msginfo->encinfo) {
+		g_free(msginfo->encinfo->plaintext_file);
+		g_free(msginfo->encinfo->sigstatus);
+		g_free(msginfo->encinfo->sigstatus_full);
+		g_free(msginfo->encinfo);
+	}
+
+	procmsg_msginfo_free_sort_keys(msginfo);
+
+	procmsg_arena_unref(msginfo->arena);
+}
+
+/* string members in the order of the cache record */
+static const glong cache_str_members[] = {
+	G_STRUCT_OFFSET(MsgInfo, fromname),
+	G_STRUCT_OFFSET(MsgInfo, date),
+	G_STRUCT_OFFSET(MsgInfo, from),
+	G_STRUCT_OFFSET(MsgInfo, to),
+	G_STRUCT_OFFSET(MsgInfo, newsgroups),
+	G_STRUCT_OFFSET(MsgInfo, subject),
+	G_STRUCT_OFFSET(MsgInfo, msgid),
+	G_STRUCT_OFFSET(MsgInfo, inreplyto)
+};
+
+#define CACHE_REC_STR_NUM	G_N_ELEMENTS(cache_str_members)
+#define CACHE_REC_STR(msginfo, i) \
+	G_STRUCT_MEMBER(gchar *, msginfo, cache_str_members[i])
+
+#define CACHE_PAD_LEN(len)	(((len) + 3) & ~3)
+
+/* Check a cache record and return the size of MsgInfo with its strings
+   and references. Returns 0 if the record is broken. */
+static gsize procmsg_get_cache_rec_alloc_len(const gchar *p,
+					     const gchar *endp,
+					     guint *n_refs)
+{
+	gsize alloc_len = sizeof(MsgInfoArenaRec);
+	guint32 len, refnum;
+	gint i;
+
+	/* msgnum, size, mtime, date_t, flags */
+	if (endp - p < sizeof(guint32) * 5)
+		return 0;
+	p += sizeof(guint32) * 5;
+
+	for (i = 0; i < CACHE_REC_STR_NUM; i++) {
+		if (endp - p < sizeof(len))
+			return 0;
+		len = *(const guint32 *)p;
+		p += sizeof(len);
+		if (len > G_MAXINT || len > endp - p)
+			return 0;
+		if (len > 0)
+			alloc_len += len + 1;
+		p += len;
+	}
+
+	if (endp - p < sizeof(refnum))
+		return 0;
+	refnum = *(const guint32 *)p;
+	p += sizeof(refnum);
+	if (refnum > (endp - p) / sizeof(len))
+		return 0;
+	alloc_len += sizeof(GSList) * refnum;
+	*n_refs = refnum;
+
+	for (; refnum != 0; refnum--) {
+		if (endp - p < sizeof(len))
+			return 0;
+		len = *(const guint32 *)p;
+		p += sizeof(len);
+		if (len > G_MAXINT || len > endp - p)
+			return 0;
+		if (len > 0)
+			alloc_len += len + 1;
+		p += len;
+	}
+
+	return alloc_len;
+}
+
+static gint procmsg_read_cache_data_str_mem(const gchar **p, const gchar *endp, gchar **str, gchar **strbuf)
 {
 	guint32 len;
 
@@ -170,20 +378,208 @@ static gint procmsg_read_cache_data_str_mem(const gchar **p, const gchar *endp,
 		return -1;
 
 	if (len > 0) {
-		*str = g_strndup(*p, len);
+		if (strbuf) {
+			memcpy(*strbuf, *p, len);
+			(*strbuf)[len] = '\0';
+			*str = *strbuf;
+			*strbuf += len + 1;
+		} else
+			*str = g_strndup(*p, len);
 		*p += len;
 	}
 
 	return 0;
 }
 
+static gchar *procmsg_arena_strndup(gchar **strp, const gchar *str,
+				    guint32 len)
+{
+	gchar *ret = *strp;
+
+	if (len == 0)
+		return NULL;
+
+	memcpy(ret, str, len);
+	ret[len] = '\0';
+	*strp += len + 1;
+
+	return ret;
+}
+
+/* str is a NUL-terminated string of the column cache, and len includes
+   the NUL. It is used in place if the cache file is kept mapped. */
+static gchar *procmsg_cache_column_str(MsgInfoArena *arena, gchar **strp,
+				       const gchar *str, guint32 len)
+{
+	if (len == 0)
+		return NULL;
+	if (arena->map_start)
+		return (gchar *)str;
+
+	return procmsg_arena_strndup(strp, str, len - 1);
+}
+
+#define GET_CACHE_COLUMN(col, len)				\
+{								\
+	if ((endp - p) / sizeof(guint32) < (len))		\
+		return NULL;					\
+	col = (const guint32 *)p;				\
+	p += sizeof(guint32) * (len);				\
+}
+
+#define GET_CACHE_STR_DATA(data, len)				\
+{								\
+	if ((gsize)(endp - p) < CACHE_PAD_LEN((gsize)(len)))	\
+		return NULL;					\
+	data = p;						\
+	p += CACHE_PAD_LEN(len);				\
+}
+
+/* Read the column block of a CACHE_COLUMN_VERSION cache. The fixed
+   columns are checked first. The string members point into the mapped
+   file if the arena keeps it, so their pages are read only when they
+   are used; otherwise the strings are copied for the messages which are
+   actually used. Returns the position after the block, or NULL if the
+   block is broken. */
+static const gchar *procmsg_read_cache_columns(FolderItem *item,
+					       gboolean scan_file,
+					       MsgFlags *default_flags,
+					       MsgInfoArena *arena,
+					       const gchar *p,
+					       const gchar *endp,
+					       GSList **mlist, GSList **last)
+{
+	const guint32 *msgnums, *sizes, *mtimes, *dates, *tmp_flags;
+	const guint32 *str_offs[CACHE_REC_STR_NUM];
+	const gchar *str_data[CACHE_REC_STR_NUM];
+	const guint32 *ref_idx, *ref_offs;
+	const gchar *ref_data;
+	const guint32 *np;
+	guint32 n, nrefs, i, j, a, b;
+	gint c;
+
+	GET_CACHE_COLUMN(np, 1);
+	n = *np;
+
+	GET_CACHE_COLUMN(msgnums, n);
+	GET_CACHE_COLUMN(sizes, n);
+	GET_CACHE_COLUMN(mtimes, n);
+	GET_CACHE_COLUMN(dates, n);
+	GET_CACHE_COLUMN(tmp_flags, n);
+
+	for (c = 0; c < CACHE_REC_STR_NUM; c++) {
+		GET_CACHE_COLUMN(str_offs[c], n + 1);
+		GET_CACHE_STR_DATA(str_data[c], str_offs[c][n]);
+	}
+
+	GET_CACHE_COLUMN(ref_idx, n + 1);
+	nrefs = ref_idx[n];
+	GET_CACHE_COLUMN(ref_offs, nrefs + 1);
+	GET_CACHE_STR_DATA(ref_data, ref_offs[nrefs]);
+
+	for (i = 0; i < n; i++) {
+		MsgInfo *msginfo;
+		GSList *refs;
+		gchar *strp;
+		gsize alloc_len = sizeof(MsgInfoArenaRec);
+
+		/* if the message file doesn't exist or is changed,
+		   don't add the data */
+		if (msgnums[i] == 0) {
+			item->cache_dirty = TRUE;
+			continue;
+		}
+		if (FOLDER_TYPE(item->folder) == F_MH && scan_file) {
+			MsgInfo tmpinfo;
+
+			memset(&tmpinfo, 0, sizeof(tmpinfo));
+			tmpinfo.msgnum = msgnums[i];
+			tmpinfo.size = sizes[i];
+			tmpinfo.mtime = mtimes[i];
+			tmpinfo.folder = item;
+			if (folder_item_is_msg_changed(item, &tmpinfo)) {
+				item->cache_dirty = TRUE;
+				continue;
+			}
+		}
+
+		for (c = 0; c < CACHE_REC_STR_NUM; c++) {
+			a = str_offs[c][i];
+			b = str_offs[c][i + 1];
+			if (a > b || b > str_offs[c][n])
+				return NULL;
+			if (b > a && str_data[c][b - 1] != '\0')
+				return NULL;
+			if (!arena->map_start)
+				alloc_len += b - a;
+		}
+		if (ref_idx[i] > ref_idx[i + 1] || ref_idx[i + 1] > nrefs)
+			return NULL;
+		alloc_len += sizeof(GSList) * (ref_idx[i + 1] - ref_idx[i]);
+		for (j = ref_idx[i]; j < ref_idx[i + 1]; j++) {
+			a = ref_offs[j];
+			b = ref_offs[j + 1];
+			if (a > b || b > ref_offs[nrefs])
+				return NULL;
+			if (b > a && ref_data[b - 1] != '\0')
+				return NULL;
+			if (!arena->map_start)
+				alloc_len += b - a;
+		}
+
+		msginfo = procmsg_arena_msginfo_new(arena, alloc_len);
+		refs = (GSList *)((MsgInfoArenaRec *)msginfo + 1);
+		strp = (gchar *)(refs + (ref_idx[i + 1] - ref_idx[i]));
+
+		msginfo->msgnum = msgnums[i];
+		msginfo->size = sizes[i];
+		msginfo->mtime = mtimes[i];
+		msginfo->date_t = dates[i];
+		msginfo->flags.tmp_flags = tmp_flags[i];
+
+		for (c = 0; c < CACHE_REC_STR_NUM; c++) {
+			a = str_offs[c][i];
+			b = str_offs[c][i + 1];
+			CACHE_REC_STR(msginfo, c) = procmsg_cache_column_str
+				(arena, &strp, str_data[c] + a, b - a);
+		}
+
+		for (j = ref_idx[i]; j < ref_idx[i + 1]; j++, refs++) {
+			a = ref_offs[j];
+			b = ref_offs[j + 1];
+			refs->data = procmsg_cache_column_str
+				(arena, &strp, ref_data + a, b - a);
+			refs->next = j + 1 < ref_idx[i + 1] ? refs + 1 : NULL;
+		}
+		if (ref_idx[i + 1] > ref_idx[i])
+			msginfo->references =
+				(GSList *)((MsgInfoArenaRec *)msginfo + 1);
+
+		MSG_SET_PERM_FLAGS(msginfo->flags, default_flags->perm_flags);
+		MSG_SET_TMP_FLAGS(msginfo->flags, default_flags->tmp_flags);
+		msginfo->folder = item;
+
+		if (!*mlist)
+			*last = *mlist = g_slist_append(NULL, msginfo);
+		else {
+			*last = g_slist_append(*last, msginfo);
+			*last = (*last)->next;
+		}
+	}
+
+	return p;
+}
+
+#undef GET_CACHE_COLUMN
+#undef GET_CACHE_STR_DATA
+
 #define READ_CACHE_DATA(data)						\
 {									\
-	if (procmsg_read_cache_data_str_mem(&p, endp, &data) < 0) {	\
+	if (procmsg_read_cache_data_str_mem(&p, endp, &data, &strp) < 0) { \
 		g_warning("Cache data is corrupted\n");			\
 		procmsg_msginfo_free(msginfo);				\
 		procmsg_msg_list_free(mlist);				\
-		g_mapped_file_free(mapfile);				\
+		procmsg_arena_unref(arena);				\
 		return NULL;						\
 	}								\
 }
@@ -194,7 +590,7 @@ static gint procmsg_read_cache_data_str_mem(const gchar **p, const gchar *endp,
 		g_warning("Cache data is corrupted\n");		\
 		procmsg_msginfo_free(msginfo);			\
 		procmsg_msg_list_free(mlist);			\
-		g_mapped_file_free(mapfile);			\
+		procmsg_arena_unref(arena);			\
 		return NULL;					\
 	} else {						\
 		n = *(const guint32 *)p;			\
@@ -210,9 +606,11 @@ GSList *procmsg_read_cache(FolderItem *item, gboolean scan_file)
 	const gchar *filep;
 	gsize file_len;
 	const gchar *p, *endp;
+	MsgInfoArena *arena;
 	MsgInfo *msginfo;
 	MsgFlags default_flags;
 	guint32 num;
+	guint32 data_ver;
 	guint refnum;
 	FolderType type;
 
@@ -235,18 +633,7 @@ GSList *procmsg_read_cache(FolderItem *item, gboolean scan_file)
 		MSG_SET_TMP_FLAGS(default_flags, MSG_NEWS);
 	}
 
-	if (type == F_MH) {
-		gchar *path;
-
-		path = folder_item_get_path(item);
-		if (change_dir(path) < 0) {
-			g_free(path);
-			return NULL;
-		}
-		g_free(path);
-	}
-
-	mapfile = procmsg_open_cache_file_mmap(item, DATA_READ);
+	mapfile = procmsg_open_cache_file_mmap(item, DATA_READ, &data_ver);
 	if (!mapfile) {
 		item->cache_dirty = TRUE;
 		return NULL;
@@ -259,8 +646,48 @@ GSList *procmsg_read_cache(FolderItem *item, gboolean scan_file)
 	endp = filep + file_len;
 	p = filep + sizeof(guint32); /* version */
 
+	/* the arena owns the mapped file from here */
+	arena = procmsg_arena_new();
+	arena->map = mapfile;
+#ifdef G_OS_UNIX
+	/* the cache file is replaced instead of being truncated when it is
+	   rewritten, so the strings can be used in place */
+	if (data_ver == CACHE_COLUMN_VERSION) {
+		arena->map_start = filep;
+		arena->map_end = endp;
+	}
+#endif
+
+	/* column block, followed by the records appended after it */
+	if (data_ver == CACHE_COLUMN_VERSION) {
+		p = procmsg_read_cache_columns(item, scan_file, &default_flags,
+					       arena, p, endp, &mlist, &last);
+		if (!p) {
+			g_warning("Cache data is corrupted\n");
+			procmsg_msg_list_free(mlist);
+			procmsg_arena_unref(arena);
+			return NULL;
+		}
+	}
+
 	while (endp - p >= sizeof(num)) {
-		msginfo = g_new0(MsgInfo, 1);
+		GSList *refs;
+		gchar *strp;
+		gsize alloc_len;
+		guint i;
+
+		alloc_len = procmsg_get_cache_rec_alloc_len(p, endp, &refnum);
+		if (alloc_len == 0) {
+			g_warning("Cache data is corrupted\n");
+			procmsg_msg_list_free(mlist);
+			procmsg_arena_unref(arena);
+			return NULL;
+		}
+
+		msginfo = procmsg_arena_msginfo_new(arena, alloc_len);
+		/* references list nodes, then strings */
+		refs = (GSList *)((MsgInfoArenaRec *)msginfo + 1);
+		strp = (gchar *)(refs + refnum);
 
 		READ_CACHE_DATA_INT(msginfo->msgnum);
 
@@ -280,16 +707,15 @@ GSList *procmsg_read_cache(FolderItem *item, gboolean scan_file)
 		READ_CACHE_DATA(msginfo->inreplyto);
 
 		READ_CACHE_DATA_INT(refnum);
-		for (; refnum != 0; refnum--) {
-			gchar *ref;
+		for (i = 0; i < refnum; i++) {
+			gchar *ref = NULL;
 
 			READ_CACHE_DATA(ref);
-			msginfo->references =
-				g_slist_prepend(msginfo->references, ref);
+			refs[i].data = ref;
+			refs[i].next = i + 1 < refnum ? &refs[i + 1] : NULL;
 		}
-		if (msginfo->references)
-			msginfo->references =
-				g_slist_reverse(msginfo->references);
+		if (refnum > 0)
+			msginfo->references = refs;
 
 		MSG_SET_PERM_FLAGS(msginfo->flags, default_flags.perm_flags);
 		MSG_SET_TMP_FLAGS(msginfo->flags, default_flags.tmp_flags);
@@ -313,7 +739,11 @@ GSList *procmsg_read_cache(FolderItem *item, gboolean scan_file)
 		}
 	}
 
-	g_mapped_file_free(mapfile);
+	if (!arena->map_start) {
+		g_mapped_file_free(arena->map);
+		arena->map = NULL;
+	}
+	procmsg_arena_unref(arena);
 
 	if (item->cache_queue) {
 		GSList *qlist;
@@ -472,6 +902,33 @@ static void mark_all_read_func(gpointer key, gpointer value, gpointer data)
 	MSG_UNSET_PERM_FLAGS(*((MsgFlags *)value), MSG_NEW|MSG_UNREAD);
 }
 
+/* Reload the permanent flags of the messages in mlist from the mark file
+   of item. Unlike procmsg_set_flags(), the folder counts are untouched. */
+void procmsg_update_flags(GSList *mlist, FolderItem *item)
+{
+	GSList *cur;
+	MsgInfo *msginfo;
+	GHashTable *mark_table;
+	MsgFlags *flags;
+
+	g_return_if_fail(item != NULL);
+
+	mark_table = procmsg_read_mark_file(item);
+	if (!mark_table)
+		return;
+
+	for (cur = mlist; cur != NULL; cur = cur->next) {
+		msginfo = (MsgInfo *)cur->data;
+		flags = g_hash_table_lookup
+			(mark_table, GUINT_TO_POINTER(msginfo->msgnum));
+		if (flags != NULL)
+			msginfo->flags.perm_flags = flags->perm_flags;
+	}
+
+	hash_free_value_mem(mark_table);
+	g_hash_table_destroy(mark_table);
+}
+
 void procmsg_mark_all_read(FolderItem *item)
 {
 	GHashTable *mark_table;
@@ -602,23 +1059,119 @@ void procmsg_write_flags(MsgInfo *msginfo, FILE *fp)
 	WRITE_CACHE_DATA_INT(flags, fp);
 }
 
+static void procmsg_write_cache_padding(guint32 len, FILE *fp)
+{
+	static const gchar pad[4] = {0, 0, 0, 0};
+
+	if (CACHE_PAD_LEN(len) > len)
+		fwrite(pad, CACHE_PAD_LEN(len) - len, 1, fp);
+}
+
+#define WRITE_CACHE_COLUMN(expr)					\
+{									\
+	for (cur = mlist, i = 0; cur != NULL; cur = cur->next, i++) {	\
+		MsgInfo *msginfo = (MsgInfo *)cur->data;		\
+		col[i] = (guint32)(expr);				\
+	}								\
+	fwrite(col, sizeof(guint32), n, fp);				\
+}
+
+/* Write the column block of a CACHE_COLUMN_VERSION cache: the fixed
+   members of all messages, then each string member as an offset table
+   and a data block of NUL-terminated strings, then the references. */
+static void procmsg_write_cache_columns(GSList *mlist, FILE *fp)
+{
+	GSList *cur, *ref;
+	guint32 *col, *ref_col;
+	guint32 n, nrefs = 0, off, i, j;
+	gint c;
+
+	n = g_slist_length(mlist);
+	WRITE_CACHE_DATA_INT(n, fp);
+
+	col = g_new(guint32, n + 1);
+
+	WRITE_CACHE_COLUMN(msginfo->msgnum);
+	WRITE_CACHE_COLUMN(msginfo->size);
+	WRITE_CACHE_COLUMN(msginfo->mtime);
+	WRITE_CACHE_COLUMN(msginfo->date_t);
+	WRITE_CACHE_COLUMN(msginfo->flags.tmp_flags & MSG_CACHED_FLAG_MASK);
+
+	for (c = 0; c < CACHE_REC_STR_NUM; c++) {
+		off = 0;
+		for (cur = mlist, i = 0; cur != NULL; cur = cur->next, i++) {
+			const gchar *str = CACHE_REC_STR(cur->data, c);
+
+			col[i] = off;
+			if (str && *str)
+				off += strlen(str) + 1;
+		}
+		col[n] = off;
+		fwrite(col, sizeof(guint32), n + 1, fp);
+
+		for (cur = mlist; cur != NULL; cur = cur->next) {
+			const gchar *str = CACHE_REC_STR(cur->data, c);
+
+			if (str && *str)
+				fwrite(str, strlen(str) + 1, 1, fp);
+		}
+		procmsg_write_cache_padding(off, fp);
+	}
+
+	for (cur = mlist, i = 0; cur != NULL; cur = cur->next, i++) {
+		col[i] = nrefs;
+		nrefs += g_slist_length(((MsgInfo *)cur->data)->references);
+	}
+	col[n] = nrefs;
+	fwrite(col, sizeof(guint32), n + 1, fp);
+
+	ref_col = g_new(guint32, nrefs + 1);
+	off = 0;
+	j = 0;
+	for (cur = mlist; cur != NULL; cur = cur->next) {
+		for (ref = ((MsgInfo *)cur->data)->references; ref != NULL;
+		     ref = ref->next) {
+			ref_col[j++] = off;
+			if (ref->data && *(gchar *)ref->data)
+				off += strlen((gchar *)ref->data) + 1;
+		}
+	}
+	ref_col[nrefs] = off;
+	fwrite(ref_col, sizeof(guint32), nrefs + 1, fp);
+
+	for (cur = mlist; cur != NULL; cur = cur->next) {
+		for (ref = ((MsgInfo *)cur->data)->references; ref != NULL;
+		     ref = ref->next) {
+			if (ref->data && *(gchar *)ref->data)
+				fwrite(ref->data,
+				       strlen((gchar *)ref->data) + 1, 1, fp);
+		}
+	}
+	procmsg_write_cache_padding(off, fp);
+
+	g_free(ref_col);
+	g_free(col);
+}
+
+#undef WRITE_CACHE_COLUMN
+
 void procmsg_write_cache_list(FolderItem *item, GSList *mlist)
 {
 	FILE *fp;
-	GSList *cur;
+	gchar *cachefile;
 
 	g_return_if_fail(item != NULL);
 
 	debug_print("Writing summary cache (%s)\n", item->path);
 
-	fp = procmsg_open_cache_file(item, DATA_WRITE);
+	cachefile = folder_item_get_cache_file(item);
+	fp = procmsg_open_data_file(cachefile, CACHE_COLUMN_VERSION,
+				    DATA_WRITE, NULL, 0);
+	g_free(cachefile);
 	if (fp == NULL)
 		return;
 
-	for (cur = mlist; cur != NULL; cur = cur->next) {
-		MsgInfo *msginfo = (MsgInfo *)cur->data;
-		procmsg_write_cache(msginfo, fp);
-	}
+	procmsg_write_cache_columns(mlist, fp);
 
 	if (item->cache_queue)
 		procmsg_flush_cache_queue(item, fp);
@@ -1026,6 +1579,12 @@ FILE *procmsg_open_data_file(const gchar *file, guint version,
 	g_return_val_if_fail(file != NULL, NULL);
 
 	if (mode == DATA_WRITE) {
+#ifdef G_OS_UNIX
+		/* don't truncate the file in place: the previous summary
+		   cache may still be mapped by the MsgInfo arenas */
+		if (g_unlink(file) < 0 && errno != ENOENT)
+			FILE_OP_ERROR(file, "unlink");
+#endif
 		if ((fp = g_fopen(file, "wb")) == NULL) {
 			if (errno == EACCES) {
 				change_file_mode_rw(NULL, file);
@@ -1064,7 +1623,13 @@ FILE *procmsg_open_data_file(const gchar *file, guint version,
 			g_warning("%s: cannot read mark/cache file (truncated?)\n", file);
 			fclose(fp);
 			fp = NULL;
-		} else if (version != data_ver) {
+		} else if (version != data_ver &&
+			   !(mode == DATA_APPEND &&
+			     version == CACHE_VERSION &&
+			     data_ver == CACHE_COLUMN_VERSION)) {
+			/* the column cache can be appended with the
+			   records of CACHE_VERSION, but it can't be read
+			   as CACHE_VERSION */
 			g_message("%s: Mark/Cache version is different (%u != %u). Discarding it.\n",
 				  file, data_ver, version);
 			fclose(fp);
@@ -1099,7 +1664,8 @@ FILE *procmsg_open_data_file(const gchar *file, guint version,
 }
 
 static GMappedFile *procmsg_open_cache_file_mmap(FolderItem *item,
-						 DataOpenMode mode)
+						 DataOpenMode mode,
+						 guint32 *version)
 {
 	gchar *cachefile;
 	GMappedFile *map = NULL;
@@ -1122,13 +1688,16 @@ static GMappedFile *procmsg_open_cache_file_mmap(FolderItem *item,
 		}
 		p = g_mapped_file_get_contents(map);
 		data_ver = *(guint32 *)p;
-		if (CACHE_VERSION != data_ver) {
+		if (CACHE_VERSION != data_ver &&
+		    CACHE_COLUMN_VERSION != data_ver) {
 			g_message("%s: Mark/Cache version is different (%u != %u). Discarding it.\n",
 				  cachefile, data_ver, CACHE_VERSION);
 			g_mapped_file_free(map);
 			g_free(cachefile);
 			return NULL;
 		}
+		if (version)
+			*version = data_ver;
 		g_free(cachefile);
 	}
 
@@ -1180,66 +1749,13 @@ void procmsg_clear_mark(FolderItem *item)
 /* return the reversed thread tree */
 GNode *procmsg_get_thread_tree(GSList *mlist)
 {
-	GNode *root, *parent, *node, *next;
-	GHashTable *table;
-	MsgInfo *msginfo;
-	const gchar *msgid;
-	GSList *reflist;
-
-	root = g_node_new(NULL);
-	table = g_hash_table_new(g_str_hash, g_str_equal);
-
-	for (; mlist != NULL; mlist = mlist->next) {
-		msginfo = (MsgInfo *)mlist->data;
-		parent = root;
-
-		/* only look for the real parent first */
-		if (msginfo->inreplyto) {
-			parent = g_hash_table_lookup(table, msginfo->inreplyto);
-			if (parent == NULL)
-				parent = root;
-		}
-
-		node = g_node_insert_data_before
-			(parent, parent == root ? parent->children : NULL,
-			 msginfo);
-		if ((msgid = msginfo->msgid) &&
-		    g_hash_table_lookup(table, msgid) == NULL)
-			g_hash_table_insert(table, (gchar *)msgid, node);
-	}
-
-	/* complete the unfinished threads */
-	for (node = root->children; node != NULL; ) {
-		next = node->next;
-		msginfo = (MsgInfo *)node->data;
-		parent = NULL;
-
-		if (msginfo->inreplyto)
-			parent = g_hash_table_lookup(table, msginfo->inreplyto);
-
-		/* try looking for the indirect parent */
-		if (!parent && msginfo->references) {
-			for (reflist = msginfo->references;
-			     reflist != NULL; reflist = reflist->next)
-				if ((parent = g_hash_table_lookup
-					(table, reflist->data)) != NULL)
-					break;
-		}
-
-		/* node should not be the parent, and node should not
-		   be an ancestor of parent (circular reference) */
-		if (parent && parent != node &&
-		    !g_node_is_ancestor(node, parent)) {
-			g_node_unlink(node);
-			g_node_insert_before
-				(parent, parent->children, node);
-		}
-		node = next;
-	}
+	ThreadIndex *index;
 
-	g_hash_table_destroy(table);
+	index = thread_index_new();
+	for (; mlist != NULL; mlist = mlist->next)
+		thread_index_insert(index, (MsgInfo *)mlist->data);
 
-	return root;
+	return thread_index_free(index, FALSE);
 }
 
 static gboolean procmsg_thread_date_func(GNode *node, gpointer data)
@@ -1563,17 +2079,9 @@ FILE *procmsg_open_message_decrypted(MsgInfo *msginfo, MimeInfo **mimeinfo)
 
 gboolean procmsg_msg_exist(MsgInfo *msginfo)
 {
-	gchar *path;
-	gboolean ret;
-
 	if (!msginfo) return FALSE;
 
-	path = folder_item_get_path(msginfo->folder);
-	change_dir(path);
-	ret = !folder_item_is_msg_changed(msginfo->folder, msginfo);
-	g_free(path);
-
-	return ret;
+	return !folder_item_is_msg_changed(msginfo->folder, msginfo);
 }
 
 gboolean procmsg_trash_messages_exist(void)
@@ -2208,6 +2716,11 @@ void procmsg_msginfo_free(MsgInfo *msginfo)
 {
 	if (msginfo == NULL) return;
 
+	if (msginfo->arena) {
+		procmsg_arena_msginfo_free(msginfo);
+		return;
+	}
+
 	g_free(msginfo->xface);
 
 	g_free(msginfo->fromname);
@@ -2233,9 +2746,67 @@ void procmsg_msginfo_free(MsgInfo *msginfo)
 		g_free(msginfo->encinfo);
 	}
 
+	procmsg_msginfo_free_sort_keys(msginfo);
+
 	g_free(msginfo);
 }
 
+static void procmsg_msginfo_free_sort_keys(MsgInfo *msginfo)
+{
+	gint i;
+
+	if (!msginfo->sort_keys)
+		return;
+
+	for (i = 0; i < MSG_SORT_KEY_NUM; i++)
+		g_free(msginfo->sort_keys->key[i]);
+	g_free(msginfo->sort_keys);
+	msginfo->sort_keys = NULL;
+}
+
+/* Return the normalized string used for sorting by the given column.
+   The key is built on the first call and kept until the MsgInfo is freed,
+   so the header strings must not be replaced afterwards. NULL is returned
+   if the source string is NULL. */
+const gchar *procmsg_msginfo_get_sort_key(MsgInfo *msginfo,
+					  MsgSortKeyType type)
+{
+	const gchar *src;
+	gchar *key, *p;
+
+	g_return_val_if_fail(msginfo != NULL, NULL);
+	g_return_val_if_fail(type < MSG_SORT_KEY_NUM, NULL);
+
+	if (msginfo->sort_keys && msginfo->sort_keys->key[type])
+		return msginfo->sort_keys->key[type];
+
+	switch (type) {
+	case MSG_SORT_KEY_SUBJECT:
+		src = msginfo->subject; break;
+	case MSG_SORT_KEY_FROMNAME:
+		src = msginfo->fromname; break;
+	default:
+		src = msginfo->to; break;
+	}
+	if (!src)
+		return NULL;
+
+	if (type == MSG_SORT_KEY_TONAME)
+		key = procheader_get_toname(src);
+	else
+		key = g_strdup(src);
+	if (type == MSG_SORT_KEY_SUBJECT)
+		trim_subject_for_sort(key);
+	for (p = key; *p != '\0'; p++)
+		*p = g_ascii_tolower(*p);
+
+	if (!msginfo->sort_keys)
+		msginfo->sort_keys = g_new0(MsgSortKeys, 1);
+	msginfo->sort_keys->key[type] = key;
+
+	return key;
+}
+
 gint procmsg_cmp_msgnum_for_sort(gconstpointer a, gconstpointer b)
 {
 	const MsgInfo *msginfo1 = a;
@@ -2292,47 +2863,32 @@ CMP_FUNC_DEF(procmsg_cmp_by_number, msginfo1->msgnum - msginfo2->msgnum)
 CMP_FUNC_DEF(procmsg_cmp_by_date, msginfo1->date_t - msginfo2->date_t)
 
 #undef CMP_FUNC_DEF
-#define CMP_FUNC_DEF(func_name, var_name)				\
+#define CMP_FUNC_DEF(func_name, key_type)				\
 static gint func_name(gconstpointer a, gconstpointer b)			\
 {									\
-	const MsgInfo *msginfo1 = a;					\
-	const MsgInfo *msginfo2 = b;					\
+	MsgInfo *msginfo1 = (MsgInfo *)a;				\
+	MsgInfo *msginfo2 = (MsgInfo *)b;				\
+	const gchar *key1, *key2;					\
 	gint ret;							\
 									\
-	if (!msginfo1->var_name)					\
-		return (msginfo2->var_name != NULL) *			\
+	key1 = procmsg_msginfo_get_sort_key(msginfo1, key_type);	\
+	key2 = procmsg_msginfo_get_sort_key(msginfo2, key_type);	\
+									\
+	if (!key1)							\
+		return (key2 != NULL) *					\
 			(cmp_func_sort_type == SORT_ASCENDING ? -1 : 1);\
-	if (!msginfo2->var_name)					\
+	if (!key2)							\
 		return (cmp_func_sort_type == SORT_ASCENDING ? 1 : -1);	\
 									\
-	ret = g_ascii_strcasecmp					\
-		(msginfo1->var_name, msginfo2->var_name);		\
+	ret = strcmp(key1, key2);					\
 	if (ret == 0)							\
 		ret = msginfo1->date_t - msginfo2->date_t;		\
 									\
 	return ret * (cmp_func_sort_type == SORT_ASCENDING ? 1 : -1);	\
 }
 
-CMP_FUNC_DEF(procmsg_cmp_by_from, fromname)
-CMP_FUNC_DEF(procmsg_cmp_by_to, to)
+CMP_FUNC_DEF(procmsg_cmp_by_from, MSG_SORT_KEY_FROMNAME)
+CMP_FUNC_DEF(procmsg_cmp_by_to, MSG_SORT_KEY_TO)
+CMP_FUNC_DEF(procmsg_cmp_by_subject, MSG_SORT_KEY_SUBJECT)
 
 #undef CMP_FUNC_DEF
-
-static gint procmsg_cmp_by_subject(gconstpointer a, gconstpointer b)
-{
-	const MsgInfo *msginfo1 = a;
-	const MsgInfo *msginfo2 = b;
-	gint ret;
-
-	if (!msginfo1->subject)
-		return (msginfo2->subject != NULL) *
-			(cmp_func_sort_type == SORT_ASCENDING ? -1 : 1);
-	if (!msginfo2->subject)
-		return (cmp_func_sort_type == SORT_ASCENDING ? 1 : -1);
-
-	ret = subject_compare_for_sort(msginfo1->subject, msginfo2->subject);
-	if (ret == 0)
-		ret = msginfo1->date_t - msginfo2->date_t;
-
-	return ret * (cmp_func_sort_type == SORT_ASCENDING ? 1 : -1);
-}
@@ -34,6 +34,8 @@ typedef struct _MsgInfo		MsgInfo;
 typedef struct _MsgFlags	MsgFlags;
 typedef struct _MsgFileInfo	MsgFileInfo;
 typedef struct _MsgEncryptInfo	MsgEncryptInfo;
+typedef struct _MsgInfoArena	MsgInfoArena;
+typedef struct _MsgSortKeys	MsgSortKeys;
 
 #include "folder.h"
 #include "procmime.h"
@@ -45,6 +47,16 @@ typedef enum
 	DATA_APPEND
 } DataOpenMode;
 
+typedef enum
+{
+	MSG_SORT_KEY_SUBJECT,
+	MSG_SORT_KEY_FROMNAME,
+	MSG_SORT_KEY_TO,
+	MSG_SORT_KEY_TONAME,
+
+	MSG_SORT_KEY_NUM
+} MsgSortKeyType;
+
 #define MSG_NEW			(1U << 0)
 #define MSG_UNREAD		(1U << 1)
 #define MSG_MARKED		(1U << 2)
@@ -198,6 +210,15 @@ struct _MsgInfo
 
 	/* used only for encrypted (and signed) messages */
 	MsgEncryptInfo *encinfo;
+
+	/* set if the MsgInfo and its strings were allocated together by
+	   procmsg_read_cache(). string members can be replaced, but the
+	   old values must not be freed. */
+	MsgInfoArena *arena;
+
+	/* normalized keys for sorting, built on demand by
+	   procmsg_msginfo_get_sort_key() */
+	MsgSortKeys *sort_keys;
 };
 
 struct _MsgFileInfo
@@ -229,6 +250,8 @@ GSList *procmsg_read_cache		(FolderItem	*item,
 					 gboolean	 scan_file);
 void	procmsg_set_flags		(GSList		*mlist,
 					 FolderItem	*item);
+void	procmsg_update_flags		(GSList		*mlist,
+					 FolderItem	*item);
 void	procmsg_mark_all_read		(FolderItem	*item);
 GSList *procmsg_sort_msg_list		(GSList		*mlist,
 					 FolderSortKey	 sort_key,
@@ -341,6 +364,10 @@ gboolean procmsg_msginfo_equal		(MsgInfo	*msginfo_a,
 					 MsgInfo	*msginfo_b);
 void	 procmsg_msginfo_free		(MsgInfo	*msginfo);
 
+const gchar *procmsg_msginfo_get_sort_key
+					(MsgInfo	*msginfo,
+					 MsgSortKeyType	 type);
+
 gint procmsg_cmp_msgnum_for_sort	(gconstpointer	 a,
 					 gconstpointer	 b);
 
@@ -19,6 +19,7 @@
 
 #include <glib.h>
 #include <ctype.h>
+#include <string.h>
 
 static gboolean get_hex_value(guchar *out, gchar c1, gchar c2);
 static void get_hex_str(gchar *out, guchar ch);
@@ -88,26 +89,38 @@ void qp_encode_line(gchar *out, const guchar *in)
 gint qp_decode_line(gchar *str)
 {
 	gchar *inp = str, *outp = str;
+	gchar *p;
+	size_t len;
+
+	/* copy the runs between '=' as a whole.  Consecutive escapes, as
+	   in text of a national charset, don't need strchr(). */
+	while ((p = *inp == '=' ? inp : strchr(inp, '=')) != NULL) {
+		len = p - inp;
+		if (len > 0) {
+			if (outp != inp)
+				memmove(outp, inp, len);
+			outp += len;
+			inp = p;
+		}
 
-	while (*inp != '\0') {
-		if (*inp == '=') {
-			if (inp[1] && inp[2] &&
-			    get_hex_value((guchar *)outp, inp[1], inp[2])
-			    == TRUE) {
-				inp += 3;
-			} else if (inp[1] == '\0' || g_ascii_isspace(inp[1])) {
-				/* soft line break */
-				break;
-			} else {
-				/* broken QP string */
-				*outp = *inp++;
-			}
+		if (inp[1] && inp[2] &&
+		    get_hex_value((guchar *)outp, inp[1], inp[2]) == TRUE) {
+			inp += 3;
+		} else if (inp[1] == '\0' || g_ascii_isspace(inp[1])) {
+			/* soft line break */
+			*outp = '\0';
+			return outp - str;
 		} else {
+			/* broken QP string */
 			*outp = *inp++;
 		}
 		outp++;
 	}
 
+	len = strlen(inp);
+	if (outp != inp)
+		memmove(outp, inp, len);
+	outp += len;
 	*outp = '\0';
 
 	return outp - str;
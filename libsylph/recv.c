@@ -33,9 +33,25 @@
 #include "socket.h"
 #include "utils.h"
 
+/* the receive buffer grows up to this size while reads keep filling it */
+#define RECV_BUFFSIZE_MAX	(1024 * 1024)
+
 static RecvUIFunc	recv_ui_func;
 static gpointer		recv_ui_func_data;
 
+static gchar *recv_buf_adapt	(gchar		*buf,
+				 gint		*size,
+				 gint		 read_len);
+
+
+static gchar *recv_buf_adapt(gchar *buf, gint *size, gint read_len)
+{
+	if (read_len < *size || *size >= RECV_BUFFSIZE_MAX)
+		return buf;
+
+	*size *= 2;
+	return g_realloc(buf, *size);
+}
 
 gchar *recv_bytes(SockInfo *sock, glong size)
 {
@@ -51,7 +67,7 @@ gchar *recv_bytes(SockInfo *sock, glong size)
 		gint read_count;
 
 		read_count = sock_read(sock, buf + count,
-				       MIN(BUFFSIZE, size - count));
+				       MIN(RECV_BUFFSIZE_MAX, size - count));
 		if (read_count <= 0) {
 			g_free(buf);
 			return NULL;
@@ -125,32 +141,175 @@ gint recv_bytes_write_to_file(SockInfo *sock, glong size, const gchar *filename)
 	return 0;
 }
 
+RecvDataWriter *recv_data_writer_new(FILE *fp, gboolean unescape_from)
+{
+	RecvDataWriter *writer;
+
+	writer = g_new0(RecvDataWriter, 1);
+	writer->fp = fp;
+	writer->line = g_string_sized_new(256);
+	writer->unescape_from = unescape_from;
+	writer->bol = TRUE;
+	writer->complete = FALSE;
+	writer->error = FALSE;
+	writer->count = 0;
+	writer->bytes = 0;
+
+	return writer;
+}
+
+void recv_data_writer_free(RecvDataWriter *writer)
+{
+	if (!writer)
+		return;
+
+	g_string_free(writer->line, TRUE);
+	g_free(writer);
+}
+
+static void recv_data_writer_output(RecvDataWriter *writer, const gchar *buf,
+				    gint len)
+{
+	if (!writer->fp || len == 0)
+		return;
+
+	if (fwrite(buf, len, 1, writer->fp) != 1) {
+		perror("fwrite");
+		g_warning(_("Can't write to file.\n"));
+		writer->error = TRUE;
+		writer->fp = NULL;
+	}
+}
+
+/* buf is a whole line, or a part of a long line */
+static void recv_data_writer_put_line(RecvDataWriter *writer, const gchar *buf,
+				      gint len)
+{
+	gboolean eol;
+
+	if (writer->bol) {
+		if (len == 3 && buf[0] == '.' && buf[1] == '\r' &&
+		    buf[2] == '\n') {
+			writer->complete = TRUE;
+			return;
+		}
+		if (len > 1 && buf[0] == '.' && buf[1] == '.') {
+			buf++;
+			len--;
+		} else if (writer->unescape_from && len >= 6 &&
+			   !strncmp(buf, ">From ", 6)) {
+			buf++;
+			len--;
+		}
+	}
+
+	writer->bytes += len;
+
+	eol = (buf[len - 1] == '\n');
+	if (eol) {
+		writer->count++;
+		if (len > 1 && buf[len - 2] == '\r') {
+			recv_data_writer_output(writer, buf, len - 2);
+			recv_data_writer_output(writer, "\n", 1);
+		} else
+			recv_data_writer_output(writer, buf, len);
+	} else
+		recv_data_writer_output(writer, buf, len);
+
+	writer->bol = eol;
+}
+
+/* Processes len bytes of buf.  Returns the number of bytes consumed, which
+   is less than len only if the terminator is found in buf: the data after
+   the terminator is left to the caller. */
+gint recv_data_writer_write(RecvDataWriter *writer, const gchar *buf, gint len)
+{
+	const gchar *p = buf;
+	const gchar *end = buf + len;
+	const gchar *newline;
+	GString *line = writer->line;
+	gint n;
+
+	while (p < end && !writer->complete) {
+		newline = memchr(p, '\n', end - p);
+		n = newline ? newline - p + 1 : end - p;
+
+		if (newline && line->len == 0) {
+			/* whole line in buf */
+			recv_data_writer_put_line(writer, p, n);
+			p += n;
+			continue;
+		}
+
+		g_string_append_len(line, p, n);
+		p += n;
+
+		if (newline) {
+			recv_data_writer_put_line(writer, line->str, line->len);
+			g_string_truncate(line, 0);
+		} else if (line->len >= BUFFSIZE) {
+			/* flush a part of a long line, but keep a trailing
+			   CR which may be followed by LF */
+			if (line->str[line->len - 1] == '\r') {
+				recv_data_writer_put_line(writer, line->str,
+							  line->len - 1);
+				g_string_assign(line, "\r");
+			} else {
+				recv_data_writer_put_line(writer, line->str,
+							  line->len);
+				g_string_truncate(line, 0);
+			}
+		}
+	}
+
+	return p - buf;
+}
+
 gint recv_write(SockInfo *sock, FILE *fp)
 {
-	gchar buf[BUFFSIZE];
+	RecvDataWriter *writer;
+	gchar *buf;
+	gint size = BUFFSIZE;
 	gint len;
-	gint count = 0;
-	gint bytes = 0;
-	gchar *p;
+	gint done;
+	gint n;
+	gint ret = 0;
 	GTimeVal tv_prev, tv_cur;
 
 	g_get_current_time(&tv_prev);
 
-	for (;;) {
-		if (sock_gets(sock, buf, sizeof(buf)) < 0) {
+	writer = recv_data_writer_new(fp, TRUE);
+	buf = g_malloc(size);
+
+	while (!writer->complete) {
+		/* peek a chunk, and consume only the part before the end of
+		   the data */
+		if ((len = sock_peek(sock, buf, size)) <= 0) {
 			g_warning(_("error occurred while retrieving data.\n"));
-			return -2;
+			ret = -2;
+			break;
 		}
 
-		len = strlen(buf);
-		if (len > 1 && buf[0] == '.' && buf[1] == '\r') {
+		n = recv_data_writer_write(writer, buf, len);
+
+		for (done = 0; done < n; done += len) {
+			if ((len = sock_read(sock, buf, n - done)) <= 0)
+				break;
+		}
+		if (done < n) {
+			g_warning(_("error occurred while retrieving data.\n"));
+			ret = -2;
+			break;
+		}
+
+		if (writer->complete) {
 			if (recv_ui_func)
-				recv_ui_func(sock, count, bytes,
-					     recv_ui_func_data);
+				recv_ui_func(sock, writer->count,
+					     writer->bytes, recv_ui_func_data);
 			break;
 		}
-		count++;
-		bytes += len;
+
+		buf = recv_buf_adapt(buf, &size, n);
 
 		if (recv_ui_func) {
 			g_get_current_time(&tv_cur);
@@ -158,78 +317,96 @@ gint recv_write(SockInfo *sock, FILE *fp)
 			   than 50msec, update UI */
 			if (tv_cur.tv_sec - tv_prev.tv_sec > 0 ||
 			    tv_cur.tv_usec - tv_prev.tv_usec > UI_REFRESH_INTERVAL) {
-				gboolean ret;
-				ret = recv_ui_func(sock, count, bytes,
-						   recv_ui_func_data);
-				if (ret == FALSE) return -1;
+				gboolean ui_ret;
+				ui_ret = recv_ui_func(sock, writer->count,
+						      writer->bytes,
+						      recv_ui_func_data);
+				if (ui_ret == FALSE) {
+					ret = -1;
+					break;
+				}
 				g_get_current_time(&tv_prev);
 			}
 		}
-
-		p = buf;
-
-		if (len > 1 && buf[len - 1] == '\n' && buf[len - 2] == '\r') {
-			buf[len - 2] = '\n';
-			buf[len - 1] = '\0';
-		}
-
-		if (buf[0] == '.' && buf[1] == '.')
-			p++;
-		else if (!strncmp(buf, ">From ", 6))
-			p++;
-
-		if (fp && fputs(p, fp) == EOF) {
-			perror("fputs");
-			g_warning(_("Can't write to file.\n"));
-			fp = NULL;
-		}
 	}
 
-	if (!fp) return -1;
+	if (ret == 0 && (!fp || writer->error))
+		ret = -1;
 
-	return 0;
+	g_free(buf);
+	recv_data_writer_free(writer);
+
+	return ret;
 }
 
+/* Reads size bytes of data and writes it to fp in chunks, converting CR+LF
+   (and lone CR) into LF. */
 gint recv_bytes_write(SockInfo *sock, glong size, FILE *fp)
 {
 	gchar *buf;
-	gchar *prev, *cur;
+	gint buf_size = BUFFSIZE;
+	glong count = 0;
+	gboolean prev_cr = FALSE;
+	gchar *prev, *cur, *end;
+	gint read_count;
 
 	if (size == 0)
 		return 0;
 
-	buf = recv_bytes(sock, size);
-	if (!buf)
-		return -2;
+	buf = g_malloc(buf_size);
 
 	/* +------------------+----------------+--------------------------+ *
-	 * ^buf               ^prev            ^cur             buf+size-1^ */
+	 * ^buf               ^prev            ^cur                    end^ */
+
+	do {
+		read_count = sock_read(sock, buf, MIN(buf_size, size - count));
+		if (read_count <= 0) {
+			g_free(buf);
+			return -2;
+		}
+		count += read_count;
 
-	prev = buf;
-	while ((cur = memchr(prev, '\r', size - (prev - buf))) != NULL) {
-		if (cur == buf + size - 1) break;
+		prev = buf;
+		end = buf + read_count;
 
-		if (fp && (fwrite(prev, sizeof(gchar), cur - prev, fp) == EOF ||
-		           fwrite("\n", sizeof(gchar), 1, fp) == EOF)) {
+		/* LF of CR+LF split between two reads */
+		if (prev_cr && *prev == '\n')
+			prev++;
+		prev_cr = FALSE;
+
+		while ((cur = memchr(prev, '\r', end - prev)) != NULL) {
+			/* keep the last CR of the data as is */
+			if (count == size && cur == end - 1)
+				break;
+
+			if (fp && (fwrite(prev, sizeof(gchar), cur - prev, fp) == EOF ||
+				   fwrite("\n", sizeof(gchar), 1, fp) == EOF)) {
+				perror("fwrite");
+				g_warning(_("Can't write to file.\n"));
+				fp = NULL;
+			}
+
+			if (cur == end - 1) {
+				prev_cr = TRUE;
+				prev = end;
+				break;
+			}
+
+			if (*(cur + 1) == '\n')
+				prev = cur + 2;
+			else
+				prev = cur + 1;
+		}
+
+		if (prev < end && fp &&
+		    fwrite(prev, sizeof(gchar), end - prev, fp) == EOF) {
 			perror("fwrite");
 			g_warning(_("Can't write to file.\n"));
 			fp = NULL;
 		}
 
-		if (*(cur + 1) == '\n')
-			prev = cur + 2;
-		else
-			prev = cur + 1;
-
-		if (prev - buf >= size) break;
-	}
-
-	if (prev - buf < size && fp &&
-	    fwrite(buf, sizeof(gchar), size - (prev - buf), fp) == EOF) {
-		perror("fwrite");
-		g_warning(_("Can't write to file.\n"));
-		fp = NULL;
-	}
+		buf = recv_buf_adapt(buf, &buf_size, read_count);
+	} while (count < size);
 
 	g_free(buf);
 
@@ -21,14 +21,35 @@
 #define __RECV_H__
 
 #include <glib.h>
+#include <stdio.h>
 
 #include "socket.h"
 
+typedef struct _RecvDataWriter	RecvDataWriter;
+
 typedef gboolean (*RecvUIFunc)	(SockInfo	*sock,
 				 gint		 count,
 				 gint		 read_bytes,
 				 gpointer	 data);
 
+/* Writes multi-line data terminated by ".\r\n" (RFC 1939 / RFC 3977) to a
+   file as it arrives, removing the dot-stuffing and converting CR+LF to
+   LF.  Only the current line is buffered. */
+struct _RecvDataWriter
+{
+	FILE *fp;
+	GString *line;
+
+	gboolean unescape_from;
+
+	gboolean bol;
+	gboolean complete;
+	gboolean error;
+
+	gint count;
+	gint bytes;
+};
+
 gchar *recv_bytes		(SockInfo	*sock,
 				 glong		 size);
 
@@ -43,6 +64,13 @@ gint recv_bytes_write		(SockInfo	*sock,
 				 glong		 size,
 				 FILE		*fp);
 
+RecvDataWriter *recv_data_writer_new	(FILE		*fp,
+					 gboolean	 unescape_from);
+void recv_data_writer_free		(RecvDataWriter	*writer);
+gint recv_data_writer_write		(RecvDataWriter	*writer,
+					 const gchar	*buf,
+					 gint		 len);
+
 void recv_set_ui_func		(RecvUIFunc	 func,
 				 gpointer	 data);
 
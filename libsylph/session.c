@@ -57,10 +57,17 @@ static gboolean session_timeout_cb	(gpointer	 data);
 static gboolean session_ping_cb		(gpointer	 data);
 #endif
 
+static void session_read_buf_adapt	(Session	*session,
+					 gint		 read_len,
+					 gint		 req_len);
+static void session_recv_data_report	(Session	*session,
+					 guint		 len);
+
 static gboolean session_recv_msg_idle_cb	(gpointer	 data);
 static gboolean session_recv_data_idle_cb	(gpointer	 data);
 
 static gboolean session_recv_data_as_file_idle_cb	(gpointer	 data);
+static gboolean session_recv_data_to_file_idle_cb	(gpointer	 data);
 
 static gboolean session_read_msg_cb	(SockInfo	*source,
 					 GIOCondition	 condition,
@@ -72,6 +79,9 @@ static gboolean session_read_data_cb	(SockInfo	*source,
 static gboolean session_read_data_as_file_cb	(SockInfo	*source,
 						 GIOCondition	 condition,
 						 gpointer	 data);
+static gboolean session_read_data_to_file_cb	(SockInfo	*source,
+						 GIOCondition	 condition,
+						 gpointer	 data);
 
 static gboolean session_write_msg_cb	(SockInfo	*source,
 					 GIOCondition	 condition,
@@ -95,11 +105,14 @@ void session_init(Session *session)
 	session->last_access_time = time(NULL);
 
 	g_get_current_time(&session->tv_prev);
+	session->tv_recv_start = session->tv_prev;
 
 	session->conn_id = 0;
 
 	session->io_tag = 0;
 
+	session->read_buf = g_malloc(SESSION_BUFFSIZE);
+	session->read_buf_size = SESSION_BUFFSIZE;
 	session->read_buf_p = session->read_buf;
 	session->read_buf_len = 0;
 
@@ -110,6 +123,9 @@ void session_init(Session *session)
 	session->read_data_fp = NULL;
 	session->read_data_pos = 0;
 
+	session->read_data_writer = NULL;
+	session->read_data_file = NULL;
+
 	session->preread_len = 0;
 
 	session->write_buf = NULL;
@@ -286,11 +302,19 @@ void session_destroy(Session *session)
 	session_close(session);
 	session->destroy(session);
 	g_free(session->server);
+	g_free(session->read_buf);
 	g_string_free(session->read_msg_buf, TRUE);
 	g_byte_array_free(session->read_data_buf, TRUE);
 	g_free(session->read_data_terminator);
 	if (session->read_data_fp)
 		fclose(session->read_data_fp);
+	if (session->read_data_writer) {
+		if (session->read_data_writer->fp)
+			fclose(session->read_data_writer->fp);
+		recv_data_writer_free(session->read_data_writer);
+		g_unlink(session->read_data_file);
+	}
+	g_free(session->read_data_file);
 	g_free(session->write_buf);
 
 	priv = session_get_priv(session);
@@ -510,6 +534,44 @@ gint session_send_msg(Session *session, SessionMsgType type, const gchar *msg)
 	return 0;
 }
 
+/* Doubles the read buffer when a read filled all the space requested, so
+   that sustained bulk transfers are done with fewer and larger reads.
+   The pending data and the position of read_buf_p are preserved. */
+static void session_read_buf_adapt(Session *session, gint read_len,
+				   gint req_len)
+{
+	gint offset;
+
+	if (read_len < req_len ||
+	    session->read_buf_size >= SESSION_BUFFSIZE_MAX)
+		return;
+
+	offset = session->read_buf_p - session->read_buf;
+	session->read_buf_size *= 2;
+	session->read_buf = g_realloc(session->read_buf,
+				      session->read_buf_size);
+	session->read_buf_p = session->read_buf + offset;
+
+	debug_print("session (%p): read buffer size: %d\n", session,
+		    session->read_buf_size);
+}
+
+static void session_recv_data_report(Session *session, guint len)
+{
+	GTimeVal tv_cur;
+	gdouble elapsed;
+
+	g_get_current_time(&tv_cur);
+	elapsed = (tv_cur.tv_sec - session->tv_recv_start.tv_sec) +
+		(tv_cur.tv_usec - session->tv_recv_start.tv_usec) /
+		(gdouble)G_USEC_PER_SEC;
+
+	if (elapsed > 0)
+		debug_print("session (%p): received %u bytes in %.3f sec "
+			    "(%.1f KB/s, buffer %d bytes)\n", session, len,
+			    elapsed, len / elapsed / 1024, session->read_buf_size);
+}
+
 gint session_recv_msg(Session *session)
 {
 	g_return_val_if_fail(session->sock != NULL, -1);
@@ -595,6 +657,7 @@ gint session_recv_data(Session *session, guint size, const gchar *terminator)
 	g_free(session->read_data_terminator);
 	session->read_data_terminator = g_strdup(terminator);
 	g_get_current_time(&session->tv_prev);
+	session->tv_recv_start = session->tv_prev;
 
 	if (session->read_buf_len > 0)
 		session->idle_tag = g_idle_add(session_recv_data_idle_cb,
@@ -638,6 +701,7 @@ gint session_recv_data_as_file(Session *session, guint size,
 	g_free(session->read_data_terminator);
 	session->read_data_terminator = g_strdup(terminator);
 	g_get_current_time(&session->tv_prev);
+	session->tv_recv_start = session->tv_prev;
 
 	session->read_data_fp = my_tmpfile();
 	if (!session->read_data_fp) {
@@ -677,13 +741,70 @@ static gboolean session_recv_data_as_file_idle_cb(gpointer data)
 	return FALSE;
 }
 
+/* receives multi-line data terminated by ".\r\n" and writes it directly
+   to file, converting it into the local format on the fly */
+gint session_recv_data_to_file(Session *session, const gchar *file)
+{
+	FILE *fp;
+
+	g_return_val_if_fail(session->sock != NULL, -1);
+	g_return_val_if_fail(session->read_data_writer == NULL, -1);
+	g_return_val_if_fail(file != NULL, -1);
+
+	session->state = SESSION_RECV;
+
+	g_get_current_time(&session->tv_prev);
+	session->tv_recv_start = session->tv_prev;
+
+	if ((fp = g_fopen(file, "wb")) == NULL) {
+		FILE_OP_ERROR(file, "fopen");
+		return -1;
+	}
+	if (change_file_mode_rw(fp, file) < 0)
+		FILE_OP_ERROR(file, "chmod");
+
+	session->read_data_writer = recv_data_writer_new(fp, FALSE);
+	session->read_data_file = g_strdup(file);
+
+	if (session->read_buf_len > 0)
+		session->idle_tag =
+			g_idle_add(session_recv_data_to_file_idle_cb, session);
+	else
+		session->io_tag = sock_add_watch(session->sock, G_IO_IN,
+						 session_read_data_to_file_cb,
+						 session);
+
+	return 0;
+}
+
+static gboolean session_recv_data_to_file_idle_cb(gpointer data)
+{
+	Session *session = SESSION(data);
+	gboolean ret;
+
+#if GLIB_CHECK_VERSION(2, 12, 0)
+	if (g_source_is_destroyed(g_main_current_source()))
+		return FALSE;
+#endif
+
+	session->idle_tag = 0;
+	ret = session_read_data_to_file_cb(session->sock, G_IO_IN, session);
+
+	if (ret == TRUE)
+		session->io_tag = sock_add_watch(session->sock, G_IO_IN,
+						 session_read_data_to_file_cb,
+						 session);
+
+	return FALSE;
+}
+
 static gboolean session_read_msg_cb(SockInfo *source, GIOCondition condition,
 				    gpointer data)
 {
 	Session *session = SESSION(data);
-	gchar buf[SESSION_BUFFSIZE];
 	gint line_len;
 	gchar *newline;
+	gboolean complete;
 	gchar *msg;
 	gint ret;
 
@@ -693,7 +814,7 @@ static gboolean session_read_msg_cb(SockInfo *source, GIOCondition condition,
 		gint read_len;
 
 		read_len = sock_read(session->sock, session->read_buf,
-				     SESSION_BUFFSIZE - 1);
+				     session->read_buf_size);
 
 		if (read_len == 0) {
 			g_warning("sock_read: received EOF\n");
@@ -726,10 +847,9 @@ static gboolean session_read_msg_cb(SockInfo *source, GIOCondition condition,
 	if (line_len == 0)
 		return TRUE;
 
-	memcpy(buf, session->read_buf_p, line_len);
-	buf[line_len] = '\0';
-
-	g_string_append(session->read_msg_buf, buf);
+	g_string_append_len(session->read_msg_buf, session->read_buf_p,
+			    line_len);
+	complete = (newline != NULL);
 
 	session->read_buf_len -= line_len;
 	if (session->read_buf_len == 0)
@@ -738,7 +858,7 @@ static gboolean session_read_msg_cb(SockInfo *source, GIOCondition condition,
 		session->read_buf_p += line_len;
 
 	/* incomplete read */
-	if (buf[line_len - 1] != '\n')
+	if (!complete)
 		return TRUE;
 
 	/* complete */
@@ -781,7 +901,7 @@ static gboolean session_read_data_cb(SockInfo *source, GIOCondition condition,
 		gint read_len;
 
 		read_len = sock_read(session->sock, session->read_buf,
-				     SESSION_BUFFSIZE);
+				     session->read_buf_size);
 
 		if (read_len == 0) {
 			g_warning("sock_read: received EOF\n");
@@ -801,6 +921,8 @@ static gboolean session_read_data_cb(SockInfo *source, GIOCondition condition,
 		}
 
 		session->read_buf_len = read_len;
+		session_read_buf_adapt(session, read_len,
+				       session->read_buf_size);
 	}
 
 	session_set_timeout(session, session->timeout_interval);
@@ -855,6 +977,7 @@ static gboolean session_read_data_cb(SockInfo *source, GIOCondition condition,
 	}
 
 	data_len = data_buf->len - terminator_len;
+	session_recv_data_report(session, data_len);
 
 	/* callback */
 	ret = session->recv_data_finished(session, (guchar *)data_buf->data,
@@ -873,7 +996,7 @@ static gboolean session_read_data_cb(SockInfo *source, GIOCondition condition,
 }
 
 #define READ_BUF_LEFT() \
-	(SESSION_BUFFSIZE - (session->read_buf_p - session->read_buf) - \
+	(session->read_buf_size - (session->read_buf_p - session->read_buf) - \
 	 session->read_buf_len)
 #define PREREAD_SIZE	8
 
@@ -893,8 +1016,10 @@ static gboolean session_read_data_as_file_cb(SockInfo *source,
 	g_return_val_if_fail(condition == G_IO_IN, FALSE);
 
 	if (session->read_buf_len == 0) {
+		gint req_len = READ_BUF_LEFT();
+
 		read_len = sock_read(session->sock, session->read_buf_p,
-				     READ_BUF_LEFT());
+				     req_len);
 
 		if (read_len == 0) {
 			g_warning("sock_read: received EOF\n");
@@ -914,6 +1039,9 @@ static gboolean session_read_data_as_file_cb(SockInfo *source,
 		}
 
 		session->read_buf_len = read_len;
+		/* a short request after leftover data is not a full read */
+		session_read_buf_adapt(session, read_len,
+				       session->read_buf_size);
 	}
 
 	session_set_timeout(session, session->timeout_interval);
@@ -967,7 +1095,7 @@ static gboolean session_read_data_as_file_cb(SockInfo *source,
 			return TRUE;
 		}
 
-		if (READ_BUF_LEFT() >= (SESSION_BUFFSIZE / 2)) {
+		if (READ_BUF_LEFT() >= (session->read_buf_size / 2)) {
 			session->read_buf_p += session->read_buf_len;
 			session->preread_len = buf_data_len;
 			session->read_buf_len = 0;
@@ -1033,6 +1161,8 @@ static gboolean session_read_data_as_file_cb(SockInfo *source,
 	session->read_buf_len = 0;
 	session->read_buf_p = session->read_buf;
 
+	session_recv_data_report(session, session->read_data_pos);
+
 	/* callback */
 	ret = session->recv_data_as_file_finished
 		(session, session->read_data_fp, session->read_data_pos);
@@ -1052,6 +1182,122 @@ static gboolean session_read_data_as_file_cb(SockInfo *source,
 	return FALSE;
 }
 
+static gboolean session_read_data_to_file_cb(SockInfo *source,
+					     GIOCondition condition,
+					     gpointer data)
+{
+	Session *session = SESSION(data);
+	RecvDataWriter *writer = session->read_data_writer;
+	FILE *fp;
+	gchar *file;
+	guint data_len;
+	gint write_len;
+	gint ret;
+
+	g_return_val_if_fail(condition == G_IO_IN, FALSE);
+	g_return_val_if_fail(writer != NULL, FALSE);
+
+	if (session->read_buf_len == 0) {
+		gint read_len;
+
+		read_len = sock_read(session->sock, session->read_buf,
+				     session->read_buf_size);
+
+		if (read_len == 0) {
+			g_warning("sock_read: received EOF\n");
+			session->state = SESSION_EOF;
+			return FALSE;
+		}
+
+		if (read_len < 0) {
+			switch (errno) {
+			case EAGAIN:
+				return TRUE;
+			default:
+				g_warning("%s: sock_read: %s\n", G_STRFUNC, g_strerror(errno));
+				session->state = SESSION_ERROR;
+				return FALSE;
+			}
+		}
+
+		session->read_buf_p = session->read_buf;
+		session->read_buf_len = read_len;
+		session_read_buf_adapt(session, read_len,
+				       session->read_buf_size);
+	}
+
+	session_set_timeout(session, session->timeout_interval);
+
+	/* the data following the terminator is left in read_buf */
+	write_len = recv_data_writer_write(writer, session->read_buf_p,
+					   session->read_buf_len);
+	session->read_buf_len -= write_len;
+	if (session->read_buf_len == 0)
+		session->read_buf_p = session->read_buf;
+	else
+		session->read_buf_p += write_len;
+
+	if (writer->error) {
+		g_warning("session_read_data_to_file_cb: "
+			  "writing data to file failed\n");
+		session->state = SESSION_ERROR;
+		return FALSE;
+	}
+
+	/* incomplete read */
+	if (!writer->complete) {
+		GTimeVal tv_cur;
+
+		g_get_current_time(&tv_cur);
+		if (tv_cur.tv_sec - session->tv_prev.tv_sec > 0 ||
+		    tv_cur.tv_usec - session->tv_prev.tv_usec >
+		    UI_REFRESH_INTERVAL) {
+			if (session->recv_data_progressive_notify)
+				session->recv_data_progressive_notify
+					(session, writer->bytes, 0,
+					 session->recv_data_progressive_notify_data);
+			g_get_current_time(&session->tv_prev);
+		}
+		return TRUE;
+	}
+
+	/* complete */
+	if (session->io_tag > 0) {
+		g_source_remove(session->io_tag);
+		session->io_tag = 0;
+	}
+
+	fp = writer->fp;
+	file = session->read_data_file;
+	data_len = writer->bytes;
+	session_recv_data_report(session, data_len);
+	recv_data_writer_free(writer);
+	session->read_data_writer = NULL;
+	session->read_data_file = NULL;
+
+	if (fclose(fp) == EOF) {
+		FILE_OP_ERROR(file, "fclose");
+		g_unlink(file);
+		g_free(file);
+		session->state = SESSION_ERROR;
+		return FALSE;
+	}
+
+	/* callback */
+	ret = session->recv_data_to_file_finished(session, file, data_len);
+
+	g_free(file);
+
+	if (session->recv_data_notify)
+		session->recv_data_notify(session, data_len,
+					  session->recv_data_notify_data);
+
+	if (ret < 0)
+		session->state = SESSION_ERROR;
+
+	return FALSE;
+}
+
 static gint session_write_buf(Session *session)
 {
 	gint write_len;
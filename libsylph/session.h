@@ -31,8 +31,10 @@
 
 #include "socket.h"
 #include "socks.h"
+#include "recv.h"
 
 #define SESSION_BUFFSIZE	8192
+#define SESSION_BUFFSIZE_MAX	(1024 * 1024)
 
 typedef struct _Session	Session;
 
@@ -108,12 +110,15 @@ struct _Session
 
 	time_t last_access_time;
 	GTimeVal tv_prev;
+	GTimeVal tv_recv_start;
 
 	gint conn_id;
 
 	gint io_tag;
 
-	gchar read_buf[SESSION_BUFFSIZE];
+	/* grows up to SESSION_BUFFSIZE_MAX while reads keep filling it */
+	gchar *read_buf;
+	gint read_buf_size;
 	gchar *read_buf_p;
 	gint read_buf_len;
 
@@ -128,6 +133,10 @@ struct _Session
 	FILE *read_data_fp;
 	gint read_data_pos;
 
+	/* large multiple lines data written to file with dot-unstuffing */
+	RecvDataWriter *read_data_writer;
+	gchar *read_data_file;
+
 	gint preread_len;
 
 	/* buffer for short messages */
@@ -161,6 +170,9 @@ struct _Session
 	gint (*recv_data_as_file_finished)	(Session	*session,
 						 FILE		*fp,
 						 guint		 len);
+	gint (*recv_data_to_file_finished)	(Session	*session,
+						 const gchar	*file,
+						 guint		 len);
 
 	void (*destroy)			(Session	*session);
 
@@ -231,5 +243,7 @@ gint session_recv_data	(Session	*session,
 gint session_recv_data_as_file	(Session	*session,
 				 guint		 size,
 				 const gchar	*terminator);
+gint session_recv_data_to_file	(Session	*session,
+				 const gchar	*file);
 
 #endif /* __SESSION_H__ */
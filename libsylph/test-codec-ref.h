@@ -0,0 +1,42 @@
+/*
+ * LibSylph -- E-Mail client library
+ * Copyright (C) 1999-2011 Hiroyuki Yamamoto
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __TEST_CODEC_REF_H__
+#define __TEST_CODEC_REF_H__
+
+#include <glib.h>
+
+#include "base64.h"
+
+/* the previous per-character codecs, used by test-codec and bench-codec
+   as the reference */
+
+void ref_base64_encode		(gchar		*out,
+				 const guchar	*in,
+				 gint		 inlen);
+gint ref_base64_decode		(guchar		*out,
+				 const gchar	*in,
+				 gint		 inlen);
+gint ref_base64_decoder_decode	(Base64Decoder	*decoder,
+				 const gchar	*in,
+				 guchar		*out);
+
+gint ref_qp_decode_line		(gchar		*str);
+
+#endif /* __TEST_CODEC_REF_H__ */
@@ -0,0 +1,334 @@
+/*
+ * LibSylph -- E-Mail client library
+ * Copyright (C) 1999-2011 Hiroyuki Yamamoto
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Round-trip tests of the base64 and quoted-printable codecs. The input
+   is fed in chunks of every size and alignment, and the output is
+   compared with the previous per-character codecs in test-codec-ref.c. */
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "base64.h"
+#include "quoted-printable.h"
+#include "procmime.h"
+#include "utils.h"
+#include "defs.h"
+#include "test-codec-ref.h"
+
+#define MAX_DATA_LEN	300
+#define N_REF_TESTS	20000
+
+static gint failures = 0;
+
+#define CHECK(cond, ...)			\
+{						\
+	if (!(cond)) {				\
+		g_print(__VA_ARGS__);		\
+		failures++;			\
+	}					\
+}
+
+static void test_base64_chunks(const guchar *data, gint len,
+			       const gchar *enc, gint enc_len)
+{
+	Base64Decoder *decoder;
+	guchar *out;
+	gint size, align, pos, n, ret, out_len;
+
+	out = g_malloc(len + 4);
+
+	/* the first chunk is align bytes long, the others size bytes */
+	for (size = 1; size <= enc_len; size++) {
+		for (align = 0; align < MIN(size, 4); align++) {
+			decoder = base64_decoder_new();
+			out_len = 0;
+			for (pos = 0; pos < enc_len; pos += n) {
+				n = (pos == 0 && align > 0) ? align : size;
+				n = MIN(n, enc_len - pos);
+				ret = base64_decoder_decode_buf
+					(decoder, enc + pos, n, out + out_len);
+				if (ret < 0)
+					break;
+				out_len += ret;
+			}
+			base64_decoder_free(decoder);
+
+			CHECK(out_len == len && memcmp(out, data, len) == 0,
+			      "base64: len %d, chunk %d, align %d: "
+			      "decoded %d bytes\n", len, size, align, out_len);
+		}
+	}
+
+	g_free(out);
+}
+
+static void test_base64(GRand *rand)
+{
+	static const gint line_sizes[] = {3, 54, 57, 72};
+	guchar data[MAX_DATA_LEN];
+	gchar enc[MAX_DATA_LEN * 2 + 4];
+	guchar out[MAX_DATA_LEN + 4];
+	gint len, i, enc_len, out_len;
+
+	for (len = 0; len <= MAX_DATA_LEN; len++) {
+		for (i = 0; i < len; i++)
+			data[i] = g_rand_int_range(rand, 0, 256);
+
+		base64_encode(enc, data, len);
+		enc_len = strlen(enc);
+		CHECK(enc_len == (len + 2) / 3 * 4,
+		      "base64: len %d: encoded %d chars\n", len, enc_len);
+
+		out_len = base64_decode(out, enc, enc_len);
+		CHECK(out_len == len && memcmp(out, data, len) == 0,
+		      "base64_decode: len %d: decoded %d bytes\n",
+		      len, out_len);
+
+		test_base64_chunks(data, len, enc, enc_len);
+
+		for (i = 0; i < G_N_ELEMENTS(line_sizes); i++) {
+			enc_len = base64_encode_lines(enc, data, len,
+						      line_sizes[i]);
+			CHECK(enc_len == strlen(enc),
+			      "base64_encode_lines: len %d, line %d: "
+			      "wrong length\n", len, line_sizes[i]);
+			test_base64_chunks(data, len, enc, enc_len);
+		}
+	}
+}
+
+/* compare with the previous codecs on random data, corrupted with
+   characters which the decoders must handle as the old ones did */
+static void test_base64_ref(GRand *rand)
+{
+	static const gchar corrupt[] = "=!-\r\n\200A";
+	guchar data[MAX_DATA_LEN];
+	gchar enc[MAX_DATA_LEN * 2 + 4];
+	gchar ref_enc[MAX_DATA_LEN * 2 + 4];
+	guchar out[MAX_DATA_LEN + 4];
+	guchar ref_out[MAX_DATA_LEN + 4];
+	Base64Decoder *decoder, *ref_decoder;
+	gchar *line, *next;
+	gint n, len, i, enc_len, ret, ref_ret;
+
+	for (n = 0; n < N_REF_TESTS; n++) {
+		len = g_rand_int_range(rand, 0, MAX_DATA_LEN + 1);
+		for (i = 0; i < len; i++)
+			data[i] = g_rand_int_range(rand, 0, 256);
+
+		base64_encode(enc, data, len);
+		ref_base64_encode(ref_enc, data, len);
+		CHECK(!strcmp(enc, ref_enc),
+		      "base64_encode: len %d: differs from reference\n", len);
+
+		/* 57 bytes per line, as compose_write_attach() */
+		enc_len = base64_encode_lines(enc, data, len, 57);
+		ref_enc[0] = '\0';
+		for (i = 0; i < len; i += 57) {
+			ref_base64_encode(ref_enc + strlen(ref_enc), data + i,
+					  MIN(57, len - i));
+			strcat(ref_enc, "\n");
+		}
+		CHECK(!strcmp(enc, ref_enc),
+		      "base64_encode_lines: len %d: differs from reference\n",
+		      len);
+
+		if (enc_len > 0 && g_rand_boolean(rand)) {
+			i = g_rand_int_range(rand, 0, enc_len);
+			enc[i] = corrupt[g_rand_int_range
+					 (rand, 0, sizeof(corrupt) - 1)];
+		}
+
+		/* decode line by line, as procmime_decode_content() */
+		decoder = base64_decoder_new();
+		ref_decoder = base64_decoder_new();
+		for (line = enc; *line != '\0'; line = next) {
+			gchar c;
+
+			if ((next = strchr(line, '\n')) != NULL)
+				next++;
+			else
+				next = line + strlen(line);
+			c = *next;
+			*next = '\0';
+
+			ret = base64_decoder_decode_buf(decoder, line,
+							strlen(line), out);
+			ref_ret = ref_base64_decoder_decode(ref_decoder, line,
+							    ref_out);
+			*next = c;
+
+			CHECK(ret == ref_ret &&
+			      (ret <= 0 || memcmp(out, ref_out, ret) == 0),
+			      "base64_decoder_decode_buf: len %d: returned %d, "
+			      "reference %d\n", len, ret, ref_ret);
+			if (ret < 0 || ref_ret < 0)
+				break;
+		}
+		base64_decoder_free(ref_decoder);
+		base64_decoder_free(decoder);
+	}
+}
+
+/* decode QP text with procmime_decode_content(), which reads the lines
+   in chunks of BUFFSIZE - 1 bytes */
+static gchar *decode_qp(const gchar *text, gint *out_len)
+{
+	MimeInfo *mimeinfo;
+	FILE *infp, *outfp;
+	GString *str;
+	gchar buf[BUFFSIZE];
+	size_t n;
+
+	infp = my_tmpfile();
+	outfp = my_tmpfile();
+	if (!infp || !outfp) {
+		g_print("can't create temporary file\n");
+		exit(1);
+	}
+	fputs(text, infp);
+	rewind(infp);
+
+	mimeinfo = procmime_mimeinfo_new();
+	mimeinfo->content_type = g_strdup("application/octet-stream");
+	mimeinfo->encoding_type = ENC_QUOTED_PRINTABLE;
+	procmime_decode_content(outfp, infp, mimeinfo);
+	procmime_mimeinfo_free_all(mimeinfo);
+	fclose(infp);
+
+	rewind(outfp);
+	str = g_string_new(NULL);
+	while ((n = fread(buf, 1, sizeof(buf), outfp)) > 0)
+		g_string_append_len(str, buf, n);
+	fclose(outfp);
+
+	*out_len = str->len;
+	return g_string_free(str, FALSE);
+}
+
+static void test_qp_one(const gchar *text, const gchar *expected,
+			gint offset, const gchar *what)
+{
+	gchar *out;
+	gint out_len;
+
+	out = decode_qp(text, &out_len);
+	CHECK(out_len == strlen(expected) && memcmp(out, expected, out_len) == 0,
+	      "qp: %s at offset %d: wrong output\n", what, offset);
+	g_free(out);
+}
+
+/* put an escape and a soft line break around the chunk boundary */
+static void test_qp(void)
+{
+	static const gchar *lbreaks[] = {"\n", "\r\n"};
+	GString *text, *expected;
+	gint offset, i;
+
+	text = g_string_new(NULL);
+	expected = g_string_new(NULL);
+
+	for (offset = BUFFSIZE - 6; offset <= BUFFSIZE + 2; offset++) {
+		for (i = 0; i < G_N_ELEMENTS(lbreaks); i++) {
+			g_string_truncate(text, 0);
+			g_string_truncate(expected, 0);
+			while (text->len < offset) {
+				g_string_append_c(text, 'a');
+				g_string_append_c(expected, 'a');
+			}
+			g_string_append(text, "=3D=C3=A9b");
+			g_string_append(expected, "=\303\251b");
+			g_string_append(text, "=");
+			g_string_append(text, lbreaks[i]);
+			g_string_append(text, "tail=41");
+			g_string_append(text, lbreaks[i]);
+			g_string_append(expected, "tailA");
+			g_string_append(expected, lbreaks[i]);
+			test_qp_one(text->str, expected->str, offset,
+				    "escape");
+
+			/* soft line break at the boundary */
+			g_string_truncate(text, 0);
+			g_string_truncate(expected, 0);
+			while (text->len < offset) {
+				g_string_append_c(text, 'a');
+				g_string_append_c(expected, 'a');
+			}
+			g_string_append(text, "=");
+			g_string_append(text, lbreaks[i]);
+			g_string_append(text, "b=");
+			g_string_append(text, lbreaks[i]);
+			g_string_append(text, "c");
+			g_string_append(text, lbreaks[i]);
+			g_string_append(expected, "bc");
+			g_string_append(expected, lbreaks[i]);
+			test_qp_one(text->str, expected->str, offset,
+				    "soft line break");
+		}
+	}
+
+	g_string_free(expected, TRUE);
+	g_string_free(text, TRUE);
+}
+
+static void test_qp_ref(GRand *rand)
+{
+	static const gchar chars[] = "ab=3Dfg9 \t\r\n";
+	gchar orig[81], line[81], ref_line[81];
+	gint n, len, i, ret, ref_ret;
+
+	for (n = 0; n < N_REF_TESTS; n++) {
+		len = g_rand_int_range(rand, 0, sizeof(line));
+		for (i = 0; i < len; i++)
+			orig[i] = chars[g_rand_int_range
+					(rand, 0, sizeof(chars) - 1)];
+		orig[len] = '\0';
+		strcpy(line, orig);
+		strcpy(ref_line, orig);
+
+		ret = qp_decode_line(line);
+		ref_ret = ref_qp_decode_line(ref_line);
+		CHECK(ret == ref_ret && memcmp(line, ref_line, ret + 1) == 0,
+		      "qp_decode_line: \"%s\" differs from reference\n",
+		      orig);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	GRand *rand;
+
+	rand = g_rand_new_with_seed(20110722);
+
+	test_base64(rand);
+	test_base64_ref(rand);
+	test_qp();
+	test_qp_ref(rand);
+
+	g_rand_free(rand);
+
+	if (failures > 0) {
+		g_print("%d failures\n", failures);
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,682 @@
+/*
+ * LibSylph -- E-Mail client library
+ * Copyright (C) 1999-2011 Hiroyuki Yamamoto
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Tests of the CONDSTORE / QRESYNC resynchronization of IMAP folders.
+   A scripted stand-in server is forked for each step, the mailbox is
+   modified between the steps, and the message list and the commands
+   sent by the client are checked. */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include "defs.h"
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#ifdef G_OS_UNIX
+#  include <unistd.h>
+#  include <signal.h>
+#  include <sys/types.h>
+#  include <sys/wait.h>
+#  include <sys/socket.h>
+#  include <netinet/in.h>
+#  include <arpa/inet.h>
+#endif
+
+#include "sylmain.h"
+#include "folder.h"
+#include "imap.h"
+#include "procmsg.h"
+#include "prefs_common.h"
+#include "prefs_account.h"
+#include "socket.h"
+#include "utils.h"
+
+#ifdef G_OS_UNIX
+
+#define MAX_MSGS	16
+#define UID_VALIDITY	1000
+
+typedef struct _TestMsg
+{
+	guint uid;
+	guint64 modseq;
+	const gchar *flags;
+	gboolean expunged;
+} TestMsg;
+
+/* the mailbox of the server */
+static TestMsg msgs[MAX_MSGS];
+static gint n_msgs = 0;
+static guint64 highest_modseq = 0;
+
+/* the server announces QRESYNC, and sends its capabilities with the
+   response of LOGIN */
+static gboolean server_qresync;
+static gboolean server_login_capability;
+
+static gint failures = 0;
+
+#define CHECK(cond, ...)			\
+{						\
+	if (!(cond)) {				\
+		g_print(__VA_ARGS__);		\
+		failures++;			\
+	}					\
+}
+
+static TestMsg *find_msg(guint uid)
+{
+	gint i;
+
+	for (i = 0; i < n_msgs; i++) {
+		if (msgs[i].uid == uid)
+			return &msgs[i];
+	}
+
+	return NULL;
+}
+
+/* a message with modseq 0 gets the next modseq */
+static void add_msg(guint uid, guint64 modseq)
+{
+	g_return_if_fail(n_msgs < MAX_MSGS);
+
+	msgs[n_msgs].uid = uid;
+	msgs[n_msgs].modseq = modseq > 0 ? modseq : ++highest_modseq;
+	msgs[n_msgs].flags = "";
+	msgs[n_msgs].expunged = FALSE;
+	n_msgs++;
+}
+
+static void set_flags(guint uid, const gchar *flags)
+{
+	TestMsg *msg;
+
+	msg = find_msg(uid);
+	g_return_if_fail(msg != NULL);
+	msg->flags = flags;
+	msg->modseq = ++highest_modseq;
+}
+
+static void expunge_msg(guint uid)
+{
+	TestMsg *msg;
+
+	msg = find_msg(uid);
+	g_return_if_fail(msg != NULL);
+	msg->expunged = TRUE;
+	msg->modseq = ++highest_modseq;
+}
+
+/* stand-in server */
+
+static gint server_send(gint fd, const gchar *format, ...)
+{
+	gchar buf[1024];
+	va_list args;
+	gint len, n;
+
+	va_start(args, format);
+	len = g_vsnprintf(buf, sizeof(buf) - 2, format, args);
+	va_end(args);
+	len = MIN(len, (gint)sizeof(buf) - 3);
+	buf[len++] = '\r';
+	buf[len++] = '\n';
+
+	for (n = 0; n < len; ) {
+		gint ret;
+
+		ret = write(fd, buf + n, len - n);
+		if (ret <= 0)
+			return -1;
+		n += ret;
+	}
+
+	return 0;
+}
+
+static gint server_getline(gint fd, gchar *buf, gint size)
+{
+	gint len = 0;
+	gchar c;
+
+	while (len < size - 1) {
+		if (read(fd, &c, 1) != 1)
+			return -1;
+		if (c == '\n')
+			break;
+		if (c != '\r')
+			buf[len++] = c;
+	}
+	buf[len] = '\0';
+
+	return len;
+}
+
+static const gchar *server_capability(gboolean authenticated)
+{
+	if (!authenticated)
+		return "IMAP4rev1 UIDPLUS";
+	if (server_qresync)
+		return "IMAP4rev1 UIDPLUS NAMESPACE CONDSTORE ENABLE QRESYNC";
+	return "IMAP4rev1 UIDPLUS NAMESPACE CONDSTORE";
+}
+
+static void server_parse_set(const gchar *set, guint *first, guint *last)
+{
+	gchar *ep;
+
+	*first = strtoul(set, &ep, 10);
+	*last = *first;
+	if (*ep == ':') {
+		if (ep[1] == '*')
+			*last = G_MAXUINT;
+		else
+			*last = strtoul(ep + 1, NULL, 10);
+	}
+}
+
+static gint server_fetch(gint fd, const gchar *tag, const gchar *args)
+{
+	const gchar *p;
+	guint first, last;
+	guint64 changedsince = 0;
+	gboolean vanished = FALSE;
+	gboolean header;
+	gint i, seq = 0;
+
+	server_parse_set(args, &first, &last);
+	header = strstr(args, "RFC822.HEADER") != NULL;
+	if ((p = strstr(args, "(CHANGEDSINCE ")) != NULL) {
+		changedsince = g_ascii_strtoull(p + 14, NULL, 10);
+		vanished = strstr(p, " VANISHED)") != NULL;
+	}
+
+	if (vanished) {
+		GString *set;
+		guint range_first = 0, range_last = 0;
+
+		set = g_string_new(NULL);
+		for (i = 0; i <= n_msgs; i++) {
+			if (i < n_msgs &&
+			    (!msgs[i].expunged || msgs[i].modseq <= changedsince))
+				continue;
+			if (i < n_msgs && range_last > 0 &&
+			    msgs[i].uid == range_last + 1) {
+				range_last = msgs[i].uid;
+				continue;
+			}
+			if (range_last > 0) {
+				if (set->len > 0)
+					g_string_append_c(set, ',');
+				if (range_first == range_last)
+					g_string_append_printf
+						(set, "%u", range_first);
+				else
+					g_string_append_printf
+						(set, "%u:%u",
+						 range_first, range_last);
+			}
+			if (i < n_msgs)
+				range_first = range_last = msgs[i].uid;
+		}
+		if (set->len > 0 &&
+		    server_send(fd, "* VANISHED (EARLIER) %s", set->str) < 0) {
+			g_string_free(set, TRUE);
+			return -1;
+		}
+		g_string_free(set, TRUE);
+	}
+
+	for (i = 0; i < n_msgs; i++) {
+		gchar *hdr;
+		gint ret;
+
+		if (msgs[i].expunged)
+			continue;
+		seq++;
+		if (msgs[i].uid < first || msgs[i].uid > last ||
+		    msgs[i].modseq <= changedsince)
+			continue;
+
+		if (!header) {
+			if (server_send(fd, "* %d FETCH (UID %u FLAGS (%s) "
+					"MODSEQ (%" G_GUINT64_FORMAT "))",
+					seq, msgs[i].uid, msgs[i].flags,
+					msgs[i].modseq) < 0)
+				return -1;
+			continue;
+		}
+
+		hdr = g_strdup_printf("From: sender@example.com\r\n"
+				      "Subject: message %u\r\n"
+				      "Message-ID: <%u@example.com>\r\n"
+				      "\r\n", msgs[i].uid, msgs[i].uid);
+		ret = server_send(fd, "* %d FETCH (UID %u FLAGS (%s) "
+				  "RFC822.SIZE %d RFC822.HEADER {%d}",
+				  seq, msgs[i].uid, msgs[i].flags,
+				  (gint)strlen(hdr) + 100, (gint)strlen(hdr));
+		if (ret == 0 &&
+		    write(fd, hdr, strlen(hdr)) != (gint)strlen(hdr))
+			ret = -1;
+		if (ret == 0)
+			ret = server_send(fd, ")");
+		g_free(hdr);
+		if (ret < 0)
+			return -1;
+	}
+
+	return server_send(fd, "%s OK UID FETCH completed", tag);
+}
+
+static gint server_search(gint fd, const gchar *tag)
+{
+	GString *str;
+	gint i, ret;
+
+	str = g_string_new("* SEARCH");
+	for (i = 0; i < n_msgs; i++) {
+		if (!msgs[i].expunged)
+			g_string_append_printf(str, " %u", msgs[i].uid);
+	}
+	ret = server_send(fd, "%s", str->str);
+	g_string_free(str, TRUE);
+	if (ret < 0)
+		return -1;
+
+	return server_send(fd, "%s OK UID SEARCH completed", tag);
+}
+
+static gint server_select(gint fd, const gchar *tag)
+{
+	gint i, exists = 0;
+
+	for (i = 0; i < n_msgs; i++) {
+		if (!msgs[i].expunged)
+			exists++;
+	}
+
+	if (server_send(fd, "* FLAGS (\\Answered \\Flagged \\Deleted "
+			"\\Seen \\Draft)") < 0 ||
+	    server_send(fd, "* %d EXISTS", exists) < 0 ||
+	    server_send(fd, "* 0 RECENT") < 0 ||
+	    server_send(fd, "* OK [UIDVALIDITY %u] UIDs valid",
+			UID_VALIDITY) < 0 ||
+	    server_send(fd, "* OK [HIGHESTMODSEQ %" G_GUINT64_FORMAT "] "
+			"Highest", highest_modseq) < 0)
+		return -1;
+
+	return server_send(fd, "%s OK [READ-WRITE] SELECT completed", tag);
+}
+
+/* serve one connection, and write the commands without the tags to
+   log_file */
+static void server_run(gint fd, const gchar *log_file)
+{
+	FILE *log_fp;
+	gchar buf[1024];
+	gchar *tag, *cmd;
+	gboolean authenticated = FALSE;
+	gint ret;
+
+	if ((log_fp = fopen(log_file, "wb")) == NULL)
+		return;
+
+	if (server_send(fd, "* OK IMAP4rev1 stand-in server ready") < 0) {
+		fclose(log_fp);
+		return;
+	}
+
+	while (server_getline(fd, buf, sizeof(buf)) >= 0) {
+		tag = buf;
+		if ((cmd = strchr(buf, ' ')) == NULL)
+			break;
+		*cmd++ = '\0';
+		fprintf(log_fp, "%s\n", cmd);
+		fflush(log_fp);
+
+		if (!strcmp(cmd, "CAPABILITY")) {
+			ret = server_send(fd, "* CAPABILITY %s",
+					  server_capability(authenticated));
+			if (ret == 0)
+				ret = server_send(fd, "%s OK CAPABILITY "
+						  "completed", tag);
+		} else if (!strncmp(cmd, "LOGIN ", 6)) {
+			authenticated = TRUE;
+			if (server_login_capability)
+				ret = server_send(fd, "%s OK [CAPABILITY %s] "
+						  "Logged in", tag,
+						  server_capability(TRUE));
+			else
+				ret = server_send(fd, "%s OK Logged in", tag);
+		} else if (!strcmp(cmd, "ENABLE QRESYNC") && server_qresync) {
+			ret = server_send(fd, "* ENABLED QRESYNC");
+			if (ret == 0)
+				ret = server_send(fd, "%s OK Enabled", tag);
+		} else if (!strcmp(cmd, "NAMESPACE")) {
+			ret = server_send(fd, "* NAMESPACE ((\"\" \"/\")) "
+					  "NIL NIL");
+			if (ret == 0)
+				ret = server_send(fd, "%s OK NAMESPACE "
+						  "completed", tag);
+		} else if (!strcmp(cmd, "SELECT INBOX"))
+			ret = server_select(fd, tag);
+		else if (!strncmp(cmd, "UID FETCH ", 10))
+			ret = server_fetch(fd, tag, cmd + 10);
+		else if (!strcmp(cmd, "UID SEARCH ALL"))
+			ret = server_search(fd, tag);
+		else if (!strcmp(cmd, "NOOP"))
+			ret = server_send(fd, "%s OK NOOP completed", tag);
+		else if (!strcmp(cmd, "LOGOUT")) {
+			server_send(fd, "* BYE Logging out");
+			server_send(fd, "%s OK LOGOUT completed", tag);
+			break;
+		} else
+			ret = server_send(fd, "%s BAD Unknown command", tag);
+
+		if (ret < 0)
+			break;
+	}
+
+	fclose(log_fp);
+}
+
+/* client */
+
+static gboolean log_has_cmd(const gchar *log, const gchar *cmd)
+{
+	gchar *line;
+	gboolean found;
+
+	line = g_strconcat("\n", cmd, "\n", NULL);
+	found = strstr(log, line) != NULL;
+	g_free(line);
+
+	return found;
+}
+
+static gint log_count_cmd(const gchar *log, const gchar *cmd)
+{
+	gchar *line;
+	const gchar *p;
+	gint count = 0;
+
+	line = g_strconcat("\n", cmd, "\n", NULL);
+	for (p = log; (p = strstr(p, line)) != NULL; p++)
+		count++;
+	g_free(line);
+
+	return count;
+}
+
+/* run folder_item_get_msg_list() against a new server process. Returns
+   the commands received by the server, each line preceded by '\n'. */
+static gchar *get_msg_list(FolderItem *item, gint listen_fd,
+			   const gchar *log_file, GSList **mlist)
+{
+	gchar *contents = NULL, *log;
+	pid_t pid;
+	gint status;
+
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		exit(1);
+	}
+	if (pid == 0) {
+		gint fd;
+
+		alarm(30);
+		fd = accept(listen_fd, NULL, NULL);
+		close(listen_fd);
+		if (fd >= 0) {
+			server_run(fd, log_file);
+			close(fd);
+		}
+		_exit(0);
+	}
+
+	*mlist = folder_item_get_msg_list(item, TRUE);
+	folder_remote_folder_destroy_all_sessions();
+	waitpid(pid, &status, 0);
+
+	if (!g_file_get_contents(log_file, &contents, NULL, NULL))
+		contents = g_strdup("");
+	log = g_strconcat("\n", contents, NULL);
+	g_free(contents);
+
+	return log;
+}
+
+/* check the UIDs of mlist against uids, and return the message of uid */
+static MsgInfo *check_msg_list(GSList *mlist, const gchar *step,
+			       const gchar *uids, guint uid)
+{
+	GString *str;
+	GSList *cur;
+	MsgInfo *found = NULL;
+	guint i;
+
+	str = g_string_new(NULL);
+	for (i = 1; i <= MAX_MSGS; i++) {
+		for (cur = mlist; cur != NULL; cur = cur->next) {
+			MsgInfo *msginfo = (MsgInfo *)cur->data;
+
+			if (msginfo->msgnum != i)
+				continue;
+			if (str->len > 0)
+				g_string_append_c(str, ',');
+			g_string_append_printf(str, "%u", i);
+			if (i == uid)
+				found = msginfo;
+			break;
+		}
+	}
+
+	CHECK(!strcmp(str->str, uids),
+	      "%s: got messages %s, expected %s\n", step, str->str, uids);
+	g_string_free(str, TRUE);
+
+	return found;
+}
+
+int main(int argc, char *argv[])
+{
+	struct sockaddr_in addr;
+	socklen_t addrlen;
+	gint listen_fd;
+	gchar *root, *log_file, *path, *log;
+	PrefsAccount *ac;
+	Folder *folder;
+	FolderItem *item;
+	GSList *mlist;
+	MsgInfo *msginfo;
+	guint i;
+
+#if USE_THREADS
+	if (!g_thread_supported())
+		g_thread_init(NULL);
+#endif
+	syl_init();
+	signal(SIGPIPE, SIG_IGN);
+
+	listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (listen_fd < 0) {
+		perror("socket");
+		return 77;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = 0;
+	addrlen = sizeof(addr);
+	if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    listen(listen_fd, 1) < 0 ||
+	    getsockname(listen_fd, (struct sockaddr *)&addr, &addrlen) < 0) {
+		perror("bind");
+		return 77;
+	}
+
+	root = g_strdup_printf("%s%ctest-imap.%d", g_get_tmp_dir(),
+			       G_DIR_SEPARATOR, getpid());
+	set_rc_dir(root);
+	log_file = g_strconcat(root, G_DIR_SEPARATOR_S, "server.log", NULL);
+
+	prefs_common_read_config();
+	sock_set_io_timeout(10);
+
+	ac = prefs_account_new();
+	ac->protocol = A_IMAP4;
+	ac->recv_server = g_strdup("127.0.0.1");
+	ac->set_imapport = TRUE;
+	ac->imapport = ntohs(addr.sin_port);
+	ac->userid = g_strdup("user");
+	ac->passwd = g_strdup("pass");
+	ac->imap_auth_type = IMAP_AUTH_LOGIN;
+
+	folder = folder_new(F_IMAP, "test", NULL);
+	folder->account = ac;
+	ac->folder = REMOTE_FOLDER(folder);
+	folder_add(folder);
+	item = folder_item_new("INBOX", "INBOX");
+	folder_item_append(FOLDER_ITEM(folder->node->data), item);
+
+	path = folder_item_get_path(item);
+	if (make_dir_hier(path) < 0)
+		return 1;
+	g_free(path);
+
+	/* initial fetch, with the capabilities in the LOGIN response */
+	server_qresync = TRUE;
+	server_login_capability = TRUE;
+	for (i = 1; i <= 6; i++)
+		add_msg(i, 0);
+
+	log = get_msg_list(item, listen_fd, log_file, &mlist);
+	check_msg_list(mlist, "initial", "1,2,3,4,5,6", 0);
+	CHECK(log_has_cmd(log, "UID FETCH 1:* "
+			  "(UID FLAGS RFC822.SIZE RFC822.HEADER)"),
+	      "initial: headers not fetched\n");
+	CHECK(log_count_cmd(log, "CAPABILITY") == 1,
+	      "initial: CAPABILITY sent %d times\n",
+	      log_count_cmd(log, "CAPABILITY"));
+	CHECK(log_has_cmd(log, "ENABLE QRESYNC"),
+	      "initial: QRESYNC not enabled\n");
+	procmsg_msg_list_free(mlist);
+	g_free(log);
+
+	/* QRESYNC: the expunged messages come with VANISHED (EARLIER) */
+	set_flags(2, "\\Seen");
+	expunge_msg(3);
+	expunge_msg(4);
+	add_msg(7, 0);
+
+	log = get_msg_list(item, listen_fd, log_file, &mlist);
+	msginfo = check_msg_list(mlist, "qresync", "1,2,5,6,7", 2);
+	CHECK(msginfo && !MSG_IS_UNREAD(msginfo->flags),
+	      "qresync: flags of message 2 not updated\n");
+	CHECK(log_has_cmd(log, "UID FETCH 1:* (UID FLAGS) "
+			  "(CHANGEDSINCE 6 VANISHED)"),
+	      "qresync: CHANGEDSINCE not sent\n");
+	CHECK(!log_has_cmd(log, "UID SEARCH ALL") &&
+	      !log_has_cmd(log, "UID FETCH 1:* (UID FLAGS)"),
+	      "qresync: all messages checked\n");
+	CHECK(log_has_cmd(log, "UID FETCH 7:7 "
+			  "(UID FLAGS RFC822.SIZE RFC822.HEADER)"),
+	      "qresync: new message not fetched\n");
+	procmsg_msg_list_free(mlist);
+	g_free(log);
+
+	/* CONDSTORE only: the count differs from EXISTS, and UID SEARCH
+	   finds the expunged message. The capabilities are asked again
+	   after LOGIN. */
+	server_qresync = FALSE;
+	server_login_capability = FALSE;
+	expunge_msg(5);
+	set_flags(6, "\\Flagged");
+
+	log = get_msg_list(item, listen_fd, log_file, &mlist);
+	msginfo = check_msg_list(mlist, "condstore", "1,2,6,7", 6);
+	CHECK(msginfo && MSG_IS_MARKED(msginfo->flags),
+	      "condstore: flags of message 6 not updated\n");
+	CHECK(log_has_cmd(log, "UID FETCH 1:* (UID FLAGS) (CHANGEDSINCE 10)"),
+	      "condstore: CHANGEDSINCE not sent\n");
+	CHECK(log_has_cmd(log, "UID SEARCH ALL"),
+	      "condstore: UID SEARCH not sent\n");
+	CHECK(!log_has_cmd(log, "UID FETCH 1:* (UID FLAGS)"),
+	      "condstore: all flags fetched\n");
+	CHECK(log_count_cmd(log, "CAPABILITY") == 2,
+	      "condstore: CAPABILITY sent %d times\n",
+	      log_count_cmd(log, "CAPABILITY"));
+	procmsg_msg_list_free(mlist);
+	g_free(log);
+
+	/* a change the server doesn't report with CHANGEDSINCE: the cache
+	   can't be resynchronized, and all flags are fetched */
+	server_login_capability = TRUE;
+	add_msg(8, 3);
+	set_flags(1, "\\Answered");
+
+	log = get_msg_list(item, listen_fd, log_file, &mlist);
+	msginfo = check_msg_list(mlist, "fallback", "1,2,6,7,8", 1);
+	CHECK(msginfo && MSG_IS_REPLIED(msginfo->flags),
+	      "fallback: flags of message 1 not updated\n");
+	CHECK(log_has_cmd(log, "UID FETCH 1:* (UID FLAGS) (CHANGEDSINCE 12)"),
+	      "fallback: CHANGEDSINCE not sent\n");
+	CHECK(log_has_cmd(log, "UID SEARCH ALL"),
+	      "fallback: UID SEARCH not sent\n");
+	CHECK(log_has_cmd(log, "UID FETCH 1:* (UID FLAGS)"),
+	      "fallback: all flags not fetched\n");
+	CHECK(log_has_cmd(log, "UID FETCH 8:8 "
+			  "(UID FLAGS RFC822.SIZE RFC822.HEADER)"),
+	      "fallback: new message not fetched\n");
+	CHECK(log_count_cmd(log, "CAPABILITY") == 1,
+	      "fallback: CAPABILITY sent %d times\n",
+	      log_count_cmd(log, "CAPABILITY"));
+	procmsg_msg_list_free(mlist);
+	g_free(log);
+
+	close(listen_fd);
+	remove_dir_recursive(root);
+	g_free(log_file);
+	g_free(root);
+
+	if (failures > 0) {
+		g_print("%d failures\n", failures);
+		return 1;
+	}
+
+	return 0;
+}
+
+#else /* G_OS_UNIX */
+
+int main(int argc, char *argv[])
+{
+	/* skipped */
+	return 77;
+}
+
+#endif /* G_OS_UNIX */
@@ -0,0 +1,573 @@
+/*
+ * LibSylph -- E-Mail client library
+ * Copyright (C) 1999-2011 Hiroyuki Yamamoto
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Thread index of a folder.
+ *
+ * The parent of a message is the first message whose Message-ID
+ * matches In-Reply-To, or else the first of References. Messages are
+ * registered in wait_table under the IDs which are preferred to their
+ * current parent, so inserting a message only relinks the messages
+ * which were waiting for it.
+ *
+ * File format (THREAD_INDEX_FILE in the folder cache directory):
+ *
+ *   header:	version
+ *   records:	(msgnum, parent msgnum, size, hash of Message-ID)
+ *		in pre-order of the thread tree (parent msgnum is 0 for
+ *		the top-level messages)
+ *
+ * A record is used only if its message is in the given list and its
+ * parent was used, so the remaining messages are inserted again.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include "defs.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "threadindex.h"
+#include "utils.h"
+
+struct _ThreadIndex
+{
+	GNode *root;
+
+	GHashTable *node_table;		/* MsgInfo -> GNode */
+	GHashTable *msgid_table;	/* Message-ID -> first GNode */
+	GHashTable *dup_table;		/* Message-ID -> GSList of GNode */
+	GHashTable *wait_table;		/* Message-ID -> GSList of GNode */
+
+	gboolean tables_built;
+	gboolean dirty;
+};
+
+#define THREAD_INDEX_REC_LEN	4
+
+/* parent msgnum of the messages whose parent can't be recorded */
+#define THREAD_INDEX_NO_PARENT	0xffffffff
+
+static void thread_index_link	(ThreadIndex	*index,
+				 GNode		*node);
+
+
+ThreadIndex *thread_index_new(void)
+{
+	ThreadIndex *index;
+
+	index = g_new0(ThreadIndex, 1);
+	index->root = g_node_new(NULL);
+	index->node_table = g_hash_table_new(NULL, NULL);
+	index->msgid_table = g_hash_table_new(g_str_hash, g_str_equal);
+	index->dup_table = g_hash_table_new_full(g_str_hash, g_str_equal,
+						 g_free, NULL);
+	index->wait_table = g_hash_table_new_full(g_str_hash, g_str_equal,
+						  g_free, NULL);
+	index->tables_built = TRUE;
+
+	return index;
+}
+
+static void thread_index_free_list_func(gpointer key, gpointer value,
+					gpointer data)
+{
+	g_slist_free((GSList *)value);
+}
+
+GNode *thread_index_free(ThreadIndex *index, gboolean free_tree)
+{
+	GNode *root;
+
+	if (!index)
+		return NULL;
+
+	g_hash_table_foreach(index->dup_table, thread_index_free_list_func,
+			     NULL);
+	g_hash_table_foreach(index->wait_table, thread_index_free_list_func,
+			     NULL);
+	g_hash_table_destroy(index->wait_table);
+	g_hash_table_destroy(index->dup_table);
+	g_hash_table_destroy(index->msgid_table);
+	g_hash_table_destroy(index->node_table);
+
+	root = index->root;
+	g_free(index);
+
+	if (free_tree) {
+		g_node_destroy(root);
+		return NULL;
+	}
+
+	return root;
+}
+
+/* In-Reply-To, then References */
+static const gchar *thread_ref_next(GSList **cur)
+{
+	const gchar *ref;
+
+	while (*cur) {
+		ref = (const gchar *)(*cur)->data;
+		*cur = (*cur)->next;
+		if (ref)
+			return ref;
+	}
+
+	return NULL;
+}
+
+static const gchar *thread_ref_first(MsgInfo *msginfo, GSList **cur)
+{
+	*cur = msginfo->references;
+	if (msginfo->inreplyto)
+		return msginfo->inreplyto;
+
+	return thread_ref_next(cur);
+}
+
+static void thread_index_add_wait(ThreadIndex *index, const gchar *id,
+				  GNode *node)
+{
+	GSList *list;
+
+	list = g_hash_table_lookup(index->wait_table, id);
+	if (list)
+		list->next = g_slist_prepend(list->next, node);
+	else
+		g_hash_table_insert(index->wait_table, g_strdup(id),
+				    g_slist_prepend(NULL, node));
+}
+
+static void thread_index_remove_wait(ThreadIndex *index, const gchar *id,
+				     GNode *node)
+{
+	gpointer orig_key, value;
+	GSList *list;
+
+	if (!g_hash_table_lookup_extended(index->wait_table, id,
+					  &orig_key, &value))
+		return;
+
+	list = g_slist_remove((GSList *)value, node);
+	if (list == value)
+		return;
+
+	g_hash_table_steal(index->wait_table, id);
+	if (list)
+		g_hash_table_insert(index->wait_table, orig_key, list);
+	else
+		g_free(orig_key);
+}
+
+/* register node under the IDs which are preferred to its current
+   parent (or all of them if it has no parent) */
+static void thread_index_set_waits(ThreadIndex *index, GNode *node,
+				   gboolean add)
+{
+	MsgInfo *msginfo = (MsgInfo *)node->data;
+	const gchar *parent_id = NULL;
+	const gchar *ref;
+	GSList *cur;
+
+	if (node->parent && node->parent != index->root)
+		parent_id = ((MsgInfo *)node->parent->data)->msgid;
+
+	for (ref = thread_ref_first(msginfo, &cur); ref != NULL;
+	     ref = thread_ref_next(&cur)) {
+		if (parent_id && !strcmp(ref, parent_id))
+			break;
+		if (add)
+			thread_index_add_wait(index, ref, node);
+		else
+			thread_index_remove_wait(index, ref, node);
+	}
+}
+
+static GNode *thread_index_find_parent(ThreadIndex *index, GNode *node)
+{
+	MsgInfo *msginfo = (MsgInfo *)node->data;
+	GNode *parent = NULL;
+	const gchar *ref;
+	GSList *cur;
+
+	for (ref = thread_ref_first(msginfo, &cur); ref != NULL;
+	     ref = thread_ref_next(&cur)) {
+		if ((parent = g_hash_table_lookup(index->msgid_table, ref))
+		    != NULL)
+			break;
+	}
+
+	/* node should not be the parent, and node should not
+	   be an ancestor of parent (circular reference) */
+	if (!parent || parent == node || g_node_is_ancestor(node, parent))
+		return index->root;
+
+	return parent;
+}
+
+/* node must not be registered in wait_table */
+static void thread_index_link(ThreadIndex *index, GNode *node)
+{
+	GNode *parent;
+
+	parent = thread_index_find_parent(index, node);
+	if (node->parent != parent) {
+		if (node->parent)
+			g_node_unlink(node);
+		if (parent == index->root)
+			g_node_prepend(parent, node);
+		else
+			g_node_append(parent, node);
+		index->dirty = TRUE;
+	}
+
+	thread_index_set_waits(index, node, TRUE);
+}
+
+static void thread_index_add_msgid(ThreadIndex *index, GNode *node)
+{
+	MsgInfo *msginfo = (MsgInfo *)node->data;
+	gpointer orig_key, value;
+	GSList *dups, *waits, *cur;
+
+	if (!msginfo->msgid)
+		return;
+
+	if (g_hash_table_lookup(index->msgid_table, msginfo->msgid)) {
+		dups = g_hash_table_lookup(index->dup_table, msginfo->msgid);
+		dups = g_slist_append(dups, node);
+		if (!dups->next)
+			g_hash_table_insert(index->dup_table,
+					    g_strdup(msginfo->msgid), dups);
+		return;
+	}
+
+	g_hash_table_insert(index->msgid_table, msginfo->msgid, node);
+
+	/* relink the messages which were waiting for this one */
+	if (!g_hash_table_lookup_extended(index->wait_table, msginfo->msgid,
+					  &orig_key, &value))
+		return;
+	g_hash_table_steal(index->wait_table, msginfo->msgid);
+	g_free(orig_key);
+	waits = (GSList *)value;
+
+	for (cur = waits; cur != NULL; cur = cur->next) {
+		GNode *child = (GNode *)cur->data;
+
+		thread_index_set_waits(index, child, FALSE);
+		thread_index_link(index, child);
+	}
+
+	g_slist_free(waits);
+}
+
+static gboolean thread_index_build_func(GNode *node, gpointer data)
+{
+	ThreadIndex *index = (ThreadIndex *)data;
+
+	if (node == index->root)
+		return FALSE;
+
+	thread_index_set_waits(index, node, TRUE);
+	thread_index_add_msgid(index, node);
+
+	return FALSE;
+}
+
+/* the tables are not built for the tree read from the file until the
+   tree is modified */
+static void thread_index_build_tables(ThreadIndex *index)
+{
+	if (index->tables_built)
+		return;
+
+	index->tables_built = TRUE;
+	g_node_traverse(index->root, G_PRE_ORDER, G_TRAVERSE_ALL, -1,
+			thread_index_build_func, index);
+}
+
+void thread_index_insert(ThreadIndex *index, MsgInfo *msginfo)
+{
+	GNode *node;
+
+	g_return_if_fail(index != NULL);
+	g_return_if_fail(msginfo != NULL);
+
+	if (g_hash_table_lookup(index->node_table, msginfo))
+		return;
+
+	thread_index_build_tables(index);
+
+	node = g_node_new(msginfo);
+	g_hash_table_insert(index->node_table, msginfo, node);
+	thread_index_link(index, node);
+	thread_index_add_msgid(index, node);
+	index->dirty = TRUE;
+}
+
+void thread_index_remove(ThreadIndex *index, MsgInfo *msginfo)
+{
+	GNode *node, *child;
+	GSList *children = NULL, *dups, *cur;
+	gpointer orig_key, value;
+
+	g_return_if_fail(index != NULL);
+	g_return_if_fail(msginfo != NULL);
+
+	node = g_hash_table_lookup(index->node_table, msginfo);
+	if (!node)
+		return;
+
+	thread_index_build_tables(index);
+
+	thread_index_set_waits(index, node, FALSE);
+
+	if (msginfo->msgid &&
+	    g_hash_table_lookup_extended(index->dup_table, msginfo->msgid,
+					 &orig_key, &value)) {
+		dups = (GSList *)value;
+		if (g_hash_table_lookup(index->msgid_table, msginfo->msgid)
+		    == node) {
+			GNode *first = (GNode *)dups->data;
+
+			g_hash_table_replace(index->msgid_table,
+					     ((MsgInfo *)first->data)->msgid,
+					     first);
+			dups = g_slist_remove(dups, first);
+		} else
+			dups = g_slist_remove(dups, node);
+
+		g_hash_table_steal(index->dup_table, msginfo->msgid);
+		if (dups)
+			g_hash_table_insert(index->dup_table, orig_key, dups);
+		else
+			g_free(orig_key);
+	} else if (msginfo->msgid &&
+		   g_hash_table_lookup(index->msgid_table, msginfo->msgid)
+		   == node)
+		g_hash_table_remove(index->msgid_table, msginfo->msgid);
+
+	/* look for the parents of the children again */
+	while ((child = node->children) != NULL) {
+		thread_index_set_waits(index, child, FALSE);
+		g_node_unlink(child);
+		children = g_slist_prepend(children, child);
+	}
+
+	g_hash_table_remove(index->node_table, msginfo);
+	g_node_destroy(node);
+
+	children = g_slist_reverse(children);
+	for (cur = children; cur != NULL; cur = cur->next)
+		thread_index_link(index, (GNode *)cur->data);
+	g_slist_free(children);
+
+	index->dirty = TRUE;
+}
+
+/* return the reversed thread tree (owned by index) */
+GNode *thread_index_get_tree(ThreadIndex *index)
+{
+	g_return_val_if_fail(index != NULL, NULL);
+
+	return index->root;
+}
+
+/* return the node of msginfo in the tree (owned by index) */
+GNode *thread_index_lookup(ThreadIndex *index, MsgInfo *msginfo)
+{
+	g_return_val_if_fail(index != NULL, NULL);
+	g_return_val_if_fail(msginfo != NULL, NULL);
+
+	return g_hash_table_lookup(index->node_table, msginfo);
+}
+
+static gchar *thread_index_get_file(FolderItem *item)
+{
+	gchar *path, *file;
+
+	path = folder_item_get_path(item);
+	if (!path)
+		return NULL;
+	file = g_strconcat(path, G_DIR_SEPARATOR_S, THREAD_INDEX_FILE, NULL);
+	g_free(path);
+
+	return file;
+}
+
+static guint32 thread_index_msgid_hash(MsgInfo *msginfo)
+{
+	return g_str_hash(msginfo->msgid ? msginfo->msgid : "");
+}
+
+/* Read the thread index of item for mlist. The messages which are not
+   in the index are inserted. */
+ThreadIndex *thread_index_read(FolderItem *item, GSList *mlist)
+{
+	ThreadIndex *index;
+	GHashTable *num_table;
+	GSList *cur;
+	gchar *file;
+	FILE *fp = NULL;
+	guint32 rec[THREAD_INDEX_REC_LEN];
+
+	g_return_val_if_fail(item != NULL, NULL);
+
+	index = thread_index_new();
+
+	file = thread_index_get_file(item);
+	if (file) {
+		fp = procmsg_open_data_file(file, THREAD_INDEX_VERSION,
+					    DATA_READ, NULL, 0);
+		g_free(file);
+	}
+	if (!fp) {
+		for (cur = mlist; cur != NULL; cur = cur->next)
+			thread_index_insert(index, (MsgInfo *)cur->data);
+		return index;
+	}
+
+	debug_print("Reading thread index...\n");
+
+	num_table = g_hash_table_new(NULL, NULL);
+	for (cur = mlist; cur != NULL; cur = cur->next) {
+		MsgInfo *msginfo = (MsgInfo *)cur->data;
+
+		if (msginfo->msgnum > 0)
+			g_hash_table_insert(num_table,
+					    GUINT_TO_POINTER(msginfo->msgnum),
+					    msginfo);
+	}
+
+	index->tables_built = FALSE;
+
+	while (fread(rec, sizeof(rec), 1, fp) == 1) {
+		MsgInfo *msginfo, *parent_info;
+		GNode *parent, *node;
+
+		msginfo = g_hash_table_lookup(num_table,
+					      GUINT_TO_POINTER(rec[0]));
+		if (!msginfo || (guint32)msginfo->size != rec[2] ||
+		    thread_index_msgid_hash(msginfo) != rec[3] ||
+		    g_hash_table_lookup(index->node_table, msginfo)) {
+			index->dirty = TRUE;
+			continue;
+		}
+
+		if (rec[1] == 0)
+			parent = index->root;
+		else {
+			parent_info = g_hash_table_lookup
+				(num_table, GUINT_TO_POINTER(rec[1]));
+			parent = parent_info ? g_hash_table_lookup
+				(index->node_table, parent_info) : NULL;
+			if (!parent) {
+				index->dirty = TRUE;
+				continue;
+			}
+		}
+
+		node = g_node_append_data(parent, msginfo);
+		g_hash_table_insert(index->node_table, msginfo, node);
+	}
+
+	fclose(fp);
+	g_hash_table_destroy(num_table);
+
+	for (cur = mlist; cur != NULL; cur = cur->next)
+		thread_index_insert(index, (MsgInfo *)cur->data);
+
+	return index;
+}
+
+static gboolean thread_index_write_func(GNode *node, gpointer data)
+{
+	FILE *fp = (FILE *)data;
+	MsgInfo *msginfo = (MsgInfo *)node->data;
+	MsgInfo *parent_info;
+	guint32 rec[THREAD_INDEX_REC_LEN];
+
+	if (!msginfo)
+		return FALSE;
+
+	parent_info = (MsgInfo *)node->parent->data;
+
+	rec[0] = msginfo->msgnum;
+	if (!parent_info)
+		rec[1] = 0;
+	else if (parent_info->msgnum == 0)
+		rec[1] = THREAD_INDEX_NO_PARENT;
+	else
+		rec[1] = parent_info->msgnum;
+	rec[2] = msginfo->size;
+	rec[3] = thread_index_msgid_hash(msginfo);
+
+	if (fwrite(rec, sizeof(rec), 1, fp) != 1)
+		return TRUE;
+
+	return FALSE;
+}
+
+/* write the index only if it was modified */
+gint thread_index_write(ThreadIndex *index, FolderItem *item)
+{
+	gchar *file;
+	FILE *fp;
+
+	g_return_val_if_fail(index != NULL, -1);
+	g_return_val_if_fail(item != NULL, -1);
+
+	if (!index->dirty)
+		return 0;
+
+	file = thread_index_get_file(item);
+	if (!file)
+		return -1;
+
+	debug_print("Writing thread index (%s)\n", item->path);
+
+	fp = procmsg_open_data_file(file, THREAD_INDEX_VERSION, DATA_WRITE,
+				    NULL, 0);
+	if (!fp) {
+		g_free(file);
+		return -1;
+	}
+
+	g_node_traverse(index->root, G_PRE_ORDER, G_TRAVERSE_ALL, -1,
+			thread_index_write_func, fp);
+
+	if (fclose(fp) == EOF) {
+		FILE_OP_ERROR(file, "fclose");
+		g_unlink(file);
+		g_free(file);
+		return -1;
+	}
+
+	g_free(file);
+	index->dirty = FALSE;
+
+	return 0;
+}
@@ -0,0 +1,48 @@
+/*
+ * LibSylph -- E-Mail client library
+ * Copyright (C) 1999-2011 Hiroyuki Yamamoto
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __THREADINDEX_H__
+#define __THREADINDEX_H__
+
+#include <glib.h>
+
+#include "folder.h"
+#include "procmsg.h"
+
+typedef struct _ThreadIndex	ThreadIndex;
+
+ThreadIndex *thread_index_new	(void);
+GNode *thread_index_free	(ThreadIndex	*index,
+				 gboolean	 free_tree);
+
+void thread_index_insert	(ThreadIndex	*index,
+				 MsgInfo	*msginfo);
+void thread_index_remove	(ThreadIndex	*index,
+				 MsgInfo	*msginfo);
+
+GNode *thread_index_get_tree	(ThreadIndex	*index);
+GNode *thread_index_lookup	(ThreadIndex	*index,
+				 MsgInfo	*msginfo);
+
+ThreadIndex *thread_index_read	(FolderItem	*item,
+				 GSList		*mlist);
+gint thread_index_write		(ThreadIndex	*index,
+				 FolderItem	*item);
+
+#endif /* __THREADINDEX_H__ */
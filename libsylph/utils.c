@@ -2376,6 +2376,27 @@ const gchar *get_domain_name(void)
 	return domain_name;
 }
 
+gint get_processor_count(void)
+{
+	static gint count = 0;
+
+	if (count == 0) {
+#ifdef G_OS_WIN32
+		SYSTEM_INFO si;
+
+		GetSystemInfo(&si);
+		count = si.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+		count = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+		if (count < 1)
+			count = 1;
+		debug_print("number of processors = %d\n", count);
+	}
+
+	return count;
+}
+
 off_t get_file_size(const gchar *file)
 {
 	struct stat s;
@@ -3844,6 +3865,163 @@ FILE *str_open_as_stream(const gchar *str)
 	return fp;
 }
 
+/* BufFile: a write-once, read-many stream which is kept in memory until it
+   grows larger than mem_max, and is moved to a temporary file after that.
+   Write the data with buf_file_write(), call buf_file_rewind(), and read it
+   back with buf_file_gets() or buf_file_read(). */
+
+struct _BufFile
+{
+	GString *buf;
+	FILE *fp;
+	gsize mem_max;
+	gsize pos;
+	gboolean error;
+};
+
+BufFile *buf_file_new(gsize mem_max)
+{
+	BufFile *bf;
+
+	bf = g_new0(BufFile, 1);
+	bf->buf = g_string_new(NULL);
+	bf->fp = NULL;
+	bf->mem_max = mem_max;
+	bf->pos = 0;
+	bf->error = FALSE;
+
+	return bf;
+}
+
+static gint buf_file_spill(BufFile *bf)
+{
+	FILE *fp;
+
+	if ((fp = my_tmpfile()) == NULL) {
+		FILE_OP_ERROR("buf_file_spill", "my_tmpfile");
+		return -1;
+	}
+	if (bf->buf->len > 0 &&
+	    fwrite(bf->buf->str, bf->buf->len, 1, fp) != 1) {
+		FILE_OP_ERROR("buf_file_spill", "fwrite");
+		fclose(fp);
+		return -1;
+	}
+
+	bf->fp = fp;
+	g_string_free(bf->buf, TRUE);
+	bf->buf = NULL;
+
+	return 0;
+}
+
+gint buf_file_write(BufFile *bf, const gchar *buf, gsize len)
+{
+	g_return_val_if_fail(bf != NULL, -1);
+
+	if (bf->error)
+		return -1;
+	if (len == 0)
+		return 0;
+
+	if (!bf->fp && bf->buf->len + len > bf->mem_max) {
+		if (buf_file_spill(bf) < 0) {
+			bf->error = TRUE;
+			return -1;
+		}
+	}
+
+	if (bf->fp) {
+		if (fwrite(buf, len, 1, bf->fp) != 1) {
+			bf->error = TRUE;
+			return -1;
+		}
+	} else
+		g_string_append_len(bf->buf, buf, len);
+
+	return 0;
+}
+
+gint buf_file_rewind(BufFile *bf)
+{
+	g_return_val_if_fail(bf != NULL, -1);
+
+	if (bf->error)
+		return -1;
+
+	if (bf->fp) {
+		if (fflush(bf->fp) == EOF) {
+			FILE_OP_ERROR("buf_file_rewind", "fflush");
+			bf->error = TRUE;
+			return -1;
+		}
+		rewind(bf->fp);
+	} else
+		bf->pos = 0;
+
+	return 0;
+}
+
+/* same as fgets() */
+gchar *buf_file_gets(gchar *buf, gint size, BufFile *bf)
+{
+	const gchar *p;
+	const gchar *nl;
+	gsize len;
+
+	g_return_val_if_fail(bf != NULL, NULL);
+	g_return_val_if_fail(size > 1, NULL);
+
+	if (bf->fp)
+		return fgets(buf, size, bf->fp);
+
+	if (bf->pos >= bf->buf->len)
+		return NULL;
+
+	p = bf->buf->str + bf->pos;
+	len = MIN(bf->buf->len - bf->pos, size - 1);
+	if ((nl = memchr(p, '\n', len)) != NULL)
+		len = nl - p + 1;
+
+	memcpy(buf, p, len);
+	buf[len] = '\0';
+	bf->pos += len;
+
+	return buf;
+}
+
+/* same as fread(buf, 1, size, fp) */
+gsize buf_file_read(gchar *buf, gsize size, BufFile *bf)
+{
+	gsize len;
+
+	g_return_val_if_fail(bf != NULL, 0);
+
+	if (bf->fp)
+		return fread(buf, 1, size, bf->fp);
+
+	len = MIN(bf->buf->len - bf->pos, size);
+	memcpy(buf, bf->buf->str + bf->pos, len);
+	bf->pos += len;
+
+	return len;
+}
+
+/* Closes bf and returns its contents as a stream positioned at the
+   beginning.  Only the contents kept in memory are written to a temporary
+   file here. */
+void buf_file_close(BufFile *bf)
+{
+	if (!bf)
+		return;
+
+	if (bf->fp)
+		fclose(bf->fp);
+	if (bf->buf)
+		g_string_free(bf->buf, TRUE);
+	g_free(bf);
+}
+
 gint str_write_to_file(const gchar *str, const gchar *file)
 {
 	FILE *fp;
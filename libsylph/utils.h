@@ -180,6 +180,8 @@ gint syl_link	(const gchar	*src,
 	perror(func); \
 }
 
+typedef struct _BufFile	BufFile;
+
 typedef void (*UIUpdateFunc)		(void);
 typedef void (*EventLoopFunc)		(void);
 typedef void (*ProgressFunc)		(gint		 cur,
@@ -207,6 +209,8 @@ void ptr_array_free_strings	(GPtrArray	*array);
 
 typedef gboolean (*StrFindFunc) (const gchar	*haystack,
 				 const gchar	*needle);
+typedef gboolean (*StrMatchFunc) (const gchar	*haystack,
+				  gpointer	 data);
 
 gboolean str_find		(const gchar	*haystack,
 				 const gchar	*needle);
@@ -414,6 +418,8 @@ const gchar *get_tmp_dir		(void);
 gchar *get_tmp_file			(void);
 const gchar *get_domain_name		(void);
 
+gint get_processor_count		(void);
+
 /* file / directory handling */
 off_t get_file_size		(const gchar	*file);
 off_t get_file_size_as_crlf	(const gchar	*file);
@@ -483,6 +489,20 @@ gint change_file_mode_rw	(FILE		*fp,
 				 const gchar	*file);
 FILE *my_tmpfile		(void);
 FILE *str_open_as_stream	(const gchar	*str);
+
+BufFile *buf_file_new		(gsize		 mem_max);
+gint buf_file_write		(BufFile	*bf,
+				 const gchar	*buf,
+				 gsize		 len);
+gint buf_file_rewind		(BufFile	*bf);
+gchar *buf_file_gets		(gchar		*buf,
+				 gint		 size,
+				 BufFile	*bf);
+gsize buf_file_read		(gchar		*buf,
+				 gsize		 size,
+				 BufFile	*bf);
+void buf_file_close		(BufFile	*bf);
+
 gint str_write_to_file		(const gchar	*str,
 				 const gchar	*file);
 gchar *file_read_to_str		(const gchar	*file);
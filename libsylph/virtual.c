@@ -40,10 +40,18 @@
 #include "procmsg.h"
 #include "procheader.h"
 #include "filter.h"
+#include "prefs_common.h"
+#include "sylmain.h"
 #include "utils.h"
 
+#define SEARCH_CHUNK_SIZE	256
+
 typedef struct _VirtualSearchInfo	VirtualSearchInfo;
+typedef struct _VirtualSearchFolder	VirtualSearchFolder;
+typedef struct _VirtualSearchJob	VirtualSearchJob;
 typedef struct _SearchCacheInfo		SearchCacheInfo;
+typedef struct _VirtualResult		VirtualResult;
+typedef struct _VirtualResultFolder	VirtualResultFolder;
 
 struct _VirtualSearchInfo {
 	FilterRule *rule;
@@ -52,6 +60,36 @@ struct _VirtualSearchInfo {
 	FILE *fp;
 	gboolean requires_full_headers;
 	gboolean exclude_trash;
+
+	/* folders searched but not written to the search cache yet */
+	GSList *folders;
+
+	/* folders to be searched */
+	GSList *scope;
+	/* materialized result being built (NULL if not persistent) */
+	VirtualResult *result;
+#if USE_THREADS
+	GThreadPool *pool;
+#endif
+};
+
+struct _VirtualSearchFolder {
+	FolderItem *item;
+	GSList *mlist;
+	MsgInfo **msgs;
+	gint *matched;
+	gint total;
+	gint count;
+	gint pending;
+	gint ncachehit;
+	VirtualResultFolder *rfolder;
+};
+
+struct _VirtualSearchJob {
+	VirtualSearchInfo *info;
+	VirtualSearchFolder *sfolder;
+	gint start;
+	gint end;
 };
 
 struct _SearchCacheInfo {
@@ -62,6 +100,36 @@ struct _SearchCacheInfo {
 	MsgFlags flags;
 };
 
+/* Materialized result of a search folder. It is updated from the
+   add-msg / remove-msg signals and saved to SEARCH_RESULT, so that
+   opening the search folder again costs only the matched messages. */
+struct _VirtualResult {
+	gchar *id;
+	time_t rule_mtime;
+	off_t rule_size;
+	GSList *folders;
+	gboolean dirty;
+	/* distinguishes the results registered in virtual_result_list */
+	guint serial;
+};
+
+/* Matched messages of a source folder. The stamps detect changes made
+   without the signals (by other programs). If the folder was touched
+   by the signals, its directory mtime is not meaningful anymore, and
+   the message files are counted instead. */
+struct _VirtualResultFolder {
+	gchar *id;
+	time_t mtime;
+	time_t mark_mtime;
+	off_t mark_size;
+	/* the highest number and the number of all the message files */
+	guint last_num;
+	gint nmsgs;
+	GHashTable *msg_table;
+	GSList *added;
+	gboolean touched;
+};
+
 enum
 {
 	SCACHE_NOT_EXIST = 0,
@@ -80,12 +148,27 @@ static void virtual_write_search_cache	(FILE		*fp,
 					 MsgInfo	*msginfo,
 					 gint		 matched);
 
-static GSList *virtual_search_folder	(VirtualSearchInfo	*info,
+static void virtual_search_folder	(VirtualSearchInfo	*info,
 					 FolderItem		*item);
-static gboolean virtual_search_recursive_func
+static void virtual_search_flush	(VirtualSearchInfo	*info,
+					 gboolean		 wait);
+static gboolean virtual_search_scope_func
 					(GNode		*node,
 					 gpointer	 data);
 
+static VirtualResult *virtual_read_search_result
+					(FolderItem	*item,
+					 const gchar	*id,
+					 time_t		 rule_mtime,
+					 off_t		 rule_size);
+static void virtual_write_search_result	(FolderItem	*item,
+					 VirtualResult	*result);
+static gboolean virtual_result_update	(VirtualResult		*result,
+					 VirtualSearchInfo	*info,
+					 GSList			*scope,
+					 GSList		       **newlists);
+static void virtual_connect_signals	(void);
+
 static Folder	*virtual_folder_new	(const gchar	*name,
 					 const gchar	*path);
 static void     virtual_folder_destroy	(Folder		*folder);
@@ -218,6 +301,10 @@ gint sinfo_equal(gconstpointer v, gconstpointer v2)
 		n = idata;				\
 }
 
+static GSList *virtual_result_list = NULL;
+static guint virtual_result_serial = 0;
+G_LOCK_DEFINE_STATIC(virtual_result);
+
 static GHashTable *virtual_read_search_cache(FolderItem *item)
 {
 	GHashTable *table;
@@ -324,52 +411,500 @@ static void virtual_search_cache_free(GHashTable *table)
 	}
 }
 
-static GSList *virtual_search_folder(VirtualSearchInfo *info, FolderItem *item)
+static MsgInfo *virtual_msginfo_copy(MsgInfo *msginfo)
+{
+	MsgInfo *newinfo;
+	GSList *cur;
+
+	newinfo = procmsg_msginfo_copy(msginfo);
+	for (cur = msginfo->references; cur != NULL; cur = cur->next)
+		newinfo->references = g_slist_prepend(newinfo->references,
+						      g_strdup(cur->data));
+	newinfo->references = g_slist_reverse(newinfo->references);
+
+	return newinfo;
+}
+
+static void virtual_get_file_stamp(const gchar *file, time_t *mtime,
+				   off_t *size)
+{
+	struct stat s;
+
+	if (g_stat(file, &s) < 0) {
+		*mtime = 0;
+		if (size)
+			*size = 0;
+	} else {
+		*mtime = MAX(s.st_mtime, s.st_ctime);
+		if (size)
+			*size = s.st_size;
+	}
+}
+
+static void virtual_result_folder_set_stamp(VirtualResultFolder *rfolder,
+					    FolderItem *item)
+{
+	gchar *path, *file;
+
+	path = folder_item_get_path(item);
+	g_return_if_fail(path != NULL);
+
+	virtual_get_file_stamp(path, &rfolder->mtime, NULL);
+	file = g_strconcat(path, G_DIR_SEPARATOR_S, MARK_FILE, NULL);
+	virtual_get_file_stamp(file, &rfolder->mark_mtime, &rfolder->mark_size);
+	g_free(file);
+	g_free(path);
+}
+
+static VirtualResultFolder *virtual_result_folder_new(gchar *id)
+{
+	VirtualResultFolder *rfolder;
+
+	rfolder = g_new0(VirtualResultFolder, 1);
+	rfolder->id = id;
+	rfolder->msg_table = g_hash_table_new(NULL, g_direct_equal);
+
+	return rfolder;
+}
+
+static void virtual_result_folder_add(VirtualResultFolder *rfolder,
+				      MsgInfo *msginfo)
+{
+	MsgInfo *newinfo;
+
+	/* the result may live longer than the folder */
+	newinfo = virtual_msginfo_copy(msginfo);
+	newinfo->folder = NULL;
+	newinfo->to_folder = NULL;
+	g_hash_table_insert(rfolder->msg_table,
+			    GUINT_TO_POINTER(newinfo->msgnum), newinfo);
+}
+
+static gboolean virtual_result_msg_remove_func(gpointer key, gpointer value,
+					       gpointer data)
+{
+	procmsg_msginfo_free((MsgInfo *)value);
+	return TRUE;
+}
+
+static void virtual_result_folder_free(VirtualResultFolder *rfolder)
+{
+	g_hash_table_foreach_remove(rfolder->msg_table,
+				    virtual_result_msg_remove_func, NULL);
+	g_hash_table_destroy(rfolder->msg_table);
+	g_slist_free(rfolder->added);
+	g_free(rfolder->id);
+	g_free(rfolder);
+}
+
+static VirtualResult *virtual_result_new(const gchar *id, time_t rule_mtime,
+					 off_t rule_size)
+{
+	VirtualResult *result;
+
+	result = g_new0(VirtualResult, 1);
+	result->id = g_strdup(id);
+	result->rule_mtime = rule_mtime;
+	result->rule_size = rule_size;
+
+	return result;
+}
+
+static void virtual_result_free(VirtualResult *result)
+{
+	GSList *cur;
+
+	for (cur = result->folders; cur != NULL; cur = cur->next)
+		virtual_result_folder_free((VirtualResultFolder *)cur->data);
+	g_slist_free(result->folders);
+	g_free(result->id);
+	g_free(result);
+}
+
+static VirtualResult *virtual_result_find(const gchar *id)
 {
-	GSList *match_list = NULL;
-	GSList *mlist;
 	GSList *cur;
+
+	for (cur = virtual_result_list; cur != NULL; cur = cur->next) {
+		VirtualResult *result = (VirtualResult *)cur->data;
+
+		if (!strcmp(result->id, id))
+			return result;
+	}
+
+	return NULL;
+}
+
+static VirtualResultFolder *virtual_result_find_folder(VirtualResult *result,
+						       const gchar *id)
+{
+	GSList *cur;
+
+	for (cur = result->folders; cur != NULL; cur = cur->next) {
+		VirtualResultFolder *rfolder = (VirtualResultFolder *)cur->data;
+
+		if (!strcmp(rfolder->id, id))
+			return rfolder;
+	}
+
+	return NULL;
+}
+
+static void virtual_result_register(VirtualResult *result)
+{
+	result->serial = ++virtual_result_serial;
+	virtual_result_list = g_slist_prepend(virtual_result_list, result);
+}
+
+static void virtual_result_remove(VirtualResult *result)
+{
+	virtual_result_list = g_slist_remove(virtual_result_list, result);
+	virtual_result_free(result);
+}
+
+#define READ_RESULT_DATA_INT(n, fp)			\
+{							\
+	guint32 idata;					\
+							\
+	if (fread(&idata, sizeof(idata), 1, fp) != 1)	\
+		goto error;				\
+	n = idata;					\
+}
+
+#define READ_RESULT_DATA(data, fp)				\
+{								\
+	if (procmsg_read_cache_data_str(fp, &data) < 0)		\
+		goto error;					\
+}
+
+static VirtualResult *virtual_read_search_result(FolderItem *item,
+						 const gchar *id,
+						 time_t rule_mtime,
+						 off_t rule_size)
+{
+	VirtualResult *result;
+	gchar *path, *file;
+	FILE *fp;
+	gchar *folder_id = NULL;
+	time_t mtime;
+	off_t size;
+	gint count = 0;
+
+	path = folder_item_get_path(item);
+	file = g_strconcat(path, G_DIR_SEPARATOR_S, SEARCH_RESULT, NULL);
+	debug_print("reading search result: %s\n", file);
+	fp = procmsg_open_data_file(file, SEARCH_RESULT_VERSION, DATA_READ,
+				    NULL, 0);
+	g_free(file);
+	g_free(path);
+	if (!fp)
+		return NULL;
+
+	result = virtual_result_new(id, rule_mtime, rule_size);
+
+	READ_RESULT_DATA_INT(mtime, fp);
+	READ_RESULT_DATA_INT(size, fp);
+	if (mtime != rule_mtime || size != rule_size) {
+		debug_print("search rule is changed\n");
+		fclose(fp);
+		virtual_result_free(result);
+		return NULL;
+	}
+
+	while (procmsg_read_cache_data_str(fp, &folder_id) == 0 && folder_id) {
+		VirtualResultFolder *rfolder;
+		guint32 msgnum;
+
+		rfolder = virtual_result_folder_new(folder_id);
+		folder_id = NULL;
+		result->folders = g_slist_append(result->folders, rfolder);
+
+		READ_RESULT_DATA_INT(rfolder->mtime, fp);
+		READ_RESULT_DATA_INT(rfolder->mark_mtime, fp);
+		READ_RESULT_DATA_INT(rfolder->mark_size, fp);
+		READ_RESULT_DATA_INT(rfolder->last_num, fp);
+		READ_RESULT_DATA_INT(rfolder->nmsgs, fp);
+
+		for (;;) {
+			MsgInfo *msginfo;
+			guint32 refnum, i;
+
+			READ_RESULT_DATA_INT(msgnum, fp);
+			if (msgnum == 0)
+				break;
+
+			msginfo = g_new0(MsgInfo, 1);
+			msginfo->msgnum = msgnum;
+			g_hash_table_insert(rfolder->msg_table,
+					    GUINT_TO_POINTER(msgnum), msginfo);
+
+			READ_RESULT_DATA_INT(msginfo->size, fp);
+			READ_RESULT_DATA_INT(msginfo->mtime, fp);
+			READ_RESULT_DATA_INT(msginfo->date_t, fp);
+			READ_RESULT_DATA_INT(msginfo->flags.tmp_flags, fp);
+
+			READ_RESULT_DATA(msginfo->fromname, fp);
+
+			READ_RESULT_DATA(msginfo->date, fp);
+			READ_RESULT_DATA(msginfo->from, fp);
+			READ_RESULT_DATA(msginfo->to, fp);
+			READ_RESULT_DATA(msginfo->newsgroups, fp);
+			READ_RESULT_DATA(msginfo->subject, fp);
+			READ_RESULT_DATA(msginfo->msgid, fp);
+			READ_RESULT_DATA(msginfo->inreplyto, fp);
+
+			READ_RESULT_DATA_INT(refnum, fp);
+			for (i = 0; i < refnum; i++) {
+				gchar *ref = NULL;
+
+				READ_RESULT_DATA(ref, fp);
+				msginfo->references =
+					g_slist_prepend(msginfo->references,
+							ref);
+			}
+			msginfo->references =
+				g_slist_reverse(msginfo->references);
+
+			READ_RESULT_DATA_INT(msginfo->flags.perm_flags, fp);
+			++count;
+		}
+	}
+
+	debug_print("%d search result items read.\n", count);
+
+	fclose(fp);
+	return result;
+
+error:
+	g_warning("Search result is corrupted\n");
+	g_free(folder_id);
+	fclose(fp);
+	virtual_result_free(result);
+	return NULL;
+}
+
+#undef READ_RESULT_DATA_INT
+#undef READ_RESULT_DATA
+
+static void virtual_write_search_result_func(gpointer key, gpointer value,
+					     gpointer data)
+{
+	MsgInfo *msginfo = (MsgInfo *)value;
+	FILE *fp = (FILE *)data;
+
+	procmsg_write_cache(msginfo, fp);
+	WRITE_CACHE_DATA_INT(msginfo->flags.perm_flags, fp);
+}
+
+static void virtual_write_search_result(FolderItem *item,
+					VirtualResult *result)
+{
+	gchar *path, *file;
+	FILE *fp;
+	GSList *cur;
+
+	path = folder_item_get_path(item);
+	file = g_strconcat(path, G_DIR_SEPARATOR_S, SEARCH_RESULT, NULL);
+	debug_print("writing search result: %s\n", file);
+	fp = procmsg_open_data_file(file, SEARCH_RESULT_VERSION, DATA_WRITE,
+				    NULL, 0);
+	g_free(file);
+	g_free(path);
+	if (!fp)
+		return;
+
+	WRITE_CACHE_DATA_INT(result->rule_mtime, fp);
+	WRITE_CACHE_DATA_INT(result->rule_size, fp);
+
+	for (cur = result->folders; cur != NULL; cur = cur->next) {
+		VirtualResultFolder *rfolder = (VirtualResultFolder *)cur->data;
+
+		WRITE_CACHE_DATA(rfolder->id, fp);
+		WRITE_CACHE_DATA_INT(rfolder->mtime, fp);
+		WRITE_CACHE_DATA_INT(rfolder->mark_mtime, fp);
+		WRITE_CACHE_DATA_INT(rfolder->mark_size, fp);
+		WRITE_CACHE_DATA_INT(rfolder->last_num, fp);
+		WRITE_CACHE_DATA_INT(rfolder->nmsgs, fp);
+		g_hash_table_foreach(rfolder->msg_table,
+				     virtual_write_search_result_func, fp);
+		WRITE_CACHE_DATA_INT(0, fp);
+	}
+
+	fclose(fp);
+	result->dirty = FALSE;
+}
+
+/* Body search may decrypt messages (and ask for a passphrase), command
+   tests spawn processes, and the address book is not thread-safe. */
+static gboolean virtual_search_rule_is_thread_safe(FilterRule *rule)
+{
+	GSList *cur;
+
+	for (cur = rule->cond_list; cur != NULL; cur = cur->next) {
+		FilterCond *cond = (FilterCond *)cur->data;
+
+		if (cond->type == FLT_COND_BODY ||
+		    cond->type == FLT_COND_CMD_TEST ||
+		    cond->match_type == FLT_IN_ADDRESSBOOK)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* The results of these rules change without any change of the messages,
+   so they can't be kept between searches. */
+static gboolean virtual_search_rule_is_persistent(FilterRule *rule)
+{
+	GSList *cur;
+
+	for (cur = rule->cond_list; cur != NULL; cur = cur->next) {
+		FilterCond *cond = (FilterCond *)cur->data;
+
+		if (cond->type == FLT_COND_AGE_GREATER ||
+		    cond->type == FLT_COND_CMD_TEST ||
+		    cond->match_type == FLT_IN_ADDRESSBOOK)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static gboolean virtual_search_rule_uses_flags(FilterRule *rule)
+{
+	GSList *cur;
+
+	for (cur = rule->cond_list; cur != NULL; cur = cur->next) {
+		FilterCond *cond = (FilterCond *)cur->data;
+
+		if (cond->type == FLT_COND_UNREAD ||
+		    cond->type == FLT_COND_MARK ||
+		    cond->type == FLT_COND_COLOR_LABEL)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+static gint virtual_search_match_msg(VirtualSearchInfo *info,
+				     MsgInfo *msginfo, FilterInfo *fltinfo)
+{
+	GSList *hlist;
+	gint matched;
+
+	fltinfo->flags = msginfo->flags;
+	if (info->requires_full_headers) {
+		gchar *file;
+
+		file = procmsg_get_message_file(msginfo);
+		hlist = procheader_get_header_list_from_file(file);
+		g_free(file);
+	} else
+		hlist = procheader_get_header_list_from_msginfo(msginfo);
+	if (!hlist)
+		return SCACHE_NOT_EXIST;
+
+	if (filter_match_rule(info->rule, msginfo, hlist, fltinfo))
+		matched = SCACHE_MATCHED;
+	else
+		matched = SCACHE_NOT_MATCHED;
+
+	procheader_header_list_destroy(hlist);
+
+	return matched;
+}
+
+static void virtual_search_match_range(VirtualSearchInfo *info,
+				       VirtualSearchFolder *sfolder,
+				       gint start, gint end)
+{
 	FilterInfo fltinfo;
-	gint count = 1, total, ncachehit = 0;
-	GTimeVal tv_prev, tv_cur;
+	gint i;
 
-	g_return_val_if_fail(info != NULL, NULL);
-	g_return_val_if_fail(info->rule != NULL, NULL);
-	g_return_val_if_fail(item != NULL, NULL);
-	g_return_val_if_fail(item->path != NULL, NULL);
+	memset(&fltinfo, 0, sizeof(FilterInfo));
+
+	for (i = start; i < end; i++) {
+		g_atomic_int_inc(&sfolder->count);
+
+		if (sfolder->matched[i] != SCACHE_NOT_EXIST)
+			continue;
+
+		sfolder->matched[i] = virtual_search_match_msg
+			(info, sfolder->msgs[i], &fltinfo);
+	}
+}
+
+#if USE_THREADS
+static void virtual_search_job_func(gpointer data, gpointer user_data)
+{
+	VirtualSearchJob *job = (VirtualSearchJob *)data;
+
+	virtual_search_match_range(job->info, job->sfolder,
+				   job->start, job->end);
+	g_atomic_int_add(&job->sfolder->pending, -1);
+	g_main_context_wakeup(NULL);
+	g_free(job);
+}
+#endif
+
+static void virtual_search_show_progress(VirtualSearchFolder *sfolder,
+					 GTimeVal *tv_prev)
+{
+	GTimeVal tv_cur;
+
+	g_get_current_time(&tv_cur);
+	if (tv_cur.tv_sec > tv_prev->tv_sec ||
+	    tv_cur.tv_usec - tv_prev->tv_usec >
+	    PROGRESS_UPDATE_INTERVAL * 1000) {
+		status_print(_("Searching %s (%d / %d)..."),
+			     sfolder->item->path,
+			     g_atomic_int_get(&sfolder->count),
+			     sfolder->total);
+		*tv_prev = tv_cur;
+	}
+}
+
+/* Look up the search cache and start matching the rest of the messages.
+   Large folders are split into chunks which are matched by the worker
+   pool (if available). The results are written by
+   virtual_search_flush() in the original folder order. */
+static void virtual_search_folder(VirtualSearchInfo *info, FolderItem *item)
+{
+	VirtualSearchFolder *sfolder;
+	GSList *cur;
+	GTimeVal tv_prev;
+	guint last_num = 0;
+	gint i, start;
+
+	g_return_if_fail(info != NULL);
+	g_return_if_fail(info->rule != NULL);
+	g_return_if_fail(item != NULL);
+	g_return_if_fail(item->path != NULL);
 
 	/* prevent circular reference */
 	if (item->stype == F_VIRTUAL)
-		return NULL;
+		return;
 
 	g_get_current_time(&tv_prev);
 	status_print(_("Searching %s ..."), item->path);
 
-	mlist = folder_item_get_msg_list(item, TRUE);
-	total = g_slist_length(mlist);
-
-	memset(&fltinfo, 0, sizeof(FilterInfo));
+	sfolder = g_new0(VirtualSearchFolder, 1);
+	sfolder->item = item;
+	sfolder->mlist = folder_item_get_msg_list(item, TRUE);
+	sfolder->total = g_slist_length(sfolder->mlist);
+	sfolder->msgs = g_new(MsgInfo *, sfolder->total + 1);
+	sfolder->matched = g_new0(gint, sfolder->total + 1);
 
 	debug_print("start query search: %s\n", item->path);
 
-	virtual_write_search_cache(info->fp, item, NULL, 0);
-
-	for (cur = mlist; cur != NULL; cur = cur->next) {
+	for (cur = sfolder->mlist, i = 0; cur != NULL; cur = cur->next, i++) {
 		MsgInfo *msginfo = (MsgInfo *)cur->data;
-		GSList *hlist;
-
-		g_get_current_time(&tv_cur);
-		if (tv_cur.tv_sec > tv_prev.tv_sec ||
-		    tv_cur.tv_usec - tv_prev.tv_usec >
-		    PROGRESS_UPDATE_INTERVAL * 1000) {
-			status_print(_("Searching %s (%d / %d)..."),
-				     item->path, count, total);
-			tv_prev = tv_cur;
-		}
-		++count;
+
+		sfolder->msgs[i] = msginfo;
+		if (msginfo->msgnum > last_num)
+			last_num = msginfo->msgnum;
 
 		if (info->search_cache_table) {
-			gint matched;
 			SearchCacheInfo sinfo;
 
 			sinfo.folder = item;
@@ -378,63 +913,117 @@ static GSList *virtual_search_folder(VirtualSearchInfo *info, FolderItem *item)
 			sinfo.mtime = msginfo->mtime;
 			sinfo.flags = msginfo->flags;
 
-			matched = (gint)g_hash_table_lookup
-				(info->search_cache_table, &sinfo);
-			if (matched == SCACHE_MATCHED) {
-				match_list = g_slist_prepend
-					(match_list, msginfo);
-				cur->data = NULL;
-				virtual_write_search_cache(info->fp, NULL,
-							   msginfo, matched);
-				++ncachehit;
-				continue;
-			} else if (matched == SCACHE_NOT_MATCHED) {
-				virtual_write_search_cache(info->fp, NULL,
-							   msginfo, matched);
-				++ncachehit;
-				continue;
-			}
+			sfolder->matched[i] = GPOINTER_TO_INT
+				(g_hash_table_lookup(info->search_cache_table,
+						     &sinfo));
+			if (sfolder->matched[i] != SCACHE_NOT_EXIST)
+				++sfolder->ncachehit;
 		}
+	}
 
-		fltinfo.flags = msginfo->flags;
-		if (info->requires_full_headers) {
-			gchar *file;
+	if (info->result) {
+		sfolder->rfolder = virtual_result_folder_new
+			(folder_item_get_identifier(item));
+		virtual_result_folder_set_stamp(sfolder->rfolder, item);
+		sfolder->rfolder->last_num = last_num;
+		sfolder->rfolder->nmsgs = sfolder->total;
+		info->result->folders = g_slist_append(info->result->folders,
+						       sfolder->rfolder);
+	}
 
-			file = procmsg_get_message_file(msginfo);
-			hlist = procheader_get_header_list_from_file(file);
-			g_free(file);
-		} else
-			hlist = procheader_get_header_list_from_msginfo
-				(msginfo);
-		if (!hlist)
+	info->folders = g_slist_append(info->folders, sfolder);
+
+	for (start = 0; start < sfolder->total; start += SEARCH_CHUNK_SIZE) {
+		gint end = MIN(start + SEARCH_CHUNK_SIZE, sfolder->total);
+
+#if USE_THREADS
+		/* remote messages must be fetched by the main thread */
+		if (info->pool && FOLDER_IS_LOCAL(item->folder)) {
+			VirtualSearchJob *job;
+
+			job = g_new(VirtualSearchJob, 1);
+			job->info = info;
+			job->sfolder = sfolder;
+			job->start = start;
+			job->end = end;
+			g_atomic_int_inc(&sfolder->pending);
+			g_thread_pool_push(info->pool, job, NULL);
 			continue;
+		}
+#endif
+		virtual_search_show_progress(sfolder, &tv_prev);
+		virtual_search_match_range(info, sfolder, start, end);
+	}
+
+	virtual_search_flush(info, FALSE);
+}
+
+/* Write the results of the finished folders to the search cache and
+   collect the matched messages. If wait is TRUE, wait until all folders
+   are finished. */
+static void virtual_search_flush(VirtualSearchInfo *info, gboolean wait)
+{
+	while (info->folders) {
+		VirtualSearchFolder *sfolder = info->folders->data;
+		GSList *match_list = NULL;
+		GTimeVal tv_prev;
+		gint i;
+
+		if (g_atomic_int_get(&sfolder->pending) > 0) {
+			if (!wait)
+				break;
+			g_get_current_time(&tv_prev);
+			while (g_atomic_int_get(&sfolder->pending) > 0) {
+				virtual_search_show_progress(sfolder, &tv_prev);
+				event_loop_iterate();
+			}
+		}
+
+		info->folders = g_slist_remove(info->folders, sfolder);
+
+		virtual_write_search_cache(info->fp, sfolder->item, NULL, 0);
+
+		for (i = 0; i < sfolder->total; i++) {
+			MsgInfo *msginfo = sfolder->msgs[i];
+
+			if (sfolder->matched[i] == SCACHE_NOT_EXIST)
+				continue;
 
-		if (filter_match_rule(info->rule, msginfo, hlist, &fltinfo)) {
-			match_list = g_slist_prepend(match_list, msginfo);
-			cur->data = NULL;
-			virtual_write_search_cache(info->fp, NULL, msginfo,
-						   SCACHE_MATCHED);
-		} else {
 			virtual_write_search_cache(info->fp, NULL, msginfo,
-						   SCACHE_NOT_MATCHED);
+						   sfolder->matched[i]);
+			if (sfolder->matched[i] == SCACHE_MATCHED) {
+				if (sfolder->rfolder)
+					virtual_result_folder_add
+						(sfolder->rfolder, msginfo);
+				match_list = g_slist_prepend(match_list,
+							     msginfo);
+				sfolder->msgs[i] = NULL;
+			}
 		}
 
-		procheader_header_list_destroy(hlist);
-	}
+		debug_print("%d cache hits (%d total)\n", sfolder->ncachehit,
+			    sfolder->total);
 
-	debug_print("%d cache hits (%d total)\n", ncachehit, total);
+		virtual_write_search_cache(info->fp, NULL, NULL, 0);
 
-	virtual_write_search_cache(info->fp, NULL, NULL, 0);
-	procmsg_msg_list_free(mlist);
+		for (i = 0; i < sfolder->total; i++) {
+			if (sfolder->msgs[i])
+				procmsg_msginfo_free(sfolder->msgs[i]);
+		}
+		g_slist_free(sfolder->mlist);
+		g_free(sfolder->matched);
+		g_free(sfolder->msgs);
+		g_free(sfolder);
 
-	return g_slist_reverse(match_list);
+		info->mlist = g_slist_concat(info->mlist,
+					     g_slist_reverse(match_list));
+	}
 }
 
-static gboolean virtual_search_recursive_func(GNode *node, gpointer data)
+static gboolean virtual_search_scope_func(GNode *node, gpointer data)
 {
 	VirtualSearchInfo *info = (VirtualSearchInfo *)data;
 	FolderItem *item;
-	GSList *mlist;
 
 	g_return_val_if_fail(node->data != NULL, FALSE);
 
@@ -444,13 +1033,569 @@ static gboolean virtual_search_recursive_func(GNode *node, gpointer data)
 		return FALSE;
 	if (info->exclude_trash && item->stype == F_TRASH)
 		return FALSE;
+	/* prevent circular reference */
+	if (item->stype == F_VIRTUAL)
+		return FALSE;
 
-	mlist = virtual_search_folder(info, item);
-	info->mlist = g_slist_concat(info->mlist, mlist);
+	info->scope = g_slist_prepend(info->scope, item);
 
 	return FALSE;
 }
 
+static gboolean virtual_id_is_under(const gchar *id, const gchar *parent_id)
+{
+	gint len;
+
+	len = strlen(parent_id);
+	return (strncmp(id, parent_id, len) == 0 &&
+		(id[len] == '\0' || id[len] == '/'));
+}
+
+static void virtual_add_msg_cb(GObject *obj, FolderItem *item,
+			       const gchar *file, guint num, gpointer data)
+{
+	GSList *cur;
+	gchar *id;
+
+	id = folder_item_get_identifier(item);
+	if (!id)
+		return;
+
+	G_LOCK(virtual_result);
+
+	for (cur = virtual_result_list; cur != NULL; cur = cur->next) {
+		VirtualResult *result = (VirtualResult *)cur->data;
+		VirtualResultFolder *rfolder;
+
+		rfolder = virtual_result_find_folder(result, id);
+		if (rfolder) {
+			rfolder->added = g_slist_prepend(rfolder->added,
+							 GUINT_TO_POINTER(num));
+			if (num > rfolder->last_num)
+				rfolder->last_num = num;
+			rfolder->nmsgs++;
+			rfolder->touched = TRUE;
+		}
+	}
+
+	G_UNLOCK(virtual_result);
+
+	g_free(id);
+}
+
+static void virtual_remove_msg_cb(GObject *obj, FolderItem *item,
+				  const gchar *file, guint num, gpointer data)
+{
+	GSList *cur;
+	gchar *id;
+
+	id = folder_item_get_identifier(item);
+	if (!id)
+		return;
+
+	G_LOCK(virtual_result);
+
+	for (cur = virtual_result_list; cur != NULL; cur = cur->next) {
+		VirtualResult *result = (VirtualResult *)cur->data;
+		VirtualResultFolder *rfolder;
+		MsgInfo *msginfo;
+
+		rfolder = virtual_result_find_folder(result, id);
+		if (!rfolder)
+			continue;
+
+		msginfo = g_hash_table_lookup(rfolder->msg_table,
+					      GUINT_TO_POINTER(num));
+		if (msginfo) {
+			g_hash_table_remove(rfolder->msg_table,
+					    GUINT_TO_POINTER(num));
+			procmsg_msginfo_free(msginfo);
+			result->dirty = TRUE;
+		}
+		rfolder->added = g_slist_remove(rfolder->added,
+						GUINT_TO_POINTER(num));
+		if (rfolder->nmsgs > 0)
+			rfolder->nmsgs--;
+		rfolder->touched = TRUE;
+	}
+
+	G_UNLOCK(virtual_result);
+
+	g_free(id);
+}
+
+static void virtual_remove_all_msg_cb(GObject *obj, FolderItem *item,
+				      gpointer data)
+{
+	GSList *cur;
+	gchar *id;
+
+	id = folder_item_get_identifier(item);
+	if (!id)
+		return;
+
+	G_LOCK(virtual_result);
+
+	for (cur = virtual_result_list; cur != NULL; cur = cur->next) {
+		VirtualResult *result = (VirtualResult *)cur->data;
+		VirtualResultFolder *rfolder;
+
+		rfolder = virtual_result_find_folder(result, id);
+		if (!rfolder)
+			continue;
+
+		g_hash_table_foreach_remove(rfolder->msg_table,
+					    virtual_result_msg_remove_func,
+					    NULL);
+		g_slist_free(rfolder->added);
+		rfolder->added = NULL;
+		rfolder->nmsgs = 0;
+		rfolder->touched = TRUE;
+		result->dirty = TRUE;
+	}
+
+	G_UNLOCK(virtual_result);
+
+	g_free(id);
+}
+
+/* Forget the results of the removed (or moved) search folders. The
+   results which refer to the folder are renewed when they are opened,
+   since their folder lists won't match anymore. */
+static void virtual_forget_results(const gchar *id)
+{
+	GSList *cur, *next;
+
+	G_LOCK(virtual_result);
+
+	for (cur = virtual_result_list; cur != NULL; cur = next) {
+		VirtualResult *result = (VirtualResult *)cur->data;
+
+		next = cur->next;
+		if (virtual_id_is_under(result->id, id))
+			virtual_result_remove(result);
+	}
+
+	G_UNLOCK(virtual_result);
+}
+
+static void virtual_remove_folder_cb(GObject *obj, FolderItem *item,
+				     gpointer data)
+{
+	gchar *id;
+
+	id = folder_item_get_identifier(item);
+	if (id) {
+		virtual_forget_results(id);
+		g_free(id);
+	}
+}
+
+static void virtual_move_folder_cb(GObject *obj, FolderItem *item,
+				   const gchar *old_id, const gchar *new_id,
+				   gpointer data)
+{
+	if (old_id)
+		virtual_forget_results(old_id);
+}
+
+static void virtual_connect_signals(void)
+{
+	static gboolean connected = FALSE;
+	GObject *app;
+
+	if (connected)
+		return;
+	if ((app = syl_app_get()) == NULL)
+		return;
+
+	g_signal_connect(app, "add-msg", G_CALLBACK(virtual_add_msg_cb),
+			 NULL);
+	g_signal_connect(app, "remove-msg", G_CALLBACK(virtual_remove_msg_cb),
+			 NULL);
+	g_signal_connect(app, "remove-all-msg",
+			 G_CALLBACK(virtual_remove_all_msg_cb), NULL);
+	g_signal_connect(app, "remove-folder",
+			 G_CALLBACK(virtual_remove_folder_cb), NULL);
+	g_signal_connect(app, "move-folder",
+			 G_CALLBACK(virtual_move_folder_cb), NULL);
+	connected = TRUE;
+}
+
+static void virtual_result_collect_func(gpointer key, gpointer value,
+					gpointer data)
+{
+	GSList **mlist = (GSList **)data;
+
+	*mlist = g_slist_prepend(*mlist, value);
+}
+
+static gboolean virtual_result_file_exist_func(gpointer key, gpointer value,
+					       gpointer data)
+{
+	const gchar *path = (const gchar *)data;
+	gchar *file;
+	gchar buf[16];
+	gboolean exist;
+
+	file = g_strconcat(path, G_DIR_SEPARATOR_S,
+			   utos_buf(buf, GPOINTER_TO_UINT(key)), NULL);
+	exist = is_file_exist(file);
+	g_free(file);
+
+	if (exist)
+		return FALSE;
+
+	procmsg_msginfo_free((MsgInfo *)value);
+	return TRUE;
+}
+
+/* Count the message files of a folder touched by the signals, and add
+   the ones delivered by other programs to rfolder->added. Returns FALSE
+   if the folder is changed in other ways. */
+static gboolean virtual_result_folder_check(VirtualResultFolder *rfolder,
+					    FolderItem *item)
+{
+	GDir *dp;
+	const gchar *dir_name;
+	gchar *path;
+	GSList *external = NULL, *cur;
+	gint num, n = 0;
+
+	path = folder_item_get_path(item);
+	g_return_val_if_fail(path != NULL, FALSE);
+
+	if ((dp = g_dir_open(path, 0, NULL)) == NULL) {
+		FILE_OP_ERROR(path, "opendir");
+		g_free(path);
+		return FALSE;
+	}
+
+	while ((dir_name = g_dir_read_name(dp)) != NULL) {
+		if ((num = to_number(dir_name)) <= 0)
+			continue;
+		n++;
+		if ((guint)num > rfolder->last_num &&
+		    !g_slist_find(rfolder->added, GINT_TO_POINTER(num)))
+			external = g_slist_prepend(external,
+						   GINT_TO_POINTER(num));
+	}
+
+	g_dir_close(dp);
+	g_free(path);
+
+	if (n != rfolder->nmsgs + g_slist_length(external)) {
+		g_slist_free(external);
+		return FALSE;
+	}
+
+	for (cur = external; cur != NULL; cur = cur->next) {
+		num = GPOINTER_TO_INT(cur->data);
+		debug_print("search result: %s/%d is added externally\n",
+			    item->path, num);
+		if ((guint)num > rfolder->last_num)
+			rfolder->last_num = num;
+	}
+	rfolder->added = g_slist_concat(rfolder->added, external);
+	rfolder->nmsgs = n;
+
+	return TRUE;
+}
+
+/* Apply the changes told by the signals (and the flags in the mark file)
+   to the result of item, and return the added messages which must be
+   matched against the rule. */
+static GSList *virtual_result_folder_update(VirtualResult *result,
+					    VirtualResultFolder *rfolder,
+					    FolderItem *item)
+{
+	GSList *newlist = NULL;
+	GSList *cur;
+	time_t mark_mtime;
+	off_t mark_size;
+	gchar *path, *file;
+
+	path = folder_item_get_path(item);
+	file = g_strconcat(path, G_DIR_SEPARATOR_S, MARK_FILE, NULL);
+	virtual_get_file_stamp(file, &mark_mtime, &mark_size);
+	g_free(file);
+
+	if (rfolder->touched) {
+		/* the messages may be removed after remove-msg */
+		if (g_hash_table_foreach_remove
+			(rfolder->msg_table, virtual_result_file_exist_func,
+			 path) > 0)
+			result->dirty = TRUE;
+	}
+
+	for (cur = rfolder->added; cur != NULL; cur = cur->next) {
+		guint num = GPOINTER_TO_UINT(cur->data);
+		MsgInfo *msginfo;
+
+		if (g_hash_table_lookup(rfolder->msg_table,
+					GUINT_TO_POINTER(num)))
+			continue;
+		msginfo = folder_item_get_msginfo(item, num);
+		if (msginfo)
+			newlist = g_slist_prepend(newlist, msginfo);
+	}
+	g_slist_free(rfolder->added);
+	rfolder->added = NULL;
+
+	if (newlist || item->mark_queue || mark_mtime != rfolder->mark_mtime ||
+	    mark_size != rfolder->mark_size) {
+		GSList *mlist = NULL;
+
+		g_hash_table_foreach(rfolder->msg_table,
+				     virtual_result_collect_func, &mlist);
+		mlist = g_slist_concat(mlist, g_slist_copy(newlist));
+		procmsg_update_flags(mlist, item);
+		g_slist_free(mlist);
+		result->dirty = TRUE;
+	}
+
+	/* reading the flags may have updated the mark file */
+	virtual_result_folder_set_stamp(rfolder, item);
+	rfolder->touched = FALSE;
+
+	g_free(path);
+
+	return g_slist_reverse(newlist);
+}
+
+/* Bring the result up to date except for the added messages, which are
+   returned in newlists (a list of the message lists of the folders in
+   scope). Returns FALSE if the folder list is changed, or a folder is
+   changed without the signals (or its flags are changed while the rule
+   tests them), so that the search must be done again. */
+static gboolean virtual_result_update(VirtualResult *result,
+				      VirtualSearchInfo *info,
+				      GSList *scope, GSList **newlists)
+{
+	GSList *rfolders = NULL;
+	GSList *cur, *rcur;
+	gboolean uses_flags;
+
+	if (g_slist_length(scope) != g_slist_length(result->folders))
+		return FALSE;
+
+	uses_flags = virtual_search_rule_uses_flags(info->rule);
+
+	for (cur = scope; cur != NULL; cur = cur->next) {
+		FolderItem *item = FOLDER_ITEM(cur->data);
+		VirtualResultFolder *rfolder = NULL;
+		VirtualResultFolder stamp;
+		gboolean changed;
+		gchar *id;
+
+		id = folder_item_get_identifier(item);
+		if (id) {
+			rfolder = virtual_result_find_folder(result, id);
+			g_free(id);
+		}
+		if (!rfolder) {
+			debug_print("search result: folder list is changed\n");
+			g_slist_free(rfolders);
+			return FALSE;
+		}
+
+		virtual_result_folder_set_stamp(&stamp, item);
+		if (rfolder->touched)
+			changed = !virtual_result_folder_check(rfolder, item);
+		else
+			changed = (stamp.mtime != rfolder->mtime);
+		if (changed ||
+		    (uses_flags &&
+		     (item->mark_queue ||
+		      stamp.mark_mtime != rfolder->mark_mtime ||
+		      stamp.mark_size != rfolder->mark_size))) {
+			debug_print("search result: %s is changed\n",
+				    item->path);
+			g_slist_free(rfolders);
+			return FALSE;
+		}
+
+		rfolders = g_slist_prepend(rfolders, rfolder);
+	}
+	rfolders = g_slist_reverse(rfolders);
+
+	*newlists = NULL;
+
+	for (cur = scope, rcur = rfolders; cur != NULL;
+	     cur = cur->next, rcur = rcur->next) {
+		FolderItem *item = FOLDER_ITEM(cur->data);
+		VirtualResultFolder *rfolder = (VirtualResultFolder *)rcur->data;
+
+		*newlists = g_slist_prepend
+			(*newlists,
+			 virtual_result_folder_update(result, rfolder, item));
+	}
+	*newlists = g_slist_reverse(*newlists);
+
+	g_slist_free(rfolders);
+
+	return TRUE;
+}
+
+/* Leave only the messages matching the rule in newlists. This is done
+   without the lock, since the body search may decrypt messages and run
+   the main loop, which emits the signals. */
+static void virtual_result_match_new(VirtualSearchInfo *info,
+				     GSList *scope, GSList *newlists)
+{
+	GSList *cur, *ncur, *mcur;
+	FilterInfo fltinfo;
+
+	memset(&fltinfo, 0, sizeof(FilterInfo));
+
+	for (cur = scope, ncur = newlists; cur != NULL && ncur != NULL;
+	     cur = cur->next, ncur = ncur->next) {
+		FolderItem *item = FOLDER_ITEM(cur->data);
+		GSList *matched = NULL;
+
+		for (mcur = (GSList *)ncur->data; mcur != NULL;
+		     mcur = mcur->next) {
+			MsgInfo *msginfo = (MsgInfo *)mcur->data;
+
+			if (virtual_search_match_msg(info, msginfo, &fltinfo)
+			    == SCACHE_MATCHED) {
+				debug_print("search result: adding %s/%d\n",
+					    item->path, msginfo->msgnum);
+				matched = g_slist_prepend(matched, msginfo);
+			} else
+				procmsg_msginfo_free(msginfo);
+		}
+		g_slist_free((GSList *)ncur->data);
+		ncur->data = g_slist_reverse(matched);
+	}
+}
+
+/* Add the matched messages to the result and return all the matched
+   messages. Returns FALSE if the folder list is changed meanwhile. */
+static gboolean virtual_result_collect(VirtualResult *result,
+				       GSList *scope, GSList *newlists,
+				       GSList **mlist)
+{
+	GSList *cur, *ncur, *mcur;
+
+	*mlist = NULL;
+
+	for (cur = scope, ncur = newlists; cur != NULL && ncur != NULL;
+	     cur = cur->next, ncur = ncur->next) {
+		FolderItem *item = FOLDER_ITEM(cur->data);
+		VirtualResultFolder *rfolder = NULL;
+		GSList *list = NULL;
+		gchar *id, *path;
+
+		id = folder_item_get_identifier(item);
+		if (id) {
+			rfolder = virtual_result_find_folder(result, id);
+			g_free(id);
+		}
+		if (!rfolder) {
+			procmsg_msg_list_free(*mlist);
+			*mlist = NULL;
+			return FALSE;
+		}
+
+		/* the messages may be removed while matching */
+		path = folder_item_get_path(item);
+		for (mcur = (GSList *)ncur->data; mcur != NULL;
+		     mcur = mcur->next) {
+			MsgInfo *msginfo = (MsgInfo *)mcur->data;
+			gchar *file;
+			gchar buf[16];
+
+			file = g_strconcat(path, G_DIR_SEPARATOR_S,
+					   utos_buf(buf, msginfo->msgnum),
+					   NULL);
+			if (is_file_exist(file)) {
+				virtual_result_folder_add(rfolder, msginfo);
+				result->dirty = TRUE;
+			}
+			g_free(file);
+		}
+		g_free(path);
+
+		g_hash_table_foreach(rfolder->msg_table,
+				     virtual_result_collect_func, &list);
+		list = g_slist_sort(list, procmsg_cmp_msgnum_for_sort);
+		for (mcur = list; mcur != NULL; mcur = mcur->next) {
+			MsgInfo *msginfo;
+
+			msginfo = virtual_msginfo_copy((MsgInfo *)mcur->data);
+			msginfo->folder = item;
+			mcur->data = msginfo;
+		}
+		*mlist = g_slist_concat(*mlist, list);
+	}
+
+	return TRUE;
+}
+
+static gboolean virtual_get_msg_list_from_result(FolderItem *item,
+						 VirtualSearchInfo *info,
+						 time_t rule_mtime,
+						 off_t rule_size,
+						 GSList **mlist)
+{
+	VirtualResult *result;
+	GSList *newlists = NULL, *cur;
+	guint serial;
+	gchar *id;
+	gboolean ret = FALSE;
+
+	id = folder_item_get_identifier(item);
+	g_return_val_if_fail(id != NULL, FALSE);
+
+	G_LOCK(virtual_result);
+
+	result = virtual_result_find(id);
+	if (result && (result->rule_mtime != rule_mtime ||
+		       result->rule_size != rule_size)) {
+		virtual_result_remove(result);
+		result = NULL;
+	}
+	if (!result) {
+		result = virtual_read_search_result(item, id, rule_mtime,
+						    rule_size);
+		if (result)
+			virtual_result_register(result);
+	}
+
+	if (!result ||
+	    !virtual_result_update(result, info, info->scope, &newlists)) {
+		G_UNLOCK(virtual_result);
+		g_free(id);
+		return FALSE;
+	}
+	serial = result->serial;
+
+	G_UNLOCK(virtual_result);
+
+	virtual_result_match_new(info, info->scope, newlists);
+
+	G_LOCK(virtual_result);
+
+	/* the result may be forgotten while matching */
+	result = virtual_result_find(id);
+	if (result && result->serial == serial &&
+	    virtual_result_collect(result, info->scope, newlists, mlist)) {
+		debug_print("virtual_get_msg_list: using search result\n");
+		if (result->dirty)
+			virtual_write_search_result(item, result);
+		ret = TRUE;
+	}
+
+	G_UNLOCK(virtual_result);
+
+	for (cur = newlists; cur != NULL; cur = cur->next)
+		procmsg_msg_list_free((GSList *)cur->data);
+	g_slist_free(newlists);
+	g_free(id);
+	return ret;
+}
+
 static GSList *virtual_get_msg_list(Folder *folder, FolderItem *item,
 				    gboolean use_cache)
 {
@@ -461,16 +1606,21 @@ static GSList *virtual_get_msg_list(Folder *folder, FolderItem *item,
 	gchar *path;
 	gchar *rule_file;
 	gchar *cache_file;
+	gchar *id;
 	FolderItem *target;
 	gint new = 0, unread = 0, total = 0;
+	gboolean persistent;
+	time_t rule_mtime;
+	off_t rule_size;
 	VirtualSearchInfo info;
 
 	g_return_val_if_fail(item != NULL, NULL);
 	g_return_val_if_fail(item->stype == F_VIRTUAL, NULL);
 
 	path = folder_item_get_path(item);
-	rule_file = g_strconcat(path, G_DIR_SEPARATOR_S, "filter.xml", NULL);
+	rule_file = g_strconcat(path, G_DIR_SEPARATOR_S, FILTER_LIST, NULL);
 	flist = filter_read_file(rule_file);
+	virtual_get_file_stamp(rule_file, &rule_mtime, &rule_size);
 	g_free(rule_file);
 
 	g_free(path);
@@ -490,6 +1640,47 @@ static GSList *virtual_get_msg_list(Folder *folder, FolderItem *item,
 
 	info.rule = rule;
 	info.mlist = NULL;
+	info.folders = NULL;
+	info.scope = NULL;
+	info.result = NULL;
+
+	info.requires_full_headers =
+		filter_rule_requires_full_headers(rule);
+
+	if (rule->recursive) {
+		if (target->stype == F_TRASH)
+			info.exclude_trash = FALSE;
+		else
+			info.exclude_trash = TRUE;
+	} else
+		info.exclude_trash = FALSE;
+
+	if (rule->recursive)
+		g_node_traverse(target->node, G_PRE_ORDER, G_TRAVERSE_ALL, -1,
+				virtual_search_scope_func, &info);
+	else if (target->stype != F_VIRTUAL)
+		info.scope = g_slist_prepend(info.scope, target);
+	info.scope = g_slist_reverse(info.scope);
+
+	/* only the local folders tell their changes */
+	persistent = virtual_search_rule_is_persistent(rule);
+	for (cur = info.scope; cur != NULL && persistent; cur = cur->next) {
+		if (FOLDER_TYPE(FOLDER_ITEM(cur->data)->folder) != F_MH)
+			persistent = FALSE;
+	}
+
+	if (persistent) {
+		virtual_connect_signals();
+		if (use_cache &&
+		    virtual_get_msg_list_from_result(item, &info, rule_mtime,
+						     rule_size, &mlist))
+			goto count;
+
+		id = folder_item_get_identifier(item);
+		info.result = virtual_result_new(id, rule_mtime, rule_size);
+		g_free(id);
+	}
+
 	if (use_cache)
 		info.search_cache_table = virtual_read_search_cache(item);
 	else
@@ -501,30 +1692,57 @@ static GSList *virtual_get_msg_list(Folder *folder, FolderItem *item,
 					 DATA_WRITE, NULL, 0);
 	g_free(cache_file);
 	g_free(path);
-	if (!info.fp)
+	if (!info.fp) {
+		virtual_search_cache_free(info.search_cache_table);
+		if (info.result)
+			virtual_result_free(info.result);
+		g_slist_free(info.scope);
 		goto finish;
+	}
 
-	info.requires_full_headers =
-		filter_rule_requires_full_headers(rule);
+#if USE_THREADS
+	info.pool = NULL;
+	if (virtual_search_rule_is_thread_safe(rule)) {
+		gint n_threads = prefs_common.search_threads;
+
+		if (n_threads <= 0)
+			n_threads = get_processor_count();
+		if (n_threads > 1) {
+			debug_print("virtual_get_msg_list: using %d threads\n",
+				    n_threads);
+			info.pool = g_thread_pool_new(virtual_search_job_func,
+						      NULL, n_threads, FALSE,
+						      NULL);
+		}
+	}
+#endif
 
-	if (rule->recursive) {
-		if (target->stype == F_TRASH)
-			info.exclude_trash = FALSE;
-		else
-			info.exclude_trash = TRUE;
-	} else
-		info.exclude_trash = FALSE;
+	for (cur = info.scope; cur != NULL; cur = cur->next)
+		virtual_search_folder(&info, FOLDER_ITEM(cur->data));
 
-	if (rule->recursive) {
-		g_node_traverse(target->node, G_PRE_ORDER, G_TRAVERSE_ALL, -1,
-				virtual_search_recursive_func, &info);
-		mlist = info.mlist;
-	} else
-		mlist = virtual_search_folder(&info, target);
+	virtual_search_flush(&info, TRUE);
+	mlist = info.mlist;
+
+#if USE_THREADS
+	if (info.pool)
+		g_thread_pool_free(info.pool, FALSE, TRUE);
+#endif
 
 	fclose(info.fp);
 	virtual_search_cache_free(info.search_cache_table);
 
+	if (info.result) {
+		VirtualResult *old;
+
+		G_LOCK(virtual_result);
+		if ((old = virtual_result_find(info.result->id)) != NULL)
+			virtual_result_remove(old);
+		virtual_result_register(info.result);
+		virtual_write_search_result(item, info.result);
+		G_UNLOCK(virtual_result);
+	}
+
+count:
 	for (cur = mlist; cur != NULL; cur = cur->next) {
 		MsgInfo *msginfo = (MsgInfo *)cur->data;
 
@@ -540,6 +1758,8 @@ static GSList *virtual_get_msg_list(Folder *folder, FolderItem *item,
 	item->total = total;
 	item->updated = TRUE;
 
+	g_slist_free(info.scope);
+
 finish:
 	filter_rule_list_free(flist);
 	return mlist;
@@ -40,21 +40,29 @@
 
 /* How it works:
  *
- * The address book is read into memory. We set up an address list
- * containing all address book entries. Next we make the completion
- * list, which contains all the completable strings, and store a
- * reference to the address entry it belongs to.
- * After calling the g_completion_complete(), we get a reference
- * to a valid email address.  
+ * The address book is read into memory. We set up an address table
+ * containing all address book entries, and a completion entry for each
+ * completable string (name, nickname and address) with a reference to
+ * the address entry it belongs to.
  *
- * Completion is very simplified. We never complete on another prefix,
- * i.e. we neglect the next smallest possible prefix for the current
- * completion cache. This is simply done so we might break up the
- * addresses a little more (e.g. break up alfons@proteus.demon.nl into
- * something like alfons, proteus, demon, nl; and then completing on
- * any of those words).
- */ 
-	
+ * The completion entries are indexed by the trigrams (3 byte sequences)
+ * of their lowercased strings. A string of 3 or more bytes is matched
+ * anywhere in the completion strings: the candidates are taken from the
+ * shortest list of its trigrams and checked with strstr(). Shorter
+ * strings only match the beginning of the completion strings or of
+ * their words, and all the entries are scanned.
+ *
+ * The matches are ranked (beginning of the string, beginning of a word,
+ * elsewhere), and each address is listed once using a stamp in the
+ * address entry.
+ *
+ * If the address book is changed, it is read again and compared with
+ * the current entries, so only the added and removed strings touch the
+ * index. Persons added, edited or deleted in the address book window
+ * are applied one by one without reading it again; the entries count
+ * the addresses which refer to them so that shared strings stay.
+ */
+
 /* address_entry - structure which refers to the original address entry in the
  * address book 
  */
@@ -62,6 +70,11 @@ typedef struct
 {
 	gchar *name;
 	gchar *address;
+	gchar *key;		/* name and address (key of address_table) */
+	GSList *entries;	/* completion entries of this address */
+	guint load_stamp;	/* last read_address_book() which found it */
+	guint refs;		/* addresses added since that read */
+	guint match_stamp;	/* last complete_address() which matched it */
 } address_entry;
 
 /* completion_entry - structure used to complete addresses, with a reference
@@ -71,25 +84,45 @@ typedef struct
 {
 	gchar		*string; /* string to complete */
 	address_entry	*ref;	 /* address the string belongs to  */
+	guint		 load_stamp;
+	guint		 refs;
+	gboolean	 removed; /* not in the address book anymore */
 } completion_entry;
 
+enum
+{
+	MATCH_PREFIX,
+	MATCH_WORD,
+	MATCH_SUBSTRING,
+	MATCH_NUM
+};
+
+#define TRIGRAM_KEY(p)						\
+	GUINT_TO_POINTER(((guint)(guchar)(p)[0] << 16) |	\
+			 ((guint)(guchar)(p)[1] << 8) |		\
+			 (guint)(guchar)(p)[2])
+
 /*******************************************************************************/
 
 static gint	    ref_count;		/* list ref count */
-static GList 	   *completion_list;	/* list of strings to be checked */
-static GList 	   *address_list;	/* address storage */
-static GCompletion *completion;		/* completion object */
+static GHashTable  *address_table;	/* address storage */
+static GPtrArray   *completion_array;	/* all completion entries */
+static GHashTable  *trigram_table;	/* trigram -> GPtrArray of entries */
+static guint	    n_removed;		/* removed entries still indexed */
+static GSList	   *removed_addresses;	/* freed when the index is compacted */
+static guint	    load_stamp;
+static guint	    match_stamp;
 
 /* To allow for continuing completion we have to keep track of the state
  * using the following variables. No need to create a context object. */
 
 static gint	    completion_count;		/* nr of addresses incl. the prefix */
 static gint	    completion_next;		/* next prev address */
-static GSList	   *completion_addresses;	/* unique addresses found in the
+static GPtrArray   *completion_addresses;	/* unique addresses found in the
 						   completion cache. */
 static gchar	   *completion_prefix;		/* last prefix. (this is cached here
-						 * because the prefix passed to g_completion
-						 * is g_strdown()'ed */
+						 * because the prefix used for
+						 * matching is g_utf8_strdown()'ed */
 
 /*******************************************************************************/
 
@@ -98,125 +131,278 @@ static void address_completion_entry_changed		(GtkEditable *editable,
 							 gpointer     data);
 
 
-/* completion_func() - used by GTK to find the string data to be used for 
- * completion 
- */
-static gchar *completion_func(gpointer data)
+static void init_all(void)
 {
-	g_return_val_if_fail(data != NULL, NULL);
+	address_table = g_hash_table_new(g_str_hash, g_str_equal);
+	completion_array = g_ptr_array_new();
+	trigram_table = g_hash_table_new(NULL, g_direct_equal);
+	completion_addresses = g_ptr_array_new();
+	n_removed = 0;
+}
 
-	return ((completion_entry *)data)->string;
-} 
+static void address_entry_free(address_entry *ae)
+{
+	g_free(ae->name);
+	g_free(ae->address);
+	g_free(ae->key);
+	g_slist_free(ae->entries);
+	g_free(ae);
+}
 
-static void init_all(void)
+static void address_entry_free_func(gpointer key, gpointer value,
+				    gpointer data)
+{
+	address_entry_free((address_entry *)value);
+}
+
+static void trigram_free_func(gpointer key, gpointer value, gpointer data)
 {
-	completion = g_completion_new(completion_func);
-	g_return_if_fail(completion != NULL);
+	g_ptr_array_free((GPtrArray *)value, TRUE);
 }
 
 static void free_all(void)
 {
-	GList *walk;
+	GSList *cur;
+	guint i;
 
-	walk = g_list_first(completion_list);
-	for (; walk != NULL; walk = g_list_next(walk)) {
-		completion_entry *ce = (completion_entry *) walk->data;
+	for (i = 0; i < completion_array->len; i++) {
+		completion_entry *ce = g_ptr_array_index(completion_array, i);
 		g_free(ce->string);
 		g_free(ce);
 	}
-	g_list_free(completion_list);
-	completion_list = NULL;
-
-	walk = address_list;
-	for (; walk != NULL; walk = g_list_next(walk)) {
-		address_entry *ae = (address_entry *) walk->data;
-		g_free(ae->name);
-		g_free(ae->address);
-		g_free(ae);
+	g_ptr_array_free(completion_array, TRUE);
+	completion_array = NULL;
+
+	g_hash_table_foreach(trigram_table, trigram_free_func, NULL);
+	g_hash_table_destroy(trigram_table);
+	trigram_table = NULL;
+
+	g_hash_table_foreach(address_table, address_entry_free_func, NULL);
+	g_hash_table_destroy(address_table);
+	address_table = NULL;
+
+	for (cur = removed_addresses; cur != NULL; cur = cur->next)
+		address_entry_free((address_entry *)cur->data);
+	g_slist_free(removed_addresses);
+	removed_addresses = NULL;
+
+	g_ptr_array_free(completion_addresses, TRUE);
+	completion_addresses = NULL;
+}
+
+static void trigram_index_add(completion_entry *ce)
+{
+	const gchar *p;
+
+	for (p = ce->string; p[0] && p[1] && p[2]; p++) {
+		GPtrArray *posting;
+		gpointer key = TRIGRAM_KEY(p);
+
+		posting = g_hash_table_lookup(trigram_table, key);
+		if (!posting) {
+			posting = g_ptr_array_new();
+			g_hash_table_insert(trigram_table, key, posting);
+		} else if (posting->len > 0 &&
+			   g_ptr_array_index(posting, posting->len - 1) == ce)
+			continue;	/* repeated in the same string */
+
+		g_ptr_array_add(posting, ce);
 	}
-	g_list_free(address_list);
-	address_list = NULL;
+}
+
+/* compact_index() - drops the removed entries and rebuilds the trigram
+ * index.
+ */
+static void compact_index(void)
+{
+	GPtrArray *array;
+	GSList *cur;
+	guint i;
+
+	debug_print("compacting address completion index (%d removed)\n",
+		    n_removed);
+
+	g_hash_table_foreach(trigram_table, trigram_free_func, NULL);
+	g_hash_table_destroy(trigram_table);
+	trigram_table = g_hash_table_new(NULL, g_direct_equal);
+
+	array = g_ptr_array_sized_new(completion_array->len - n_removed);
+	for (i = 0; i < completion_array->len; i++) {
+		completion_entry *ce = g_ptr_array_index(completion_array, i);
 
-	g_completion_free(completion);
-	completion = NULL;
+		if (ce->removed) {
+			g_free(ce->string);
+			g_free(ce);
+			continue;
+		}
+		g_ptr_array_add(array, ce);
+		trigram_index_add(ce);
+	}
+	g_ptr_array_free(completion_array, TRUE);
+	completion_array = array;
+	n_removed = 0;
+
+	for (cur = removed_addresses; cur != NULL; cur = cur->next)
+		address_entry_free((address_entry *)cur->data);
+	g_slist_free(removed_addresses);
+	removed_addresses = NULL;
 }
 
-static gint address_entry_find_func(gconstpointer a, gconstpointer b)
+static void add_completion_entry(address_entry *ae, const gchar *str)
 {
-	const address_entry *ae1 = a;
-	const address_entry *ae2 = b;
-	gint val;
+	completion_entry *ce;
+	gchar *string;
+	GSList *cur;
+
+	/* completion is case insensitive */
+	string = g_utf8_strdown(str, -1);
+
+	for (cur = ae->entries; cur != NULL; cur = cur->next) {
+		ce = (completion_entry *)cur->data;
+		if (!strcmp(ce->string, string)) {
+			if (ce->load_stamp != load_stamp) {
+				ce->load_stamp = load_stamp;
+				ce->refs = 0;
+			}
+			ce->refs++;
+			g_free(string);
+			return;
+		}
+	}
 
-	if (!a || !b)
-		return -1;
+	ce = g_new0(completion_entry, 1);
+	ce->string = string;
+	ce->ref = ae;
+	ce->load_stamp = load_stamp;
+	ce->refs = 1;
+	ae->entries = g_slist_prepend(ae->entries, ce);
 
-	val = strcmp(ae1->name, ae2->name);
-	if (val != 0)
-		return val;
-	val = strcmp(ae1->address, ae2->address);
-	if (val != 0)
-		return val;
+	g_ptr_array_add(completion_array, ce);
+	trigram_index_add(ce);
+}
+
+/* add_address() - adds address to the completion list, or marks it as
+ * still existing if it is already there.
+ */
+static gint add_address(const gchar *name, const gchar *address, const gchar *nickname)
+{
+	address_entry *ae;
+	gchar *key;
+
+	if (!address) return -1;
+
+	key = g_strconcat(name ? name : "", "\n", address, NULL);
+	ae = g_hash_table_lookup(address_table, key);
+	if (ae)
+		g_free(key);
+	else {
+		ae = g_new0(address_entry, 1);
+		ae->name    = g_strdup(name ? name : "");
+		ae->address = g_strdup(address);
+		ae->key     = key;
+		g_hash_table_insert(address_table, ae->key, ae);
+	}
+	if (ae->load_stamp != load_stamp) {
+		ae->load_stamp = load_stamp;
+		ae->refs = 0;
+	}
+	ae->refs++;
+
+	if (name && *name)
+		add_completion_entry(ae, name);
+	if (nickname && *nickname)
+		add_completion_entry(ae, nickname);
+	add_completion_entry(ae, address);
 
 	return 0;
 }
 
-/* add_address() - adds address to the completion list. this function looks
- * complicated, but it's only allocation checks.
+static void remove_completion_entry(address_entry *ae, const gchar *str)
+{
+	completion_entry *ce;
+	gchar *string;
+	GSList *cur;
+
+	string = g_utf8_strdown(str, -1);
+
+	for (cur = ae->entries; cur != NULL; cur = cur->next) {
+		ce = (completion_entry *)cur->data;
+		if (!strcmp(ce->string, string)) {
+			if (--ce->refs == 0) {
+				ce->removed = TRUE;
+				n_removed++;
+				ae->entries = g_slist_remove(ae->entries, ce);
+			}
+			break;
+		}
+	}
+
+	g_free(string);
+}
+
+/* remove_address() - reverses add_address(), and removes the strings
+ * which no other address refers to.
  */
-static gint add_address(const gchar *name, const gchar *address, const gchar *nickname)
+static gint remove_address(const gchar *name, const gchar *address, const gchar *nickname)
 {
-	address_entry    *ae;
-	completion_entry *name_ce = NULL;
-	completion_entry *nick_ce = NULL;
-	completion_entry *addr_ce;
-	GList            *found;
+	address_entry *ae;
+	gchar *key;
 
 	if (!address) return -1;
 
+	key = g_strconcat(name ? name : "", "\n", address, NULL);
+	ae = g_hash_table_lookup(address_table, key);
+	g_free(key);
+	if (!ae) return -1;
+
 	if (name && *name)
-		name_ce = g_new0(completion_entry, 1);
+		remove_completion_entry(ae, name);
 	if (nickname && *nickname)
-		nick_ce = g_new0(completion_entry, 1);
-	addr_ce = g_new0(completion_entry, 1);
-
-	ae = g_new0(address_entry, 1);
-	ae->name    = g_strdup(name ? name : "");
-	ae->address = g_strdup(address);		
-	if ((found = g_list_find_custom(address_list, ae,
-					address_entry_find_func))) {
-		g_free(ae->name);
-		g_free(ae->address);
-		g_free(ae);
-		ae = (address_entry *)found->data;
-	} else
-		address_list = g_list_append(address_list, ae);
-
-	/* GCompletion list is case sensitive */
-	if (name_ce)
-		name_ce->string = g_utf8_strdown(name, -1);
-	if (nick_ce)
-		nick_ce->string = g_utf8_strdown(nickname, -1);
-	addr_ce->string = g_utf8_strdown(address, -1);
-
-	if (name_ce)
-		name_ce->ref = ae;
-	if (nick_ce)
-		nick_ce->ref = ae;
-	addr_ce->ref = ae;
-
-	if (name_ce)
-		completion_list = g_list_append(completion_list, name_ce);
-	if (nick_ce)
-		completion_list = g_list_append(completion_list, nick_ce);
-	completion_list = g_list_append(completion_list, addr_ce);
+		remove_completion_entry(ae, nickname);
+	remove_completion_entry(ae, address);
+
+	if (--ae->refs == 0) {
+		g_hash_table_remove(address_table, ae->key);
+		removed_addresses = g_slist_prepend(removed_addresses, ae);
+	}
 
 	return 0;
 }
 
-/* read_address_book()
+/* read_address_book() - reads the address book and updates the entries
+ * which are added or removed since the last read.
  */ 
-static void read_address_book(void) {	
+static void read_address_book(void)
+{
+	guint i;
+
+	load_stamp++;
 	addressbook_load_completion( add_address );
+
+	for (i = 0; i < completion_array->len; i++) {
+		completion_entry *ce = g_ptr_array_index(completion_array, i);
+		address_entry *ae = ce->ref;
+
+		if (ce->removed || ce->load_stamp == load_stamp)
+			continue;
+
+		ce->removed = TRUE;
+		n_removed++;
+		ae->entries = g_slist_remove(ae->entries, ce);
+
+		if (ae->load_stamp != load_stamp &&
+		    g_hash_table_lookup(address_table, ae->key) == ae) {
+			g_hash_table_remove(address_table, ae->key);
+			removed_addresses = g_slist_prepend(removed_addresses,
+							    ae);
+		}
+	}
+
+	if (n_removed > completion_array->len / 2)
+		compact_index();
+
+	debug_print("read_address_book: %d completion entries\n",
+		    completion_array->len - n_removed);
 }
 
 /* start_address_completion() - returns the number of addresses 
@@ -229,14 +415,11 @@ gint start_address_completion(void)
 		init_all();
 		/* open the address book */
 		read_address_book();
-		/* merge the completion entry list into g_completion */
-		if (completion_list)
-			g_completion_add_items(completion, completion_list);
 	}
 	ref_count++;
 	debug_print("start_address_completion ref count %d\n", ref_count);
 
-	return g_list_length(completion_list);
+	return completion_array->len - n_removed;
 }
 
 /* get_address_from_edit() - returns a possible address (or a part)
@@ -350,6 +533,71 @@ static gint insert_address_func(gconstpointer a, gconstpointer b)
 }
 #endif
 
+/* completion_match() - returns the rank of the match of d (of len bytes)
+ * in string, or -1. matches inside a word are only taken if substring is
+ * TRUE.
+ */
+static gint completion_match(const gchar *string, const gchar *d, gsize len,
+			     gboolean substring)
+{
+	const gchar *p;
+	gint rank = -1;
+
+	if (strncmp(string, d, len) == 0)
+		return MATCH_PREFIX;
+	if (*string == '\0')
+		return -1;
+
+	for (p = string + 1; (p = strstr(p, d)) != NULL; p++) {
+		if (!((guchar)p[-1] & 0x80) && !g_ascii_isalnum(p[-1]))
+			return MATCH_WORD;
+		if (substring)
+			rank = MATCH_SUBSTRING;
+	}
+
+	return rank;
+}
+
+/* find_matches() - adds the completion entries matching d to matches,
+ * by rank.
+ */
+static void find_matches(const gchar *d, GPtrArray **matches)
+{
+	GPtrArray *candidates = completion_array;
+	gsize len;
+	guint i;
+
+	len = strlen(d);
+
+	if (len >= 3) {
+		const gchar *p;
+
+		/* take the rarest trigram */
+		for (p = d; p[2] != '\0'; p++) {
+			GPtrArray *posting;
+
+			posting = g_hash_table_lookup(trigram_table,
+						      TRIGRAM_KEY(p));
+			if (!posting)
+				return;
+			if (candidates == completion_array ||
+			    posting->len < candidates->len)
+				candidates = posting;
+		}
+	}
+
+	for (i = 0; i < candidates->len; i++) {
+		completion_entry *ce = g_ptr_array_index(candidates, i);
+		gint rank;
+
+		if (ce->removed)
+			continue;
+		rank = completion_match(ce->string, d, len, len >= 3);
+		if (rank >= 0)
+			g_ptr_array_add(matches[rank], ce);
+	}
+}
+
 /* complete_address() - tries to complete an addres, and returns the
  * number of addresses found. use get_complete_address() to get one.
  * returns zero if no match was found, otherwise the number of addresses,
@@ -357,41 +605,41 @@ static gint insert_address_func(gconstpointer a, gconstpointer b)
  */
 guint complete_address(const gchar *str)
 {
-	GList *result;
+	GPtrArray *matches[MATCH_NUM];
 	gchar *d;
-	guint  count, cpl;
-	completion_entry *ce;
+	guint  count, i;
+	gint   rank;
 
 	g_return_val_if_fail(str != NULL, 0);
 
 	clear_completion_cache();
 	completion_prefix = g_strdup(str);
 
-	/* g_completion is case sensitive */
 	d = g_utf8_strdown(str, -1);
-	result = g_completion_complete(completion, d, NULL);
 
-	count = g_list_length(result);
-	if (count) {
-		/* create list with unique addresses  */
-		for (cpl = 0, result = g_list_first(result);
-		     result != NULL;
-		     result = g_list_next(result)) {
-			ce = (completion_entry *)(result->data);
-			if (NULL == g_slist_find(completion_addresses,
-						 ce->ref)) {
-				cpl++;
-				completion_addresses =
-					g_slist_append(completion_addresses,
-						       ce->ref);
-#if 0
-					g_slist_insert_sorted
-						(completion_addresses, ce->ref,
-						 insert_address_func);
-#endif
-			}
+	for (rank = 0; rank < MATCH_NUM; rank++)
+		matches[rank] = g_ptr_array_new();
+
+	find_matches(d, matches);
+
+	/* create list with unique addresses  */
+	match_stamp++;
+	for (rank = 0; rank < MATCH_NUM; rank++) {
+		for (i = 0; i < matches[rank]->len; i++) {
+			completion_entry *ce;
+
+			ce = g_ptr_array_index(matches[rank], i);
+			if (ce->ref->match_stamp == match_stamp)
+				continue;
+			ce->ref->match_stamp = match_stamp;
+			g_ptr_array_add(completion_addresses, ce->ref);
 		}
-		count = cpl + 1;	/* index 0 is the original prefix */
+		g_ptr_array_free(matches[rank], TRUE);
+	}
+
+	count = completion_addresses->len;
+	if (count) {
+		count++;		/* index 0 is the original prefix */
 		completion_next = 1;	/* we start at the first completed one */
 	} else {
 		g_free(completion_prefix);
@@ -418,7 +666,7 @@ gchar *get_complete_address(gint index)
 			address = g_strdup(completion_prefix);
 		else {
 			/* get something from the unique addresses */
-			p = (address_entry *)g_slist_nth_data
+			p = (address_entry *)g_ptr_array_index
 				(completion_addresses, index - 1);
 			if (p != NULL) {
 				if (!p->name || p->name[0] == '\0')
@@ -481,14 +729,14 @@ guint get_completion_count(void)
 void clear_completion_cache(void)
 {
 	if (is_completion_pending()) {
-		if (completion_prefix)
+		if (completion_prefix) {
 			g_free(completion_prefix);
-
-		if (completion_addresses) {
-			g_slist_free(completion_addresses);
-			completion_addresses = NULL;
+			completion_prefix = NULL;
 		}
 
+		if (completion_addresses)
+			g_ptr_array_set_size(completion_addresses, 0);
+
 		completion_count = completion_next = 0;
 	}
 }
@@ -506,17 +754,48 @@ gboolean is_completion_pending(void)
 gint invalidate_address_completion(void)
 {
 	if (ref_count) {
-		/* simply the same as start_address_completion() */
+		/* only the changes are applied to the index */
 		debug_print("Invalidation request for address completion\n");
-		free_all();
-		init_all();
-		read_address_book();
-		if (completion_list)
-			g_completion_add_items(completion, completion_list);
 		clear_completion_cache();
+		read_address_book();
+		return completion_array->len - n_removed;
 	}
 
-	return g_list_length(completion_list);
+	return 0;
+}
+
+/* address_completion_add_address() - should be called for each address
+ * of a person added to the address book, with the same arguments as
+ * addressbook_load_completion() passes.
+ */
+gint address_completion_add_address(const gchar *name, const gchar *address,
+				    const gchar *nickname)
+{
+	if (!ref_count)
+		return 0;
+
+	clear_completion_cache();
+	return add_address(name, address, nickname);
+}
+
+/* address_completion_remove_address() - should be called for each address
+ * of a person before it is edited or deleted.
+ */
+gint address_completion_remove_address(const gchar *name,
+				       const gchar *address,
+				       const gchar *nickname)
+{
+	gint ret;
+
+	if (!ref_count)
+		return 0;
+
+	clear_completion_cache();
+	ret = remove_address(name, address, nickname);
+	if (n_removed > completion_array->len / 2)
+		compact_index();
+
+	return ret;
 }
 
 gint end_address_completion(void)
@@ -652,7 +931,9 @@ static void completion_window_apply_selection_address_only(GtkCList *clist, GtkE
 
 	row = GPOINTER_TO_INT(clist->selection->data);
 
-	ae = (address_entry *)g_slist_nth_data(completion_addresses, row - 1);
+	if (row < 1 || (guint)row > completion_addresses->len)
+		return;
+	ae = (address_entry *)g_ptr_array_index(completion_addresses, row - 1);
 	if (ae && ae->address) {
 		address = get_address_from_edit(entry, &cursor_pos);
 		g_free(address);
@@ -23,6 +23,12 @@
 
 gint start_address_completion		(void);
 gint invalidate_address_completion	(void);
+gint address_completion_add_address	(const gchar	*name,
+					 const gchar	*address,
+					 const gchar	*nickname);
+gint address_completion_remove_address	(const gchar	*name,
+					 const gchar	*address,
+					 const gchar	*nickname);
 
 guint complete_address			(const gchar	*str);
 
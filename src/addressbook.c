@@ -392,6 +392,17 @@ static void addressbook_list_select_set		(GList		*row_list);
 static void addressbook_import_ldif_cb		(void);
 static void addressbook_import_csv_cb		(void);
 
+static void addressbook_email_completion	(ItemPerson	*person,
+						 ItemEMail	*email,
+						 gint (*callBackFunc)
+						 (const gchar *, const gchar *,
+						  const gchar *));
+static void addressbook_person_completion	(ItemPerson	*person,
+						 gint (*callBackFunc)
+						 (const gchar *, const gchar *,
+						  const gchar *));
+
+static void addressbook_clear_addr_table	(void);
 static void addressbook_modified		(void);
 
 
@@ -1168,6 +1179,8 @@ static void addressbook_del_clicked(GtkButton *button, gpointer data)
 				if (_clipObjectList_) {
 					_clipObjectList_ = g_list_remove(_clipObjectList_, item);
 				}
+				addressbook_person_completion
+					(item, address_completion_remove_address);
 				item = addrbook_remove_person(abf, item);
 				if (item) {
 					addritem_free_item_person(item);
@@ -1177,6 +1190,8 @@ static void addressbook_del_clicked(GtkButton *button, gpointer data)
 				ItemEMail *item = (ItemEMail *)aio;
 				ItemPerson *person = (ItemPerson *)ADDRITEM_PARENT(item);
 
+				addressbook_email_completion
+					(person, item, address_completion_remove_address);
 				item = addrbook_person_remove_email(abf, person, item);
 				if (item) {
 					addritem_free_item_email(item);
@@ -1186,7 +1201,8 @@ static void addressbook_del_clicked(GtkButton *button, gpointer data)
 		}
 		addressbook_list_select_clear();
 		addressbook_reopen();
-		addressbook_modified();
+		/* the completion entries are already removed */
+		addressbook_clear_addr_table();
 		return;
 	} else if (pobj->type == ADDR_ITEM_GROUP) {
 		/* Items inside groups */
@@ -2427,7 +2443,9 @@ static void addressbook_new_address_cb(gpointer data, guint action, GtkWidget *w
 				if (gtkut_tree_row_reference_equal(addrbook.tree_selected, addrbook.tree_opened)) {
 					addressbook_reopen();
 				}
-				addressbook_modified();
+				addressbook_clear_addr_table();
+				addressbook_person_completion
+					(person, address_completion_add_address);
 			}
 		}
 	}
@@ -2439,7 +2457,9 @@ static void addressbook_new_address_cb(gpointer data, guint action, GtkWidget *w
 			if (gtkut_tree_row_reference_equal(addrbook.tree_selected, addrbook.tree_opened)) {
 				addressbook_reopen();
 			}
-			addressbook_modified();
+			addressbook_clear_addr_table();
+			addressbook_person_completion
+				(person, address_completion_add_address);
 		}
 	}
 	else if( pobj->type == ADDR_ITEM_GROUP ) {
@@ -2625,20 +2645,35 @@ static void addressbook_edit_address_cb(gpointer data, guint action, GtkWidget *
 		} else {
 			/* Edit person - email page */
 			person = (ItemPerson *)ADDRITEM_PARENT(email);
-			if (addressbook_edit_person(abf, NULL, person, TRUE) == NULL)
+			addressbook_person_completion
+				(person, address_completion_remove_address);
+			if (addressbook_edit_person(abf, NULL, person, TRUE) == NULL) {
+				addressbook_person_completion
+					(person, address_completion_add_address);
 				return;
+			}
 			addressbook_reopen();
-			addressbook_modified();
+			addressbook_clear_addr_table();
+			addressbook_person_completion
+				(person, address_completion_add_address);
 			return;
 		}
 	} else if (obj->type == ADDR_ITEM_PERSON) {
 		/* Edit person - basic page */
 		ItemPerson *person = (ItemPerson *)obj;
 
-		if (addressbook_edit_person(abf, NULL, person, FALSE) == NULL)
+		/* replace the completion entries of the person */
+		addressbook_person_completion
+			(person, address_completion_remove_address);
+		if (addressbook_edit_person(abf, NULL, person, FALSE) == NULL) {
+			addressbook_person_completion
+				(person, address_completion_add_address);
 			return;
+		}
 		addressbook_reopen();
-		addressbook_modified();
+		addressbook_clear_addr_table();
+		addressbook_person_completion
+			(person, address_completion_add_address);
 		return;
 	} else if (obj->type == ADDR_ITEM_GROUP) {
 		ItemGroup *itemGrp = (ItemGroup *)obj;
@@ -4521,14 +4556,54 @@ gboolean addressbook_add_contact_autoreg(const gchar *name, const gchar *address
 *                     to be loaded.
 * Return: TRUE if data loaded, FALSE if address index not loaded.
 */
+/*
+* Pass the completion strings of an E-Mail address to the callback
+* function, as addressbook_load_completion() does.
+*/
+static void addressbook_email_completion(ItemPerson *person, ItemEMail *email, gint (*callBackFunc)(const gchar *, const gchar *, const gchar *))
+{
+	gchar *sName, *sAddress, *sAlias, *sNickName;
+
+	/* Figure out name to use */
+	sName = ADDRITEM_NAME(person);
+	sNickName = person->nickName;
+	if( sName == NULL || *sName == '\0' ) {
+		if (sNickName)
+			sName = sNickName;
+	}
+
+	/* Have mail */
+	sAddress = email->address;
+	if( sAddress && *sAddress != '\0' ) {
+		sAlias = ADDRITEM_NAME(email);
+		if( sAlias && *sAlias != '\0' ) {
+			( callBackFunc ) ( sName, sAddress, sAlias );
+		} else {
+			( callBackFunc ) ( sName, sAddress, sNickName );
+		}
+	}
+}
+
+/*
+* Pass the completion strings of each E-Mail address of a person.
+*/
+static void addressbook_person_completion(ItemPerson *person, gint (*callBackFunc)(const gchar *, const gchar *, const gchar *))
+{
+	GList *nodeM;
+
+	nodeM = person->listEMail;
+	while( nodeM ) {
+		addressbook_email_completion( person, nodeM->data, callBackFunc );
+		nodeM = g_list_next( nodeM );
+	}
+}
+
 gboolean addressbook_load_completion(gint (*callBackFunc)(const gchar *, const gchar *, const gchar *))
 {
 	/* AddressInterface *interface; */
 	AddressDataSource *ds;
 	GList *nodeIf, *nodeDS;
 	GList *listP, *nodeP;
-	GList *nodeM;
-	gchar *sName, *sAddress, *sAlias, *sNickName;
 
 	debug_print( "addressbook_load_completion\n" );
 
@@ -4550,32 +4625,7 @@ gboolean addressbook_load_completion(gint (*callBackFunc)(const gchar *, const g
 			listP = addrindex_ds_get_all_persons( ds );
 			nodeP = listP;
 			while( nodeP ) {
-				ItemPerson *person = nodeP->data;
-				nodeM = person->listEMail;
-
-				/* Figure out name to use */
-				sName = ADDRITEM_NAME(person);
-				sNickName = person->nickName;
-				if( sName == NULL || *sName == '\0' ) {
-					if (sNickName)
-						sName = sNickName;
-				}
-
-				/* Process each E-Mail address */
-				while( nodeM ) {
-					ItemEMail *email = nodeM->data;
-					/* Have mail */
-					sAddress = email->address;
-					if( sAddress && *sAddress != '\0' ) {
-						sAlias = ADDRITEM_NAME(email);
-						if( sAlias && *sAlias != '\0' ) {
-							( callBackFunc ) ( sName, sAddress, sAlias );
-						} else {
-							( callBackFunc ) ( sName, sAddress, sNickName );
-						}
-					}
-					nodeM = g_list_next( nodeM );
-				}
+				addressbook_person_completion( nodeP->data, callBackFunc );
 				nodeP = g_list_next( nodeP );
 			}
 			/* Free up the list */
@@ -4727,7 +4777,7 @@ static gint load_address(const gchar *name, const gchar *address,
 	return 0;
 }
 
-static void addressbook_modified(void)
+static void addressbook_clear_addr_table(void)
 {
 	S_LOCK(addr_table);
 
@@ -4738,7 +4788,11 @@ static void addressbook_modified(void)
 	}
 
 	S_UNLOCK(addr_table);
+}
 
+static void addressbook_modified(void)
+{
+	addressbook_clear_addr_table();
 	invalidate_address_completion();
 }
 
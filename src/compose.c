@@ -170,6 +170,7 @@ typedef enum
 
 #define B64_LINE_SIZE		57
 #define B64_BUFFSIZE		77
+#define B64_BLOCK_LINES		64
 
 #define MAX_REFERENCES_LEN	999
 
@@ -4495,7 +4496,8 @@ static gint compose_write_attach(Compose *compose, FILE *fp,
 			procmime_get_encoding_str(encoding));
 
 		if (encoding == ENC_BASE64) {
-			gchar inbuf[B64_LINE_SIZE], outbuf[B64_BUFFSIZE];
+			gchar inbuf[B64_LINE_SIZE * B64_BLOCK_LINES];
+			gchar outbuf[B64_BUFFSIZE * B64_BLOCK_LINES + 1];
 			FILE *tmp_fp = attach_fp;
 			gchar *tmp_file = NULL;
 			ContentType content_type;
@@ -4520,18 +4522,15 @@ static gint compose_write_attach(Compose *compose, FILE *fp,
 				}
 			}
 
+			/* encode B64_BLOCK_LINES lines at a time */
 			while ((len = fread(inbuf, sizeof(gchar),
-					    B64_LINE_SIZE, tmp_fp))
-			       == B64_LINE_SIZE) {
-				base64_encode(outbuf, (guchar *)inbuf,
-					      B64_LINE_SIZE);
-				fputs(outbuf, fp);
-				fputc('\n', fp);
-			}
-			if (len > 0 && feof(tmp_fp)) {
-				base64_encode(outbuf, (guchar *)inbuf, len);
-				fputs(outbuf, fp);
-				fputc('\n', fp);
+					    sizeof(inbuf), tmp_fp)) > 0) {
+				if (len < (gint)sizeof(inbuf) && !feof(tmp_fp))
+					break;
+				len = base64_encode_lines(outbuf,
+							  (guchar *)inbuf, len,
+							  B64_LINE_SIZE);
+				fwrite(outbuf, sizeof(gchar), len, fp);
 			}
 
 			if (tmp_file) {
@@ -67,6 +67,7 @@
 #include "account.h"
 #include "account_dialog.h"
 #include "folder.h"
+#include "imap.h"
 #include "inc.h"
 #include "send_message.h"
 #include "virtual.h"
@@ -992,6 +993,7 @@ gint folderview_check_new(Folder *folder)
 	GtkTreeIter iter;
 	gboolean valid;
 	gint prev_new, prev_unread, n_updated = 0;
+	GHashTable *scanned = NULL;
 
 	folderview = (FolderView *)folderview_list->data;
 	model = GTK_TREE_MODEL(folderview->store);
@@ -1006,24 +1008,66 @@ gint folderview_check_new(Folder *folder)
 	gtk_widget_set_sensitive(folderview->treeview, FALSE);
 	GTK_EVENTS_FLUSH();
 
+#define SKIP_ITEM(item)						\
+	(!item || !item->path || !item->folder ||		\
+	 item->stype == F_VIRTUAL || item->no_select ||		\
+	 (folder && folder != item->folder) ||			\
+	 (!folder && FOLDER_IS_REMOTE(item->folder)))
+
+	/* IMAP folders are scanned in parallel at once */
+	if (folder && FOLDER_TYPE(folder) == F_IMAP) {
+		GSList *item_list = NULL;
+		GSList *cur;
+
+		for (valid = gtk_tree_model_get_iter_first(model, &iter);
+		     valid; valid = gtkut_tree_model_next(model, &iter)) {
+			item = NULL;
+			gtk_tree_model_get(model, &iter,
+					   COL_FOLDER_ITEM, &item, -1);
+			if (SKIP_ITEM(item)) continue;
+			item_list = g_slist_prepend(item_list, item);
+		}
+		item_list = g_slist_reverse(item_list);
+
+		/* remember the previous counts */
+		scanned = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+		for (cur = item_list; cur != NULL; cur = cur->next) {
+			gint *prev;
+
+			item = FOLDER_ITEM(cur->data);
+			prev = g_new(gint, 2);
+			prev[0] = item->new;
+			prev[1] = item->unread;
+			g_hash_table_insert(scanned, item, prev);
+		}
+
+		imap_scan_folder_list(folder, item_list);
+		g_slist_free(item_list);
+	}
+
 	for (valid = gtk_tree_model_get_iter_first(model, &iter);
 	     valid; valid = gtkut_tree_model_next(model, &iter)) {
 		item = NULL;
 		gtk_tree_model_get(model, &iter,
 				   COL_FOLDER_ITEM, &item, -1);
-		if (!item || !item->path || !item->folder) continue;
-		if (item->stype == F_VIRTUAL) continue;
-		if (item->no_select) continue;
-		if (folder && folder != item->folder) continue;
-		if (!folder && FOLDER_IS_REMOTE(item->folder)) continue;
-
-		prev_new = item->new;
-		prev_unread = item->unread;
-		folderview_scan_tree_func(item->folder, item, NULL);
-		if (folder_item_scan(item) < 0) {
-			if (folder && FOLDER_IS_REMOTE(folder) &&
-			    REMOTE_FOLDER(folder)->session == NULL)
-				break;
+		if (SKIP_ITEM(item)) continue;
+
+		if (scanned) {
+			gint *prev;
+
+			prev = g_hash_table_lookup(scanned, item);
+			if (!prev) continue;
+			prev_new = prev[0];
+			prev_unread = prev[1];
+		} else {
+			prev_new = item->new;
+			prev_unread = item->unread;
+			folderview_scan_tree_func(item->folder, item, NULL);
+			if (folder_item_scan(item) < 0) {
+				if (folder && FOLDER_IS_REMOTE(folder) &&
+				    REMOTE_FOLDER(folder)->session == NULL)
+					break;
+			}
 		}
 		folderview_update_row(folderview, &iter);
 		if (item->stype != F_TRASH && item->stype != F_JUNK) {
@@ -1034,6 +1078,11 @@ gint folderview_check_new(Folder *folder)
 		}
 	}
 
+#undef SKIP_ITEM
+
+	if (scanned)
+		g_hash_table_destroy(scanned);
+
 	gtk_widget_set_sensitive(folderview->treeview, TRUE);
 	main_window_unlock(folderview->mainwin);
 	inc_unlock();
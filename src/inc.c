@@ -336,6 +336,7 @@ static gint inc_remote_account_mail(MainWindow *mainwin, PrefsAccount *account)
 
 		if (junk_rule)
 			filter_rule_free(junk_rule);
+		filter_junk_classifier_stop();
 
 		procmsg_msg_list_free(mlist);
 
@@ -650,8 +651,10 @@ static void inc_session_destroy(IncSession *session)
 	session_destroy(session->session);
 	g_hash_table_destroy(session->folder_table);
 	g_hash_table_destroy(session->tmp_folder_table);
-	if (session->junk_fltlist)
+	if (session->junk_fltlist) {
 		filter_rule_list_free(session->junk_fltlist);
+		filter_junk_classifier_stop();
+	}
 	g_free(session);
 }
 
@@ -439,6 +439,10 @@ static void prefs_search_folder_apply_cb(GtkWidget *widget,
 	if (is_file_exist(file))
 		g_unlink(file);
 	g_free(file);
+	file = g_strconcat(path, G_DIR_SEPARATOR_S, SEARCH_RESULT, NULL);
+	if (is_file_exist(file))
+		g_unlink(file);
+	g_free(file);
 	g_free(path);
 
 	filter_rule_free(rule);
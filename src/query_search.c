@@ -1228,6 +1228,7 @@ static gint query_search_cmp_by_subject(GtkTreeModel *model,
 					gpointer data)
 {
 	MsgInfo *msginfo_a = NULL, *msginfo_b = NULL;
+	const gchar *key_a, *key_b;
 	gint ret;
 
 	gtk_tree_model_get(model, a, COL_MSGINFO, &msginfo_a, -1);
@@ -1236,12 +1237,15 @@ static gint query_search_cmp_by_subject(GtkTreeModel *model,
 	if (!msginfo_a || !msginfo_b)
 		return 0;
 
-	if (!msginfo_a->subject)
-		return -(msginfo_b->subject != NULL);
-	if (!msginfo_b->subject)
-		return (msginfo_a->subject != NULL);
+	key_a = procmsg_msginfo_get_sort_key(msginfo_a, MSG_SORT_KEY_SUBJECT);
+	key_b = procmsg_msginfo_get_sort_key(msginfo_b, MSG_SORT_KEY_SUBJECT);
 
-	ret = subject_compare_for_sort(msginfo_a->subject, msginfo_b->subject);
+	if (!key_a)
+		return -(key_b != NULL);
+	if (!key_b)
+		return (key_a != NULL);
+
+	ret = strcmp(key_a, key_b);
 	return (ret != 0) ? ret : (msginfo_a->date_t - msginfo_b->date_t);
 }
 
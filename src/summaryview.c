@@ -129,6 +129,19 @@
 #  define SUMMARY_COL_MIME_WIDTH	17
 #endif
 
+#define SUMMARY_ROW_TEXT_CACHE_SIZE	512
+
+/* display strings of a row */
+typedef struct _SummaryRowText
+{
+	MsgInfo *msginfo;
+	gchar *subject;
+	gchar *from;
+	gchar *date;
+	gchar *to;
+	GList link;
+} SummaryRowText;
+
 static GdkPixbuf *mark_pixbuf;
 static GdkPixbuf *deleted_pixbuf;
 
@@ -203,6 +216,18 @@ static void summary_update_status	(SummaryView		*summaryview);
 
 /* display functions */
 static void summary_status_show		(SummaryView		*summaryview);
+static SummaryRowText *summary_row_text_get
+					(SummaryView		*summaryview,
+					 MsgInfo		*msginfo);
+static void summary_row_text_remove	(SummaryView		*summaryview,
+					 MsgInfo		*msginfo);
+static void summary_row_text_clear	(SummaryView		*summaryview);
+static void summary_row_text_free	(SummaryRowText		*row);
+static void summary_text_cell_func	(GtkTreeViewColumn	*column,
+					 GtkCellRenderer	*renderer,
+					 GtkTreeModel		*model,
+					 GtkTreeIter		*iter,
+					 gpointer		 data);
 static void summary_set_row		(SummaryView		*summaryview,
 					 GtkTreeIter		*iter,
 					 MsgInfo		*msginfo);
@@ -248,6 +273,18 @@ static gint summary_execute_delete	(SummaryView		*summaryview);
 
 static void summary_modify_threads	(SummaryView		*summaryview);
 
+static GNode *summary_thread_tree_get	(SummaryView		*summaryview,
+					 GSList			*mlist,
+					 gboolean		 use_index);
+static void summary_thread_tree_free	(SummaryView		*summaryview,
+					 GNode			*root);
+static void summary_thread_index_free	(SummaryView		*summaryview);
+static void summary_thread_insert_msg	(SummaryView		*summaryview,
+					 GtkTreeIter		*iter,
+					 MsgInfo		*msginfo);
+static void summary_thread_remove_msg	(SummaryView		*summaryview,
+					 MsgInfo		*msginfo);
+
 static void summary_colorlabel_menu_item_activate_cb
 					(GtkWidget	*widget,
 					 gpointer	 data);
@@ -504,6 +541,10 @@ SummaryView *summary_create(void)
 
 	debug_print(_("Creating summary view...\n"));
 	summaryview = g_new0(SummaryView, 1);
+	summaryview->row_text_table =
+		g_hash_table_new_full(NULL, NULL, NULL,
+				      (GDestroyNotify)summary_row_text_free);
+	summaryview->row_text_lru = g_queue_new();
 
 	vbox = gtk_vbox_new(FALSE, 1);
 
@@ -758,7 +799,7 @@ gboolean summary_show(SummaryView *summaryview, FolderItem *item,
 	if (!item || !item->path || !item->parent || item->no_select ||
 	    (FOLDER_TYPE(item->folder) == F_MH && item->stype != F_VIRTUAL &&
 	     ((buf = folder_item_get_path(item)) == NULL ||
-	      change_dir(buf) < 0))) {
+	      !is_dir_exist(buf)))) {
 		g_free(buf);
 		debug_print("empty folder\n\n");
 		summary_clear_all(summaryview);
@@ -992,6 +1033,8 @@ static void summary_clear_list_full(SummaryView *summaryview,
 	GtkTreeView *treeview = GTK_TREE_VIEW(summaryview->treeview);
 	GtkAdjustment *adj;
 
+	summary_thread_index_free(summaryview);
+
 	if (summaryview->folder_item) {
 		folder_item_close(summaryview->folder_item);
 		summaryview->folder_item = NULL;
@@ -1009,6 +1052,7 @@ static void summary_clear_list_full(SummaryView *summaryview,
 	summaryview->copied = 0;
 
 	summary_msgid_table_destroy(summaryview);
+	summary_row_text_clear(summaryview);
 
 	summaryview->tmp_mlist = NULL;
 	summaryview->to_folder = NULL;
@@ -1100,8 +1144,12 @@ void summary_show_queued_msgs(SummaryView *summaryview)
 		debug_print("summary_show_queued_msgs: appending msg %u\n",
 			    msginfo->msgnum);
 		msginfo->folder = item;
-		gtk_tree_store_append(store, &iter, NULL);
-		summary_set_row(summaryview, &iter, msginfo);
+		if (summaryview->thread_index)
+			summary_thread_insert_msg(summaryview, &iter, msginfo);
+		else {
+			gtk_tree_store_append(store, &iter, NULL);
+			summary_set_row(summaryview, &iter, msginfo);
+		}
 
 		if (cur == qlist) {
 			GtkTreePath *path;
@@ -2385,55 +2433,162 @@ static gboolean summary_have_unread_children(SummaryView *summaryview,
 	return FALSE;
 }
 
-static void summary_set_row(SummaryView *summaryview, GtkTreeIter *iter,
-			    MsgInfo *msginfo)
+static void summary_row_text_free(SummaryRowText *row)
 {
-	GtkTreeStore *store = GTK_TREE_STORE(summaryview->store);
+	g_free(row->subject);
+	g_free(row->from);
+	g_free(row->date);
+	g_free(row->to);
+	g_free(row);
+}
+
+static void summary_row_text_clear(SummaryView *summaryview)
+{
+	g_hash_table_destroy(summaryview->row_text_table);
+	summaryview->row_text_table =
+		g_hash_table_new_full(NULL, NULL, NULL,
+				      (GDestroyNotify)summary_row_text_free);
+	g_queue_free(summaryview->row_text_lru);
+	summaryview->row_text_lru = g_queue_new();
+}
+
+static void summary_row_text_remove(SummaryView *summaryview,
+				    MsgInfo *msginfo)
+{
+	SummaryRowText *row;
+
+	row = g_hash_table_lookup(summaryview->row_text_table, msginfo);
+	if (row) {
+		g_queue_unlink(summaryview->row_text_lru, &row->link);
+		g_hash_table_remove(summaryview->row_text_table, msginfo);
+	}
+}
+
+/* Format the display strings of a row. Only the rows which are drawn
+   get here, and the most recently drawn ones are kept in an LRU cache. */
+static SummaryRowText *summary_row_text_get(SummaryView *summaryview,
+					    MsgInfo *msginfo)
+{
+	SummaryRowText *row;
+	GList *last;
 	gchar date_modified[80];
-	const gchar *date_s;
-	gchar *sw_from_s = NULL;
-	gchar *subject_s = NULL;
-	gchar *to_s = NULL;
-	GdkPixbuf *mark_pix = NULL;
-	GdkPixbuf *unread_pix = NULL;
-	GdkPixbuf *mime_pix = NULL;
-	GdkColor *foreground = NULL;
-	PangoWeight weight = PANGO_WEIGHT_NORMAL;
-	MsgFlags flags;
-	GdkColor color;
-	gint color_val;
 
-	if (!msginfo) {
-		GET_MSG_INFO(msginfo, iter);
+	row = g_hash_table_lookup(summaryview->row_text_table, msginfo);
+	if (row) {
+		g_queue_unlink(summaryview->row_text_lru, &row->link);
+		g_queue_push_head_link(summaryview->row_text_lru, &row->link);
+		return row;
 	}
 
+	row = g_new0(SummaryRowText, 1);
+	row->msginfo = msginfo;
+	row->link.data = row;
+
 	if (msginfo->date_t) {
 		procheader_date_get_localtime(date_modified,
 					      sizeof(date_modified),
 					      msginfo->date_t);
-		date_s = date_modified;
+		row->date = g_strdup(date_modified);
 	} else if (msginfo->date)
-		date_s = msginfo->date;
+		row->date = g_strdup(msginfo->date);
 	else
-		date_s = _("(No Date)");
+		row->date = g_strdup(_("(No Date)"));
 	if (prefs_common.swap_from && msginfo->from && msginfo->to) {
 		gchar from[BUFFSIZE];
 
 		strncpy2(from, msginfo->from, sizeof(from));
 		extract_address(from);
 		if (account_address_exist(from))
-			sw_from_s = g_strconcat("-->", msginfo->to, NULL);
+			row->from = g_strconcat("-->", msginfo->to, NULL);
 	}
+	if (!row->from)
+		row->from = g_strdup(msginfo->fromname ? msginfo->fromname :
+				     _("(No From)"));
 
 	if (msginfo->subject) {
-		if (msginfo->folder && msginfo->folder->trim_summary_subject) {
-			subject_s = g_strdup(msginfo->subject);
-			trim_subject(subject_s);
-		}
-	}
+		row->subject = g_strdup(msginfo->subject);
+		if (msginfo->folder && msginfo->folder->trim_summary_subject)
+			trim_subject(row->subject);
+	} else
+		row->subject = g_strdup(_("(No Subject)"));
 
 	if (msginfo->to)
-		to_s = procheader_get_toname(msginfo->to);
+		row->to = procheader_get_toname(msginfo->to);
+
+	g_hash_table_insert(summaryview->row_text_table, msginfo, row);
+	g_queue_push_head_link(summaryview->row_text_lru, &row->link);
+
+	if (summaryview->row_text_lru->length > SUMMARY_ROW_TEXT_CACHE_SIZE) {
+		last = g_queue_pop_tail_link(summaryview->row_text_lru);
+		g_hash_table_remove(summaryview->row_text_table,
+				    ((SummaryRowText *)last->data)->msginfo);
+	}
+
+	return row;
+}
+
+static void summary_text_cell_func(GtkTreeViewColumn *column,
+				   GtkCellRenderer *renderer,
+				   GtkTreeModel *model, GtkTreeIter *iter,
+				   gpointer data)
+{
+	SummaryView *summaryview = (SummaryView *)data;
+	SummaryColumnType type;
+	SummaryRowText *row;
+	MsgInfo *msginfo = NULL;
+	const gchar *text = NULL;
+
+	gtk_tree_model_get(model, iter, S_COL_MSG_INFO, &msginfo, -1);
+	if (!msginfo) {
+		g_object_set(renderer, "text", NULL, NULL);
+		return;
+	}
+
+	type = GPOINTER_TO_INT(g_object_get_data(G_OBJECT(column),
+						 "column_id"));
+	if (type == S_COL_SIZE) {
+		g_object_set(renderer, "text",
+			     to_human_readable(msginfo->size), NULL);
+		return;
+	}
+
+	row = summary_row_text_get(summaryview, msginfo);
+
+	switch (type) {
+	case S_COL_SUBJECT:
+		text = row->subject; break;
+	case S_COL_FROM:
+		text = row->from; break;
+	case S_COL_DATE:
+		text = row->date; break;
+	case S_COL_TO:
+		text = row->to; break;
+	default:
+		break;
+	}
+
+	g_object_set(renderer, "text", text, NULL);
+}
+
+static void summary_set_row(SummaryView *summaryview, GtkTreeIter *iter,
+			    MsgInfo *msginfo)
+{
+	GtkTreeStore *store = GTK_TREE_STORE(summaryview->store);
+	GdkPixbuf *mark_pix = NULL;
+	GdkPixbuf *unread_pix = NULL;
+	GdkPixbuf *mime_pix = NULL;
+	GdkColor *foreground = NULL;
+	PangoWeight weight = PANGO_WEIGHT_NORMAL;
+	MsgFlags flags;
+	GdkColor color;
+	gint color_val;
+
+	if (!msginfo) {
+		GET_MSG_INFO(msginfo, iter);
+	}
+
+	/* the text columns are formatted when they are drawn */
+	summary_row_text_remove(summaryview, msginfo);
 
 	flags = msginfo->flags;
 
@@ -2489,16 +2644,7 @@ static void summary_set_row(SummaryView *summaryview, GtkTreeIter *iter,
 			   S_COL_MARK, mark_pix,
 			   S_COL_UNREAD, unread_pix,
 			   S_COL_MIME, mime_pix,
-			   S_COL_SUBJECT, subject_s ? subject_s :
-			   		  msginfo->subject ? msginfo->subject :
-					  _("(No Subject)"),
-			   S_COL_FROM, sw_from_s ? sw_from_s :
-			   	       msginfo->fromname ? msginfo->fromname :
-				       _("(No From)"),
-			   S_COL_DATE, date_s,
-			   S_COL_SIZE, to_human_readable(msginfo->size),
 			   S_COL_NUMBER, msginfo->msgnum,
-			   S_COL_TO, to_s ? to_s : "",
 
 			   S_COL_MSG_INFO, msginfo,
 
@@ -2507,13 +2653,6 @@ static void summary_set_row(SummaryView *summaryview, GtkTreeIter *iter,
 			   S_COL_FOREGROUND, foreground,
 			   S_COL_BOLD, weight,
 			   -1);
-
-	if (to_s)
-		g_free(to_s);
-	if (subject_s)
-		g_free(subject_s);
-	if (sw_from_s)
-		g_free(sw_from_s);
 }
 
 static void summary_insert_gnode(SummaryView *summaryview, GtkTreeStore *store,
@@ -2589,7 +2728,9 @@ static void summary_set_tree_model_from_list(SummaryView *summaryview,
 	if (summaryview->folder_item->threaded) {
 		GNode *root, *gnode;
 
-		root = procmsg_get_thread_tree(mlist);
+		root = summary_thread_tree_get
+			(summaryview, mlist,
+			 mlist == summaryview->all_mlist);
 
 		for (gnode = root->children; gnode != NULL;
 		     gnode = gnode->next) {
@@ -2604,7 +2745,7 @@ static void summary_set_tree_model_from_list(SummaryView *summaryview,
 			}
 		}
 
-		g_node_destroy(root);
+		summary_thread_tree_free(summaryview, root);
 
 		for (cur = mlist; cur != NULL; cur = cur->next) {
 			msginfo = (MsgInfo *)cur->data;
@@ -2655,18 +2796,13 @@ static void summary_set_tree_model_from_list(SummaryView *summaryview,
 	STATUSBAR_POP(summaryview->mainwin);
 }
 
-struct wcachefp
-{
-	FILE *cache_fp;
-	FILE *mark_fp;
-};
-
 gint summary_write_cache(SummaryView *summaryview)
 {
-	struct wcachefp fps;
+	FILE *mark_fp;
 	FolderItem *item;
 	gchar *buf;
 	GSList *cur;
+	gboolean write_cache;
 
 	item = summaryview->folder_item;
 	if (!item || !item->path)
@@ -2676,25 +2812,18 @@ gint summary_write_cache(SummaryView *summaryview)
 	if (!item->cache_dirty && !item->mark_dirty)
 		return 0;
 
-	if (item->cache_dirty) {
-		fps.cache_fp = procmsg_open_cache_file(item, DATA_WRITE);
-		if (fps.cache_fp == NULL)
-			return -1;
+	write_cache = item->cache_dirty;
+	if (write_cache)
 		item->mark_dirty = TRUE;
-	} else
-		fps.cache_fp = NULL;
 
 	if (item->mark_dirty && item->stype != F_VIRTUAL) {
-		fps.mark_fp = procmsg_open_mark_file(item, DATA_WRITE);
-		if (fps.mark_fp == NULL) {
-			if (fps.cache_fp)
-				fclose(fps.cache_fp);
+		mark_fp = procmsg_open_mark_file(item, DATA_WRITE);
+		if (mark_fp == NULL)
 			return -1;
-		}
 	} else
-		fps.mark_fp = NULL;
+		mark_fp = NULL;
 
-	if (item->cache_dirty) {
+	if (write_cache) {
 		buf = g_strdup_printf(_("Writing summary cache (%s)..."),
 				      item->path);
 		debug_print("%s", buf);
@@ -2709,23 +2838,24 @@ gint summary_write_cache(SummaryView *summaryview)
 		if (msginfo->folder && msginfo->folder->mark_queue != NULL) {
 			MSG_UNSET_PERM_FLAGS(msginfo->flags, MSG_NEW);
 		}
-		if (fps.cache_fp)
-			procmsg_write_cache(msginfo, fps.cache_fp);
-		if (fps.mark_fp)
-			procmsg_write_flags(msginfo, fps.mark_fp);
+		if (mark_fp)
+			procmsg_write_flags(msginfo, mark_fp);
 	}
 
-	if (item->cache_queue)
-		procmsg_flush_cache_queue(item, fps.cache_fp);
+	/* the cache is written in the column format */
+	if (write_cache)
+		procmsg_write_cache_list(item, summaryview->all_mlist);
+	else if (item->cache_queue)
+		procmsg_flush_cache_queue(item, NULL);
+	if (summaryview->thread_index)
+		thread_index_write(summaryview->thread_index, item);
 	if (item->mark_queue)
-		procmsg_flush_mark_queue(item, fps.mark_fp);
+		procmsg_flush_mark_queue(item, mark_fp);
 
 	item->unmarked_num = 0;
 
-	if (fps.cache_fp)
-		fclose(fps.cache_fp);
-	if (fps.mark_fp)
-		fclose(fps.mark_fp);
+	if (mark_fp)
+		fclose(mark_fp);
 
 	if (item->stype == F_VIRTUAL) {
 		GSList *mlist;
@@ -2740,7 +2870,7 @@ gint summary_write_cache(SummaryView *summaryview)
 
 	debug_print(_("done.\n"));
 
-	if (item->cache_dirty) {
+	if (write_cache) {
 		STATUSBAR_POP(summaryview->mainwin);
 	}
 
@@ -3998,6 +4128,7 @@ static void summary_remove_invalid_messages(SummaryView *summaryview)
 		if (summaryview->flt_mlist)
 			summaryview->flt_mlist =
 				g_slist_remove(summaryview->flt_mlist, msginfo);
+		summary_thread_remove_msg(summaryview, msginfo);
 		procmsg_msginfo_free(msginfo);
 
 		item->cache_dirty = TRUE;
@@ -4195,6 +4326,88 @@ static gint summary_execute_delete(SummaryView *summaryview)
 
 /* thread functions */
 
+/* get the thread tree of mlist. If use_index is TRUE, mlist must be
+   all the messages of the folder, and the thread index of the folder is
+   kept in summaryview so that the tree can be updated incrementally. */
+static GNode *summary_thread_tree_get(SummaryView *summaryview, GSList *mlist,
+				      gboolean use_index)
+{
+	FolderItem *item = summaryview->folder_item;
+
+	summary_thread_index_free(summaryview);
+
+	if (!use_index || !item || item->stype == F_VIRTUAL)
+		return procmsg_get_thread_tree(mlist);
+
+	summaryview->thread_index = thread_index_read(item, mlist);
+	thread_index_write(summaryview->thread_index, item);
+
+	return thread_index_get_tree(summaryview->thread_index);
+}
+
+static void summary_thread_tree_free(SummaryView *summaryview, GNode *root)
+{
+	if (summaryview->thread_index &&
+	    thread_index_get_tree(summaryview->thread_index) == root)
+		return;
+
+	g_node_destroy(root);
+}
+
+static void summary_thread_index_free(SummaryView *summaryview)
+{
+	if (!summaryview->thread_index)
+		return;
+
+	if (summaryview->folder_item)
+		thread_index_write(summaryview->thread_index,
+				   summaryview->folder_item);
+	thread_index_free(summaryview->thread_index, TRUE);
+	summaryview->thread_index = NULL;
+}
+
+/* add msginfo to the thread index and append the row under its parent.
+   Existing rows are not moved. */
+static void summary_thread_insert_msg(SummaryView *summaryview,
+				      GtkTreeIter *iter, MsgInfo *msginfo)
+{
+	GtkTreeModel *model = GTK_TREE_MODEL(summaryview->store);
+	GtkTreeIter parent, top;
+	GNode *node, *topnode;
+	gboolean found = FALSE;
+
+	thread_index_insert(summaryview->thread_index, msginfo);
+	node = thread_index_lookup(summaryview->thread_index, msginfo);
+
+	if (node && node->parent && node->parent->data)
+		found = gtkut_tree_model_find_by_column_data
+			(model, &parent, NULL, S_COL_MSG_INFO,
+			 node->parent->data);
+
+	gtk_tree_store_append(summaryview->store, iter,
+			      found ? &parent : NULL);
+	summary_set_row(summaryview, iter, msginfo);
+
+	if (!found)
+		return;
+
+	for (topnode = node; topnode->parent && topnode->parent->data;
+	     topnode = topnode->parent)
+		;
+	top = parent;
+	while (gtk_tree_model_iter_parent(model, &parent, &top))
+		top = parent;
+	gtk_tree_store_set(summaryview->store, &top,
+			   S_COL_TDATE, procmsg_get_thread_date(topnode), -1);
+}
+
+static void summary_thread_remove_msg(SummaryView *summaryview,
+				      MsgInfo *msginfo)
+{
+	if (summaryview->thread_index)
+		thread_index_remove(summaryview->thread_index, msginfo);
+}
+
 void summary_thread_build(SummaryView *summaryview)
 {
 	GtkTreeModel *model = GTK_TREE_MODEL(summaryview->store);
@@ -4230,7 +4443,8 @@ void summary_thread_build(SummaryView *summaryview)
 	summaryview->folder_item->threaded = TRUE;
 
 	mlist = summary_get_msg_list(summaryview);
-	root = procmsg_get_thread_tree(mlist);
+	root = summary_thread_tree_get(summaryview, mlist,
+				       !summaryview->on_filter);
 	node_table = g_hash_table_new(NULL, NULL);
 	for (node = root->children; node != NULL; node = node->next) {
 		g_hash_table_insert(node_table, node->data, node);
@@ -4270,7 +4484,7 @@ void summary_thread_build(SummaryView *summaryview)
 		summary_sort(summaryview, sort_key, sort_type);
 
 	g_hash_table_destroy(node_table);
-	g_node_destroy(root);
+	summary_thread_tree_free(summaryview, root);
 	g_slist_free(mlist);
 
 	if (prefs_common.expand_thread)
@@ -4381,6 +4595,8 @@ void summary_unthread(SummaryView *summaryview)
 	if (summaryview->folder_item)
 		summaryview->folder_item->threaded = FALSE;
 
+	summary_thread_index_free(summaryview);
+
 	if (summaryview->folder_item->sort_key != SORT_BY_NONE) {
 		sort_key = summaryview->folder_item->sort_key;
 		sort_type = summaryview->folder_item->sort_type;
@@ -4487,6 +4703,7 @@ static GNode *summary_get_modified_node(SummaryView *summaryview,
 		if (summaryview->flt_mlist)
 			summaryview->flt_mlist =
 				g_slist_remove(summaryview->flt_mlist, msginfo);
+		summary_thread_remove_msg(summaryview, msginfo);
 		procmsg_msginfo_free(msginfo);
 	}
 
@@ -4869,6 +5086,7 @@ void summary_filter_junk(SummaryView *summaryview, gboolean selected_only)
 				    selected_only);
 		summaryview->junk_fltlist = NULL;
 		filter_rule_free(rule);
+		filter_junk_classifier_stop();
 	}
 }
 
@@ -5395,20 +5613,38 @@ static GtkWidget *summary_tree_view_create(SummaryView *summaryview)
 	gtk_widget_show(image);
 	gtk_tree_view_column_set_widget(column, image);
 
+#define SET_TEXT_FUNC()							\
+{									\
+	gtk_tree_view_column_set_attributes				\
+		(column, renderer,					\
+		 "foreground-gdk", S_COL_FOREGROUND,			\
+		 "weight", S_COL_BOLD,					\
+		 NULL);							\
+	gtk_tree_view_column_set_cell_data_func				\
+		(column, renderer, summary_text_cell_func,		\
+		 summaryview, NULL);					\
+}
+
 	ADD_COLUMN(_("Subject"), text, S_COL_SUBJECT, TRUE,
 		   prefs_common.summary_col_size[S_COL_SUBJECT], 0.0);
+	SET_TEXT_FUNC();
 	gtk_tree_view_set_expander_column(GTK_TREE_VIEW(treeview), column);
 	ADD_COLUMN(_("From"), text, S_COL_FROM, TRUE,
 		   prefs_common.summary_col_size[S_COL_FROM], 0.0);
+	SET_TEXT_FUNC();
 	ADD_COLUMN(_("Date"), text, S_COL_DATE, TRUE,
 		   prefs_common.summary_col_size[S_COL_DATE], 0.0);
+	SET_TEXT_FUNC();
 	ADD_COLUMN(_("Size"), text, S_COL_SIZE, TRUE,
 		   prefs_common.summary_col_size[S_COL_SIZE], 1.0);
+	SET_TEXT_FUNC();
 	ADD_COLUMN(_("No."), text, S_COL_NUMBER, TRUE,
 		   prefs_common.summary_col_size[S_COL_NUMBER], 1.0);
 	ADD_COLUMN(_("To"), text, S_COL_TO, TRUE,
 		   prefs_common.summary_col_size[S_COL_TO], 0.0);
+	SET_TEXT_FUNC();
 
+#undef SET_TEXT_FUNC
 #undef ADD_COLUMN
 
 	g_object_set_data(G_OBJECT(treeview), "user_data", summaryview);
@@ -6392,11 +6628,12 @@ static gint summary_cmp_by_thread_date(GtkTreeModel *model,
 		return tdate_a - tdate_b;
 }
 
-#define CMP_FUNC_DEF(func_name, var_name)				\
+#define CMP_FUNC_DEF(func_name, key_type)				\
 static gint func_name(GtkTreeModel *model,				\
 		      GtkTreeIter *a, GtkTreeIter *b, gpointer data)	\
 {									\
 	MsgInfo *msginfo_a = NULL, *msginfo_b = NULL;			\
+	const gchar *key_a, *key_b;					\
 	gint ret;							\
 									\
 	gtk_tree_model_get(model, a, S_COL_MSG_INFO, &msginfo_a, -1);	\
@@ -6405,19 +6642,22 @@ static gint func_name(GtkTreeModel *model,				\
 	if (!msginfo_a || !msginfo_b)					\
 		return 0;						\
 									\
-	if (msginfo_a->var_name == NULL)				\
-		return -(msginfo_b->var_name != NULL);			\
-	if (msginfo_b->var_name == NULL)				\
-		return (msginfo_a->var_name != NULL);			\
+	key_a = procmsg_msginfo_get_sort_key(msginfo_a, key_type);	\
+	key_b = procmsg_msginfo_get_sort_key(msginfo_b, key_type);	\
+									\
+	if (key_a == NULL)						\
+		return -(key_b != NULL);				\
+	if (key_b == NULL)						\
+		return (key_a != NULL);					\
 									\
-	ret = g_ascii_strcasecmp					\
-		(msginfo_a->var_name, msginfo_b->var_name);		\
+	ret = strcmp(key_a, key_b);					\
 									\
 	return (ret != 0) ? ret :					\
 		(msginfo_a->date_t - msginfo_b->date_t);		\
 }
 
-CMP_FUNC_DEF(summary_cmp_by_from, fromname)
+CMP_FUNC_DEF(summary_cmp_by_from, MSG_SORT_KEY_FROMNAME)
+CMP_FUNC_DEF(summary_cmp_by_subject, MSG_SORT_KEY_SUBJECT)
 
 #undef CMP_FUNC_DEF
 
@@ -6426,34 +6666,7 @@ static gint summary_cmp_by_to(GtkTreeModel *model,
 				   gpointer data)
 {
 	MsgInfo *msginfo_a = NULL, *msginfo_b = NULL;
-	gchar *to_a = NULL, *to_b = NULL;
-	gint ret;
-
-	gtk_tree_model_get(model, a, S_COL_MSG_INFO, &msginfo_a,
-			   S_COL_TO, &to_a, -1);
-	gtk_tree_model_get(model, b, S_COL_MSG_INFO, &msginfo_b,
-			   S_COL_TO, &to_b, -1);
-
-	if (!msginfo_a || !msginfo_b) {
-		g_free(to_b);
-		g_free(to_a);
-		return 0;
-	}
-
-	ret = g_ascii_strcasecmp(to_a ? to_a : "", to_b ? to_b : "");
-
-	g_free(to_b);
-	g_free(to_a);
-
-	return (ret != 0) ? ret :
-		(msginfo_a->date_t - msginfo_b->date_t);
-}
-
-static gint summary_cmp_by_subject(GtkTreeModel *model,
-				   GtkTreeIter *a, GtkTreeIter *b,
-				   gpointer data)
-{
-	MsgInfo *msginfo_a = NULL, *msginfo_b = NULL;
+	const gchar *key_a, *key_b;
 	gint ret;
 
 	gtk_tree_model_get(model, a, S_COL_MSG_INFO, &msginfo_a, -1);
@@ -6462,12 +6675,11 @@ static gint summary_cmp_by_subject(GtkTreeModel *model,
 	if (!msginfo_a || !msginfo_b)
 		return 0;
 
-	if (msginfo_a->subject == NULL)
-		return -(msginfo_b->subject != NULL);
-	if (msginfo_b->subject == NULL)
-		return (msginfo_a->subject != NULL);
+	/* the To column shows the names only */
+	key_a = procmsg_msginfo_get_sort_key(msginfo_a, MSG_SORT_KEY_TONAME);
+	key_b = procmsg_msginfo_get_sort_key(msginfo_b, MSG_SORT_KEY_TONAME);
 
-	ret = subject_compare_for_sort(msginfo_a->subject, msginfo_b->subject);
+	ret = strcmp(key_a ? key_a : "", key_b ? key_b : "");
 
 	return (ret != 0) ? ret :
 		(msginfo_a->date_t - msginfo_b->date_t);
@@ -41,6 +41,7 @@ typedef struct _SummaryColumnState	SummaryColumnState;
 #include "filter.h"
 #include "folder.h"
 #include "procmsg.h"
+#include "threadindex.h"
 
 typedef enum
 {
@@ -122,11 +123,18 @@ private:
 	/* table for looking up message-id */
 	GHashTable *msgid_table;
 
+	/* cached display strings of the recently drawn rows */
+	GHashTable *row_text_table;
+	GQueue *row_text_lru;
+
 	/* all message list */
 	GSList *all_mlist;
 	/* filtered message list */
 	GSList *flt_mlist;
 
+	/* thread index of all_mlist in threaded view */
+	ThreadIndex *thread_index;
+
 	gint64 total_flt_msg_size;
 	gint flt_msg_total;
 	gint flt_deleted;
@@ -160,8 +160,11 @@ static void textview_write_body		(TextView	*textview,
 					 MimeInfo	*mimeinfo,
 					 FILE		*fp,
 					 const gchar	*charset);
+static void textview_write_text		(TextView	*textview,
+					 BufFile	*bf,
+					 CodeConverter	*conv);
 static void textview_show_html		(TextView	*textview,
-					 FILE		*fp,
+					 BufFile	*bf,
 					 CodeConverter	*conv);
 
 static void textview_write_line		(TextView	*textview,
@@ -1120,21 +1123,19 @@ void textview_show_error(TextView *textview)
 static void textview_write_body(TextView *textview, MimeInfo *mimeinfo,
 				FILE *fp, const gchar *charset)
 {
-	FILE *tmpfp;
-	gchar buf[BUFFSIZE];
+	BufFile *bf;
 	CodeConverter *conv;
 
 	conv = conv_code_converter_new(charset, NULL);
 
-	tmpfp = procmime_decode_content(NULL, fp, mimeinfo);
-	if (tmpfp) {
+	bf = procmime_decode_content_buf(fp, mimeinfo);
+	if (bf) {
 		if (mimeinfo->mime_type == MIME_TEXT_HTML &&
 		    prefs_common.render_html)
-			textview_show_html(textview, tmpfp, conv);
+			textview_show_html(textview, bf, conv);
 		else
-			while (fgets(buf, sizeof(buf), tmpfp) != NULL)
-				textview_write_line(textview, buf, conv);
-		fclose(tmpfp);
+			textview_write_text(textview, bf, conv);
+		buf_file_close(bf);
 	} else {
 		textview_write_error
 			(textview,
@@ -1145,13 +1146,36 @@ static void textview_write_body(TextView *textview, MimeInfo *mimeinfo,
 	conv_code_converter_destroy(conv);
 }
 
-static void textview_show_html(TextView *textview, FILE *fp,
+/* convert the text in chunks so that multibyte characters split by the
+   line buffer are not broken */
+static void textview_write_text(TextView *textview, BufFile *bf,
+				CodeConverter *conv)
+{
+	gchar buf[BUFFSIZE];
+	gchar *str;
+
+	while (buf_file_gets(buf, sizeof(buf), bf) != NULL) {
+		str = conv_convert_chunk(conv, buf, -1, NULL);
+		if (!str)
+			str = conv_utf8todisp(buf, NULL);
+		if (*str != '\0')
+			textview_write_line(textview, str, NULL);
+		g_free(str);
+	}
+
+	str = conv_convert_finish(conv, NULL);
+	if (str && *str != '\0')
+		textview_write_line(textview, str, NULL);
+	g_free(str);
+}
+
+static void textview_show_html(TextView *textview, BufFile *bf,
 			       CodeConverter *conv)
 {
 	HTMLParser *parser;
 	const gchar *str;
 
-	parser = html_parser_new(fp, conv);
+	parser = html_parser_new_from_buf_file(bf, conv);
 	g_return_if_fail(parser != NULL);
 
 	while ((str = html_parse(parser)) != NULL) {